@@ -0,0 +1,38 @@
+#include "aspired_models_snapshot.h"
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/protobuf.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+Status ReadAspiredModelsSnapshot(
+    const string &path, ::cranberries::AspiredModelsSnapshot *snapshot) {
+  string text;
+  TF_RETURN_IF_ERROR(ReadFileToString(Env::Default(), path, &text));
+  if (!protobuf::TextFormat::ParseFromString(text, snapshot)) {
+    return errors::DataLoss("Unable to parse AspiredModelsSnapshot from ",
+                            path);
+  }
+  return Status::OK();
+}
+
+Status WriteAspiredModelsSnapshot(
+    const string &path, const ::cranberries::AspiredModelsSnapshot &snapshot) {
+  string text;
+  if (!protobuf::TextFormat::PrintToString(snapshot, &text)) {
+    return errors::Internal("Unable to print AspiredModelsSnapshot");
+  }
+  // Rename is atomic within a file system, so the temporary file is created
+  // next to the target.
+  const string tmp_path = path + ".tmp";
+  Env *env = Env::Default();
+  TF_RETURN_IF_ERROR(WriteStringToFile(env, tmp_path, text));
+  return env->RenameFile(tmp_path, path);
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,25 @@
+#ifndef CRANBERRIES_ASPIRED_MODELS_SNAPSHOT_H_
+#define CRANBERRIES_ASPIRED_MODELS_SNAPSHOT_H_
+
+#include "tensorflow/core/lib/core/status.h"
+#include "cranberries/core/aspired_models_snapshot.pb.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Reads snapshot in text format from `path`. Returns NOT_FOUND if there is
+// no such file.
+Status ReadAspiredModelsSnapshot(
+    const string &path, ::cranberries::AspiredModelsSnapshot *snapshot);
+
+// Writes snapshot in text format to `path` atomically: readers see either the
+// previous snapshot or the new one, even if the server crashes meanwhile.
+Status WriteAspiredModelsSnapshot(
+    const string &path, const ::cranberries::AspiredModelsSnapshot &snapshot);
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_ASPIRED_MODELS_SNAPSHOT_H_
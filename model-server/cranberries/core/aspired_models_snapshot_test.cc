@@ -0,0 +1,72 @@
+#include "aspired_models_snapshot.h"
+
+#include <stdlib.h>
+#include <string>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+using cranberries::AspiredModel;
+using cranberries::AspiredModelsSnapshot;
+using tensorflow::Env;
+using tensorflow::serving::cranberries::ReadAspiredModelsSnapshot;
+using tensorflow::serving::cranberries::WriteAspiredModelsSnapshot;
+
+namespace {
+
+std::string TestPath(const std::string &name) {
+  return tensorflow::io::JoinPath(getenv("TEST_TMPDIR"), name);
+}
+
+}  // namespace
+
+TEST(AspiredModelsSnapshotTest, ReportsMissingFile) {
+  AspiredModelsSnapshot snapshot;
+  EXPECT_TRUE(tensorflow::errors::IsNotFound(
+      ReadAspiredModelsSnapshot(TestPath("missing"), &snapshot)));
+}
+
+TEST(AspiredModelsSnapshotTest, RoundTrip) {
+  AspiredModelsSnapshot snapshot;
+  AspiredModel *model = snapshot.add_models();
+  model->set_name("mnist");
+  model->set_config("cache_results: true");
+  auto *version = model->add_versions();
+  version->set_version(2);
+  version->set_path("/tmp/mnist_model/2");
+
+  const std::string path = TestPath("round_trip");
+  ASSERT_TRUE(WriteAspiredModelsSnapshot(path, snapshot).ok());
+  tensorflow::uint64 tmp_size;
+  EXPECT_TRUE(tensorflow::errors::IsNotFound(
+      Env::Default()->GetFileSize(path + ".tmp", &tmp_size)));
+
+  AspiredModelsSnapshot read;
+  ASSERT_TRUE(ReadAspiredModelsSnapshot(path, &read).ok());
+  EXPECT_EQ(snapshot.DebugString(), read.DebugString());
+}
+
+TEST(AspiredModelsSnapshotTest, OverwritesSnapshot) {
+  const std::string path = TestPath("overwrite");
+  AspiredModelsSnapshot first;
+  first.add_models()->set_name("a");
+  ASSERT_TRUE(WriteAspiredModelsSnapshot(path, first).ok());
+  AspiredModelsSnapshot second;
+  second.add_models()->set_name("b");
+  ASSERT_TRUE(WriteAspiredModelsSnapshot(path, second).ok());
+
+  AspiredModelsSnapshot read;
+  ASSERT_TRUE(ReadAspiredModelsSnapshot(path, &read).ok());
+  ASSERT_EQ(1, read.models_size());
+  EXPECT_EQ("b", read.models(0).name());
+}
+
+TEST(AspiredModelsSnapshotTest, RejectsCorruptedFile) {
+  const std::string path = TestPath("corrupted");
+  ASSERT_TRUE(
+      tensorflow::WriteStringToFile(Env::Default(), path, "models {").ok());
+  AspiredModelsSnapshot snapshot;
+  EXPECT_TRUE(tensorflow::errors::IsDataLoss(
+      ReadAspiredModelsSnapshot(path, &snapshot)));
+}
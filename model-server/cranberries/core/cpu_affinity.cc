@@ -0,0 +1,133 @@
+#include "cpu_affinity.h"
+
+#include <ctype.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using tensorflow::strings::StrCat;
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+bool ParseCpuList(const string &text, std::vector<int> *cpus) {
+  cpus->clear();
+  string trimmed = text;
+  while (!trimmed.empty() && isspace(trimmed.back())) {
+    trimmed.pop_back();
+  }
+  if (trimmed.empty()) {
+    return true;
+  }
+  for (const string &range : str_util::Split(trimmed, ',')) {
+    const std::vector<string> bounds = str_util::Split(range, '-');
+    int32 first, last;
+    if (bounds.empty() || bounds.size() > 2 ||
+        !strings::safe_strto32(bounds.front(), &first) ||
+        !strings::safe_strto32(bounds.back(), &last) || first < 0 ||
+        first > last) {
+      return false;
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return true;
+}
+
+Status GetNumaNodeCpus(int node, std::vector<int> *cpus) {
+  const string path = StrCat("/sys/devices/system/node/node", node, "/cpulist");
+  string content;
+  TF_RETURN_IF_ERROR(ReadFileToString(Env::Default(), path, &content));
+  if (!ParseCpuList(content, cpus)) {
+    return errors::Internal("Unable to parse ", path, ": ", content);
+  }
+  return Status::OK();
+}
+
+#ifdef __linux__
+
+Status GetCurrentThreadAffinity(std::vector<int> *cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof set, &set) != 0) {
+    return errors::Internal("pthread_getaffinity_np failed");
+  }
+  cpus->clear();
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus->push_back(cpu);
+    }
+  }
+  return Status::OK();
+}
+
+Status SetCurrentThreadAffinity(const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return errors::InvalidArgument("Invalid CPU ", cpu);
+    }
+    CPU_SET(cpu, &set);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof set, &set) != 0) {
+    return errors::InvalidArgument("Unable to set affinity to CPUs ",
+                                   str_util::Join(cpus, ","));
+  }
+  return Status::OK();
+}
+
+#else
+
+Status GetCurrentThreadAffinity(std::vector<int> *cpus) {
+  return errors::Unimplemented("Thread affinity is supported on Linux only");
+}
+
+Status SetCurrentThreadAffinity(const std::vector<int> &cpus) {
+  return errors::Unimplemented("Thread affinity is supported on Linux only");
+}
+
+#endif
+
+Status PinCurrentThreadToCpu(int index) {
+  std::vector<int> available;
+  TF_RETURN_IF_ERROR(GetCurrentThreadAffinity(&available));
+  if (available.empty()) {
+    return errors::Internal("No CPUs are available");
+  }
+  return SetCurrentThreadAffinity({available[index % available.size()]});
+}
+
+ScopedThreadAffinity::ScopedThreadAffinity(const std::vector<int> &cpus) {
+  if (cpus.empty()) {
+    return;
+  }
+  status_ = GetCurrentThreadAffinity(&saved_cpus_);
+  if (status_.ok()) {
+    status_ = SetCurrentThreadAffinity(cpus);
+  }
+  restore_ = status_.ok();
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity() {
+  if (restore_) {
+    Status status = SetCurrentThreadAffinity(saved_cpus_);
+    if (!status.ok()) {
+      LOG(ERROR) << "Unable to restore thread affinity: " << status;
+    }
+  }
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,51 @@
+#ifndef CRANBERRIES_CPU_AFFINITY_H_
+#define CRANBERRIES_CPU_AFFINITY_H_
+
+#include <vector>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Helpers for CPU affinity of threads. They are implemented for Linux only,
+// elsewhere they return Unimplemented.
+
+// Parses list of CPUs in the kernel's format, e.g. "0-3,8,10-11".
+bool ParseCpuList(const string &text, std::vector<int> *cpus);
+
+// Returns CPUs of NUMA node `node` according to sysfs.
+Status GetNumaNodeCpus(int node, std::vector<int> *cpus);
+
+Status GetCurrentThreadAffinity(std::vector<int> *cpus);
+Status SetCurrentThreadAffinity(const std::vector<int> &cpus);
+
+// Pins current thread to `index`-th (modulo number of CPUs) CPU from the set
+// of CPUs available to the thread.
+Status PinCurrentThreadToCpu(int index);
+
+// Restricts current thread to `cpus` for the lifetime of the object, unless
+// `cpus` is empty. Threads started in the meantime inherit the affinity, which
+// is the only way to set affinity of threads created by third-party code.
+class ScopedThreadAffinity {
+ public:
+  explicit ScopedThreadAffinity(const std::vector<int> &cpus);
+  ~ScopedThreadAffinity();
+
+  // Whether the affinity was set successfully.
+  const Status &status() const { return status_; }
+
+ private:
+  std::vector<int> saved_cpus_;
+  Status status_;
+  bool restore_ = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedThreadAffinity);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_CPU_AFFINITY_H_
@@ -0,0 +1,38 @@
+#include "cpu_affinity.h"
+
+#include <vector>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using tensorflow::serving::cranberries::ParseCpuList;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+TEST(ParseCpuListTest, Empty) {
+  std::vector<int> cpus = {1};
+  EXPECT_TRUE(ParseCpuList("", &cpus));
+  EXPECT_THAT(cpus, IsEmpty());
+  EXPECT_TRUE(ParseCpuList("\n", &cpus));
+  EXPECT_THAT(cpus, IsEmpty());
+}
+
+TEST(ParseCpuListTest, SingleCpus) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0,2,5\n", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(0, 2, 5));
+}
+
+TEST(ParseCpuListTest, Ranges) {
+  std::vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0-2,8,10-11", &cpus));
+  EXPECT_THAT(cpus, ElementsAre(0, 1, 2, 8, 10, 11));
+}
+
+TEST(ParseCpuListTest, Invalid) {
+  std::vector<int> cpus;
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("1-2-3", &cpus));
+  EXPECT_FALSE(ParseCpuList("-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("1,,2", &cpus));
+}
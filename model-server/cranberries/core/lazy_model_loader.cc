@@ -0,0 +1,412 @@
+#include "lazy_model_loader.h"
+
+#include <functional>
+#include <utility>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "cranberries/core/memory_budget.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+constexpr int64 LazyModelLoader::kLatestVersion;
+
+LazyModelLoader::LazyModelLoader(ModelConfigRegistry *model_configs,
+                                 const Options &options)
+  : model_configs_(model_configs),
+    options_(options),
+    env_(Env::Default()),
+    model_names_(std::make_shared<std::set<string>>()) {
+  thread_.reset(env_->StartThread(ThreadOptions(), "lazy_model_loader",
+                                  [this]() {
+    while (!WaitForNotificationWithTimeout(
+        &stop_, options_.housekeeping_interval_micros)) {
+      Housekeep();
+    }
+  }));
+}
+
+LazyModelLoader::~LazyModelLoader() {
+  Detach();
+  stop_.Notify();
+  thread_.reset();
+}
+
+void LazyModelLoader::SetAspiredVersionsCallback(
+    AspiredVersionsCallback callback) {
+  mutex_lock l(forward_mu_);
+  callback_ = callback;
+}
+
+void LazyModelLoader::SetAspiredVersions(
+    const StringPiece servable_name,
+    std::vector<ServableData<StoragePath>> versions) {
+  const string model_name = servable_name.ToString();
+  const bool on_demand = model_configs_->Get(model_name)->load_on_demand();
+  Notes notes;
+  bool pass_through = true;
+  {
+    mutex_lock l(mu_);
+    const size_t num_models = models_.size();
+    auto iter = models_.find(model_name);
+    if (on_demand && iter == models_.end()) {
+      iter = models_.emplace(model_name, Model()).first;
+    }
+    if (iter != models_.end()) {
+      Model &model = iter->second;
+      std::map<int64, StoragePath> registered;
+      model.errors.clear();
+      for (auto &version : versions) {
+        if (on_demand && version.status().ok()) {
+          registered.emplace(version.id().version, version.DataOrDie());
+        } else {
+          model.errors.push_back(std::move(version));
+        }
+      }
+      // Znodes of versions which are not loaded are maintained here, others
+      // are maintained by the manager.
+      for (const auto &version : model.registered) {
+        if (registered.count(version.first) == 0 &&
+            model.resident.count(version.first) == 0) {
+          notes.emplace_back(ServableId{model_name, version.first}, "");
+        }
+      }
+      for (const auto &version : registered) {
+        if (model.registered.count(version.first) == 0 &&
+            model.resident.count(version.first) == 0) {
+          notes.push_back(NotLoadedNote({model_name, version.first}));
+        }
+      }
+      for (auto resident = model.resident.begin();
+           resident != model.resident.end();) {
+        if (registered.count(resident->first) == 0) {
+          resident = Evict(&model, resident);
+        } else {
+          ++resident;
+        }
+      }
+      model.registered = std::move(registered);
+      if (on_demand && !model.registered.empty()) {
+        pass_through = false;
+      } else {
+        // Nothing is left to load on demand (all versions are in `errors`
+        // now), the manager takes over loaded versions, if any.
+        versions = std::move(model.errors);
+        models_.erase(iter);
+        state_changed_.notify_all();
+      }
+    }
+    // The model was either added or removed.
+    if (models_.size() != num_models) {
+      std::shared_ptr<std::set<string>> model_names =
+          std::make_shared<std::set<string>>();
+      for (const auto &model : models_) {
+        model_names->insert(model.first);
+      }
+      std::atomic_store(&model_names_,
+                        std::shared_ptr<const std::set<string>>(model_names));
+    }
+  }
+  if (pass_through) {
+    mutex_lock l(forward_mu_);
+    if (callback_) {
+      callback_(model_name, std::move(versions));
+    }
+  } else {
+    Forward({model_name});
+  }
+  ShowNotes(notes);
+}
+
+Status LazyModelLoader::Acquire(const string &model_name, int64 version) {
+  if (std::atomic_load(&model_names_)->count(model_name) == 0) {
+    return Status::OK();
+  }
+  StoragePath path;
+  {
+    mutex_lock l(mu_);
+    auto iter = models_.find(model_name);
+    if (iter == models_.end()) {
+      return Status::OK();
+    }
+    const Model &model = iter->second;
+    if (version == kLatestVersion) {
+      if (model.registered.empty()) {
+        return errors::NotFound("Model ", model_name, " has no versions");
+      }
+      version = model.registered.rbegin()->first;
+    }
+    auto registered = model.registered.find(version);
+    if (registered == model.registered.end()) {
+      return errors::NotFound("Version ", version, " of model ", model_name,
+                              " is not aspired");
+    }
+    auto resident = iter->second.resident.find(version);
+    if (resident != iter->second.resident.end() &&
+        resident->second.available) {
+      resident->second.last_used_micros = env_->NowMicros();
+      return Status::OK();
+    }
+    path = registered->second;
+  }
+
+  const ServableId id{model_name, version};
+  uint64 bytes = 0;
+  if (options_.memory_cap_bytes > 0) {
+    // Reads file sizes, so it's not done under the lock.
+    const Status status =
+        EstimateModelRamBytes(path, options_.graph_overhead_factor, &bytes);
+    if (!status.ok()) {
+      LOG(WARNING) << "Unable to estimate RAM of " << id.DebugString()
+                   << ", it's not accounted: " << status;
+    }
+  }
+  std::set<string> changed_models;
+  {
+    mutex_lock l(mu_);
+    auto iter = models_.find(model_name);
+    if (iter != models_.end() &&
+        iter->second.registered.count(version) != 0 &&
+        iter->second.resident.count(version) == 0) {
+      if (iter->second.unloading.count(version) != 0) {
+        return errors::Unavailable(id.DebugString(),
+                                   " is being unloaded, it's loaded again "
+                                   "once that's finished");
+      }
+      auto error = iter->second.load_errors.find(version);
+      if (error != iter->second.load_errors.end()) {
+        if (dirty_models_.count(model_name) != 0) {
+          // The failed version is not unaspired yet, so the manager would
+          // not load it again.
+          return error->second;
+        }
+        iter->second.load_errors.erase(error);
+      }
+      Activate(id, bytes, &changed_models);
+    }
+  }
+  if (!changed_models.empty()) {
+    LOG(INFO) << "Loading " << id.DebugString() << " on demand";
+    Forward(changed_models);
+  }
+
+  const uint64 deadline_micros = env_->NowMicros() + options_.load_wait_micros;
+  mutex_lock l(mu_);
+  while (true) {
+    auto iter = models_.find(model_name);
+    if (iter == models_.end()) {
+      return errors::NotFound("Model ", model_name,
+                              " was unaspired while loading");
+    }
+    Model &model = iter->second;
+    auto resident = model.resident.find(version);
+    if (resident == model.resident.end()) {
+      auto error = model.load_errors.find(version);
+      if (error != model.load_errors.end()) {
+        return error->second;
+      }
+      return errors::Unavailable(id.DebugString(),
+                                 " was unloaded while loading");
+    }
+    if (resident->second.available) {
+      resident->second.last_used_micros = env_->NowMicros();
+      return Status::OK();
+    }
+    const uint64 now_micros = env_->NowMicros();
+    if (now_micros >= deadline_micros) {
+      return errors::Unavailable(id.DebugString(), " is still loading");
+    }
+    WaitForMilliseconds(&l, &state_changed_,
+                        (deadline_micros - now_micros + 999) / 1000);
+  }
+}
+
+void LazyModelLoader::Activate(const ServableId &id, uint64 bytes,
+                               std::set<string> *changed_models) {
+  if (options_.memory_cap_bytes > 0) {
+    while (resident_bytes_ + bytes > options_.memory_cap_bytes) {
+      // Least recently used available version.
+      std::map<string, Model>::iterator lru_model = models_.end();
+      std::map<int64, ResidentVersion>::iterator lru;
+      for (auto model = models_.begin(); model != models_.end(); ++model) {
+        for (auto resident = model->second.resident.begin();
+             resident != model->second.resident.end(); ++resident) {
+          if (resident->second.available &&
+              (lru_model == models_.end() ||
+               resident->second.last_used_micros <
+                   lru->second.last_used_micros)) {
+            lru_model = model;
+            lru = resident;
+          }
+        }
+      }
+      if (lru_model == models_.end()) {
+        LOG(WARNING) << id.DebugString() << " exceeds the memory cap of "
+                     << "models loaded on demand, but other ones are still "
+                     << "loading";
+        break;
+      }
+      LOG(INFO) << "Unloading least recently used version " << lru->first
+                << " of model " << lru_model->first << " to load "
+                << id.DebugString();
+      Evict(&lru_model->second, lru);
+      changed_models->insert(lru_model->first);
+    }
+  }
+  ResidentVersion resident;
+  resident.bytes = bytes;
+  resident.last_used_micros = env_->NowMicros();
+  models_[id.name].resident[id.version] = resident;
+  resident_bytes_ += bytes;
+  changed_models->insert(id.name);
+}
+
+std::map<int64, LazyModelLoader::ResidentVersion>::iterator
+LazyModelLoader::Evict(Model *model,
+                       std::map<int64, ResidentVersion>::iterator resident) {
+  resident_bytes_ -= resident->second.bytes;
+  if (resident->second.started) {
+    model->unloading.insert(resident->first);
+  }
+  return model->resident.erase(resident);
+}
+
+std::pair<ServableId, string> LazyModelLoader::NotLoadedNote(
+    const ServableId &id) {
+  return {id, "kNotLoaded: loads on the first request"};
+}
+
+void LazyModelLoader::Forward(const std::set<string> &model_names) {
+  mutex_lock f(forward_mu_);
+  if (!callback_) {
+    return;
+  }
+  for (const string &model_name : model_names) {
+    std::vector<ServableData<StoragePath>> versions;
+    {
+      mutex_lock l(mu_);
+      auto iter = models_.find(model_name);
+      if (iter == models_.end()) {
+        // Passed through by SetAspiredVersions().
+        continue;
+      }
+      const Model &model = iter->second;
+      versions = model.errors;
+      for (const auto &resident : model.resident) {
+        versions.emplace_back(ServableId{model_name, resident.first},
+                              model.registered.at(resident.first));
+      }
+    }
+    callback_(model_name, std::move(versions));
+  }
+}
+
+void LazyModelLoader::ShowNotes(const Notes &notes) {
+  if (!options_.set_note) {
+    return;
+  }
+  for (const auto &note : notes) {
+    options_.set_note(note.first, note.second);
+  }
+}
+
+void LazyModelLoader::Housekeep() {
+  std::set<string> changed_models;
+  Notes notes;
+  {
+    mutex_lock l(mu_);
+    const uint64 now_micros = env_->NowMicros();
+    for (auto &model : models_) {
+      auto &resident_versions = model.second.resident;
+      for (auto resident = resident_versions.begin();
+           resident != resident_versions.end();) {
+        if (options_.idle_unload_micros > 0 && resident->second.available &&
+            now_micros - resident->second.last_used_micros >=
+                static_cast<uint64>(options_.idle_unload_micros)) {
+          LOG(INFO) << "Unloading idle version " << resident->first
+                    << " of model " << model.first;
+          resident = Evict(&model.second, resident);
+          changed_models.insert(model.first);
+        } else {
+          ++resident;
+        }
+      }
+    }
+    changed_models.insert(dirty_models_.begin(), dirty_models_.end());
+    dirty_models_.clear();
+    for (const ServableId &id : unloaded_versions_) {
+      // The version may have been acquired again since.
+      auto iter = models_.find(id.name);
+      if (iter != models_.end() &&
+          iter->second.registered.count(id.version) != 0 &&
+          iter->second.resident.count(id.version) == 0) {
+        notes.push_back(NotLoadedNote(id));
+      }
+    }
+    unloaded_versions_.clear();
+  }
+  Forward(changed_models);
+  ShowNotes(notes);
+}
+
+EventBus<ServableState>::Callback LazyModelLoader::GetEventBusCallback() {
+  return std::bind(&LazyModelLoader::ProcessEvent, this,
+                   std::placeholders::_1);
+}
+
+void LazyModelLoader::ProcessEvent(
+    const EventBus<ServableState>::EventAndTime &ev) {
+  const ServableState &state = ev.event;
+  if (std::atomic_load(&model_names_)->count(state.id.name) == 0) {
+    return;
+  }
+  mutex_lock l(mu_);
+  auto iter = models_.find(state.id.name);
+  if (iter == models_.end()) {
+    return;
+  }
+  Model &model = iter->second;
+  auto resident = model.resident.find(state.id.version);
+  if (resident == model.resident.end()) {
+    // An evicted version is unloaded by the manager, which removes its znode.
+    if (state.manager_state == ServableState::ManagerState::kEnd) {
+      model.unloading.erase(state.id.version);
+      if (model.registered.count(state.id.version) != 0) {
+        unloaded_versions_.insert(state.id);
+      }
+    }
+    return;
+  }
+  switch (state.manager_state) {
+    case ServableState::ManagerState::kStart:
+      resident->second.started = true;
+      break;
+    case ServableState::ManagerState::kAvailable:
+      resident->second.available = true;
+      state_changed_.notify_all();
+      break;
+    case ServableState::ManagerState::kEnd:
+      if (!resident->second.started) {
+        // End of a previously evicted instance of the version.
+        break;
+      }
+      // The load has failed or the version was unloaded by someone else. It
+      // is unaspired, so it can be aspired again by the next Acquire().
+      if (!state.health.ok()) {
+        model.load_errors[state.id.version] = state.health;
+      }
+      resident_bytes_ -= resident->second.bytes;
+      model.resident.erase(resident);
+      dirty_models_.insert(state.id.name);
+      unloaded_versions_.insert(state.id);
+      state_changed_.notify_all();
+      break;
+    default:
+      break;
+  }
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,190 @@
+#ifndef CRANBERRIES_LAZY_MODEL_LOADER_H_
+#define CRANBERRIES_LAZY_MODEL_LOADER_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/core/servable_id.h"
+#include "tensorflow_serving/core/servable_state.h"
+#include "tensorflow_serving/core/source.h"
+#include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/core/target.h"
+#include "tensorflow_serving/util/event_bus.h"
+#include "cranberries/core/model_config_registry.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Filter between ZookeeperSource and the loader of models which keeps rarely
+// used models out of memory. Versions of models with `load_on_demand` set in
+// their ModelConfig are only registered when they are aspired in Zookeeper;
+// a version is aspired further (hence loaded) on the first Acquire() of it,
+// which is called for each request. Versions of other models pass through.
+//
+// A version loaded on demand is unloaded once it has not been acquired for
+// `idle_unload_micros`, or earlier if versions loaded on demand exceed
+// `memory_cap_bytes` (estimated by EstimateModelRamBytes()), least recently
+// used ones first. Versions which are still loading are never evicted.
+//
+// Acquire() waits for the version to become available, so the loader should
+// be subscribed to the manager's EventBus<ServableState>. Versions which are
+// registered but not loaded are shown by the `set_note` callback (e.g.
+// ZookeeperStateReporter::SetNote()) as "kNotLoaded: ...", so they are listed
+// in `current-models`; the note is cleared once the version is unaspired.
+//
+// Acquire() of models which are not loaded on demand only reads an immutable
+// snapshot of names of ones which are, so serving them takes no locks.
+//
+// Changes of `load_on_demand` take effect when ZookeeperSource re-reads the
+// model's versions, which it does on every change of the model's znode.
+class LazyModelLoader final : public TargetBase<StoragePath>,
+                              public Source<StoragePath> {
+ public:
+  // Acquire() the latest registered version of the model.
+  static constexpr int64 kLatestVersion = -1;
+
+  using NoteCallback =
+      std::function<void(const ServableId &id, const string &note)>;
+
+  struct Options {
+    // Versions which are not acquired for that long are unloaded, zero means
+    // they are never unloaded because of idleness.
+    int64 idle_unload_micros = 0;
+    // Limit of estimated RAM of versions loaded on demand, zero means no
+    // limit.
+    uint64 memory_cap_bytes = 0;
+    // See EstimateModelRamBytes().
+    double graph_overhead_factor = 1;
+    // How long Acquire() waits for the version to load, zero means it
+    // returns UNAVAILABLE right away (e.g. not to block a completion queue's
+    // thread) and the client retries.
+    int64 load_wait_micros = 0;
+    // How often idle versions are looked for.
+    int64 housekeeping_interval_micros = 10 * 1000 * 1000;
+    // Shows notes of registered versions which are not loaded (an empty
+    // note clears it), may be empty. Should not block.
+    NoteCallback set_note;
+  };
+
+  // `model_configs` should outlive the loader.
+  LazyModelLoader(ModelConfigRegistry *model_configs, const Options &options);
+  ~LazyModelLoader() override;
+
+  void SetAspiredVersionsCallback(AspiredVersionsCallback callback) override;
+
+  // Makes sure that the version of the model is loaded if it's loaded on
+  // demand, waiting for it at most `load_wait_micros`. Returns OK right away
+  // for other models. Returns NOT_FOUND if the version is not registered,
+  // UNAVAILABLE if it's still loading or its previous instance is still
+  // being unloaded, and the load error if it has failed.
+  Status Acquire(const string &model_name, int64 version);
+
+  EventBus<ServableState>::Callback GetEventBusCallback();
+
+  // Unloads idle versions and reports unloaded ones. Called periodically by
+  // the loader's thread, public for tests.
+  void Housekeep();
+
+ protected:
+  void SetAspiredVersions(
+      const StringPiece servable_name,
+      std::vector<ServableData<StoragePath>> versions) override;
+
+ private:
+  struct ResidentVersion {
+    uint64 bytes = 0;
+    uint64 last_used_micros = 0;
+    // The manager has started managing this instance of the version, so its
+    // kEnd is not the one of a previously evicted instance.
+    bool started = false;
+    bool available = false;
+  };
+
+  struct Model {
+    // Versions aspired in Zookeeper, they are all OK.
+    std::map<int64, StoragePath> registered;
+    // Versions which failed to be registered, passed through as is.
+    std::vector<ServableData<StoragePath>> errors;
+    std::map<int64, ResidentVersion> resident;
+    // Versions which were unaspired while the manager had them, until it
+    // unloads them. They are not aspired again before that: the manager
+    // would keep the old instance without publishing its state again.
+    std::set<int64> unloading;
+    // Error of the last failed load of each version, reported to waiters.
+    std::map<int64, Status> load_errors;
+  };
+
+  // Adds the version to resident ones, evicting least recently used versions
+  // if it does not fit into `memory_cap_bytes`. Adds names of models whose
+  // aspired versions changed to `changed_models`.
+  void Activate(const ServableId &id, uint64 bytes,
+                std::set<string> *changed_models)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Removes the version from resident ones, so that it's unaspired by the
+  // next Forward(). Returns the next resident version.
+  std::map<int64, ResidentVersion>::iterator Evict(
+      Model *model, std::map<int64, ResidentVersion>::iterator resident)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Notes to show, in order.
+  using Notes = std::vector<std::pair<ServableId, string>>;
+
+  // Returns note of the version which is registered but not loaded.
+  static std::pair<ServableId, string> NotLoadedNote(const ServableId &id);
+
+  // Aspires versions of `model_names` to the target according to their
+  // current state.
+  void Forward(const std::set<string> &model_names);
+
+  void ShowNotes(const Notes &notes);
+
+  void ProcessEvent(const EventBus<ServableState>::EventAndTime &ev);
+
+  ModelConfigRegistry *model_configs_;
+  const Options options_;
+  Env *env_;
+
+  // Serializes calls of `callback_` so that the target always ends up with
+  // the latest state. Never acquired under `mu_`.
+  mutex forward_mu_;
+  AspiredVersionsCallback callback_ GUARDED_BY(forward_mu_);
+
+  mutable mutex mu_;
+  condition_variable state_changed_;
+  // Models loaded on demand, keyed by name.
+  std::map<string, Model> models_ GUARDED_BY(mu_);
+  // Snapshot of names in `models_`, replaced under `mu_` whenever they
+  // change and read with std::atomic_load(), so that Acquire() of other
+  // models skips the lock.
+  std::shared_ptr<const std::set<string>> model_names_;
+  uint64 resident_bytes_ GUARDED_BY(mu_) = 0;
+  // ProcessEvent() can neither call the target nor publish events, so it
+  // leaves that to Housekeep(): models whose aspired versions changed and
+  // versions which were unloaded and are still registered.
+  std::set<string> dirty_models_ GUARDED_BY(mu_);
+  std::set<ServableId> unloaded_versions_ GUARDED_BY(mu_);
+
+  Notification stop_;
+  std::unique_ptr<Thread> thread_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LazyModelLoader);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_LAZY_MODEL_LOADER_H_
@@ -0,0 +1,317 @@
+#include "lazy_model_loader.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+using cranberries::ModelConfig;
+using tensorflow::Env;
+using tensorflow::Status;
+using tensorflow::StringPiece;
+using tensorflow::int64;
+using tensorflow::serving::EventBus;
+using tensorflow::serving::ServableData;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::ServableState;
+using tensorflow::serving::StoragePath;
+using tensorflow::serving::cranberries::LazyModelLoader;
+using tensorflow::serving::cranberries::ModelConfigRegistry;
+
+namespace {
+
+std::string TestPath(const std::string &name) {
+  return tensorflow::io::JoinPath(getenv("TEST_TMPDIR"), name);
+}
+
+// Records versions aspired by the loader and plays the manager: versions
+// which appear become available right away unless `load_error` is set, and
+// available versions which disappear are unloaded right away unless `unload`
+// is unset; then they are unloaded by Unload().
+class FakeManager {
+ public:
+  explicit FakeManager(LazyModelLoader *loader) {
+    events_ = loader->GetEventBusCallback();
+    loader->SetAspiredVersionsCallback(
+        [this](const StringPiece name,
+               std::vector<ServableData<StoragePath>> versions) {
+          SetAspiredVersions(name.ToString(), versions);
+        });
+  }
+
+  // Versions last aspired for the model, -1 if there were no calls.
+  std::vector<int64> aspired(const std::string &name) const {
+    auto iter = aspired_.find(name);
+    return iter == aspired_.end() ? std::vector<int64>{-1} : iter->second;
+  }
+
+  // Unloads versions which were unaspired while `unload` was unset.
+  void Unload() {
+    std::vector<ServableId> ids;
+    ids.swap(pending_unloads_);
+    for (const ServableId &id : ids) {
+      Publish(id, ServableState::ManagerState::kEnd);
+    }
+  }
+
+  Status load_error;
+  bool load = true;
+  bool unload = true;
+
+ private:
+  void SetAspiredVersions(
+      const std::string &name,
+      const std::vector<ServableData<StoragePath>> &versions) {
+    std::vector<int64> &aspired = aspired_[name];
+    std::vector<int64> previous = aspired;
+    aspired.clear();
+    for (const auto &version : versions) {
+      aspired.push_back(version.id().version);
+    }
+    for (int64 version : previous) {
+      const ServableId id{name, version};
+      if (!Contains(aspired, version) && loaded_.erase(id) != 0) {
+        if (unload) {
+          Publish(id, ServableState::ManagerState::kEnd);
+        } else {
+          pending_unloads_.push_back(id);
+        }
+      }
+    }
+    for (int64 version : aspired) {
+      const ServableId id{name, version};
+      // Like the real manager, keeps an instance which is re-aspired before
+      // it's unloaded.
+      if (Contains(previous, version) || loaded_.count(id) != 0 || !load) {
+        continue;
+      }
+      Publish(id, ServableState::ManagerState::kStart);
+      if (load_error.ok()) {
+        loaded_.insert(id);
+        Publish(id, ServableState::ManagerState::kAvailable);
+      } else {
+        Publish(id, ServableState::ManagerState::kEnd);
+      }
+    }
+  }
+
+  static bool Contains(const std::vector<int64> &versions, int64 version) {
+    return std::find(versions.begin(), versions.end(), version) !=
+           versions.end();
+  }
+
+  void Publish(const ServableId &id, ServableState::ManagerState state) {
+    events_({{id, state, load_error}, 0});
+  }
+
+  EventBus<ServableState>::Callback events_;
+  std::map<std::string, std::vector<int64>> aspired_;
+  std::set<ServableId> loaded_;
+  std::vector<ServableId> pending_unloads_;
+};
+
+ServableData<StoragePath> Version(const std::string &name, int64 version,
+                                  const std::string &path = "") {
+  return ServableData<StoragePath>({name, version}, path);
+}
+
+void SetOnDemand(ModelConfigRegistry *model_configs, const std::string &name) {
+  ModelConfig config;
+  config.set_load_on_demand(true);
+  model_configs->Set(name, config);
+}
+
+LazyModelLoader::Options TestOptions() {
+  LazyModelLoader::Options options;
+  options.load_wait_micros = 1000000;
+  options.housekeeping_interval_micros = 3600LL * 1000 * 1000;
+  return options;
+}
+
+std::string MakeModel(const std::string &name, size_t graph_size) {
+  const std::string export_dir = TestPath(name);
+  EXPECT_TRUE(Env::Default()->RecursivelyCreateDir(export_dir).ok());
+  EXPECT_TRUE(tensorflow::WriteStringToFile(
+                  Env::Default(),
+                  tensorflow::io::JoinPath(export_dir, "saved_model.pb"),
+                  std::string(graph_size, 'x')).ok());
+  return export_dir;
+}
+
+}  // namespace
+
+TEST(LazyModelLoaderTest, PassesThroughRegularModels) {
+  ModelConfigRegistry model_configs;
+  LazyModelLoader loader(&model_configs, TestOptions());
+  FakeManager manager(&loader);
+
+  loader.GetAspiredVersionsCallback()("mnist",
+                                      {Version("mnist", 1),
+                                       Version("mnist", 2)});
+  EXPECT_EQ((std::vector<int64>{1, 2}), manager.aspired("mnist"));
+  EXPECT_TRUE(loader.Acquire("mnist", 3).ok());
+}
+
+TEST(LazyModelLoaderTest, LoadsOnFirstAcquire) {
+  ModelConfigRegistry model_configs;
+  SetOnDemand(&model_configs, "mnist");
+  LazyModelLoader loader(&model_configs, TestOptions());
+  FakeManager manager(&loader);
+
+  loader.GetAspiredVersionsCallback()("mnist",
+                                      {Version("mnist", 1),
+                                       Version("mnist", 2)});
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("mnist"));
+
+  EXPECT_TRUE(loader.Acquire("mnist", LazyModelLoader::kLatestVersion).ok());
+  EXPECT_EQ(std::vector<int64>{2}, manager.aspired("mnist"));
+  EXPECT_TRUE(loader.Acquire("mnist", 1).ok());
+  EXPECT_EQ((std::vector<int64>{1, 2}), manager.aspired("mnist"));
+
+  EXPECT_TRUE(tensorflow::errors::IsNotFound(loader.Acquire("mnist", 3)));
+
+  // Unaspired versions are unaspired right away.
+  loader.GetAspiredVersionsCallback()("mnist", {Version("mnist", 2)});
+  EXPECT_EQ(std::vector<int64>{2}, manager.aspired("mnist"));
+  loader.GetAspiredVersionsCallback()("mnist", {});
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("mnist"));
+}
+
+TEST(LazyModelLoaderTest, WaitsForLoadWithTimeout) {
+  ModelConfigRegistry model_configs;
+  SetOnDemand(&model_configs, "mnist");
+  LazyModelLoader::Options options = TestOptions();
+  options.load_wait_micros = 1000;
+  LazyModelLoader loader(&model_configs, options);
+  FakeManager manager(&loader);
+  manager.load = false;
+
+  loader.GetAspiredVersionsCallback()("mnist", {Version("mnist", 1)});
+  EXPECT_TRUE(tensorflow::errors::IsUnavailable(loader.Acquire("mnist", 1)));
+  EXPECT_EQ(std::vector<int64>{1}, manager.aspired("mnist"));
+}
+
+TEST(LazyModelLoaderTest, ReportsLoadError) {
+  ModelConfigRegistry model_configs;
+  SetOnDemand(&model_configs, "mnist");
+  LazyModelLoader loader(&model_configs, TestOptions());
+  FakeManager manager(&loader);
+  manager.load_error = tensorflow::errors::Internal("broken model");
+
+  loader.GetAspiredVersionsCallback()("mnist", {Version("mnist", 1)});
+  EXPECT_EQ(manager.load_error, loader.Acquire("mnist", 1));
+  // Until the failed version is unaspired, it's not loaded again.
+  EXPECT_EQ(manager.load_error, loader.Acquire("mnist", 1));
+  loader.Housekeep();
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("mnist"));
+
+  manager.load_error = Status::OK();
+  EXPECT_TRUE(loader.Acquire("mnist", 1).ok());
+  EXPECT_EQ(std::vector<int64>{1}, manager.aspired("mnist"));
+}
+
+TEST(LazyModelLoaderTest, UnloadsIdleVersions) {
+  ModelConfigRegistry model_configs;
+  SetOnDemand(&model_configs, "mnist");
+  LazyModelLoader::Options options = TestOptions();
+  options.idle_unload_micros = 100000;
+  LazyModelLoader loader(&model_configs, options);
+  FakeManager manager(&loader);
+
+  loader.GetAspiredVersionsCallback()("mnist", {Version("mnist", 1)});
+  ASSERT_TRUE(loader.Acquire("mnist", 1).ok());
+  loader.Housekeep();
+  EXPECT_EQ(std::vector<int64>{1}, manager.aspired("mnist"));
+
+  Env::Default()->SleepForMicroseconds(200000);
+  loader.Housekeep();
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("mnist"));
+}
+
+TEST(LazyModelLoaderTest, LoadsAgainOnlyAfterUnload) {
+  ModelConfigRegistry model_configs;
+  SetOnDemand(&model_configs, "mnist");
+  LazyModelLoader::Options options = TestOptions();
+  options.idle_unload_micros = 100000;
+  LazyModelLoader loader(&model_configs, options);
+  FakeManager manager(&loader);
+  manager.unload = false;
+
+  loader.GetAspiredVersionsCallback()("mnist", {Version("mnist", 1)});
+  ASSERT_TRUE(loader.Acquire("mnist", 1).ok());
+  Env::Default()->SleepForMicroseconds(200000);
+  loader.Housekeep();
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("mnist"));
+
+  // Requested again before the manager has unloaded the idle version: it's
+  // not aspired, otherwise the manager would keep the old instance without
+  // publishing kAvailable again.
+  EXPECT_TRUE(tensorflow::errors::IsUnavailable(loader.Acquire("mnist", 1)));
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("mnist"));
+
+  manager.Unload();
+  EXPECT_TRUE(loader.Acquire("mnist", 1).ok());
+  EXPECT_EQ(std::vector<int64>{1}, manager.aspired("mnist"));
+
+  // The new instance is known to be available, so it's unloaded once idle.
+  Env::Default()->SleepForMicroseconds(200000);
+  loader.Housekeep();
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("mnist"));
+}
+
+TEST(LazyModelLoaderTest, EvictsLeastRecentlyUsedVersions) {
+  ModelConfigRegistry model_configs;
+  SetOnDemand(&model_configs, "a");
+  SetOnDemand(&model_configs, "b");
+  SetOnDemand(&model_configs, "c");
+  LazyModelLoader::Options options = TestOptions();
+  options.memory_cap_bytes = 250;
+  LazyModelLoader loader(&model_configs, options);
+  FakeManager manager(&loader);
+
+  for (const std::string name : {"a", "b", "c"}) {
+    loader.GetAspiredVersionsCallback()(
+        name, {Version(name, 1, MakeModel(name, 100))});
+  }
+  ASSERT_TRUE(loader.Acquire("a", 1).ok());
+  Env::Default()->SleepForMicroseconds(1000);
+  ASSERT_TRUE(loader.Acquire("b", 1).ok());
+  Env::Default()->SleepForMicroseconds(1000);
+  ASSERT_TRUE(loader.Acquire("a", 1).ok());
+
+  ASSERT_TRUE(loader.Acquire("c", 1).ok());
+  EXPECT_EQ(std::vector<int64>{1}, manager.aspired("a"));
+  EXPECT_EQ(std::vector<int64>{}, manager.aspired("b"));
+  EXPECT_EQ(std::vector<int64>{1}, manager.aspired("c"));
+}
+
+TEST(LazyModelLoaderTest, ShowsNotesOfVersionsWhichAreNotLoaded) {
+  ModelConfigRegistry model_configs;
+  SetOnDemand(&model_configs, "mnist");
+  std::vector<std::pair<ServableId, std::string>> notes;
+  LazyModelLoader::Options options = TestOptions();
+  options.set_note = [&notes](const ServableId &id, const std::string &note) {
+    notes.emplace_back(id, note);
+  };
+  LazyModelLoader loader(&model_configs, options);
+  FakeManager manager(&loader);
+
+  loader.GetAspiredVersionsCallback()("mnist", {Version("mnist", 1)});
+  ASSERT_EQ(1, notes.size());
+  EXPECT_EQ((ServableId{"mnist", 1}), notes[0].first);
+  EXPECT_EQ("kNotLoaded: loads on the first request", notes[0].second);
+
+  // Cleared once the version is unaspired.
+  loader.GetAspiredVersionsCallback()("mnist", {});
+  ASSERT_EQ(2, notes.size());
+  EXPECT_EQ((ServableId{"mnist", 1}), notes[1].first);
+  EXPECT_EQ("", notes[1].second);
+}
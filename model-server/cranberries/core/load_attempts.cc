@@ -0,0 +1,43 @@
+#include "load_attempts.h"
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+Status LoadAttempts::Start(const ServableId &id) {
+  mutex_lock l(mu_);
+  if (closed_) {
+    return errors::Cancelled("Unable to load ", id.DebugString(),
+                             ": the source adapter is destroyed");
+  }
+  if (!running_.insert(id).second) {
+    return errors::Unavailable("Previous attempt to load ", id.DebugString(),
+                               " has timed out and is still running");
+  }
+  return Status::OK();
+}
+
+void LoadAttempts::Finish(const ServableId &id) {
+  mutex_lock l(mu_);
+  running_.erase(id);
+  finished_.notify_all();
+}
+
+void LoadAttempts::Close() {
+  mutex_lock l(mu_);
+  closed_ = true;
+  if (!running_.empty()) {
+    LOG(INFO) << "Waiting for " << running_.size()
+              << " load attempts to finish";
+  }
+  while (!running_.empty()) {
+    finished_.wait(l);
+  }
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
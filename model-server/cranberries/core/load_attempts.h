@@ -0,0 +1,43 @@
+#ifndef CRANBERRIES_LOAD_ATTEMPTS_H_
+#define CRANBERRIES_LOAD_ATTEMPTS_H_
+
+#include <set>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow_serving/core/servable_id.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Load attempts which are still running. Shared by ModelBundleSourceAdapter
+// and its loaders, as an abandoned attempt may outlive both.
+class LoadAttempts {
+ public:
+  LoadAttempts() = default;
+
+  // Fails if an attempt of `id` is still running (i.e. an abandoned one, the
+  // manager does not load a servable twice), or if the adapter is destroyed.
+  Status Start(const ServableId &id);
+
+  void Finish(const ServableId &id);
+
+  // Fails new attempts and waits for the running ones.
+  void Close();
+
+ private:
+  mutex mu_;
+  condition_variable finished_;
+  std::set<ServableId> running_ GUARDED_BY(mu_);
+  bool closed_ GUARDED_BY(mu_) = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LoadAttempts);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_LOAD_ATTEMPTS_H_
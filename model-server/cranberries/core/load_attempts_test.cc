@@ -0,0 +1,60 @@
+#include "load_attempts.h"
+
+#include <atomic>
+#include <memory>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
+
+using tensorflow::Env;
+using tensorflow::Thread;
+using tensorflow::ThreadOptions;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::cranberries::LoadAttempts;
+
+TEST(LoadAttemptsTest, FailsAttemptsOfRunningServable) {
+  LoadAttempts attempts;
+  const ServableId id{"a", 1};
+  ASSERT_TRUE(attempts.Start(id).ok());
+  // An abandoned attempt is still running.
+  EXPECT_EQ(tensorflow::error::UNAVAILABLE, attempts.Start(id).code());
+  // Other servables are not affected.
+  EXPECT_TRUE(attempts.Start({"a", 2}).ok());
+  EXPECT_TRUE(attempts.Start({"b", 1}).ok());
+
+  attempts.Finish(id);
+  EXPECT_TRUE(attempts.Start(id).ok());
+  attempts.Finish(id);
+  attempts.Finish({"a", 2});
+  attempts.Finish({"b", 1});
+}
+
+TEST(LoadAttemptsTest, CloseFailsNewAttempts) {
+  LoadAttempts attempts;
+  attempts.Close();
+  EXPECT_EQ(tensorflow::error::CANCELLED, attempts.Start({"a", 1}).code());
+}
+
+TEST(LoadAttemptsTest, CloseWaitsForRunningAttempts) {
+  LoadAttempts attempts;
+  ASSERT_TRUE(attempts.Start({"a", 1}).ok());
+  ASSERT_TRUE(attempts.Start({"a", 2}).ok());
+
+  std::atomic<bool> closed(false);
+  std::unique_ptr<Thread> closer(Env::Default()->StartThread(
+      ThreadOptions(), "closer", [&attempts, &closed]() {
+        attempts.Close();
+        closed = true;
+      }));
+  Env::Default()->SleepForMicroseconds(100 * 1000);
+  EXPECT_FALSE(closed);
+  // Attempts running while closing can't be started again.
+  attempts.Finish({"a", 1});
+  EXPECT_EQ(tensorflow::error::CANCELLED, attempts.Start({"a", 1}).code());
+  Env::Default()->SleepForMicroseconds(100 * 1000);
+  EXPECT_FALSE(closed);
+
+  attempts.Finish({"a", 2});
+  closer.reset();
+  EXPECT_TRUE(closed);
+}
@@ -0,0 +1,331 @@
+#include "memory_budget.h"
+
+#include <utility>
+#include <vector>
+#include "tensorflow/cc/saved_model/constants.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+using tensorflow::strings::StrCat;
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+// Returns total size of regular files in `dir`, zero if it does not exist.
+Status GetDirectorySize(Env *env, const string &dir, uint64 *bytes) {
+  *bytes = 0;
+  std::vector<string> children;
+  const Status status = env->GetChildren(dir, &children);
+  if (errors::IsNotFound(status)) {
+    return Status::OK();
+  }
+  TF_RETURN_IF_ERROR(status);
+  for (const string &child : children) {
+    const string path = io::JoinPath(dir, child);
+    if (env->IsDirectory(path).ok()) {
+      continue;
+    }
+    uint64 size;
+    TF_RETURN_IF_ERROR(env->GetFileSize(path, &size));
+    *bytes += size;
+  }
+  return Status::OK();
+}
+
+// Returns size of the serialized graph, either binary or text one.
+Status GetSavedModelSize(Env *env, const string &export_dir, uint64 *bytes) {
+  const Status status = env->GetFileSize(
+      io::JoinPath(export_dir, kSavedModelFilenamePb), bytes);
+  if (!errors::IsNotFound(status)) {
+    return status;
+  }
+  return env->GetFileSize(io::JoinPath(export_dir, kSavedModelFilenamePbTxt),
+                          bytes);
+}
+
+}  // namespace
+
+Status EstimateModelRamBytes(const string &export_dir,
+                             double graph_overhead_factor, uint64 *bytes) {
+  Env *env = Env::Default();
+  uint64 variables_bytes;
+  TF_RETURN_IF_ERROR(GetDirectorySize(
+      env, io::JoinPath(export_dir, kSavedModelVariablesDirectory),
+      &variables_bytes));
+  uint64 graph_bytes;
+  TF_RETURN_IF_ERROR(GetSavedModelSize(env, export_dir, &graph_bytes));
+  *bytes = variables_bytes +
+           static_cast<uint64>(graph_bytes * graph_overhead_factor);
+  return Status::OK();
+}
+
+MemoryBudget::MemoryBudget(uint64 budget_bytes,
+                           int64 housekeeping_interval_micros)
+  : budget_bytes_(budget_bytes) {
+  thread_.reset(Env::Default()->StartThread(
+      ThreadOptions(), "memory_budget", [this, housekeeping_interval_micros]() {
+    while (!WaitForNotificationWithTimeout(&stop_,
+                                           housekeeping_interval_micros)) {
+      Housekeep();
+    }
+  }));
+}
+
+MemoryBudget::~MemoryBudget() {
+  Detach();
+  stop_.Notify();
+  thread_.reset();
+}
+
+void MemoryBudget::SetAspiredVersionsCallback(
+    AspiredVersionsCallback callback) {
+  mutex_lock l(forward_mu_);
+  callback_ = callback;
+}
+
+void MemoryBudget::SetNoteCallback(NoteCallback callback) {
+  mutex_lock l(note_mu_);
+  note_callback_ = callback;
+}
+
+void MemoryBudget::ShowNotes(const Notes &notes) {
+  mutex_lock l(note_mu_);
+  if (!note_callback_) {
+    return;
+  }
+  for (const auto &note : notes) {
+    note_callback_(note.first, note.second);
+  }
+}
+
+void MemoryBudget::SetAspiredVersions(
+    const StringPiece servable_name,
+    std::vector<ServableData<StoragePath>> versions) {
+  const string model_name = servable_name.ToString();
+  Notes notes;
+  mutex_lock f(forward_mu_);
+  std::vector<ServableData<StoragePath>> forwarded;
+  {
+    mutex_lock l(mu_);
+    std::set<int64> aspired;
+    for (const auto &version : versions) {
+      aspired.insert(version.id().version);
+    }
+    // Unaspired versions are forgotten by the manager, so they are not
+    // withheld if they are aspired again.
+    for (auto iter = dropped_.lower_bound({model_name, kint64min});
+         iter != dropped_.end() && iter->first.name == model_name;) {
+      if (aspired.count(iter->first.version) == 0) {
+        notes.emplace_back(iter->first, "");
+        iter = dropped_.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    for (auto iter = withheld_.lower_bound({model_name, kint64min});
+         iter != withheld_.end() && iter->name == model_name;) {
+      if (aspired.count(iter->version) == 0) {
+        notes.emplace_back(*iter, "");
+        iter = withheld_.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    if (versions.empty()) {
+      aspired_.erase(model_name);
+    } else {
+      aspired_[model_name] = std::move(versions);
+    }
+    forwarded = GetForwardedVersions(model_name);
+  }
+  if (callback_) {
+    callback_(model_name, std::move(forwarded));
+  }
+  ShowNotes(notes);
+}
+
+std::vector<ServableData<StoragePath>> MemoryBudget::GetForwardedVersions(
+    const string &model_name) {
+  std::vector<ServableData<StoragePath>> versions;
+  auto iter = aspired_.find(model_name);
+  if (iter == aspired_.end()) {
+    return versions;
+  }
+  for (const auto &version : iter->second) {
+    if (withheld_.count(version.id()) == 0) {
+      versions.push_back(version);
+    }
+  }
+  return versions;
+}
+
+void MemoryBudget::Forward(const std::set<string> &model_names) {
+  mutex_lock f(forward_mu_);
+  if (!callback_) {
+    return;
+  }
+  for (const string &model_name : model_names) {
+    std::vector<ServableData<StoragePath>> versions;
+    {
+      mutex_lock l(mu_);
+      versions = GetForwardedVersions(model_name);
+    }
+    callback_(model_name, std::move(versions));
+  }
+}
+
+void MemoryBudget::Housekeep() {
+  std::set<string> changed_models;
+  Notes notes;
+  {
+    mutex_lock l(mu_);
+    const bool retry = released_;
+    released_ = false;
+    if (retry) {
+      for (const ServableId &id : withheld_) {
+        LOG(INFO) << "Memory was released, retrying deferred load of "
+                  << id.DebugString();
+        changed_models.insert(id.name);
+      }
+      withheld_.clear();
+    }
+    for (const auto &dropped : dropped_) {
+      const ServableId &id = dropped.first;
+      LOG(INFO) << "Withholding " << id.DebugString()
+                << " until memory is released";
+      withheld_.insert(id);
+      changed_models.insert(id.name);
+      notes.emplace_back(
+          id, StrCat("kDeferred: ", dropped.second.error_message(),
+                     ", waiting for memory to be released"));
+    }
+    if (retry && !dropped_.empty()) {
+      // They are aspired again by the next call, once the manager has
+      // forgotten them.
+      released_ = true;
+    }
+    dropped_.clear();
+  }
+  Forward(changed_models);
+  ShowNotes(notes);
+}
+
+std::vector<ServableId> MemoryBudget::withheld() const {
+  mutex_lock l(mu_);
+  return std::vector<ServableId>(withheld_.begin(), withheld_.end());
+}
+
+Status MemoryBudget::Reserve(const ServableId &id, uint64 bytes) {
+  Status reason;
+  {
+    mutex_lock l(mu_);
+    ReleaseLocked(id);
+    if (bytes > budget_bytes_) {
+      reason = errors::ResourceExhausted(
+          id.DebugString(), " needs ", bytes,
+          " bytes of RAM, which exceeds the whole memory budget of ",
+          budget_bytes_, " bytes");
+    } else if (reserved_bytes_ + bytes <= budget_bytes_) {
+      reservations_[id] = {bytes, false};
+      reserved_bytes_ += bytes;
+      if (deferred_.erase(id) == 0) {
+        return Status::OK();
+      }
+    } else {
+      reason = errors::ResourceExhausted(
+          id.DebugString(), " needs ", bytes, " bytes of RAM, but only ",
+          budget_bytes_ - reserved_bytes_, " of ", budget_bytes_,
+          " budgeted bytes are available");
+    }
+    if (!reason.ok()) {
+      deferred_[id] = reason;
+    }
+  }
+  if (reason.ok()) {
+    // The previous attempt was deferred.
+    ShowNotes({{id, ""}});
+    return reason;
+  }
+  LOG(INFO) << "Deferring load: " << reason.error_message();
+  ShowNotes({{id, StrCat("kLoading: ", reason.error_message())}});
+  return reason;
+}
+
+void MemoryBudget::Pin(const ServableId &id) {
+  mutex_lock l(mu_);
+  auto iter = reservations_.find(id);
+  if (iter != reservations_.end()) {
+    iter->second.pinned = true;
+  }
+}
+
+void MemoryBudget::Release(const ServableId &id) {
+  mutex_lock l(mu_);
+  ReleaseLocked(id);
+}
+
+void MemoryBudget::ReleaseLocked(const ServableId &id) {
+  auto iter = reservations_.find(id);
+  if (iter == reservations_.end()) {
+    return;
+  }
+  reserved_bytes_ -= iter->second.bytes;
+  reservations_.erase(iter);
+  if (!deferred_.empty() || !dropped_.empty() || !withheld_.empty()) {
+    released_ = true;
+  }
+}
+
+uint64 MemoryBudget::reserved_bytes() const {
+  mutex_lock l(mu_);
+  return reserved_bytes_;
+}
+
+EventBus<ServableState>::Callback MemoryBudget::GetEventBusCallback() {
+  return std::bind(&MemoryBudget::ProcessEvent, this, std::placeholders::_1);
+}
+
+void MemoryBudget::ProcessEvent(
+    const EventBus<ServableState>::EventAndTime &ev) {
+  if (ev.event.manager_state != ServableState::ManagerState::kEnd) {
+    return;
+  }
+  const ServableId &id = ev.event.id;
+  Notes notes;
+  {
+    mutex_lock l(mu_);
+    auto iter = reservations_.find(id);
+    if (iter != reservations_.end() && !iter->second.pinned) {
+      ReleaseLocked(id);
+    }
+    // The manager has given up on a deferred version. It can neither be
+    // unaspired nor aspired again from here, so that's left to Housekeep().
+    auto deferred = deferred_.find(id);
+    if (deferred != deferred_.end()) {
+      bool aspired = false;
+      auto versions = aspired_.find(id.name);
+      if (versions != aspired_.end()) {
+        for (const auto &version : versions->second) {
+          aspired = aspired || version.id() == id;
+        }
+      }
+      if (aspired) {
+        dropped_.insert(*deferred);
+      } else {
+        notes.emplace_back(id, "");
+      }
+      deferred_.erase(deferred);
+    }
+  }
+  ShowNotes(notes);
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,165 @@
+#ifndef CRANBERRIES_MEMORY_BUDGET_H_
+#define CRANBERRIES_MEMORY_BUDGET_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/core/servable_id.h"
+#include "tensorflow_serving/core/servable_state.h"
+#include "tensorflow_serving/core/source.h"
+#include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/core/target.h"
+#include "tensorflow_serving/util/event_bus.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Estimates RAM taken by a loaded SavedModel in `export_dir`: sizes of files
+// in its variables/ directory (restored as is) plus size of the serialized
+// graph multiplied by `graph_overhead_factor`, which accounts for the parsed
+// MetaGraphDef, the constructed graph and its kernels.
+Status EstimateModelRamBytes(const string &export_dir,
+                             double graph_overhead_factor, uint64 *bytes);
+
+// Accounts estimated RAM of loaded servables against a fixed budget, so that
+// loading too many models defers new loads instead of running out of memory.
+//
+// A reservation is made before the servable is loaded and is released either
+// explicitly if the load fails, or once the servable reaches kEnd, so the
+// budget should be subscribed to the manager's EventBus<ServableState>.
+//
+// A load which does not fit fails right away rather than waiting for memory
+// on the manager's load thread, and is retried by the manager. Once the
+// manager gives up on it (after `max_num_load_retries`), the version is not
+// dropped for good: the budget is also a filter between the source and the
+// loader, which withholds the version from the manager (so that the manager
+// forgets its failed instance) and aspires it again once some reservation is
+// released. Withheld versions are looked at every
+// `housekeeping_interval_micros`, a version is withheld for at least one
+// interval.
+//
+// States of deferred versions are shown by the note callback, e.g.
+// "kLoading: <reason>" while the manager retries the version and
+// "kDeferred: <reason>" while it's withheld.
+class MemoryBudget final : public TargetBase<StoragePath>,
+                           public Source<StoragePath> {
+ public:
+  // Shows `note` as the state of the version, an empty note clears it. See
+  // ZookeeperStateReporter::SetNote().
+  using NoteCallback =
+      std::function<void(const ServableId &id, const string &note)>;
+
+  explicit MemoryBudget(uint64 budget_bytes,
+                        int64 housekeeping_interval_micros = 1000 * 1000);
+  ~MemoryBudget() override;
+
+  void SetAspiredVersionsCallback(AspiredVersionsCallback callback) override;
+
+  // The callback should not block. Once this returns, the previous callback
+  // is not called anymore.
+  void SetNoteCallback(NoteCallback callback);
+
+  // Reserves `bytes` for `id`, replacing its previous reservation, if any.
+  // If they do not fit (including when they exceed the whole budget), the
+  // version is deferred and the reason is returned, i.e. RESOURCE_EXHAUSTED.
+  Status Reserve(const ServableId &id, uint64 bytes);
+
+  // Keeps reservation of `id`, if any, when the servable reaches kEnd: it's
+  // released by Release() only. Used for loads which are abandoned but still
+  // allocate memory.
+  void Pin(const ServableId &id);
+
+  // Releases reservation of `id`, if any.
+  void Release(const ServableId &id);
+
+  uint64 budget_bytes() const { return budget_bytes_; }
+  uint64 reserved_bytes() const;
+
+  // Versions which are withheld from the manager until memory is released.
+  std::vector<ServableId> withheld() const;
+
+  EventBus<ServableState>::Callback GetEventBusCallback();
+
+  // Withholds versions the manager gave up on and aspires withheld versions
+  // again if memory was released since. Called periodically by the budget's
+  // thread, public for tests.
+  void Housekeep();
+
+ protected:
+  void SetAspiredVersions(
+      const StringPiece servable_name,
+      std::vector<ServableData<StoragePath>> versions) override;
+
+ private:
+  // Releases reservation of `id`, if any, and notes that deferred versions
+  // may fit now.
+  void ReleaseLocked(const ServableId &id) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Returns aspired versions of the model without withheld ones.
+  std::vector<ServableData<StoragePath>> GetForwardedVersions(
+      const string &model_name) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Aspires versions of `model_names` to the target according to their
+  // current state.
+  void Forward(const std::set<string> &model_names);
+
+  void ProcessEvent(const EventBus<ServableState>::EventAndTime &ev);
+
+  // Notes to show, in order.
+  using Notes = std::vector<std::pair<ServableId, string>>;
+  void ShowNotes(const Notes &notes);
+
+  const uint64 budget_bytes_;
+
+  // Serializes calls of `callback_` so that the target always ends up with
+  // the latest state. Never acquired under `mu_`.
+  mutex forward_mu_;
+  AspiredVersionsCallback callback_ GUARDED_BY(forward_mu_);
+
+  // Never acquired under `mu_`.
+  mutex note_mu_;
+  NoteCallback note_callback_ GUARDED_BY(note_mu_);
+
+  mutable mutex mu_;
+  struct Reservation {
+    uint64 bytes;
+    bool pinned;
+  };
+  std::map<ServableId, Reservation> reservations_ GUARDED_BY(mu_);
+  uint64 reserved_bytes_ GUARDED_BY(mu_) = 0;
+  // Versions last aspired by the source, keyed by model name.
+  std::map<string, std::vector<ServableData<StoragePath>>> aspired_
+      GUARDED_BY(mu_);
+  // Versions which did not fit and are retried by the manager, with the
+  // reason.
+  std::map<ServableId, Status> deferred_ GUARDED_BY(mu_);
+  // Deferred versions the manager gave up on, withheld by the next
+  // Housekeep().
+  std::map<ServableId, Status> dropped_ GUARDED_BY(mu_);
+  std::set<ServableId> withheld_ GUARDED_BY(mu_);
+  // A reservation was released while some versions were deferred.
+  bool released_ GUARDED_BY(mu_) = false;
+
+  Notification stop_;
+  std::unique_ptr<Thread> thread_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_MEMORY_BUDGET_H_
@@ -0,0 +1,307 @@
+#include "memory_budget.h"
+
+#include <stdlib.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+using tensorflow::Env;
+using tensorflow::Status;
+using tensorflow::serving::EventBus;
+using tensorflow::serving::ServableData;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::ServableState;
+using tensorflow::serving::StoragePath;
+using tensorflow::serving::cranberries::EstimateModelRamBytes;
+using tensorflow::serving::cranberries::MemoryBudget;
+
+namespace {
+
+std::string TestPath(const std::string &name) {
+  return tensorflow::io::JoinPath(getenv("TEST_TMPDIR"), name);
+}
+
+void WriteFile(const std::string &path, size_t size) {
+  ASSERT_TRUE(tensorflow::WriteStringToFile(Env::Default(), path,
+                                            std::string(size, 'x')).ok());
+}
+
+// Long enough for the budget's thread to never run in a test, which calls
+// Housekeep() itself.
+const tensorflow::int64 kHousekeepingIntervalMicros =
+    3600 * tensorflow::int64{1000000};
+
+// Records versions aspired by the budget, like the loader would.
+class Recorder {
+ public:
+  explicit Recorder(MemoryBudget *budget) {
+    budget->SetAspiredVersionsCallback(
+        [this](const tensorflow::StringPiece name,
+               std::vector<ServableData<StoragePath>> versions) {
+          std::vector<tensorflow::int64> &aspired = aspired_[name.ToString()];
+          aspired.clear();
+          for (const auto &version : versions) {
+            aspired.push_back(version.id().version);
+          }
+          num_calls_++;
+        });
+  }
+
+  // Versions last aspired for the model, -1 if there were no calls.
+  std::vector<tensorflow::int64> aspired(const std::string &name) const {
+    auto iter = aspired_.find(name);
+    return iter == aspired_.end() ? std::vector<tensorflow::int64>{-1}
+                                  : iter->second;
+  }
+
+  int num_calls() const { return num_calls_; }
+
+ private:
+  std::map<std::string, std::vector<tensorflow::int64>> aspired_;
+  int num_calls_ = 0;
+};
+
+// Aspires versions of the model to the budget, like the source would.
+void Aspire(MemoryBudget *budget, const std::string &name,
+            const std::vector<tensorflow::int64> &versions) {
+  std::vector<ServableData<StoragePath>> data;
+  for (tensorflow::int64 version : versions) {
+    data.emplace_back(ServableId{name, version}, "/models/" + name);
+  }
+  budget->GetAspiredVersionsCallback()(name, std::move(data));
+}
+
+}  // namespace
+
+TEST(EstimateModelRamBytesTest, SumsVariablesAndGraph) {
+  const std::string export_dir = TestPath("estimate");
+  const std::string variables_dir =
+      tensorflow::io::JoinPath(export_dir, "variables");
+  ASSERT_TRUE(Env::Default()->RecursivelyCreateDir(variables_dir).ok());
+  WriteFile(tensorflow::io::JoinPath(export_dir, "saved_model.pb"), 100);
+  WriteFile(tensorflow::io::JoinPath(variables_dir,
+                                     "variables.data-00000-of-00001"),
+            1000);
+  WriteFile(tensorflow::io::JoinPath(variables_dir, "variables.index"), 24);
+
+  tensorflow::uint64 bytes = 0;
+  ASSERT_TRUE(EstimateModelRamBytes(export_dir, 2.5, &bytes).ok());
+  EXPECT_EQ(1274, bytes);
+}
+
+TEST(EstimateModelRamBytesTest, AllowsModelWithoutVariables) {
+  const std::string export_dir = TestPath("no_variables");
+  ASSERT_TRUE(Env::Default()->RecursivelyCreateDir(export_dir).ok());
+  WriteFile(tensorflow::io::JoinPath(export_dir, "saved_model.pbtxt"), 10);
+
+  tensorflow::uint64 bytes = 0;
+  ASSERT_TRUE(EstimateModelRamBytes(export_dir, 3, &bytes).ok());
+  EXPECT_EQ(30, bytes);
+}
+
+TEST(EstimateModelRamBytesTest, ReportsMissingGraph) {
+  tensorflow::uint64 bytes = 0;
+  EXPECT_TRUE(tensorflow::errors::IsNotFound(
+      EstimateModelRamBytes(TestPath("missing"), 1, &bytes)));
+}
+
+TEST(MemoryBudgetTest, ReservesWithinBudget) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  EXPECT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+  EXPECT_TRUE(budget.Reserve({"b", 1}, 40).ok());
+  EXPECT_EQ(100, budget.reserved_bytes());
+
+  // Reserving again replaces the previous reservation.
+  EXPECT_TRUE(budget.Reserve({"a", 1}, 50).ok());
+  EXPECT_EQ(90, budget.reserved_bytes());
+}
+
+TEST(MemoryBudgetTest, DefersLoadWhichDoesNotFit) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  std::vector<std::string> notes;
+  budget.SetNoteCallback([&notes](const ServableId &id,
+                                  const std::string &note) {
+    notes.push_back(id.name + ":" + std::to_string(id.version) + " " + note);
+  });
+  ASSERT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+  EXPECT_TRUE(notes.empty());
+
+  const Status status = budget.Reserve({"b", 1}, 50);
+  EXPECT_TRUE(tensorflow::errors::IsResourceExhausted(status));
+  ASSERT_EQ(1, notes.size());
+  EXPECT_EQ("b:1 kLoading: " + status.error_message(), notes[0]);
+  EXPECT_EQ(60, budget.reserved_bytes());
+
+  budget.Release({"a", 1});
+  EXPECT_EQ(0, budget.reserved_bytes());
+  // The note of the deferred load is cleared.
+  EXPECT_TRUE(budget.Reserve({"b", 1}, 50).ok());
+  ASSERT_EQ(2, notes.size());
+  EXPECT_EQ("b:1 ", notes[1]);
+}
+
+TEST(MemoryBudgetTest, DefersLoadLargerThanBudget) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  std::vector<std::string> notes;
+  budget.SetNoteCallback([&notes](const ServableId &id,
+                                  const std::string &note) {
+    notes.push_back(note);
+  });
+  const Status status = budget.Reserve({"a", 1}, 101);
+  EXPECT_TRUE(tensorflow::errors::IsResourceExhausted(status));
+  // The reason is reported, it's never going to fit.
+  EXPECT_EQ(std::vector<std::string>{"kLoading: " + status.error_message()},
+            notes);
+  EXPECT_EQ(0, budget.reserved_bytes());
+}
+
+TEST(MemoryBudgetTest, ReleasesUnloadedServables) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  std::shared_ptr<EventBus<ServableState>> bus =
+      EventBus<ServableState>::CreateEventBus();
+  auto subscription = bus->Subscribe(budget.GetEventBusCallback());
+  ASSERT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+
+  bus->Publish({{"a", 1}, ServableState::ManagerState::kAvailable,
+                Status::OK()});
+  EXPECT_EQ(60, budget.reserved_bytes());
+  bus->Publish({{"a", 1}, ServableState::ManagerState::kEnd, Status::OK()});
+  EXPECT_EQ(0, budget.reserved_bytes());
+}
+
+TEST(MemoryBudgetTest, KeepsPinnedReservationAfterEnd) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  std::shared_ptr<EventBus<ServableState>> bus =
+      EventBus<ServableState>::CreateEventBus();
+  auto subscription = bus->Subscribe(budget.GetEventBusCallback());
+  ASSERT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+
+  budget.Pin({"a", 1});
+  bus->Publish({{"a", 1}, ServableState::ManagerState::kEnd,
+                tensorflow::errors::DeadlineExceeded("timed out")});
+  EXPECT_EQ(60, budget.reserved_bytes());
+  budget.Release({"a", 1});
+  EXPECT_EQ(0, budget.reserved_bytes());
+
+  // Pinning a servable without a reservation does nothing.
+  budget.Pin({"a", 1});
+  ASSERT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+  bus->Publish({{"a", 1}, ServableState::ManagerState::kEnd, Status::OK()});
+  EXPECT_EQ(0, budget.reserved_bytes());
+}
+
+TEST(MemoryBudgetTest, RetriesDroppedLoadOnceMemoryIsReleased) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  std::vector<std::string> notes;
+  budget.SetNoteCallback([&notes](const ServableId &id,
+                                  const std::string &note) {
+    notes.push_back(note);
+  });
+  Recorder recorder(&budget);
+  std::shared_ptr<EventBus<ServableState>> bus =
+      EventBus<ServableState>::CreateEventBus();
+  auto subscription = bus->Subscribe(budget.GetEventBusCallback());
+
+  // Versions pass through as they are.
+  Aspire(&budget, "a", {1});
+  Aspire(&budget, "b", {1});
+  EXPECT_EQ(std::vector<tensorflow::int64>{1}, recorder.aspired("a"));
+  EXPECT_EQ(std::vector<tensorflow::int64>{1}, recorder.aspired("b"));
+  ASSERT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+  ASSERT_FALSE(budget.Reserve({"b", 1}, 50).ok());
+
+  // The manager has run out of retries.
+  bus->Publish({{"b", 1}, ServableState::ManagerState::kEnd,
+                tensorflow::errors::ResourceExhausted("Does not fit")});
+  budget.Housekeep();
+  EXPECT_TRUE(recorder.aspired("b").empty());
+  EXPECT_EQ(std::vector<ServableId>({ServableId{"b", 1}}), budget.withheld());
+  ASSERT_EQ(2, notes.size());
+  EXPECT_EQ(0, notes[1].find("kDeferred: "));
+
+  // Nothing has changed.
+  const int num_calls = recorder.num_calls();
+  budget.Housekeep();
+  EXPECT_EQ(num_calls, recorder.num_calls());
+
+  bus->Publish({{"a", 1}, ServableState::ManagerState::kEnd, Status::OK()});
+  budget.Housekeep();
+  EXPECT_EQ(std::vector<tensorflow::int64>{1}, recorder.aspired("b"));
+  EXPECT_TRUE(budget.withheld().empty());
+  EXPECT_TRUE(budget.Reserve({"b", 1}, 50).ok());
+
+  // It's not deferred anymore, so its unload is not a drop.
+  bus->Publish({{"b", 1}, ServableState::ManagerState::kEnd, Status::OK()});
+  budget.Housekeep();
+  EXPECT_TRUE(budget.withheld().empty());
+  EXPECT_EQ(std::vector<tensorflow::int64>{1}, recorder.aspired("b"));
+}
+
+TEST(MemoryBudgetTest, WithholdsDroppedVersionForOneRound) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  Recorder recorder(&budget);
+  std::shared_ptr<EventBus<ServableState>> bus =
+      EventBus<ServableState>::CreateEventBus();
+  auto subscription = bus->Subscribe(budget.GetEventBusCallback());
+
+  Aspire(&budget, "a", {1});
+  Aspire(&budget, "b", {1});
+  ASSERT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+  ASSERT_FALSE(budget.Reserve({"b", 1}, 50).ok());
+  // Memory is released before the manager gives up.
+  bus->Publish({{"a", 1}, ServableState::ManagerState::kEnd, Status::OK()});
+  bus->Publish({{"b", 1}, ServableState::ManagerState::kEnd,
+                tensorflow::errors::ResourceExhausted("Does not fit")});
+
+  // The manager has to forget the failed instance first.
+  budget.Housekeep();
+  EXPECT_TRUE(recorder.aspired("b").empty());
+  budget.Housekeep();
+  EXPECT_EQ(std::vector<tensorflow::int64>{1}, recorder.aspired("b"));
+}
+
+TEST(MemoryBudgetTest, ForgetsUnaspiredVersions) {
+  MemoryBudget budget(100, kHousekeepingIntervalMicros);
+  Recorder recorder(&budget);
+  std::shared_ptr<EventBus<ServableState>> bus =
+      EventBus<ServableState>::CreateEventBus();
+  auto subscription = bus->Subscribe(budget.GetEventBusCallback());
+
+  Aspire(&budget, "a", {1, 2});
+  ASSERT_TRUE(budget.Reserve({"a", 1}, 60).ok());
+  ASSERT_FALSE(budget.Reserve({"a", 2}, 50).ok());
+  bus->Publish({{"a", 2}, ServableState::ManagerState::kEnd,
+                tensorflow::errors::ResourceExhausted("Does not fit")});
+  budget.Housekeep();
+  EXPECT_EQ(std::vector<tensorflow::int64>{1}, recorder.aspired("a"));
+
+  // Withheld versions are still withheld when other versions change.
+  Aspire(&budget, "a", {1, 2, 3});
+  EXPECT_EQ(std::vector<tensorflow::int64>({1, 3}), recorder.aspired("a"));
+
+  // Once unaspired, the version is passed through when it's aspired again.
+  Aspire(&budget, "a", {1, 3});
+  EXPECT_TRUE(budget.withheld().empty());
+  Aspire(&budget, "a", {1, 2, 3});
+  EXPECT_EQ(std::vector<tensorflow::int64>({1, 2, 3}), recorder.aspired("a"));
+
+  // A deferred version which is unaspired while the manager retries it is
+  // not withheld, and its note is cleared.
+  std::vector<std::string> notes;
+  budget.SetNoteCallback([&notes](const ServableId &id,
+                                  const std::string &note) {
+    notes.push_back(note);
+  });
+  ASSERT_FALSE(budget.Reserve({"a", 3}, 50).ok());
+  Aspire(&budget, "a", {1, 2});
+  bus->Publish({{"a", 3}, ServableState::ManagerState::kEnd, Status::OK()});
+  budget.Housekeep();
+  EXPECT_TRUE(budget.withheld().empty());
+  ASSERT_EQ(2, notes.size());
+  EXPECT_EQ("", notes[1]);
+}
@@ -0,0 +1,348 @@
+#include "model_bundle_source_adapter.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow/core/public/session.h"
+#include "tensorflow/core/public/session_options.h"
+#include "tensorflow_serving/core/simple_loader.h"
+#include "cranberries/core/cpu_affinity.h"
+
+using tensorflow::strings::StrCat;
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+// Returns an error if `threads` asks for what this TensorFlow version can't
+// do per session.
+Status CheckSessionThreads(const ::cranberries::SessionThreadsConfig &threads) {
+  if (threads.intra_op_threads() != 0) {
+    return errors::InvalidArgument(
+        "session_threads.intra_op_threads is not supported: intra-op threads "
+        "are shared by all sessions in this TensorFlow version, see "
+        "--tensorflow_session_parallelism");
+  }
+  return Status::OK();
+}
+
+// Overrides session threads of `config` with ones from `threads`.
+void ApplySessionThreads(const ::cranberries::SessionThreadsConfig &threads,
+                         SessionBundleConfig *config) {
+  ConfigProto *session_config = config->mutable_session_config();
+  // Otherwise inter-op threads are shared by all sessions in the process.
+  session_config->set_use_per_session_threads(true);
+  if (threads.inter_op_threads() > 0) {
+    session_config->set_inter_op_parallelism_threads(
+        threads.inter_op_threads());
+  }
+}
+
+// Creates TensorFlow's process-wide thread pools, i.e. intra-op threads of CPU
+// devices (which are shared even by sessions with `use_per_session_threads`)
+// and inter-op threads of sessions without their own, by creating a throwaway
+// session. Otherwise they would be created by the first loaded session and
+// inherit its affinity, restricting all models to that model's CPUs.
+void CreateGlobalThreadPools(const SessionBundleConfig &base_config) {
+  SessionOptions options;
+  options.config = base_config.session_config();
+  std::unique_ptr<Session> session(NewSession(options));
+  if (!session) {
+    LOG(WARNING) << "Unable to create a session, TensorFlow's thread pools "
+                 << "are created by the first loaded model";
+  }
+}
+
+// Returns CPUs the model's session threads should be restricted to, empty if
+// there is no restriction.
+Status GetSessionCpus(const ::cranberries::SessionThreadsConfig &threads,
+                      std::vector<int> *cpus) {
+  cpus->assign(threads.cpus().begin(), threads.cpus().end());
+  for (int node : threads.numa_nodes()) {
+    std::vector<int> node_cpus;
+    TF_RETURN_IF_ERROR(GetNumaNodeCpus(node, &node_cpus));
+    cpus->insert(cpus->end(), node_cpus.begin(), node_cpus.end());
+  }
+  std::sort(cpus->begin(), cpus->end());
+  cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+  return Status::OK();
+}
+
+using BundleCreator =
+    std::function<Status(std::unique_ptr<SavedModelBundle> *)>;
+
+// Runs `create_bundle` on a separate thread and waits for it at most
+// `timeout_micros`. On timeout sets `abandoned` and returns DEADLINE_EXCEEDED:
+// the attempt continues in background, its bundle is destroyed once it's
+// finished and then `abandoned_done` is called.
+Status CreateBundleWithTimeout(const ServableId &id,
+                               const BundleCreator &create_bundle,
+                               int64 timeout_micros,
+                               const std::function<void()> &abandoned_done,
+                               std::unique_ptr<SavedModelBundle> *bundle,
+                               bool *abandoned) {
+  struct Attempt {
+    // Dropped as soon as it returns, so that nothing it captures (e.g. the
+    // factory) is destroyed after `abandoned_done`.
+    BundleCreator create_bundle;
+    std::function<void()> abandoned_done;
+
+    mutex mu;
+    condition_variable finished;
+    bool done GUARDED_BY(mu) = false;
+    bool abandoned GUARDED_BY(mu) = false;
+    Status status GUARDED_BY(mu);
+    std::unique_ptr<SavedModelBundle> bundle GUARDED_BY(mu);
+  };
+  std::shared_ptr<Attempt> attempt(new Attempt);
+  attempt->create_bundle = create_bundle;
+  attempt->abandoned_done = abandoned_done;
+  Env::Default()->SchedClosure([attempt, id]() {
+    std::unique_ptr<SavedModelBundle> bundle;
+    const Status status = attempt->create_bundle(&bundle);
+    attempt->create_bundle = nullptr;
+    {
+      mutex_lock l(attempt->mu);
+      attempt->done = true;
+      if (!attempt->abandoned) {
+        attempt->status = status;
+        attempt->bundle = std::move(bundle);
+        attempt->finished.notify_all();
+        return;
+      }
+    }
+    LOG(INFO) << "Abandoned loading of " << id.DebugString()
+              << " has finished: " << status;
+    bundle.reset();
+    attempt->abandoned_done();
+  });
+
+  Env *env = Env::Default();
+  const uint64 deadline_micros = env->NowMicros() + timeout_micros;
+  mutex_lock l(attempt->mu);
+  while (!attempt->done) {
+    const uint64 now_micros = env->NowMicros();
+    if (now_micros >= deadline_micros) {
+      break;
+    }
+    WaitForMilliseconds(&l, &attempt->finished,
+                        (deadline_micros - now_micros + 999) / 1000);
+  }
+  *abandoned = !attempt->done;
+  if (*abandoned) {
+    attempt->abandoned = true;
+    LOG(WARNING) << "Loading of " << id.DebugString() << " timed out, it "
+                 << "continues in background and will be discarded";
+    return errors::DeadlineExceeded("Loading of ", id.DebugString(),
+                                    " took more than ", timeout_micros,
+                                    " microseconds");
+  }
+  TF_RETURN_IF_ERROR(attempt->status);
+  *bundle = std::move(attempt->bundle);
+  return Status::OK();
+}
+
+// Reserves estimated RAM of the version in the budget, if any.
+Status ReserveMemory(const ServableId &id, const StoragePath &path,
+                     const ModelBundleSourceAdapter::Options &options) {
+  if (!options.memory_budget) {
+    return Status::OK();
+  }
+  uint64 bytes;
+  TF_RETURN_IF_ERROR(
+      EstimateModelRamBytes(path, options.graph_overhead_factor, &bytes));
+  return options.memory_budget->Reserve(id, bytes);
+}
+
+}  // namespace
+
+SessionBundleConfig MakeSessionBundleConfig(
+    const SessionBundleConfig &base_config, const string &model_name,
+    const ::cranberries::ModelConfig &model_config) {
+  SessionBundleConfig config = base_config;
+  if (model_config.has_session_threads()) {
+    ApplySessionThreads(model_config.session_threads(), &config);
+  }
+  if (!model_config.has_batching()) {
+    return config;
+  }
+  const ::cranberries::BatchingConfig &batching = model_config.batching();
+  BatchingParameters *parameters = config.mutable_batching_parameters();
+  if (batching.max_batch_size() > 0) {
+    parameters->mutable_max_batch_size()->set_value(batching.max_batch_size());
+  }
+  if (batching.batch_timeout_micros() > 0) {
+    parameters->mutable_batch_timeout_micros()->set_value(
+        batching.batch_timeout_micros());
+  }
+  if (batching.allowed_batch_sizes_size() > 0) {
+    parameters->clear_allowed_batch_sizes();
+    for (int64 size : batching.allowed_batch_sizes()) {
+      parameters->add_allowed_batch_sizes(size);
+    }
+  }
+  if (batching.num_batch_threads() > 0) {
+    parameters->mutable_num_batch_threads()->set_value(
+        batching.num_batch_threads());
+  }
+  if (batching.max_enqueued_batches() > 0) {
+    parameters->mutable_max_enqueued_batches()->set_value(
+        batching.max_enqueued_batches());
+  }
+  // Model-specific parameters get their own batch scheduler, so its threads
+  // are named after the model.
+  parameters->mutable_thread_pool_name()->set_value(
+      StrCat("batch_threads_", model_name));
+  return config;
+}
+
+ModelBundleSourceAdapter::ModelBundleSourceAdapter(
+    const SessionBundleConfig &base_config, ModelConfigRegistry *model_configs,
+    const Options &options)
+  : base_config_(base_config),
+    model_configs_(model_configs),
+    options_(options),
+    attempts_(new LoadAttempts) {
+  CreateGlobalThreadPools(base_config_);
+}
+
+ModelBundleSourceAdapter::~ModelBundleSourceAdapter() {
+  Detach();
+  // Abandoned attempts still call `post_load`, which may use objects that
+  // are destroyed after the adapter.
+  attempts_->Close();
+}
+
+std::vector<ServableData<std::unique_ptr<Loader>>>
+ModelBundleSourceAdapter::Adapt(
+    const StringPiece servable_name,
+    std::vector<ServableData<StoragePath>> versions) {
+  const string model_name = servable_name.ToString();
+  const std::shared_ptr<const ::cranberries::ModelConfig> model_config =
+      model_configs_->Get(model_name);
+  const SessionBundleConfig config =
+      MakeSessionBundleConfig(base_config_, model_name, *model_config);
+  std::shared_ptr<SavedModelBundleFactory> factory;
+  std::vector<int> cpus;
+  Status factory_status = CheckSessionThreads(model_config->session_threads());
+  if (factory_status.ok()) {
+    factory_status = GetSessionCpus(model_config->session_threads(), &cpus);
+  }
+  if (factory_status.ok()) {
+    factory_status = GetFactory(config, &factory);
+  }
+  if (!factory_status.ok()) {
+    LOG(ERROR) << "Unable to create bundle factory for model " << model_name
+               << ": " << factory_status;
+  }
+
+  std::vector<ServableData<std::unique_ptr<Loader>>> adapted_versions;
+  adapted_versions.reserve(versions.size());
+  for (auto &version : versions) {
+    if (!version.status().ok()) {
+      adapted_versions.emplace_back(version.id(), version.status());
+      continue;
+    }
+    if (!factory_status.ok()) {
+      adapted_versions.emplace_back(version.id(), factory_status);
+      continue;
+    }
+    const StoragePath path = version.DataOrDie();
+    const ServableId id = version.id();
+    const PostLoadCallback post_load = options_.post_load;
+    const BundleCreator create_bundle = [factory, id, path, cpus, post_load](
+        std::unique_ptr<SavedModelBundle> *bundle) {
+      // Session's own threads are started while the bundle is created, so
+      // they inherit affinity of the loading thread. Shared thread pools
+      // already exist, see CreateGlobalThreadPools().
+      ScopedThreadAffinity affinity(cpus);
+      TF_RETURN_IF_ERROR(affinity.status());
+      TF_RETURN_IF_ERROR(factory->CreateSavedModelBundle(path, bundle));
+      if (post_load) {
+        TF_RETURN_IF_ERROR(post_load(id, path, bundle->get()));
+      }
+      return Status::OK();
+    };
+    const Options options = options_;
+    const std::shared_ptr<LoadAttempts> attempts = attempts_;
+    auto servable_creator = [create_bundle, id, path, options, attempts](
+        std::unique_ptr<SavedModelBundle> *bundle) {
+      // At most one attempt of a version runs at a time, so abandoned ones
+      // do not pile up if retries time out too.
+      TF_RETURN_IF_ERROR(attempts->Start(id));
+      Status status = ReserveMemory(id, path, options);
+      if (status.ok() && options.load_timeout_micros <= 0) {
+        status = create_bundle(bundle);
+      } else if (status.ok()) {
+        MemoryBudget *memory_budget = options.memory_budget;
+        bool abandoned = false;
+        status = CreateBundleWithTimeout(
+            id, create_bundle, options.load_timeout_micros,
+            [attempts, id, memory_budget]() {
+              if (memory_budget) {
+                memory_budget->Release(id);
+              }
+              attempts->Finish(id);
+            },
+            bundle, &abandoned);
+        if (abandoned) {
+          // The abandoned attempt still allocates memory, so its reservation
+          // is kept until it's finished even if the version reaches kEnd.
+          // It's released already if the attempt has just finished.
+          if (memory_budget) {
+            memory_budget->Pin(id);
+          }
+          return status;
+        }
+      }
+      if (!status.ok() && options.memory_budget) {
+        options.memory_budget->Release(id);
+      }
+      attempts->Finish(id);
+      return status;
+    };
+    auto resource_estimator = [factory, path](ResourceAllocation *estimate) {
+      return factory->EstimateResourceRequirement(path, estimate);
+    };
+    std::unique_ptr<Loader> loader(new SimpleLoader<SavedModelBundle>(
+        servable_creator, resource_estimator));
+    adapted_versions.emplace_back(version.id(), std::move(loader));
+  }
+  return adapted_versions;
+}
+
+Status ModelBundleSourceAdapter::GetFactory(
+    const SessionBundleConfig &config,
+    std::shared_ptr<SavedModelBundleFactory> *factory) {
+  string key;
+  config.SerializeToString(&key);
+  mutex_lock l(mu_);
+  *factory = factories_[key].lock();
+  if (*factory) {
+    return Status::OK();
+  }
+  std::unique_ptr<SavedModelBundleFactory> new_factory;
+  TF_RETURN_IF_ERROR(SavedModelBundleFactory::Create(config, &new_factory));
+  factory->reset(new_factory.release());
+  factories_[key] = *factory;
+  // Drop entries of factories which are already destroyed.
+  for (auto iter = factories_.begin(); iter != factories_.end();) {
+    if (iter->second.expired()) {
+      iter = factories_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,121 @@
+#ifndef CRANBERRIES_MODEL_BUNDLE_SOURCE_ADAPTER_H_
+#define CRANBERRIES_MODEL_BUNDLE_SOURCE_ADAPTER_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_serving/core/loader.h"
+#include "tensorflow_serving/core/servable_id.h"
+#include "tensorflow_serving/core/source_adapter.h"
+#include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/servables/tensorflow/saved_model_bundle_factory.h"
+#include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
+#include "cranberries/core/load_attempts.h"
+#include "cranberries/core/memory_budget.h"
+#include "cranberries/core/model_config_registry.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Returns `base_config` with parameters overridden by `model_config` of model
+// `model_name`, i.e. the config its versions are loaded with. Does not check
+// `session_threads`, whose CPUs are applied by the loader.
+SessionBundleConfig MakeSessionBundleConfig(
+    const SessionBundleConfig &base_config, const string &model_name,
+    const ::cranberries::ModelConfig &model_config);
+
+// Replacement of TensorFlow Serving's SavedModelBundleSourceAdapter which
+// takes per-model configuration into account: each model is loaded with
+// server-wide SessionBundleConfig, overridden by the model's ModelConfig from
+// ModelConfigRegistry at the time its version is adapted.
+//
+// If the model has its own session threads, they are restricted to the
+// configured CPUs by setting affinity of the loading thread while the session
+// is created. Only the session's inter-op threads are its own: intra-op
+// threads of CPU devices are shared by the process in this TensorFlow
+// version, and they are created by the constructor, unrestricted, so that a
+// model's affinity does not leak to them. Versions of a model which sets
+// `intra_op_threads` fail with INVALID_ARGUMENT.
+//
+// Models with the same effective configuration share SavedModelBundleFactory,
+// hence the batch scheduler and its threads. Factories are destroyed once the
+// last loader created by them is gone.
+//
+// Optional PostLoadCallback is called by the loader right after the bundle is
+// created (with the same thread affinity), so the version does not become
+// available until it returns. It may modify the bundle, e.g. wrap its session.
+// Its error fails the load.
+//
+// Loads may be limited in time. A load which takes longer fails with
+// DEADLINE_EXCEEDED and frees the manager's load thread, but cannot be
+// interrupted: it continues in background and its bundle is destroyed once
+// it's finished. Until then retries of the version fail with UNAVAILABLE, and
+// the adapter's destructor waits for it, as it still calls PostLoadCallback.
+//
+// With MemoryBudget, RAM of each version is estimated before it's loaded (see
+// EstimateModelRamBytes()) and reserved in the budget. A load which does not
+// fit is deferred: it fails with RESOURCE_EXHAUSTED right away to be retried
+// by the manager later (and by the budget once the manager gives up), and the
+// budget reports the reason to Zookeeper. The reservation of a timed out load is kept until its abandoned attempt is
+// finished.
+class ModelBundleSourceAdapter final
+    : public SourceAdapter<StoragePath, std::unique_ptr<Loader>> {
+ public:
+  using PostLoadCallback = std::function<Status(
+      const ServableId &id, const StoragePath &path,
+      SavedModelBundle *bundle)>;
+
+  struct Options {
+    // Called after each bundle is created, may be empty.
+    PostLoadCallback post_load;
+    // Maximal duration of a single load attempt including `post_load`, zero
+    // means no limit.
+    int64 load_timeout_micros = 0;
+
+    // Budget of estimated RAM of loaded versions, null means no limit. It
+    // should be subscribed to the manager's event bus and outlive the adapter.
+    MemoryBudget *memory_budget = nullptr;
+    // See EstimateModelRamBytes().
+    double graph_overhead_factor = 1;
+  };
+
+  // `model_configs` should outlive the adapter.
+  ModelBundleSourceAdapter(const SessionBundleConfig &base_config,
+                           ModelConfigRegistry *model_configs,
+                           const Options &options);
+  ~ModelBundleSourceAdapter() override;
+
+  // Returns factory for the given effective config, creating it if needed.
+  // Public for tests.
+  Status GetFactory(const SessionBundleConfig &config,
+                    std::shared_ptr<SavedModelBundleFactory> *factory);
+
+ private:
+  std::vector<ServableData<std::unique_ptr<Loader>>> Adapt(
+      const StringPiece servable_name,
+      std::vector<ServableData<StoragePath>> versions) override;
+
+  const SessionBundleConfig base_config_;
+  ModelConfigRegistry *model_configs_;
+  const Options options_;
+
+  mutex mu_;
+  // Keyed by serialized SessionBundleConfig.
+  std::map<string, std::weak_ptr<SavedModelBundleFactory>> factories_
+      GUARDED_BY(mu_);
+
+  std::shared_ptr<LoadAttempts> attempts_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ModelBundleSourceAdapter);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_MODEL_BUNDLE_SOURCE_ADAPTER_H_
@@ -0,0 +1,169 @@
+#include "model_bundle_source_adapter.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+
+using tensorflow::StringPiece;
+using tensorflow::serving::Loader;
+using tensorflow::serving::SavedModelBundleFactory;
+using tensorflow::serving::ServableData;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::SessionBundleConfig;
+using tensorflow::serving::StoragePath;
+using tensorflow::serving::cranberries::MakeSessionBundleConfig;
+using tensorflow::serving::cranberries::ModelBundleSourceAdapter;
+using tensorflow::serving::cranberries::ModelConfigRegistry;
+using tensorflow::serving::cranberries::ParseModelConfig;
+
+namespace {
+
+::cranberries::ModelConfig Config(const std::string &text) {
+  ::cranberries::ModelConfig config;
+  EXPECT_TRUE(ParseModelConfig(text, &config).ok()) << text;
+  return config;
+}
+
+SessionBundleConfig BaseConfig() {
+  SessionBundleConfig config;
+  config.mutable_session_config()->set_inter_op_parallelism_threads(8);
+  config.mutable_session_config()->set_intra_op_parallelism_threads(8);
+  auto *batching = config.mutable_batching_parameters();
+  batching->mutable_max_batch_size()->set_value(32);
+  batching->mutable_num_batch_threads()->set_value(4);
+  return config;
+}
+
+class ModelBundleSourceAdapterTest : public ::testing::Test {
+ protected:
+  ModelBundleSourceAdapterTest()
+    : adapter_(BaseConfig(), &model_configs_,
+               ModelBundleSourceAdapter::Options()) {
+    adapter_.SetAspiredVersionsCallback(
+        [this](const StringPiece name,
+               std::vector<ServableData<std::unique_ptr<Loader>>> versions) {
+          adapted_ = std::move(versions);
+        });
+  }
+
+  std::shared_ptr<SavedModelBundleFactory> GetFactory(
+      const std::string &model_name) {
+    const SessionBundleConfig config = MakeSessionBundleConfig(
+        BaseConfig(), model_name, *model_configs_.Get(model_name));
+    std::shared_ptr<SavedModelBundleFactory> factory;
+    EXPECT_TRUE(adapter_.GetFactory(config, &factory).ok());
+    return factory;
+  }
+
+  // Adapts version 1 of the model, its path does not matter as the loader
+  // is not loaded.
+  void Adapt(const std::string &model_name) {
+    std::vector<ServableData<StoragePath>> versions;
+    versions.emplace_back(ServableId{model_name, 1}, "/nonexistent");
+    adapter_.GetAspiredVersionsCallback()(model_name, std::move(versions));
+  }
+
+  ModelConfigRegistry model_configs_;
+  ModelBundleSourceAdapter adapter_;
+  std::vector<ServableData<std::unique_ptr<Loader>>> adapted_;
+};
+
+}  // namespace
+
+TEST(MakeSessionBundleConfigTest, KeepsBaseConfigByDefault) {
+  const SessionBundleConfig base = BaseConfig();
+  const SessionBundleConfig config =
+      MakeSessionBundleConfig(base, "a", Config(""));
+  EXPECT_EQ(base.SerializeAsString(), config.SerializeAsString());
+}
+
+TEST(MakeSessionBundleConfigTest, OverridesBatchingParameters) {
+  const SessionBundleConfig config = MakeSessionBundleConfig(
+      BaseConfig(), "a",
+      Config("batching { max_batch_size: 64 allowed_batch_sizes: 16 "
+             "allowed_batch_sizes: 64 batch_timeout_micros: 500 }"));
+  const auto &parameters = config.batching_parameters();
+  EXPECT_EQ(64, parameters.max_batch_size().value());
+  EXPECT_EQ(500, parameters.batch_timeout_micros().value());
+  ASSERT_EQ(2, parameters.allowed_batch_sizes_size());
+  EXPECT_EQ(16, parameters.allowed_batch_sizes(0));
+  EXPECT_EQ(64, parameters.allowed_batch_sizes(1));
+  // Zero fields keep server-wide values.
+  EXPECT_EQ(4, parameters.num_batch_threads().value());
+  // The model gets its own batch scheduler.
+  EXPECT_EQ("batch_threads_a", parameters.thread_pool_name().value());
+  EXPECT_EQ(8, config.session_config().inter_op_parallelism_threads());
+}
+
+TEST(MakeSessionBundleConfigTest, GivesSessionItsOwnThreads) {
+  const SessionBundleConfig config = MakeSessionBundleConfig(
+      BaseConfig(), "a", Config("session_threads { inter_op_threads: 2 }"));
+  EXPECT_TRUE(config.session_config().use_per_session_threads());
+  EXPECT_EQ(2, config.session_config().inter_op_parallelism_threads());
+  EXPECT_EQ(8, config.session_config().intra_op_parallelism_threads());
+  EXPECT_EQ(32, config.batching_parameters().max_batch_size().value());
+
+  // Zero keeps the server-wide setting, but the threads are still the
+  // session's own.
+  const SessionBundleConfig cpus_only = MakeSessionBundleConfig(
+      BaseConfig(), "a", Config("session_threads { cpus: 0 }"));
+  EXPECT_TRUE(cpus_only.session_config().use_per_session_threads());
+  EXPECT_EQ(8, cpus_only.session_config().inter_op_parallelism_threads());
+}
+
+TEST_F(ModelBundleSourceAdapterTest, SharesFactoriesOfEqualConfigs) {
+  model_configs_.Set("a", Config("session_threads { inter_op_threads: 2 }"));
+  model_configs_.Set("b", Config("session_threads { inter_op_threads: 2 }"));
+  model_configs_.Set("c", Config("session_threads { inter_op_threads: 4 }"));
+  model_configs_.Set("d", Config("batching { max_batch_size: 64 }"));
+  model_configs_.Set("e", Config("batching { max_batch_size: 64 }"));
+
+  std::shared_ptr<SavedModelBundleFactory> a = GetFactory("a");
+  ASSERT_TRUE(a != nullptr);
+  EXPECT_EQ(a, GetFactory("a"));
+  EXPECT_EQ(a, GetFactory("b"));
+  EXPECT_NE(a, GetFactory("c"));
+  // Models with default config share the server-wide factory.
+  std::shared_ptr<SavedModelBundleFactory> base = GetFactory("x");
+  EXPECT_EQ(base, GetFactory("y"));
+  EXPECT_NE(a, base);
+  // Batching parameters of a model get a batch scheduler of their own, even
+  // if they are equal to another model's.
+  EXPECT_NE(GetFactory("d"), GetFactory("e"));
+}
+
+TEST_F(ModelBundleSourceAdapterTest, DestroysUnusedFactories) {
+  std::shared_ptr<SavedModelBundleFactory> factory = GetFactory("a");
+  std::weak_ptr<SavedModelBundleFactory> weak_factory = factory;
+  factory.reset();
+  EXPECT_TRUE(weak_factory.expired());
+
+  // Loaders keep their factory.
+  Adapt("a");
+  ASSERT_EQ(1, adapted_.size());
+  ASSERT_TRUE(adapted_[0].status().ok()) << adapted_[0].status();
+  factory = GetFactory("a");
+  weak_factory = factory;
+  factory.reset();
+  EXPECT_FALSE(weak_factory.expired());
+  adapted_.clear();
+  EXPECT_TRUE(weak_factory.expired());
+}
+
+TEST_F(ModelBundleSourceAdapterTest, RejectsIntraOpThreads) {
+  model_configs_.Set("a", Config("session_threads { intra_op_threads: 2 }"));
+  Adapt("a");
+  ASSERT_EQ(1, adapted_.size());
+  EXPECT_EQ(ServableId({"a", 1}), adapted_[0].id());
+  EXPECT_EQ(tensorflow::error::INVALID_ARGUMENT,
+            adapted_[0].status().code());
+
+  // Once the config is fixed, versions load again.
+  model_configs_.Set("a", Config("session_threads { inter_op_threads: 2 }"));
+  Adapt("a");
+  ASSERT_EQ(1, adapted_.size());
+  EXPECT_TRUE(adapted_[0].status().ok()) << adapted_[0].status();
+}
@@ -0,0 +1,65 @@
+#include "model_config_registry.h"
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/protobuf.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+Status ParseModelConfig(const string &text,
+                        ::cranberries::ModelConfig *config) {
+  if (!protobuf::TextFormat::ParseFromString(text, config)) {
+    return errors::InvalidArgument("Unable to parse ModelConfig from '", text,
+                                   "'");
+  }
+  if (config->traffic_split_size() > 0) {
+    TF_RETURN_IF_ERROR(TrafficSplit::Validate(config->traffic_split()));
+  }
+  return Status::OK();
+}
+
+std::shared_ptr<const ::cranberries::ModelConfig> ModelConfigRegistry::Get(
+    const string &model_name) const {
+  {
+    mutex_lock l(mu_);
+    auto iter = configs_.find(model_name);
+    if (iter != configs_.end()) {
+      return iter->second.config;
+    }
+  }
+  static const auto *default_config =
+      new std::shared_ptr<const ::cranberries::ModelConfig>(
+          new ::cranberries::ModelConfig);
+  return *default_config;
+}
+
+std::shared_ptr<const TrafficSplit> ModelConfigRegistry::GetTrafficSplit(
+    const string &model_name) const {
+  mutex_lock l(mu_);
+  auto iter = configs_.find(model_name);
+  if (iter == configs_.end()) {
+    return nullptr;
+  }
+  return iter->second.traffic_split;
+}
+
+void ModelConfigRegistry::Set(const string &model_name,
+                              const ::cranberries::ModelConfig &config) {
+  Entry entry;
+  entry.config.reset(new ::cranberries::ModelConfig(config));
+  if (config.traffic_split_size() > 0) {
+    entry.traffic_split.reset(new TrafficSplit(config.traffic_split()));
+  }
+  mutex_lock l(mu_);
+  configs_[model_name] = std::move(entry);
+}
+
+void ModelConfigRegistry::Erase(const string &model_name) {
+  mutex_lock l(mu_);
+  configs_.erase(model_name);
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
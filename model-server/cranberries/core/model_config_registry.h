@@ -0,0 +1,56 @@
+#ifndef CRANBERRIES_MODEL_CONFIG_REGISTRY_H_
+#define CRANBERRIES_MODEL_CONFIG_REGISTRY_H_
+
+#include <memory>
+#include <unordered_map>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "cranberries/core/model_config.pb.h"
+#include "cranberries/core/traffic_split.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Parses ModelConfig from its text format and validates it, empty text is a
+// valid default configuration.
+Status ParseModelConfig(const string &text, ::cranberries::ModelConfig *config);
+
+// Thread-safe storage of the most recent configuration of each model, filled
+// by ZookeeperSource and read by components which load and serve models.
+class ModelConfigRegistry {
+ public:
+  ModelConfigRegistry() {}
+
+  // Returns configuration of the model, or the default one if there is none.
+  std::shared_ptr<const ::cranberries::ModelConfig> Get(
+      const string &model_name) const;
+
+  // Returns routing table of the model, null if its calls are not split.
+  std::shared_ptr<const TrafficSplit> GetTrafficSplit(
+      const string &model_name) const;
+
+  // `config` should be valid, see ParseModelConfig(). The configuration and
+  // routing table built from it are replaced at once.
+  void Set(const string &model_name, const ::cranberries::ModelConfig &config);
+  void Erase(const string &model_name);
+
+ private:
+  struct Entry {
+    std::shared_ptr<const ::cranberries::ModelConfig> config;
+    std::shared_ptr<const TrafficSplit> traffic_split;
+  };
+
+  mutable mutex mu_;
+  std::unordered_map<string, Entry> configs_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ModelConfigRegistry);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_MODEL_CONFIG_REGISTRY_H_
@@ -0,0 +1,65 @@
+#include "traffic_split.h"
+
+#include <algorithm>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+uint64 SplitMix64(uint64 *state) {
+  uint64 z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+}  // namespace
+
+Status TrafficSplit::Validate(const Weights &weights) {
+  uint64 total_weight = 0;
+  for (const auto &weight : weights) {
+    total_weight += weight.weight();
+  }
+  if (total_weight == 0) {
+    return errors::InvalidArgument(
+        "Weights of traffic_split should have a positive sum");
+  }
+  return Status::OK();
+}
+
+TrafficSplit::TrafficSplit(const Weights &weights) {
+  for (const auto &weight : weights) {
+    if (weight.weight() == 0) {
+      continue;
+    }
+    total_weight_ += weight.weight();
+    cumulative_weights_.emplace_back(total_weight_, weight.version());
+  }
+}
+
+int64 TrafficSplit::Pick(uint64 hash) const {
+  const uint64 point = hash % total_weight_;
+  // The first version whose cumulative weight exceeds the point.
+  auto iter = std::upper_bound(
+      cumulative_weights_.begin(), cumulative_weights_.end(), point,
+      [](uint64 point, const std::pair<uint64, int64> &weight) {
+        return point < weight.first;
+      });
+  return iter->second;
+}
+
+uint64 TrafficSplit::NextCallHash() {
+  // Threads start from different states, so that they do not pick the same
+  // sequence of versions.
+  static thread_local uint64 state =
+      Env::Default()->NowMicros() ^ reinterpret_cast<uintptr_t>(&state);
+  return SplitMix64(&state);
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
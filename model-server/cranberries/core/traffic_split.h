@@ -0,0 +1,48 @@
+#ifndef CRANBERRIES_TRAFFIC_SPLIT_H_
+#define CRANBERRIES_TRAFFIC_SPLIT_H_
+
+#include <utility>
+#include <vector>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/protobuf.h"
+#include "tensorflow/core/platform/types.h"
+#include "cranberries/core/model_config.pb.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Immutable routing table of a model built from `traffic_split` of its
+// ModelConfig: picks a version for a call which does not specify one.
+class TrafficSplit {
+ public:
+  using Weights = protobuf::RepeatedPtrField<::cranberries::VersionWeight>;
+
+  // Returns INVALID_ARGUMENT unless the weights have a positive sum.
+  static Status Validate(const Weights &weights);
+
+  // `weights` should be valid.
+  explicit TrafficSplit(const Weights &weights);
+
+  // Returns version for a call with the given hash. Uniformly distributed
+  // hashes are split between versions proportionally to their weights.
+  int64 Pick(uint64 hash) const;
+
+  // Returns a cheap pseudo-random hash for the next call: a per-thread
+  // sequence number mixed by SplitMix64, no locks or shared state.
+  static uint64 NextCallHash();
+
+ private:
+  // Cumulative weight up to and including the version, and the version.
+  std::vector<std::pair<uint64, int64>> cumulative_weights_;
+  uint64 total_weight_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TrafficSplit);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_TRAFFIC_SPLIT_H_
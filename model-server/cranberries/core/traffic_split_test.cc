@@ -0,0 +1,72 @@
+#include "traffic_split.h"
+
+#include <map>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "cranberries/core/model_config_registry.h"
+
+using cranberries::ModelConfig;
+using tensorflow::int64;
+using tensorflow::uint64;
+using tensorflow::serving::cranberries::ModelConfigRegistry;
+using tensorflow::serving::cranberries::ParseModelConfig;
+using tensorflow::serving::cranberries::TrafficSplit;
+
+namespace {
+
+ModelConfig ParseOrDie(const std::string &text) {
+  ModelConfig config;
+  EXPECT_TRUE(ParseModelConfig(text, &config).ok());
+  return config;
+}
+
+}  // namespace
+
+TEST(TrafficSplitTest, SplitsByWeights) {
+  const ModelConfig config = ParseOrDie(
+      "traffic_split { version: 1 weight: 90 } "
+      "traffic_split { version: 2 weight: 0 } "
+      "traffic_split { version: 3 weight: 10 }");
+  TrafficSplit split(config.traffic_split());
+  std::map<int64, int> counts;
+  for (uint64 hash = 1000; hash < 1100; hash++) {
+    counts[split.Pick(hash)]++;
+  }
+  EXPECT_EQ(2, counts.size());
+  EXPECT_EQ(90, counts[1]);
+  EXPECT_EQ(10, counts[3]);
+}
+
+TEST(TrafficSplitTest, SplitsCallHashesEvenly) {
+  const ModelConfig config = ParseOrDie(
+      "traffic_split { version: 1 weight: 1 } "
+      "traffic_split { version: 2 weight: 1 }");
+  TrafficSplit split(config.traffic_split());
+  int num_first = 0;
+  for (int i = 0; i < 10000; i++) {
+    if (split.Pick(TrafficSplit::NextCallHash()) == 1) {
+      num_first++;
+    }
+  }
+  EXPECT_GT(num_first, 4500);
+  EXPECT_LT(num_first, 5500);
+}
+
+TEST(TrafficSplitTest, RejectsZeroWeights) {
+  ModelConfig config;
+  EXPECT_TRUE(tensorflow::errors::IsInvalidArgument(ParseModelConfig(
+      "traffic_split { version: 1 } traffic_split { version: 2 }", &config)));
+}
+
+TEST(TrafficSplitTest, IsReplacedWithConfig) {
+  ModelConfigRegistry model_configs;
+  EXPECT_EQ(nullptr, model_configs.GetTrafficSplit("mnist"));
+
+  model_configs.Set("mnist",
+                    ParseOrDie("traffic_split { version: 2 weight: 1 }"));
+  ASSERT_NE(nullptr, model_configs.GetTrafficSplit("mnist"));
+  EXPECT_EQ(2, model_configs.GetTrafficSplit("mnist")->Pick(42));
+
+  model_configs.Set("mnist", ParseOrDie("cache_results: true"));
+  EXPECT_EQ(nullptr, model_configs.GetTrafficSplit("mnist"));
+}
@@ -1,53 +1,27 @@
 #include "zookeeper_source.h"
 
-#include "tensorflow/core/lib/strings/strcat.h"
+#include <functional>
+#include <map>
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/strings/numbers.h"
 #include "tensorflow_serving/core/servable_data.h"
 #include "tensorflow_serving/core/servable_id.h"
-#include "zookeeper_cc/path_utils.h"
+#include "cranberries/core/aspired_models_snapshot.h"
 
-using tensorflow::strings::StrCat;
 using tensorflow::strings::safe_strto64;
+using zookeeper_cc::TreeCache;
 
-// This implementation uses Zookeeper Watches to monitor configuration changes.
-// It sets multiple watches on znodes under <base-path>/aspired-models and
-// re-reads the tree (or subtree) when something changes.
-//
-// NOTE: it does not try to avoid setting same watcher on same znode several
-// time; this redundancy is expected to be handled by the underlying Zookeeper
-// client library: it should avoid issuing same event to the same watch
-// function, otherwise exponential increase of number of watches may be
-// possible.
-//
-// This implementation has three main callbacks which set watches and update
-// data:
-// 1. ReloadAspiredModels()
-//   a. Sets watches on "aspired-models" znode and set of its children, they
-//      re-trigger ReloadAspiredModels().
-//   b. Thus, this callback is run every time this znode is created/removed
-//      or set of its children is changed.
-//   c. Calls ReloadAspiredModelVersions() for all _new_ children. "Current"
-//      children are tracked in the monitored_models_ field. This is done for
-//      optimization purposes: we don't want to reload all versions of all
-//      models every time. Invariant for monitored_models_: all models in it
-//      will be processed ReloadAspiredModelVersions() at some point in the
-//      future: either because it will be called directly, or because it's a
-//      watch callback. In particular, it's always safe to remove from
-//      monitored_models_ and we do not guarantee that it's eventually
-//      consistent with Zookeeper's state.
-// 2. ReloadAspiredModelVersions()
-//   a. Sets watch on set of <base-path>/aspired-models/<model-name>'s children.
-//   b. Thus, this callback Re-run every time set of model's znode's children is
-//      changed, the znode is deleted.
-//   c. It reads list of children of <base-path>/aspired-models/<model-name>,
-//      reads their data, and calls aspired_versions_callback_ from Source<>
-//      interface.
-//   d. It also sets data watch on all correct verions of the model, so if some
-//      version's znode had empty data, we will be notified when it's changed.
-// 3. ReloadAspiredModelVersion()
-//   a. Ran by changes of <base-path>/aspired-models/<model-name>/<version>.
-//   b. Simply calls ReloadAspiredModelVersions() to reload list of aspired
-//      versions of the corresponding model.
+// This implementation mirrors <base-path>/aspired-models in
+// zookeeper_cc::TreeCache, which keeps it up to date with watches and reads
+// only znodes which have changed. After each batch of changes the cache
+// calls ProcessTreeChanges(), which reloads models whose subtrees have
+// changed from the cache's snapshot: parses configuration from data of the
+// model's znode and aspires versions whose znodes have non-empty data.
+// Removed models are unaspired. With a coalescing window, changed models are
+// only collected there, and the reconciler thread reloads them from the
+// latest snapshot once the window is over. Models of a batch are reloaded in
+// parallel by the reload pool, if there is one.
 //
 // Note that ABA problem does not look like a problem here: we're guaranteed
 // to receive an update even for ABAs (except for when a znode was created and
@@ -57,6 +31,18 @@ using tensorflow::strings::safe_strto64;
 namespace {
 
 static const char kAspiredModelsZnode[] = "aspired-models";
+// Models and their versions are cached.
+static const int kAspiredModelsDepth = 2;
+
+// Keeps the earliest of known event times in `*event_micros`, zero is
+// unknown.
+void MergeEventTime(tensorflow::uint64 candidate_micros,
+                    tensorflow::uint64 *event_micros) {
+  if (candidate_micros != 0 &&
+      (*event_micros == 0 || candidate_micros < *event_micros)) {
+    *event_micros = candidate_micros;
+  }
+}
 
 }
 
@@ -64,23 +50,35 @@ namespace tensorflow {
 namespace serving {
 namespace cranberries {
 
-ZookeeperSource::ZookeeperSource(zookeeper_cc::Zookeeper *zookeeper)
-  : reload_aspired_models_(
-      [this](int type, int state, const char* path) {
-          ReloadAspiredModels();
-      })
-  , reload_aspired_model_versions_(
-      [this](int type, int state, const char* path) {
-          ReloadAspiredModelVersions(path);
-      })
-  , reload_aspired_model_version_(
-      [this](int type, int state, const char* path) {
-          ReloadAspiredModelVersion(path);
-      })
-  , zookeeper_(zookeeper)
+ZookeeperSource::ZookeeperSource(zookeeper_cc::Zookeeper *zookeeper,
+                                 ModelConfigRegistry *model_configs,
+                                 const Options &options)
+  : zookeeper_(zookeeper)
+  , model_configs_(model_configs)
+  , snapshot_path_(options.snapshot_path)
+  , coalescing_window_micros_(options.coalescing_window_micros)
+  , tree_cache_(zookeeper, kAspiredModelsZnode, kAspiredModelsDepth)
 {
-  // Watch for session changes.
-  zookeeper_->SetWatcher(&reload_aspired_models_);
+  if (options.num_reload_threads > 1) {
+    reload_pool_.reset(new thread::ThreadPool(
+        Env::Default(), "zookeeper_source_reload",
+        options.num_reload_threads));
+  }
+  if (coalescing_window_micros_ > 0) {
+    reconciler_.reset(Env::Default()->StartThread(
+        ThreadOptions(), "zookeeper_source_reconciler",
+        [this]() { RunReconciler(); }));
+  }
+}
+
+ZookeeperSource::~ZookeeperSource() {
+  {
+    mutex_lock l(mu_);
+    stop_ = true;
+  }
+  pending_changed_.notify_all();
+  // Changes which are still pending are dropped.
+  reconciler_.reset();
 }
 
 void ZookeeperSource::SetAspiredVersionsCallback(
@@ -89,138 +87,313 @@ void ZookeeperSource::SetAspiredVersionsCallback(
     mutex_lock l(mu_);
     set_aspired_versions_callback_ = callback;
   }
-  ReloadAspiredModels();
+  LoadSnapshot();
+  // Watches for session changes as well.
+  tree_cache_.Start(std::bind(&ZookeeperSource::ProcessTreeChanges, this,
+                              std::placeholders::_1, std::placeholders::_2));
 };
 
-void ZookeeperSource::ReloadAspiredModels() {
-  // Do not ignore session events, it's the "root" watch which should actually
-  // handle state changes.
-
-  // We want to be notified when the node is created, so we set a watch; we
-  // don't mind being notified when the node is removed as well.
-  int res = zookeeper_->Exists(kAspiredModelsZnode, &reload_aspired_models_,
-                               nullptr);
-  if (res == ZNONODE) {
-    // Probably the node was just removed, waiting until it's created.
-    LOG(WARNING) << "Node " << zookeeper_->GetBasePath() << kAspiredModelsZnode << " does not exist";
+void ZookeeperSource::LoadSnapshot() {
+  if (snapshot_path_.empty()) {
     return;
   }
-  if (res != ZOK) {
-    LOG(ERROR) << "Zookeeper error " << res;
+  ::cranberries::AspiredModelsSnapshot snapshot;
+  Status status = ReadAspiredModelsSnapshot(snapshot_path_, &snapshot);
+  if (errors::IsNotFound(status)) {
+    LOG(INFO) << "No snapshot of aspired models at " << snapshot_path_;
     return;
   }
-
-  LOG(INFO) << "Reloading information from " << zookeeper_->GetBasePath() << kAspiredModelsZnode;
-  std::vector<std::string> models;
-  res = zookeeper_->GetChildren(kAspiredModelsZnode, &models,
-                                &reload_aspired_models_);
-  if (res == ZNONODE) {
-    // Potential race condition: znode can be deleted between Exists() and
-    // GetChildren(), not a problem, we will re-set watch once it reappears.
+  if (!status.ok()) {
+    LOG(ERROR) << "Unable to read snapshot of aspired models: " << status;
     return;
   }
-  if (res != ZOK) {
-    LOG(ERROR) << "Zookeeper error " << res;
-    return;
+  AspiredVersionsCallback callback;
+  {
+    mutex_lock l(mu_);
+    callback = set_aspired_versions_callback_;
+    for (const auto &model : snapshot.models()) {
+      aspired_models_[model.name()] = model;
+      unconfirmed_models_.insert(model.name());
+    }
+  }
+  for (const auto &model : snapshot.models()) {
+    if (model_configs_) {
+      ::cranberries::ModelConfig config;
+      if (ParseModelConfig(model.config(), &config).ok()) {
+        model_configs_->Set(model.name(), config);
+      }
+    }
+    std::vector<ServableData<StoragePath>> aspired_versions;
+    for (const auto &version : model.versions()) {
+      aspired_versions.emplace_back(ServableId{model.name(), version.version()},
+                                    version.path());
+    }
+    LOG(INFO) << "Will aspire " << aspired_versions.size()
+              << " versions of model " << model.name() << " from snapshot";
+    callback(model.name(), aspired_versions);
   }
+}
 
-  // Start watching new models. First, remove all models which are in the
-  // monitored_models_ list, then add the remaining to the list, and finally
-  // call ReloadAspiredModelVersions() on newly created models.
+void ZookeeperSource::ReconcileSnapshot(
+    const std::vector<std::string> &models) {
+  if (snapshot_path_.empty()) {
+    return;
+  }
+  const std::unordered_set<string> existing_models(models.begin(),
+                                                   models.end());
+  std::vector<string> removed_models;
+  AspiredVersionsCallback callback;
   {
-    // Lock is scoped because ReloadAspiredModelVersions() will take it. It's
-    // ok to release lock and possibly call ReloadAspiredModelVersions() with
-    // "slightly inconsistent" monitored_models_ list because the invariant
-    // is preserved: after we exit the block, ReloadAspiredModelVersions() is
-    // guaranteed to be called for all models in monitored_models_ list at some
-    // point in the future.
     mutex_lock l(mu_);
-    std::remove_if(models.begin(), models.end(),
-        [this](const std::string &model_name) {
-          return monitored_models_.count(model_name) > 0;
-        }
-    );
-    monitored_models_.insert(models.begin(), models.end());
+    callback = set_aspired_versions_callback_;
+    for (const string &name : unconfirmed_models_) {
+      if (existing_models.count(name) == 0) {
+        removed_models.push_back(name);
+      }
+    }
+    if (removed_models.empty()) {
+      return;
+    }
+    for (const string &name : removed_models) {
+      unconfirmed_models_.erase(name);
+      aspired_models_.erase(name);
+    }
+    WriteSnapshot();
+  }
+  for (const string &name : removed_models) {
+    LOG(INFO) << "Model " << name << " from snapshot is not in Zookeeper, "
+              << "will unaspire it";
+    if (model_configs_) {
+      model_configs_->Erase(name);
+    }
+    callback(name, {});
   }
-  for (const auto &model_name : models) {
-    ReloadAspiredModelVersions(model_name.c_str());
+}
+
+void ZookeeperSource::WriteSnapshot() {
+  ::cranberries::AspiredModelsSnapshot snapshot;
+  for (const auto &entry : aspired_models_) {
+    *snapshot.add_models() = entry.second;
   }
+  Status status = WriteAspiredModelsSnapshot(snapshot_path_, snapshot);
+  if (!status.ok()) {
+    LOG(ERROR) << "Unable to write snapshot of aspired models: " << status;
+  }
+}
+
+ZookeeperSource::Stats ZookeeperSource::GetStats() const {
+  Stats stats;
+  stats.watch_events = tree_cache_.watch_events();
+  stats.zookeeper_requests = tree_cache_.requests();
+  stats.updates = num_updates_;
+  stats.update_latency_micros_sum = update_latency_micros_sum_;
+  stats.update_latency_count = update_latency_count_;
+  return stats;
 }
 
-void ZookeeperSource::ReloadAspiredModelVersions(const char *path) {
-  if (!path[0]) {
-    // Session event, ignoring.
+void ZookeeperSource::ProcessTreeChanges(
+    const std::shared_ptr<const TreeCache::Node> &root,
+    const std::vector<TreeCache::Change> &changes) {
+  // Any change of a model's subtree (configuration, list of versions or
+  // their paths) makes the model to be reloaded from the cache. Latency is
+  // measured since the earliest watch event.
+  std::map<string, uint64> changed_models;
+  for (const auto &change : changes) {
+    if (!change.path.empty()) {
+      MergeEventTime(change.event_micros,
+                     &changed_models[change.path.substr(
+                         0, change.path.find('/'))]);
+    }
+  }
+  if (coalescing_window_micros_ <= 0) {
+    Reconcile(root, changed_models);
     return;
   }
-  const char *name = zookeeper_cc::GetLastPathSegment(path);
+  {
+    mutex_lock l(mu_);
+    if (!pending_) {
+      pending_ = true;
+      pending_since_micros_ = Env::Default()->NowMicros();
+    }
+    pending_root_ = root;
+    for (const auto &model : changed_models) {
+      MergeEventTime(model.second, &pending_models_[model.first]);
+    }
+  }
+  pending_changed_.notify_all();
+}
+
+void ZookeeperSource::RunReconciler() {
+  Env *env = Env::Default();
+  mutex_lock l(mu_);
+  while (!stop_) {
+    if (!pending_) {
+      pending_changed_.wait(l);
+      continue;
+    }
+    const uint64 deadline_micros =
+        pending_since_micros_ + coalescing_window_micros_;
+    const uint64 now_micros = env->NowMicros();
+    if (now_micros < deadline_micros) {
+      WaitForMilliseconds(&l, &pending_changed_,
+                          (deadline_micros - now_micros + 999) / 1000);
+      continue;
+    }
+    std::shared_ptr<const TreeCache::Node> root = std::move(pending_root_);
+    std::map<string, uint64> models = std::move(pending_models_);
+    pending_root_.reset();
+    pending_models_.clear();
+    pending_ = false;
+    l.unlock();
+    Reconcile(root, models);
+    l.lock();
+  }
+}
 
-  // Get set of children and set watch for it.
-  std::vector<std::string> versions;
-  int res = zookeeper_->GetChildren(
-    StrCat(kAspiredModelsZnode, "/", name).c_str(),
-    &versions,
-    &reload_aspired_model_versions_
-  );
-  if (res == ZNONODE) {
+void ZookeeperSource::Reconcile(
+    const std::shared_ptr<const TreeCache::Node> &root,
+    const std::map<string, uint64> &models) {
+  if (!root) {
+    // Probably the node was just removed, waiting until it's created.
+    LOG(WARNING) << "Node " << zookeeper_->GetBasePath()
+                 << kAspiredModelsZnode << " does not exist";
+  } else {
+    std::vector<std::string> names;
+    for (const auto &model : root->children) {
+      names.push_back(model.first);
+    }
+    ReconcileSnapshot(names);
+  }
+  auto reload = [this, &root](const string &name, uint64 event_micros) {
+    const TreeCache::Node *model = nullptr;
+    if (root) {
+      auto iter = root->children.find(name);
+      if (iter != root->children.end()) {
+        model = iter->second.get();
+      }
+    }
+    ReloadModel(name, model, event_micros);
+  };
+  if (reload_pool_ && models.size() > 1) {
+    // Each model is updated by a single task, so its updates are not
+    // reordered, and the next batch waits for this one.
+    BlockingCounter counter(models.size());
+    for (const auto &model : models) {
+      reload_pool_->Schedule([&reload, &model, &counter]() {
+        reload(model.first, model.second);
+        counter.DecrementCount();
+      });
+    }
+    counter.Wait();
+  } else {
+    for (const auto &model : models) {
+      reload(model.first, model.second);
+    }
+  }
+  if (!snapshot_path_.empty() && !models.empty()) {
     mutex_lock l(mu_);
-    // It's always safe to remove from monitored_models_. Here we have to do it
-    // because ZNONODE means that the znode was deleted from Zookeeper, as well
-    // as its watches, so we do not monitor it anymore.
-    monitored_models_.erase(name);
-    return;
+    WriteSnapshot();
   }
-  if (res != ZOK) {
-    LOG(ERROR) << "Zookeepeer error " << res;
+}
+
+void ZookeeperSource::ReloadModel(const string &name,
+                                  const TreeCache::Node *model,
+                                  uint64 event_micros) {
+  AspiredVersionsCallback callback;
+  {
+    mutex_lock l(mu_);
+    callback = set_aspired_versions_callback_;
+  }
+  if (!model) {
+    LOG(INFO) << "Model " << name << " is removed, will unaspire it";
+    if (model_configs_) {
+      model_configs_->Erase(name);
+    }
+    if (!snapshot_path_.empty()) {
+      mutex_lock l(mu_);
+      aspired_models_.erase(name);
+      unconfirmed_models_.erase(name);
+    }
+    RecordUpdate(event_micros);
+    callback(name, {});
     return;
   }
+  if (model_configs_) {
+    // Configuration has to be in place before versions are aspired, as it's
+    // read when they are loaded.
+    ReloadModelConfig(name, model->data);
+  }
 
   std::vector<ServableData<StoragePath>> aspired_versions;
-  aspired_versions.reserve(versions.size());
+  aspired_versions.reserve(model->children.size());
   // Retrieve paths for all valid aspired versions.
-  for (const auto &version : versions) {
+  for (const auto &version : model->children) {
     ServableId id;
     id.name = name;
-    if (!safe_strto64(version.c_str(), &id.version) || id.version < 0) {
-      LOG(ERROR) << "Invalid version of model " << name << ": " << version;
-      continue;
-    }
-    std::string path;
-    res = zookeeper_->Get(
-      StrCat(kAspiredModelsZnode, "/", name, "/", version).c_str(),
-      &path,
-      &reload_aspired_model_version_,
-      nullptr
-    );
-    if (res != ZOK) {
-      LOG(ERROR) << "Zookeeper error " << res;
+    if (!safe_strto64(version.first.c_str(), &id.version) || id.version < 0) {
+      LOG(ERROR) << "Invalid version of model " << name << ": "
+                 << version.first;
       continue;
     }
+    const string &path = version.second->data;
     if (path.empty()) {
-      LOG(INFO) << "Model " << name << ", version " << version
+      LOG(INFO) << "Model " << name << ", version " << version.first
                 << ": path is empty";
       continue;
     }
-    LOG(INFO) << "Model " << name << ", version " << version
+    LOG(INFO) << "Model " << name << ", version " << version.first
               << ": located at " << path;
-    aspired_versions.emplace_back(id, std::move(path));
+    aspired_versions.emplace_back(id, path);
   }
-  if (set_aspired_versions_callback_) {
-    LOG(INFO) << "Will aspire " << aspired_versions.size()
-              << " versions of model " << name;
-    set_aspired_versions_callback_(name, aspired_versions);
+  if (!snapshot_path_.empty()) {
+    mutex_lock l(mu_);
+    ::cranberries::AspiredModel &snapshot_model = aspired_models_[name];
+    snapshot_model.set_name(name);
+    snapshot_model.clear_versions();
+    for (const auto &version : aspired_versions) {
+      ::cranberries::AspiredVersion *snapshot_version =
+          snapshot_model.add_versions();
+      snapshot_version->set_version(version.id().version);
+      snapshot_version->set_path(version.DataOrDie());
+    }
+    unconfirmed_models_.erase(name);
   }
+  LOG(INFO) << "Will aspire " << aspired_versions.size()
+            << " versions of model " << name;
+  // Counted first, so the update is in the stats once the callback sees it.
+  RecordUpdate(event_micros);
+  callback(name, aspired_versions);
 }
 
-void ZookeeperSource::ReloadAspiredModelVersion(const char *path) {
-  if (!path[0]) {
-    // Session event, ignoring.
+void ZookeeperSource::RecordUpdate(uint64 event_micros) {
+  num_updates_++;
+  if (event_micros == 0) {
     return;
   }
-  std::string model_path = string(path);
-  auto version_pos = model_path.find_last_of('/');
-  CHECK(version_pos != std::string::npos);
-  model_path.erase(model_path.begin() + version_pos, model_path.end());
-  ReloadAspiredModelVersions(model_path.c_str());
+  const uint64 now_micros = Env::Default()->NowMicros();
+  // Wall clock may step back.
+  if (now_micros >= event_micros) {
+    update_latency_micros_sum_ += now_micros - event_micros;
+    update_latency_count_++;
+  }
+}
+
+void ZookeeperSource::ReloadModelConfig(const string &name,
+                                        const string &data) {
+  ::cranberries::ModelConfig config;
+  Status status = ParseModelConfig(data, &config);
+  if (!status.ok()) {
+    LOG(ERROR) << "Invalid configuration of model " << name
+               << ", keeping the previous one: " << status;
+    return;
+  }
+  LOG(INFO) << "Model " << name << " configuration: "
+            << config.ShortDebugString();
+  model_configs_->Set(name, config);
+  if (!snapshot_path_.empty()) {
+    mutex_lock l(mu_);
+    aspired_models_[name].set_config(data);
+  }
 }
 
 }  // namespace cranberries
@@ -1,11 +1,21 @@
 #ifndef CRANBERRIES_ZOOKEEPER_SOURCE_H_
 #define CRANBERRIES_ZOOKEEPER_SOURCE_H_
 
+#include <atomic>
+#include <map>
+#include <memory>
 #include <unordered_set>
+#include <vector>
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow_serving/core/source.h"
 #include "tensorflow_serving/core/storage_path.h"
+#include "zookeeper_cc/tree_cache.h"
 #include "zookeeper_cc/zookeeper_cc.h"
+#include "cranberries/core/aspired_models_snapshot.pb.h"
+#include "cranberries/core/model_config_registry.h"
 
 namespace tensorflow {
 namespace serving {
@@ -20,11 +30,11 @@ namespace cranberries {
 // <base-path>
 // +-- aspired-models (no data)
 //     | list of models:
-//     +-- model1 (no data)
+//     +-- model1 (optional ModelConfig in text format)
 //     |   | list of model's versions:
 //     |   +-- 1 (data contains path to the version)
 //     |   +-- 2 (similar)
-//     +-- model2 (no data)
+//     +-- model2 (similar)
 //         | list of model's versions:
 //         +-- 1 (data contains path to the versions)
 //         +-- 2 (similar)
@@ -36,6 +46,11 @@ namespace cranberries {
 // version znodes which do not contain empty data - they are not included in
 // the list of aspired versions.
 //
+// Data of a model's znode is parsed as ModelConfig (see model_config.proto)
+// and stored in ModelConfigRegistry before the model's versions are aspired,
+// so it's applied to versions which are loaded afterwards. Invalid
+// configuration is logged and ignored, the previous one stays in effect.
+//
 // Nevertheless, it's not allowed to alter znode's data after it was seen by
 // ZookeeperSource, because of limitation of AspiredVersionsManager: it assumes
 // that paths do not change, thus it does not check whether path of an already
@@ -45,42 +60,125 @@ namespace cranberries {
 // and the old model is unloaded, and the create the new node. Obviously, that
 // will cause some downtime for that model.
 //
-// NOTE: AspiredVersionsManager "queues" load requests and do not process
-// further model load requests until previous are processed and retried
-// several times. That means that if you specify invalid path to model's
-// version, further changes won't be reflected until AspiredVersionsManager
-// decides to stop retrying to load the model from invalid path. Similarly,
-// if a model takes long time to load, all further changes won't be reflected
-// until the loading is finished.
+// If snapshot path is given, aspired versions and configuration of all models
+// are saved there (see aspired_models_snapshot.proto) whenever they change.
+// On start, models from the snapshot are aspired immediately, without waiting
+// for Zookeeper. Once the list of models is read from Zookeeper, models which
+// are not there anymore are unaspired, others are reloaded as usual.
+//
+// NOTE: unless AspiredVersionsManager has load threads, it loads versions
+// one by one on its own thread, retrying failed loads several times, so an
+// invalid path or a slow model delays all further changes. With load threads
+// (see --num_load_threads) only changes of the same model wait.
 //
-// TODO(egor.suvorov): handle re/disconnections from Zookeeper because of
-// session expirations (Zookeeper* becomes invalid?).
-// TODO(egor.suvorov): handle Zookeeper errors gracefully without losing
-// watches (if that's an issue at all).
-// TODO(egor.suvorov): make it asynchronous(?).
+// The tree is mirrored by zookeeper_cc::TreeCache, so a change of a znode
+// makes only that znode to be read again, and only the affected model is
+// re-aspired. Models are aspired on the cache's thread. When the session
+// expires, the cache starts a new one on the same Zookeeper and reads the
+// tree again, so models whose znodes have changed meanwhile are re-aspired.
 class ZookeeperSource : public Source<StoragePath> {
  public:
-  ZookeeperSource(zookeeper_cc::Zookeeper *zookeeper);
-  ~ZookeeperSource() {}
+  struct Stats {
+    // Watch events received from Zookeeper.
+    uint64 watch_events = 0;
+    // Requests sent to Zookeeper.
+    uint64 zookeeper_requests = 0;
+    // Calls of the aspired versions callback, one per model.
+    uint64 updates = 0;
+    // Time from receipt of the watch event to the callback, summed over
+    // updates caused by watch events, and the number of such updates.
+    uint64 update_latency_micros_sum = 0;
+    uint64 update_latency_count = 0;
+  };
+
+  struct Options {
+    // Empty path disables the snapshot.
+    string snapshot_path;
+    // Changes of the tree are coalesced during that time since the first
+    // one, so a burst of changes (e.g. a deploy script which creates
+    // versions one by one) results in a single update of each affected
+    // model instead of an update per change. They are processed by a
+    // separate thread then. Zero processes every batch of changes read by
+    // the tree cache right away.
+    int64 coalescing_window_micros = 0;
+    // Models of a batch are reloaded by that many threads in parallel, one
+    // reloads them on the thread which processes the batch.
+    int num_reload_threads = 1;
+  };
+
+  // `model_configs` is optional, it should outlive the source.
+  ZookeeperSource(zookeeper_cc::Zookeeper *zookeeper,
+                  ModelConfigRegistry *model_configs, const Options &options);
+  ~ZookeeperSource();
 
   void SetAspiredVersionsCallback(AspiredVersionsCallback callback) override;
 
+  Stats GetStats() const;
+
  private:
   mutable mutex mu_;
 
-  using WatcherCallback = zookeeper_cc::Zookeeper::WatcherCallback;
+  // Called by the tree cache with the latest snapshot of aspired-models,
+  // reloads models which have changed or leaves that to the reconciler.
+  void ProcessTreeChanges(
+      const std::shared_ptr<const zookeeper_cc::TreeCache::Node> &root,
+      const std::vector<zookeeper_cc::TreeCache::Change> &changes);
+  // Reloads `models` (changed models mapped to time of the watch event which
+  // revealed the change, see TreeCache::Change) from the snapshot.
+  void Reconcile(
+      const std::shared_ptr<const zookeeper_cc::TreeCache::Node> &root,
+      const std::map<string, uint64> &models);
+  // Body of the reconciler thread.
+  void RunReconciler();
+  // Aspires versions of the model, unaspires it if `model` is null. The
+  // snapshot is not written, Reconcile() does it once per batch.
+  void ReloadModel(const string &name,
+                   const zookeeper_cc::TreeCache::Node *model,
+                   uint64 event_micros);
+  // Counts an update, measuring its latency unless `event_micros` is zero.
+  void RecordUpdate(uint64 event_micros);
+  void ReloadModelConfig(const string &name, const string &data);
 
-  void ReloadAspiredModels();
-  void ReloadAspiredModelVersions(const char *path);
-  void ReloadAspiredModelVersion(const char *path);
-
-  const WatcherCallback reload_aspired_models_;
-  const WatcherCallback reload_aspired_model_versions_;
-  const WatcherCallback reload_aspired_model_version_;
+  // Aspires models from the snapshot, if any.
+  void LoadSnapshot();
+  // Unaspires models from the snapshot which are not in `models` read from
+  // Zookeeper.
+  void ReconcileSnapshot(const std::vector<std::string> &models);
+  void WriteSnapshot() EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   zookeeper_cc::Zookeeper *zookeeper_;
+  ModelConfigRegistry *model_configs_;
   AspiredVersionsCallback set_aspired_versions_callback_ GUARDED_BY(mu_);
-  std::unordered_set<string> monitored_models_ GUARDED_BY(mu_);
+
+  const string snapshot_path_;
+  // Last aspired versions and valid configuration of each model, keyed by
+  // model's name. Maintained only if snapshot is enabled.
+  std::map<string, ::cranberries::AspiredModel> aspired_models_
+      GUARDED_BY(mu_);
+  // Models aspired from the snapshot which are not seen in Zookeeper yet.
+  std::unordered_set<string> unconfirmed_models_ GUARDED_BY(mu_);
+
+  const int64 coalescing_window_micros_;
+  // Changes waiting for the reconciler: the latest snapshot and models which
+  // have changed since `pending_since_micros_`.
+  bool pending_ GUARDED_BY(mu_) = false;
+  uint64 pending_since_micros_ GUARDED_BY(mu_) = 0;
+  std::shared_ptr<const zookeeper_cc::TreeCache::Node> pending_root_
+      GUARDED_BY(mu_);
+  std::map<string, uint64> pending_models_ GUARDED_BY(mu_);
+  condition_variable pending_changed_;
+  bool stop_ GUARDED_BY(mu_) = false;
+  // Null if changes are not coalesced.
+  std::unique_ptr<Thread> reconciler_;
+  // Null if models are reloaded by the calling thread.
+  std::unique_ptr<thread::ThreadPool> reload_pool_;
+
+  std::atomic<uint64> num_updates_{0};
+  std::atomic<uint64> update_latency_micros_sum_{0};
+  std::atomic<uint64> update_latency_count_{0};
+
+  // Destroyed first, so that it does not call back destroyed members.
+  zookeeper_cc::TreeCache tree_cache_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(ZookeeperSource);
 };
@@ -0,0 +1,198 @@
+#include "zookeeper_source.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+
+using tensorflow::Env;
+using tensorflow::condition_variable;
+using tensorflow::mutex;
+using tensorflow::mutex_lock;
+using tensorflow::serving::ServableData;
+using tensorflow::serving::StoragePath;
+using tensorflow::serving::cranberries::ZookeeperSource;
+using zookeeper_cc::Zookeeper;
+
+namespace {
+
+const int kRecvTimeoutMs = 1000;
+const tensorflow::int64 kCoalescingWindowMicros = 1000 * 1000;
+const tensorflow::int64 kTimeoutMicros = 10 * 1000 * 1000;
+
+// Aspired versions of a model passed to the callback, e.g. "a: 1 2".
+using Update = std::string;
+
+// Records calls of the aspired versions callback.
+class Recorder {
+ public:
+  ZookeeperSource::AspiredVersionsCallback callback() {
+    return [this](const tensorflow::StringPiece name,
+                  std::vector<ServableData<StoragePath>> versions) {
+      std::stringstream update;
+      update << name.ToString() << ":";
+      for (const auto &version : versions) {
+        update << " " << version.id().version;
+      }
+      mutex_lock l(mu_);
+      updates_.push_back(update.str());
+      called_.notify_all();
+    };
+  }
+
+  // Waits until there are `count` updates, returns false on timeout.
+  bool WaitFor(size_t count, tensorflow::int64 timeout_micros) {
+    Env *env = Env::Default();
+    const tensorflow::uint64 deadline_micros =
+        env->NowMicros() + timeout_micros;
+    mutex_lock l(mu_);
+    while (updates_.size() < count) {
+      const tensorflow::uint64 now_micros = env->NowMicros();
+      if (now_micros >= deadline_micros) {
+        return false;
+      }
+      WaitForMilliseconds(&l, &called_,
+                          (deadline_micros - now_micros + 999) / 1000);
+    }
+    return true;
+  }
+
+  std::vector<Update> updates() {
+    mutex_lock l(mu_);
+    return updates_;
+  }
+
+ private:
+  mutex mu_;
+  condition_variable called_;
+  std::vector<Update> updates_;
+};
+
+}  // namespace
+
+class ZookeeperSourceTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() override {
+    char *hosts = getenv("ZOOKEEPER_TEST_HOSTS");
+    ASSERT_TRUE(hosts && strlen(hosts) > 0) << "ZOOKEEPER_TEST_HOSTS is unspecified";
+
+    // Construct random path inside Zookeeper to provide some tests isolation.
+    auto unit_test = ::testing::UnitTest::GetInstance();
+    const ::testing::TestInfo* const test_info =
+        unit_test->current_test_info();
+    std::stringstream bases;
+    bases << "/zookeeper-source-test"
+          << "/" << unit_test->random_seed()
+          << "/" << test_info->test_case_name()
+          << "/" << test_info->name();
+
+    // Disable most logging.
+    zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
+
+    zk_.reset(new Zookeeper(hosts, kRecvTimeoutMs, bases.str()));
+    ASSERT_TRUE(zk_->Init());
+  }
+
+  virtual void TearDown() override {
+    source_.reset();
+    zk_.reset();
+  }
+
+  void StartSource(const ZookeeperSource::Options &options) {
+    source_.reset(new ZookeeperSource(zk_.get(), nullptr, options));
+    source_->SetAspiredVersionsCallback(recorder_.callback());
+  }
+
+  void CreateVersion(const std::string &model, int version) {
+    const std::string path =
+        "aspired-models/" + model + "/" + std::to_string(version);
+    ASSERT_EQ(ZOK, zk_->Create(path.c_str(), "/models/" + model, false,
+                               &ZOO_OPEN_ACL_UNSAFE));
+  }
+
+  std::unique_ptr<Zookeeper> zk_;
+  std::unique_ptr<ZookeeperSource> source_;
+  Recorder recorder_;
+};
+
+TEST_F(ZookeeperSourceTest, CoalescesBurstOfChanges) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("aspired-models/a", &ZOO_OPEN_ACL_UNSAFE));
+  ZookeeperSource::Options options;
+  options.coalescing_window_micros = kCoalescingWindowMicros;
+  StartSource(options);
+  // The first read is an update of its own, so the burst below starts a new
+  // window.
+  ASSERT_TRUE(recorder_.WaitFor(1, kTimeoutMicros));
+  EXPECT_EQ("a:", recorder_.updates()[0]);
+  const ZookeeperSource::Stats initial = source_->GetStats();
+  EXPECT_EQ(1, initial.updates);
+  // Changes found by the first read are not caused by watch events.
+  EXPECT_EQ(0, initial.update_latency_count);
+
+  // A deploy script creating versions one by one, well within the window.
+  const tensorflow::uint64 burst_start_micros = Env::Default()->NowMicros();
+  for (int version = 1; version <= 5; version++) {
+    CreateVersion("a", version);
+  }
+  ASSERT_LT(Env::Default()->NowMicros() - burst_start_micros,
+            kCoalescingWindowMicros / 2)
+      << "The burst is too slow for the test to be reliable";
+
+  ASSERT_TRUE(recorder_.WaitFor(2, kTimeoutMicros));
+  EXPECT_EQ("a: 1 2 3 4 5", recorder_.updates()[1]);
+  // Nothing else arrives after another window.
+  Env::Default()->SleepForMicroseconds(2 * kCoalescingWindowMicros);
+  EXPECT_EQ(2, recorder_.updates().size());
+
+  const ZookeeperSource::Stats stats = source_->GetStats();
+  EXPECT_EQ(2, stats.updates);
+  EXPECT_EQ(1, stats.update_latency_count);
+  // The update waited for the window, measured since the first event.
+  EXPECT_GE(stats.update_latency_micros_sum, kCoalescingWindowMicros);
+  EXPECT_GE(stats.watch_events, initial.watch_events + 1);
+  EXPECT_GT(stats.zookeeper_requests, initial.zookeeper_requests);
+}
+
+TEST_F(ZookeeperSourceTest, UpdatesEachChangedModelOnce) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("aspired-models/a", &ZOO_OPEN_ACL_UNSAFE));
+  ZookeeperSource::Options options;
+  options.coalescing_window_micros = kCoalescingWindowMicros;
+  StartSource(options);
+  ASSERT_TRUE(recorder_.WaitFor(1, kTimeoutMicros));
+
+  CreateVersion("a", 1);
+  ASSERT_EQ(ZOK, zk_->EnforcePath("aspired-models/b", &ZOO_OPEN_ACL_UNSAFE));
+  CreateVersion("b", 1);
+  CreateVersion("a", 2);
+
+  ASSERT_TRUE(recorder_.WaitFor(3, kTimeoutMicros));
+  Env::Default()->SleepForMicroseconds(2 * kCoalescingWindowMicros);
+  const std::vector<Update> updates = recorder_.updates();
+  ASSERT_EQ(3, updates.size());
+  // Models of a batch are updated in order of their names.
+  EXPECT_EQ("a: 1 2", updates[1]);
+  EXPECT_EQ("b: 1", updates[2]);
+
+  const ZookeeperSource::Stats stats = source_->GetStats();
+  EXPECT_EQ(3, stats.updates);
+  EXPECT_EQ(2, stats.update_latency_count);
+}
+
+TEST_F(ZookeeperSourceTest, UpdatesEveryBatchWithoutWindow) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("aspired-models/a", &ZOO_OPEN_ACL_UNSAFE));
+  StartSource(ZookeeperSource::Options());
+  ASSERT_TRUE(recorder_.WaitFor(1, kTimeoutMicros));
+
+  CreateVersion("a", 1);
+  ASSERT_TRUE(recorder_.WaitFor(2, kTimeoutMicros));
+  EXPECT_EQ("a: 1", recorder_.updates()[1]);
+  CreateVersion("a", 2);
+  ASSERT_TRUE(recorder_.WaitFor(3, kTimeoutMicros));
+  EXPECT_EQ("a: 1 2", recorder_.updates()[2]);
+  EXPECT_EQ(3, source_->GetStats().updates);
+}
@@ -0,0 +1,9 @@
+#!/bin/bash
+
+set -u
+set -e
+set -o pipefail
+
+source zookeeper_cc/run_zookeeper_server.sh
+
+cranberries/core/zookeeper_source_test_impl "$@"
@@ -1,12 +1,14 @@
 #include "zookeeper_state_reporter.h"
 
 #include <functional>
+#include <vector>
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 
 using tensorflow::serving::ServableState;
 using tensorflow::strings::StrCat;
 using tensorflow::string;
+using zookeeper_cc::Zookeeper;
 
 namespace {
 
@@ -27,46 +29,276 @@ namespace tensorflow {
 namespace serving {
 namespace cranberries {
 
+const size_t ZookeeperStateReporter::kMaxOpsPerMulti;
+const int64 ZookeeperStateReporter::kSessionCheckIntervalMs;
+
+ZookeeperStateReporter::ZookeeperStateReporter(
+    zookeeper_cc::Zookeeper *zookeeper)
+  : zookeeper_(zookeeper)
+  , session_number_(zookeeper->SessionNumber())
+{
+  writer_.reset(Env::Default()->StartThread(
+      ThreadOptions(), "zookeeper_state_reporter", [this]() { Run(); }));
+}
+
+ZookeeperStateReporter::~ZookeeperStateReporter() {
+  {
+    mutex_lock l(mu_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  writer_.reset();
+}
+
 EventBus<ServableState>::Callback ZookeeperStateReporter::GetEventBusCallback() {
   return std::bind(&ZookeeperStateReporter::ProcessEvent, this, std::placeholders::_1);
 }
 
+void ZookeeperStateReporter::Flush() {
+  mutex_lock l(mu_);
+  // The writer checks the session before it writes anything else.
+  const uint64 session_checks = session_checks_;
+  changed_.notify_all();
+  while (session_checks_ == session_checks || !pending_.empty() || writing_) {
+    changed_.wait(l);
+  }
+}
+
+void ZookeeperStateReporter::SetPaused(bool paused) {
+  {
+    mutex_lock l(mu_);
+    paused_ = paused;
+  }
+  changed_.notify_all();
+}
+
 void ZookeeperStateReporter::ProcessEvent(const EventBus<ServableState>::EventAndTime &ev) {
   const auto &state = ev.event;
-  string prefix = StrCat("current-models/", state.id.name);
-  string name = StrCat(prefix, "/", state.id.version);
-  string value = ManagerStateToString(state.manager_state);
-  LOG(INFO) << "Reporting servable state to Zookeeper: " << name << "=" << value;
+  Report report;
+  report.value = ManagerStateToString(state.manager_state);
+  if (!state.health.ok()) {
+    // E.g. a failed load.
+    report.value = StrCat(report.value, ": ", state.health.error_message());
+  }
 
+  mutex_lock l(mu_);
   if (state.manager_state == ServableState::ManagerState::kEnd) {
-    int res = zookeeper_->Delete(name.c_str());
-    if (res == ZOK || res == ZNONODE) {
-      // Do nothing.
+    manager_states_.erase(state.id);
+    auto note = notes_.find(state.id);
+    if (note != notes_.end()) {
+      report.value = note->second;
     } else {
-      LOG(ERROR) << "Zookeeper::Delete() returned " << res;
+      report.remove = true;
     }
+  } else {
+    manager_states_[state.id] = report.value;
+    notes_.erase(state.id);
+  }
+  Record(state.id, std::move(report));
+}
+
+void ZookeeperStateReporter::SetNote(const ServableId &id,
+                                     const string &note) {
+  Report report;
+  mutex_lock l(mu_);
+  if (!note.empty()) {
+    notes_[id] = note;
+    report.value = note;
+  } else {
+    if (notes_.erase(id) == 0) {
+      return;
+    }
+    auto state = manager_states_.find(id);
+    if (state != manager_states_.end()) {
+      report.value = state->second;
+    } else {
+      report.remove = true;
+    }
+  }
+  Record(id, std::move(report));
+}
+
+void ZookeeperStateReporter::Record(const ServableId &id, Report report) {
+  report.model_path = StrCat("current-models/", id.name);
+  string name = StrCat(report.model_path, "/", id.version);
+  LOG(INFO) << "Reporting servable state to Zookeeper: " << name << "="
+            << (report.remove ? "<removed>" : report.value);
+  if (report.remove) {
+    latest_.erase(name);
+  } else {
+    latest_[name] = report;
+  }
+  // Supersedes the state which is not written yet, if any.
+  pending_[name] = std::move(report);
+  changed_.notify_all();
+}
+
+void ZookeeperStateReporter::Run() {
+  mutex_lock l(mu_);
+  while (true) {
+    CheckSession();
+    if ((pending_.empty() || paused_) && !stop_) {
+      // Wakes up now and then to notice a new session.
+      WaitForMilliseconds(&l, &changed_, kSessionCheckIntervalMs);
+      continue;
+    }
+    if (pending_.empty()) {
+      return;
+    }
+    std::map<string, Report> reports;
+    reports.swap(pending_);
+    writing_ = true;
+    l.unlock();
+    Write(reports);
+    l.lock();
+    writing_ = false;
+    changed_.notify_all();
+  }
+}
+
+void ZookeeperStateReporter::CheckSession() {
+  session_checks_++;
+  changed_.notify_all();
+  const uint64 session_number = zookeeper_->SessionNumber();
+  if (session_number == session_number_) {
     return;
   }
+  LOG(WARNING) << "New Zookeeper session, writing states of "
+               << latest_.size() << " servables again";
+  session_number_ = session_number;
+  // `written_` is kept: some of its znodes may have been written in the new
+  // session already, e.g. by a batch which was in flight. The batch which
+  // sets the others fails, and they are created one by one.
+  for (const auto &entry : latest_) {
+    // Pending reports are the latest ones as well.
+    pending_.insert(entry);
+  }
+}
 
-  int res = zookeeper_->EnforcePath(prefix.c_str(), &ZOO_OPEN_ACL_UNSAFE);
-  if (res != ZOK && res != ZNODEEXISTS) {
-    LOG(ERROR) << "Unable to create node in Zookeeper, error code is " << res;
+void ZookeeperStateReporter::Write(const std::map<string, Report> &reports) {
+  std::map<string, Report> batch;
+  auto flush = [this, &batch]() {
+    if (!batch.empty() && !WriteMulti(batch)) {
+      for (const auto &entry : batch) {
+        WriteOne(entry.first, entry.second);
+      }
+    }
+    batch.clear();
+  };
+  for (const auto &entry : reports) {
+    const Report &report = entry.second;
+    if (report.remove) {
+      // Otherwise there is nothing to remove: e.g. the servable has reached
+      // kEnd before its first state was written.
+      if (written_.count(entry.first) == 0) {
+        continue;
+      }
+    } else if (!EnsureModelPath(report.model_path)) {
+      continue;
+    }
+    batch.insert(entry);
+    if (batch.size() >= kMaxOpsPerMulti) {
+      flush();
+    }
+  }
+  flush();
+}
+
+bool ZookeeperStateReporter::WriteMulti(
+    const std::map<string, Report> &reports) {
+  std::vector<Zookeeper::Op> ops;
+  ops.reserve(reports.size());
+  for (const auto &entry : reports) {
+    const char *path = entry.first.c_str();
+    const Report &report = entry.second;
+    if (report.remove) {
+      ops.push_back(Zookeeper::Op::Delete(path));
+    } else if (written_.count(entry.first) != 0) {
+      ops.push_back(Zookeeper::Op::Set(path, report.value));
+    } else {
+      ops.push_back(Zookeeper::Op::Create(path, report.value,
+                                          true /* ephemeral */,
+                                          &ZOO_OPEN_ACL_UNSAFE));
+    }
+  }
+  requests_++;
+  int res = zookeeper_->Multi(ops, nullptr);
+  if (res != ZOK) {
+    LOG(WARNING) << "Zookeeper::Multi() of " << ops.size()
+                 << " operations returned " << res
+                 << ", writing them one by one";
+    return false;
+  }
+  for (const auto &entry : reports) {
+    if (entry.second.remove) {
+      written_.erase(entry.first);
+    } else {
+      written_.insert(entry.first);
+    }
+  }
+  return true;
+}
+
+void ZookeeperStateReporter::WriteOne(const string &path,
+                                      const Report &report) {
+  const char *name = path.c_str();
+  if (report.remove) {
+    requests_++;
+    int res = zookeeper_->Delete(name);
+    if (res == ZOK || res == ZNONODE) {
+      written_.erase(path);
+    } else {
+      LOG(ERROR) << "Zookeeper::Delete() returned " << res;
+    }
     return;
   }
 
-  res = zookeeper_->Create(name.c_str(), value, true /* ephemeral */, &ZOO_OPEN_ACL_UNSAFE);
+  requests_++;
+  int res = zookeeper_->Create(name, report.value, true /* ephemeral */, &ZOO_OPEN_ACL_UNSAFE);
   if (res == ZOK) {
+    written_.insert(path);
     return;
   }
+  if (res == ZNONODE) {
+    // The model's znode was removed meanwhile, e.g. along with all models.
+    model_paths_.erase(report.model_path);
+    if (!EnsureModelPath(report.model_path)) {
+      return;
+    }
+    requests_++;
+    res = zookeeper_->Create(name, report.value, true /* ephemeral */, &ZOO_OPEN_ACL_UNSAFE);
+    if (res == ZOK) {
+      written_.insert(path);
+      return;
+    }
+  }
   if (res != ZNODEEXISTS) {
     LOG(ERROR) << "Zookeeper::Create() returned " << res;
     return;
   }
-  res = zookeeper_->Set(name.c_str(), value);
+  requests_++;
+  res = zookeeper_->Set(name, report.value);
   if (res != ZOK) {
     LOG(ERROR) << "Zookeeper::Set() returned " << res;
     return;
   }
+  written_.insert(path);
+}
+
+bool ZookeeperStateReporter::EnsureModelPath(const string &model_path) {
+  if (model_paths_.count(model_path) != 0) {
+    return true;
+  }
+  // Parents are created once per model, they are not in the batch because
+  // it fails as a whole if one of them exists.
+  requests_++;
+  int res = zookeeper_->EnforcePath(model_path.c_str(), &ZOO_OPEN_ACL_UNSAFE);
+  if (res != ZOK && res != ZNODEEXISTS) {
+    LOG(ERROR) << "Unable to create node in Zookeeper, error code is " << res;
+    return false;
+  }
+  model_paths_.insert(model_path);
+  return true;
 }
 
 }  // namespace cranberries
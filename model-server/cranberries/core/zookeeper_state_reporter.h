@@ -1,6 +1,16 @@
 #ifndef CRANBERRIES_ZOOKEEPER_STATE_REPORTER_H_
 #define CRANBERRIES_ZOOKEEPER_STATE_REPORTER_H_
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/core/servable_id.h"
 #include "tensorflow_serving/core/servable_state.h"
 #include "tensorflow_serving/util/event_bus.h"
 #include "zookeeper_cc/zookeeper_cc.h"
@@ -11,29 +21,126 @@ namespace cranberries {
 
 // Processes events coming from EventBus<ServableState> about
 // current state of servables and saves that information info
-// Zookeeper.
+// Zookeeper. Data of a servable's znode is its manager state, followed by
+// the error message if the state is not healthy, e.g.
+// "kLoading: <reason the load is deferred>".
 //
-// TODO(egor.suvorov): make it non-blocking, because EventBus<>'s
-// subscriber is assumed to be non-blocking.
+// The event bus callback only records the latest state of the servable, so
+// it never blocks loads and unloads on Zookeeper. States are written by the
+// reporter's own thread: whatever is recorded while it's busy is written by
+// the next batch, and only the latest state of each servable (e.g.
+// kAvailable, not kLoading before it) is written. A batch is sent as a
+// single zoo_multi of at most `kMaxOpsPerMulti` operations; if it fails
+// (e.g. because a znode unexpectedly exists), its states are written one by
+// one instead. If the model's znode has been removed meanwhile, it's created
+// again.
 //
-// TODO(egor.suvorov): make it handle Zookeeper disconnections
-// gracefully, right now it assumes connection is always up and
-// it's enough to react to changes only.
+// Components other than the manager may show a note instead of the
+// servable's state (see SetNote()), e.g. the reason a load is deferred.
+//
+// Znodes are ephemeral, so they are gone with the session which has created
+// them. Once Zookeeper::Reconnect() starts a new session (e.g. ZookeeperSource
+// does when the previous one has expired), the latest states of all servables
+// are written again. The writer checks for a new session every
+// `kSessionCheckIntervalMs`.
+//
+// TODO(egor.suvorov): retry writes which fail while Zookeeper is
+// disconnected, right now they are only logged and the state is written
+// with the next change of the servable or the next session.
 //
 // TODO(egor.suvorov): make it handle ephemeral znodes remaining from crashed
 // instance (they are not recreated and removed).
 class ZookeeperStateReporter {
  public:
-  ZookeeperStateReporter(zookeeper_cc::Zookeeper *zookeeper)
-    : zookeeper_(zookeeper) {}
-  ~ZookeeperStateReporter() {}
+  static const size_t kMaxOpsPerMulti = 100;
+  static const int64 kSessionCheckIntervalMs = 1000;
+
+  explicit ZookeeperStateReporter(zookeeper_cc::Zookeeper *zookeeper);
+  // States which are not written yet are written before it returns.
+  ~ZookeeperStateReporter();
 
   EventBus<ServableState>::Callback GetEventBusCallback();
 
+  // Shows `note` (e.g. "kDeferred: <reason>") as the servable's state until
+  // the manager reports a state other than kEnd, or until the note is
+  // cleared; if the manager reports kEnd meanwhile, the note is kept. An
+  // empty note clears it: the manager's state is shown again, or the znode
+  // is removed if the manager does not have the servable. Never blocks.
+  void SetNote(const ServableId &id, const string &note);
+
+  // Waits until all states recorded so far are written (or failed to),
+  // again if a new session has started since they were.
+  void Flush();
+
+  // Number of requests sent to Zookeeper so far.
+  uint64 requests() const { return requests_; }
+
  private:
+  friend class ZookeeperStateReporterTestPeer;
+
+  // Latest state of a servable's znode.
+  struct Report {
+    // Path of the model's znode, the parent.
+    string model_path;
+    // Data of the znode, ignored if `remove` is set.
+    string value;
+    bool remove = false;
+  };
+
   void ProcessEvent(const EventBus<ServableState>::EventAndTime &ev);
+  // Records the report of the servable's znode, superseding the one which is
+  // not written yet, if any.
+  void Record(const ServableId &id, Report report)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // While paused, states are only recorded and the writer waits, so that
+  // states recorded meanwhile are written together. Flush() should not be
+  // called while paused.
+  void SetPaused(bool paused);
+  void Run();
+  // If Zookeeper has started a new session, records the latest states of all
+  // servables again. Called by the writer thread.
+  void CheckSession() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Writes reports keyed by paths of their znodes.
+  void Write(const std::map<string, Report> &reports);
+  // Returns false if the batch has failed and nothing was written.
+  bool WriteMulti(const std::map<string, Report> &reports);
+  void WriteOne(const string &path, const Report &report);
+  // Creates the model's znode unless it's known to exist, returns false on
+  // failure.
+  bool EnsureModelPath(const string &model_path);
 
   zookeeper_cc::Zookeeper *zookeeper_;
+  std::atomic<uint64> requests_{0};
+
+  mutex mu_;
+  condition_variable changed_;
+  // Reports which are not written yet, keyed by paths of their znodes.
+  std::map<string, Report> pending_ GUARDED_BY(mu_);
+  // Latest reports of znodes which should exist, keyed by their paths.
+  std::map<string, Report> latest_ GUARDED_BY(mu_);
+  // Notes and states of servables the manager has (i.e. which have not
+  // reached kEnd), keyed by servable ids.
+  std::map<ServableId, string> notes_ GUARDED_BY(mu_);
+  std::map<ServableId, string> manager_states_ GUARDED_BY(mu_);
+  // Whether the writer is writing a batch.
+  bool writing_ GUARDED_BY(mu_) = false;
+  bool paused_ GUARDED_BY(mu_) = false;
+  bool stop_ GUARDED_BY(mu_) = false;
+  // Incremented by the writer each time it checks the session, lets Flush()
+  // wait for a check.
+  uint64 session_checks_ GUARDED_BY(mu_) = 0;
+
+  // Owned by the writer thread: the session whose states were recorded last,
+  // znodes of servables which were written by the reporter (only those are
+  // removed), and models whose znodes are known to exist.
+  uint64 session_number_;
+  std::set<string> written_;
+  std::set<string> model_paths_;
+
+  std::unique_ptr<Thread> writer_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ZookeeperStateReporter);
 };
 
 }  // namespace cranberries
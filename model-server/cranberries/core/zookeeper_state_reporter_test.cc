@@ -0,0 +1,274 @@
+#include "zookeeper_state_reporter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+
+using tensorflow::serving::EventBus;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::ServableState;
+using tensorflow::serving::cranberries::ZookeeperStateReporter;
+using zookeeper_cc::Zookeeper;
+
+namespace {
+
+const int kRecvTimeoutMs = 1000;
+
+using ManagerState = ServableState::ManagerState;
+
+}  // namespace
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+class ZookeeperStateReporterTestPeer {
+ public:
+  static void SetPaused(ZookeeperStateReporter *reporter, bool paused) {
+    reporter->SetPaused(paused);
+  }
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+using tensorflow::serving::cranberries::ZookeeperStateReporterTestPeer;
+
+class ZookeeperStateReporterTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() override {
+    char *hosts = getenv("ZOOKEEPER_TEST_HOSTS");
+    ASSERT_TRUE(hosts && strlen(hosts) > 0) << "ZOOKEEPER_TEST_HOSTS is unspecified";
+
+    // Construct random path inside Zookeeper to provide some tests isolation.
+    auto unit_test = ::testing::UnitTest::GetInstance();
+    const ::testing::TestInfo* const test_info =
+        unit_test->current_test_info();
+    std::stringstream bases;
+    bases << "/zookeeper-state-reporter-test"
+          << "/" << unit_test->random_seed()
+          << "/" << test_info->test_case_name()
+          << "/" << test_info->name();
+
+    // Disable most logging.
+    zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
+
+    zk_.reset(new Zookeeper(hosts, kRecvTimeoutMs, bases.str()));
+    ASSERT_TRUE(zk_->Init());
+    reporter_.reset(new ZookeeperStateReporter(zk_.get()));
+    callback_ = reporter_->GetEventBusCallback();
+  }
+
+  virtual void TearDown() override {
+    reporter_.reset();
+    zk_.reset();
+  }
+
+  void Report(const std::string &model, int version, ManagerState state,
+              const tensorflow::Status &health = tensorflow::Status::OK()) {
+    ServableState event;
+    event.id = ServableId{model, version};
+    event.manager_state = state;
+    event.health = health;
+    callback_({event, 0});
+  }
+
+  void SetPaused(bool paused) {
+    ZookeeperStateReporterTestPeer::SetPaused(reporter_.get(), paused);
+  }
+
+  // Data of the servable's znode, or "NONODE".
+  std::string Get(const std::string &model, int version) {
+    const std::string path =
+        "current-models/" + model + "/" + std::to_string(version);
+    std::string data;
+    if (zk_->Get(path.c_str(), &data, nullptr, nullptr) == ZNONODE) {
+      return "NONODE";
+    }
+    return data;
+  }
+
+  std::unique_ptr<Zookeeper> zk_;
+  std::unique_ptr<ZookeeperStateReporter> reporter_;
+  EventBus<ServableState>::Callback callback_;
+};
+
+TEST_F(ZookeeperStateReporterTest, WritesStates) {
+  Report("a", 1, ManagerState::kLoading,
+         tensorflow::errors::ResourceExhausted("Not enough memory"));
+  reporter_->Flush();
+  EXPECT_EQ("kLoading: Not enough memory", Get("a", 1));
+
+  Report("a", 1, ManagerState::kAvailable);
+  reporter_->Flush();
+  EXPECT_EQ("kAvailable", Get("a", 1));
+
+  Report("a", 1, ManagerState::kEnd);
+  reporter_->Flush();
+  EXPECT_EQ("NONODE", Get("a", 1));
+}
+
+TEST_F(ZookeeperStateReporterTest, ShowsNotes) {
+  // E.g. a deferred load, which the manager keeps retrying.
+  Report("a", 1, ManagerState::kLoading);
+  reporter_->SetNote({"a", 1}, "kLoading: Not enough memory");
+  reporter_->Flush();
+  EXPECT_EQ("kLoading: Not enough memory", Get("a", 1));
+  // The manager gives up, the note is kept.
+  Report("a", 1, ManagerState::kEnd,
+         tensorflow::errors::ResourceExhausted("Not enough memory"));
+  reporter_->Flush();
+  EXPECT_EQ("kLoading: Not enough memory", Get("a", 1));
+  reporter_->SetNote({"a", 1}, "kDeferred: Not enough memory");
+  reporter_->Flush();
+  EXPECT_EQ("kDeferred: Not enough memory", Get("a", 1));
+  // Loaded again later, the manager's states supersede the note.
+  Report("a", 1, ManagerState::kStart);
+  Report("a", 1, ManagerState::kLoading);
+  reporter_->Flush();
+  EXPECT_EQ("kLoading", Get("a", 1));
+  Report("a", 1, ManagerState::kEnd);
+  reporter_->Flush();
+  EXPECT_EQ("NONODE", Get("a", 1));
+
+  // Clearing the note shows the manager's state again.
+  Report("a", 2, ManagerState::kLoading);
+  reporter_->SetNote({"a", 2}, "kLoading: Not enough memory");
+  reporter_->SetNote({"a", 2}, "");
+  reporter_->Flush();
+  EXPECT_EQ("kLoading", Get("a", 2));
+
+  // A note of a servable the manager does not have is removed once cleared.
+  reporter_->SetNote({"b", 1}, "kNotLoaded");
+  reporter_->Flush();
+  EXPECT_EQ("kNotLoaded", Get("b", 1));
+  reporter_->SetNote({"b", 1}, "");
+  reporter_->Flush();
+  EXPECT_EQ("NONODE", Get("b", 1));
+  // Clearing a missing note does nothing.
+  const tensorflow::uint64 requests = reporter_->requests();
+  reporter_->SetNote({"b", 2}, "");
+  reporter_->Flush();
+  EXPECT_EQ(requests, reporter_->requests());
+}
+
+TEST_F(ZookeeperStateReporterTest, DropsSupersededStates) {
+  SetPaused(true);
+  Report("a", 1, ManagerState::kStart);
+  Report("a", 1, ManagerState::kLoading);
+  Report("a", 1, ManagerState::kAvailable);
+  // Reaches kEnd before its first state is written.
+  Report("a", 2, ManagerState::kStart);
+  Report("a", 2, ManagerState::kEnd);
+  SetPaused(false);
+  reporter_->Flush();
+
+  EXPECT_EQ("kAvailable", Get("a", 1));
+  EXPECT_EQ("NONODE", Get("a", 2));
+  // The model's znode and a batch of a single state.
+  EXPECT_EQ(2, reporter_->requests());
+}
+
+TEST_F(ZookeeperStateReporterTest, WritesInBatches) {
+  const int kNumVersions = 250;
+  SetPaused(true);
+  for (int version = 0; version < kNumVersions; version++) {
+    Report("a", version, ManagerState::kAvailable);
+  }
+  SetPaused(false);
+  reporter_->Flush();
+
+  std::vector<std::string> children;
+  ASSERT_EQ(ZOK, zk_->GetChildren("current-models/a", &children, nullptr));
+  EXPECT_EQ(kNumVersions, children.size());
+  EXPECT_EQ("kAvailable", Get("a", kNumVersions - 1));
+  // The model's znode and batches of 100, 100 and 50 states.
+  ASSERT_EQ(100, ZookeeperStateReporter::kMaxOpsPerMulti);
+  EXPECT_EQ(4, reporter_->requests());
+
+  // Updates and removals are batched as well.
+  SetPaused(true);
+  for (int version = 0; version < kNumVersions; version++) {
+    Report("a", version,
+           version % 2 == 0 ? ManagerState::kUnloading : ManagerState::kEnd);
+  }
+  SetPaused(false);
+  reporter_->Flush();
+  EXPECT_EQ("kUnloading", Get("a", 0));
+  EXPECT_EQ("NONODE", Get("a", 1));
+  EXPECT_EQ(7, reporter_->requests());
+}
+
+TEST_F(ZookeeperStateReporterTest, FallsBackToWritingOneByOne) {
+  // Left by someone else, so the batch which creates it fails.
+  ASSERT_EQ(ZOK, zk_->EnforcePath("current-models/a/1", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->Set("current-models/a/1", "stale"));
+
+  SetPaused(true);
+  Report("a", 1, ManagerState::kLoading);
+  Report("a", 2, ManagerState::kLoading);
+  SetPaused(false);
+  reporter_->Flush();
+
+  EXPECT_EQ("kLoading", Get("a", 1));
+  EXPECT_EQ("kLoading", Get("a", 2));
+  // The model's znode, the failed batch, creation and update of a/1 and
+  // creation of a/2.
+  EXPECT_EQ(5, reporter_->requests());
+
+  // Both are known to be written now, so they are batched again.
+  Report("a", 1, ManagerState::kEnd);
+  Report("a", 2, ManagerState::kEnd);
+  reporter_->Flush();
+  EXPECT_EQ("NONODE", Get("a", 1));
+  EXPECT_EQ("NONODE", Get("a", 2));
+}
+
+TEST_F(ZookeeperStateReporterTest, RecreatesRemovedModel) {
+  Report("a", 1, ManagerState::kLoading);
+  reporter_->Flush();
+  ASSERT_EQ("kLoading", Get("a", 1));
+
+  // E.g. an operator cleaning up current-models.
+  ASSERT_EQ(ZOK, zk_->Delete("current-models/a/1"));
+  ASSERT_EQ(ZOK, zk_->Delete("current-models/a"));
+
+  Report("a", 1, ManagerState::kAvailable);
+  reporter_->Flush();
+  EXPECT_EQ("kAvailable", Get("a", 1));
+}
+
+TEST_F(ZookeeperStateReporterTest, WritesStatesAgainInNewSession) {
+  Report("a", 1, ManagerState::kAvailable);
+  Report("a", 2, ManagerState::kLoading);
+  reporter_->SetNote({"b", 1}, "kNotLoaded");
+  Report("a", 3, ManagerState::kAvailable);
+  Report("a", 3, ManagerState::kEnd);
+  reporter_->Flush();
+  ASSERT_EQ("kAvailable", Get("a", 1));
+
+  // E.g. ZookeeperSource replacing an expired session. Ephemeral znodes of
+  // the previous one are gone with it.
+  ASSERT_TRUE(zk_->Reconnect());
+  ASSERT_EQ("NONODE", Get("a", 1));
+  reporter_->Flush();
+  EXPECT_EQ("kAvailable", Get("a", 1));
+  EXPECT_EQ("kLoading", Get("a", 2));
+  EXPECT_EQ("kNotLoaded", Get("b", 1));
+  EXPECT_EQ("NONODE", Get("a", 3));
+
+  // Written in the new session, so they are removed as usual.
+  Report("a", 1, ManagerState::kEnd);
+  reporter_->Flush();
+  EXPECT_EQ("NONODE", Get("a", 1));
+  // Without a new session, nothing is written again.
+  const tensorflow::uint64 requests = reporter_->requests();
+  reporter_->Flush();
+  EXPECT_EQ(requests, reporter_->requests());
+}
@@ -0,0 +1,9 @@
+#!/bin/bash
+
+set -u
+set -e
+set -o pipefail
+
+source zookeeper_cc/run_zookeeper_server.sh
+
+cranberries/core/zookeeper_state_reporter_test_impl "$@"
@@ -0,0 +1,93 @@
+#!/bin/bash
+
+# Compares throughput and tail latency of synchronous and asynchronous gRPC
+# servers: starts model_server in both modes with test model `a` and runs the
+# same closed and open loop loads against it. Extra arguments are passed to the
+# asynchronous server, e.g. --grpc_async_worker_threads=32. Loads are set by
+# QPS, CONCURRENCY, DURATION_SECONDS and ASYNC_COMPLETION_QUEUES environment
+# variables.
+#
+# Usage: bazel run -c opt //cranberries/load_generator:compare_servers
+
+set -u
+set -e
+set -o pipefail
+
+QPS="${QPS:-5000}"
+CONCURRENCY="${CONCURRENCY:-64}"
+DURATION_SECONDS="${DURATION_SECONDS:-30}"
+ASYNC_COMPLETION_QUEUES="${ASYNC_COMPLETION_QUEUES:-4}"
+
+MODEL_SERVER="cranberries/model_server/model_server"
+LOAD_GENERATOR="cranberries/load_generator/load_generator"
+
+MODELS_BASE=$(mktemp -d)
+tar xf integration_tests/test_models/test_models.tar -C "$MODELS_BASE"
+RESULTS=$(mktemp -d)
+
+source zookeeper_cc/run_zookeeper_server.sh
+ZOOKEEPER_BASE="/cranberries/servers/benchmark"
+
+function zk_create() {
+  docker exec "$ZOOKEEPER_TEST_DOCKER_CONTAINER_ID" \
+    zkCli.sh -server localhost:2181 create "$1" "$2" >/dev/null 2>&1
+}
+
+for NODE in /cranberries /cranberries/servers "$ZOOKEEPER_BASE" \
+    "$ZOOKEEPER_BASE/aspired-models" "$ZOOKEEPER_BASE/aspired-models/a"; do
+  zk_create "$NODE" ""
+done
+zk_create "$ZOOKEEPER_BASE/aspired-models/a/1" "$MODELS_BASE/models/a/1"
+
+MODEL_SERVER_PID=""
+function stop_model_server() {
+  if [[ -n "$MODEL_SERVER_PID" ]]; then
+    kill "$MODEL_SERVER_PID" && wait "$MODEL_SERVER_PID" || true
+    MODEL_SERVER_PID=""
+  fi
+}
+atexit stop_model_server
+
+function model_available() {
+  docker exec "$ZOOKEEPER_TEST_DOCKER_CONTAINER_ID" \
+    zkCli.sh -server localhost:2181 get "$ZOOKEEPER_BASE/current-models/a/1" \
+    2>/dev/null | grep -q '^kAvailable$'
+}
+
+# Usage: run_loads MODE [MODEL_SERVER_ARG ...]
+function run_loads() {
+  local MODE="$1"
+  echo -n "Starting $MODE model_server..."
+  "$MODEL_SERVER" --zookeeper_hosts="$ZOOKEEPER_TEST_HOSTS" \
+    --zookeeper_base="$ZOOKEEPER_BASE" "${@:2}" >"$RESULTS/$MODE.log" 2>&1 &
+  MODEL_SERVER_PID="$!"
+  wait_cmd_with_timeout 30 model_available
+  echo " OK"
+
+  "$LOAD_GENERATOR" --model=a --concurrency="$CONCURRENCY" \
+    --duration_seconds="$DURATION_SECONDS" \
+    --output_file="$RESULTS/$MODE-closed.json"
+  "$LOAD_GENERATOR" --model=a --qps="$QPS" --concurrency=1000 \
+    --duration_seconds="$DURATION_SECONDS" \
+    --output_file="$RESULTS/$MODE-open.json"
+  stop_model_server
+}
+
+run_loads sync
+run_loads async --grpc_async_completion_queues="$ASYNC_COMPLETION_QUEUES" "$@"
+
+printf "%-8s %-24s %14s %12s\n" server load throughput_qps p99_micros
+for MODE in sync async; do
+  for LOOP in closed open; do
+    if [[ "$LOOP" == closed ]]; then
+      LOAD="closed, $CONCURRENCY outstanding"
+    else
+      LOAD="open, $QPS qps"
+    fi
+    python -c '
+import json, sys
+result = json.load(open(sys.argv[1]))
+print("%14.0f %12d" % (result["throughput_qps"], result["latency_micros"]["p99"]))
+' "$RESULTS/$MODE-$LOOP.json" | xargs printf "%-8s %-24s %14s %12s\n" "$MODE" "$LOAD"
+  done
+done
@@ -0,0 +1,106 @@
+#include "latency_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/lib/strings/stringprintf.h"
+
+using tensorflow::strings::Printf;
+using tensorflow::strings::StrAppend;
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+void LatencyStats::RecordSuccess(int64 latency_micros) {
+  if (!latencies_micros_.empty() &&
+      latencies_micros_.back() > latency_micros) {
+    sorted_ = false;
+  }
+  latencies_micros_.push_back(latency_micros);
+}
+
+void LatencyStats::RecordError(int code) { errors_by_code_[code]++; }
+
+void LatencyStats::RecordDropped() { num_dropped_++; }
+
+void LatencyStats::Merge(const LatencyStats& other) {
+  latencies_micros_.insert(latencies_micros_.end(),
+                           other.latencies_micros_.begin(),
+                           other.latencies_micros_.end());
+  sorted_ = false;
+  for (const auto& entry : other.errors_by_code_) {
+    errors_by_code_[entry.first] += entry.second;
+  }
+  num_dropped_ += other.num_dropped_;
+}
+
+int64 LatencyStats::num_errors() const {
+  int64 result = 0;
+  for (const auto& entry : errors_by_code_) {
+    result += entry.second;
+  }
+  return result;
+}
+
+void LatencyStats::Sort() {
+  if (!sorted_) {
+    std::sort(latencies_micros_.begin(), latencies_micros_.end());
+    sorted_ = true;
+  }
+}
+
+int64 LatencyStats::Percentile(double percentile) {
+  if (latencies_micros_.empty()) {
+    return 0;
+  }
+  Sort();
+  // Nearest-rank method; the epsilon compensates rounding errors, e.g.
+  // 99.9 / 100 * 1000 is slightly above 999.
+  const int64 size = latencies_micros_.size();
+  int64 rank = static_cast<int64>(std::ceil(percentile / 100 * size - 1e-9));
+  rank = std::min(std::max<int64>(rank, 1), size);
+  return latencies_micros_[rank - 1];
+}
+
+string LatencyStats::ToJson(double duration_seconds) {
+  Sort();
+  double mean_micros = 0;
+  for (int64 latency : latencies_micros_) {
+    mean_micros += latency;
+  }
+  if (!latencies_micros_.empty()) {
+    mean_micros /= latencies_micros_.size();
+  }
+  const double throughput =
+      duration_seconds > 0 ? num_successes() / duration_seconds : 0;
+
+  string json = "{";
+  StrAppend(&json, "\"successes\": ", num_successes(), ", ");
+  StrAppend(&json, "\"errors\": ", num_errors(), ", ");
+  StrAppend(&json, "\"dropped\": ", num_dropped(), ", ");
+  StrAppend(&json, "\"throughput_qps\": ", Printf("%.3f", throughput), ", ");
+  StrAppend(&json, "\"latency_micros\": {");
+  StrAppend(&json, "\"min\": ", Percentile(0), ", ");
+  StrAppend(&json, "\"mean\": ", Printf("%.1f", mean_micros), ", ");
+  StrAppend(&json, "\"p50\": ", Percentile(50), ", ");
+  StrAppend(&json, "\"p90\": ", Percentile(90), ", ");
+  StrAppend(&json, "\"p99\": ", Percentile(99), ", ");
+  StrAppend(&json, "\"p999\": ", Percentile(99.9), ", ");
+  StrAppend(&json, "\"max\": ", Percentile(100), "}, ");
+  StrAppend(&json, "\"errors_by_code\": {");
+  bool first = true;
+  for (const auto& entry : errors_by_code_) {
+    StrAppend(&json, first ? "" : ", ", "\"",
+              error::Code_Name(static_cast<error::Code>(entry.first)),
+              "\": ", entry.second);
+    first = false;
+  }
+  StrAppend(&json, "}}");
+  return json;
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
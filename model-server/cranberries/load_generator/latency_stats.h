@@ -0,0 +1,52 @@
+#ifndef CRANBERRIES_LATENCY_STATS_H_
+#define CRANBERRIES_LATENCY_STATS_H_
+
+#include <map>
+#include <vector>
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Outcomes of requests sent by the load generator during the measurement
+// phase. Not thread-safe: every client thread has its own instance, which are
+// merged at the end.
+class LatencyStats {
+ public:
+  LatencyStats() {}
+
+  void RecordSuccess(int64 latency_micros);
+  // `code` is gRPC's status code, which matches TensorFlow's ones.
+  void RecordError(int code);
+  // Request was not sent because too many requests were outstanding.
+  void RecordDropped();
+
+  void Merge(const LatencyStats& other);
+
+  int64 num_successes() const { return latencies_micros_.size(); }
+  int64 num_errors() const;
+  int64 num_dropped() const { return num_dropped_; }
+
+  // Returns the smallest latency of successful requests such that at least
+  // `percentile` percent of them were not slower, zero if there are none.
+  int64 Percentile(double percentile);
+
+  // Returns results as a JSON object; throughput is number of successful
+  // requests per second of `duration_seconds`.
+  string ToJson(double duration_seconds);
+
+ private:
+  void Sort();
+
+  std::vector<int64> latencies_micros_;
+  bool sorted_ = true;
+  std::map<int, int64> errors_by_code_;
+  int64 num_dropped_ = 0;
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_LATENCY_STATS_H_
@@ -0,0 +1,60 @@
+#include "latency_stats.h"
+
+#include <string>
+#include <gtest/gtest.h>
+
+using tensorflow::serving::cranberries::LatencyStats;
+
+TEST(LatencyStatsTest, ReturnsZeroPercentilesWithoutRequests) {
+  LatencyStats stats;
+  EXPECT_EQ(0, stats.Percentile(50));
+  EXPECT_EQ(0, stats.Percentile(100));
+}
+
+TEST(LatencyStatsTest, ComputesNearestRankPercentiles) {
+  LatencyStats stats;
+  for (int i = 1000; i >= 1; i--) {
+    stats.RecordSuccess(i);
+  }
+  EXPECT_EQ(1000, stats.num_successes());
+  EXPECT_EQ(1, stats.Percentile(0));
+  EXPECT_EQ(500, stats.Percentile(50));
+  EXPECT_EQ(900, stats.Percentile(90));
+  EXPECT_EQ(990, stats.Percentile(99));
+  EXPECT_EQ(999, stats.Percentile(99.9));
+  EXPECT_EQ(1000, stats.Percentile(100));
+}
+
+TEST(LatencyStatsTest, MergesStats) {
+  LatencyStats first, second;
+  first.RecordSuccess(30);
+  first.RecordError(4);
+  second.RecordSuccess(10);
+  second.RecordSuccess(20);
+  second.RecordError(4);
+  second.RecordError(8);
+  second.RecordDropped();
+
+  first.Merge(second);
+  EXPECT_EQ(3, first.num_successes());
+  EXPECT_EQ(3, first.num_errors());
+  EXPECT_EQ(1, first.num_dropped());
+  EXPECT_EQ(10, first.Percentile(0));
+  EXPECT_EQ(20, first.Percentile(50));
+}
+
+TEST(LatencyStatsTest, WritesJson) {
+  LatencyStats stats;
+  stats.RecordSuccess(100);
+  stats.RecordSuccess(300);
+  stats.RecordError(4);
+
+  const std::string json = stats.ToJson(2);
+  EXPECT_EQ(
+      "{\"successes\": 2, \"errors\": 1, \"dropped\": 0, "
+      "\"throughput_qps\": 1.000, \"latency_micros\": {\"min\": 100, "
+      "\"mean\": 200.0, \"p50\": 100, \"p90\": 300, \"p99\": 300, "
+      "\"p999\": 300, \"max\": 300}, "
+      "\"errors_by_code\": {\"DEADLINE_EXCEEDED\": 1}}",
+      json);
+}
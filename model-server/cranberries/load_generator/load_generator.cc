@@ -0,0 +1,378 @@
+// Sends Predict requests to a model server and reports latency percentiles and
+// throughput as JSON.
+//
+// Two modes are supported:
+// * Closed loop (default): every client thread keeps `--concurrency` requests
+//   (split between threads) outstanding, sending a new one as soon as one is
+//   finished. Measures the maximal throughput.
+// * Open loop (`--qps` > 0): requests are sent at a fixed rate regardless of
+//   responses, up to `--concurrency` outstanding requests; requests which do
+//   not fit are dropped and counted. Latency is measured from the time a
+//   request was supposed to be sent, so a stalled client or server does not
+//   hide slow requests.
+//
+// Requests sent during the first `--warmup_seconds` are not measured.
+//
+// Example (model `a` from //integration_tests/test_models):
+//   bazel run -c opt //cranberries/load_generator -- --server=localhost:8500 \
+//       --model=a --qps=5000 --duration_seconds=30
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "grpc++/channel.h"
+#include "grpc++/client_context.h"
+#include "grpc++/completion_queue.h"
+#include "grpc++/create_channel.h"
+#include "grpc++/security/credentials.h"
+#include "grpc++/support/async_unary_call.h"
+#include "grpc++/support/channel_arguments.h"
+#include "grpc++/support/status.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/protobuf.h"
+#include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "cranberries/load_generator/latency_stats.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+namespace {
+
+struct Options {
+  string server;
+  int concurrency = 0;
+  double qps = 0;
+  int client_threads = 0;
+  int64 warmup_micros = 0;
+  int64 duration_micros = 0;
+  int64 timeout_micros = 0;
+};
+
+// Builds a request for models from //integration_tests/test_models, which
+// take a batch of int32 values as `inp` input.
+PredictRequest MakeTestModelRequest(const string& model, int64 version,
+                                    const string& signature_name,
+                                    int batch_size, int input_value) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name(model);
+  if (version > 0) {
+    request.mutable_model_spec()->mutable_version()->set_value(version);
+  }
+  if (!signature_name.empty()) {
+    request.mutable_model_spec()->set_signature_name(signature_name);
+  }
+  TensorProto& input = (*request.mutable_inputs())["inp"];
+  input.set_dtype(DT_INT32);
+  input.mutable_tensor_shape()->add_dim()->set_size(batch_size);
+  for (int i = 0; i < batch_size; i++) {
+    input.add_int_val(input_value);
+  }
+  return request;
+}
+
+Status ReadRequestTemplate(const string& path, PredictRequest* request) {
+  string contents;
+  TF_RETURN_IF_ERROR(ReadFileToString(Env::Default(), path, &contents));
+  if (!protobuf::TextFormat::ParseFromString(contents, request)) {
+    return errors::InvalidArgument("Unable to parse PredictRequest from ",
+                                   path);
+  }
+  return Status::OK();
+}
+
+std::chrono::system_clock::time_point ToTimePoint(int64 micros) {
+  return std::chrono::system_clock::time_point(
+      std::chrono::microseconds(micros));
+}
+
+// Sends requests over its own channel and completion queue from a single
+// thread.
+class Worker {
+ public:
+  // `concurrency` and `qps` are this worker's shares. Warmup starts at
+  // `start_micros`.
+  Worker(const Options& options, int index, int concurrency, double qps,
+         const PredictRequest& request, int64 start_micros)
+      : options_(options),
+        concurrency_(concurrency),
+        qps_(qps),
+        request_(request),
+        start_micros_(start_micros),
+        measure_start_micros_(start_micros + options.warmup_micros),
+        end_micros_(measure_start_micros_ + options.duration_micros) {
+    // Channels with equal arguments may share a TCP connection, make them
+    // distinct so the load is spread over several connections.
+    grpc::ChannelArguments args;
+    args.SetInt("cranberries.load_generator.channel", index);
+    stub_ = PredictionService::NewStub(grpc::CreateCustomChannel(
+        options.server, grpc::InsecureChannelCredentials(), args));
+  }
+
+  void Run() {
+    if (qps_ > 0) {
+      RunOpenLoop();
+    } else {
+      RunClosedLoop();
+    }
+    cq_.Shutdown();
+    void* tag;
+    bool ok;
+    while (cq_.Next(&tag, &ok)) {
+    }
+  }
+
+  const LatencyStats& stats() const { return stats_; }
+
+ private:
+  struct Call {
+    grpc::ClientContext context;
+    PredictResponse response;
+    grpc::Status status;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<PredictResponse>> reader;
+    // Time the call was supposed to start, latency is measured from it.
+    int64 start_micros;
+  };
+
+  void RunClosedLoop() {
+    for (int i = 0; i < concurrency_; i++) {
+      StartCall(Env::Default()->NowMicros());
+    }
+    while (outstanding_ > 0) {
+      void* tag;
+      bool ok;
+      if (!cq_.Next(&tag, &ok)) {
+        break;
+      }
+      const int64 now_micros = FinishCall(static_cast<Call*>(tag));
+      if (now_micros < end_micros_) {
+        StartCall(now_micros);
+      }
+    }
+  }
+
+  void RunOpenLoop() {
+    const double interval_micros = 1e6 / qps_;
+    double next_send_micros = start_micros_;
+    while (true) {
+      const int64 now_micros = Env::Default()->NowMicros();
+      while (next_send_micros <= now_micros && next_send_micros < end_micros_) {
+        const int64 send_micros = static_cast<int64>(next_send_micros);
+        if (outstanding_ < concurrency_) {
+          StartCall(send_micros);
+        } else if (IsMeasured(send_micros)) {
+          stats_.RecordDropped();
+        }
+        next_send_micros += interval_micros;
+      }
+      const bool sending = next_send_micros < end_micros_;
+      if (!sending && outstanding_ == 0) {
+        break;
+      }
+      // Without anything to send, wait for responses up to the timeout.
+      const int64 wait_until_micros =
+          sending ? static_cast<int64>(next_send_micros)
+                  : now_micros + options_.timeout_micros;
+      void* tag;
+      bool ok;
+      const grpc::CompletionQueue::NextStatus status =
+          cq_.AsyncNext(&tag, &ok, ToTimePoint(wait_until_micros));
+      if (status == grpc::CompletionQueue::GOT_EVENT) {
+        FinishCall(static_cast<Call*>(tag));
+      } else if (status == grpc::CompletionQueue::SHUTDOWN) {
+        break;
+      }
+    }
+  }
+
+  bool IsMeasured(int64 start_micros) const {
+    return start_micros >= measure_start_micros_ &&
+           start_micros < end_micros_;
+  }
+
+  void StartCall(int64 start_micros) {
+    Call* call = new Call;
+    call->start_micros = start_micros;
+    call->context.set_deadline(
+        ToTimePoint(Env::Default()->NowMicros() + options_.timeout_micros));
+    call->reader = stub_->AsyncPredict(&call->context, request_, &cq_);
+    call->reader->Finish(&call->response, &call->status, call);
+    outstanding_++;
+  }
+
+  // Returns the current time.
+  int64 FinishCall(Call* call) {
+    std::unique_ptr<Call> call_holder(call);
+    outstanding_--;
+    const int64 now_micros = Env::Default()->NowMicros();
+    if (IsMeasured(call->start_micros)) {
+      if (call->status.ok()) {
+        stats_.RecordSuccess(now_micros - call->start_micros);
+      } else {
+        stats_.RecordError(call->status.error_code());
+      }
+    }
+    return now_micros;
+  }
+
+  const Options& options_;
+  const int concurrency_;
+  const double qps_;
+  const PredictRequest& request_;
+  const int64 start_micros_;
+  const int64 measure_start_micros_;
+  const int64 end_micros_;
+
+  std::unique_ptr<PredictionService::Stub> stub_;
+  grpc::CompletionQueue cq_;
+  int outstanding_ = 0;
+  LatencyStats stats_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(Worker);
+};
+
+// Splits `total` between `parts` as evenly as possible.
+int GetShare(int total, int parts, int index) {
+  return total / parts + (index < total % parts ? 1 : 0);
+}
+
+string RunLoad(const Options& options, const PredictRequest& request) {
+  // Let all workers connect before the warmup starts.
+  const int64 start_micros = Env::Default()->NowMicros() + 100000;
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int i = 0; i < options.client_threads; i++) {
+    workers.emplace_back(new Worker(
+        options, i, GetShare(options.concurrency, options.client_threads, i),
+        options.qps / options.client_threads, request, start_micros));
+  }
+  {
+    std::vector<std::unique_ptr<Thread>> threads;
+    for (int i = 0; i < options.client_threads; i++) {
+      Worker* worker = workers[i].get();
+      threads.emplace_back(Env::Default()->StartThread(
+          ThreadOptions(), strings::StrCat("load_generator_", i),
+          [worker]() { worker->Run(); }));
+    }
+    // Destructors of threads join them.
+  }
+  LatencyStats stats;
+  for (const auto& worker : workers) {
+    stats.Merge(worker->stats());
+  }
+  return stats.ToJson(options.duration_micros / 1e6);
+}
+
+}  // namespace
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  using tensorflow::serving::PredictRequest;
+  using tensorflow::serving::cranberries::MakeTestModelRequest;
+  using tensorflow::serving::cranberries::Options;
+  using tensorflow::serving::cranberries::ReadRequestTemplate;
+  using tensorflow::serving::cranberries::RunLoad;
+
+  tensorflow::string server = "localhost:8500";
+  tensorflow::string model = "a";
+  tensorflow::int64 version = 0;
+  tensorflow::string signature_name;
+  tensorflow::int32 batch_size = 1;
+  tensorflow::int32 input_value = 6;
+  tensorflow::string request_file;
+  tensorflow::int32 concurrency = 16;
+  tensorflow::int32 qps = 0;
+  tensorflow::int32 client_threads = 1;
+  tensorflow::int32 warmup_seconds = 5;
+  tensorflow::int32 duration_seconds = 30;
+  tensorflow::int32 timeout_ms = 10000;
+  tensorflow::string output_file;
+  std::vector<tensorflow::Flag> flag_list = {
+      tensorflow::Flag("server", &server,
+                       "PredictionService in 'host:port' format"),
+      tensorflow::Flag("model", &model, "name of the model"),
+      tensorflow::Flag("version", &version,
+                       "version of the model, the latest one if zero"),
+      tensorflow::Flag("signature_name", &signature_name,
+                       "signature, the default one if empty"),
+      tensorflow::Flag("batch_size", &batch_size,
+                       "number of values in `inp` input of the request"),
+      tensorflow::Flag("input_value", &input_value,
+                       "value of every element of `inp` input"),
+      tensorflow::Flag("request_file", &request_file,
+                       "PredictRequest in text format to send instead of the "
+                       "one for test models; overrides --model, --version, "
+                       "--signature_name, --batch_size and --input_value"),
+      tensorflow::Flag("concurrency", &concurrency,
+                       "number of outstanding requests in closed loop mode, "
+                       "maximal number of outstanding requests in open loop "
+                       "mode"),
+      tensorflow::Flag("qps", &qps,
+                       "if positive, send requests at this rate (open loop "
+                       "mode)"),
+      tensorflow::Flag("client_threads", &client_threads,
+                       "number of threads sending requests, each one has its "
+                       "own connection"),
+      tensorflow::Flag("warmup_seconds", &warmup_seconds,
+                       "duration of warmup, which is not measured"),
+      tensorflow::Flag("duration_seconds", &duration_seconds,
+                       "duration of measurement"),
+      tensorflow::Flag("timeout_ms", &timeout_ms, "deadline of requests"),
+      tensorflow::Flag("output_file", &output_file,
+                       "if not empty, results are also written here")};
+  tensorflow::string usage = tensorflow::Flags::Usage(argv[0], flag_list);
+  const bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
+  if (!parse_result || server.empty() || batch_size <= 0 ||
+      concurrency <= 0 || qps < 0 || client_threads <= 0 ||
+      client_threads > concurrency || warmup_seconds < 0 ||
+      duration_seconds <= 0 || timeout_ms <= 0) {
+    std::cout << usage;
+    return -1;
+  }
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+  if (argc != 1) {
+    std::cout << "unknown argument: " << argv[1] << "\n" << usage;
+    return -1;
+  }
+
+  PredictRequest request;
+  if (request_file.empty()) {
+    request = MakeTestModelRequest(model, version, signature_name, batch_size,
+                                   input_value);
+  } else {
+    TF_CHECK_OK(ReadRequestTemplate(request_file, &request));
+  }
+
+  Options options;
+  options.server = server;
+  options.concurrency = concurrency;
+  options.qps = qps;
+  options.client_threads = client_threads;
+  options.warmup_micros = warmup_seconds * tensorflow::int64{1000000};
+  options.duration_micros = duration_seconds * tensorflow::int64{1000000};
+  options.timeout_micros = timeout_ms * tensorflow::int64{1000};
+  const tensorflow::string results = RunLoad(options, request);
+
+  const tensorflow::string json = tensorflow::strings::StrCat(
+      "{\"server\": \"", server, "\", \"model\": \"",
+      request.model_spec().name(), "\", \"mode\": \"",
+      qps > 0 ? "open_loop" : "closed_loop", "\", \"target_qps\": ", qps,
+      ", \"concurrency\": ", concurrency, ", \"client_threads\": ",
+      client_threads, ", \"warmup_seconds\": ", warmup_seconds,
+      ", \"duration_seconds\": ", duration_seconds, ", \"results\": ", results,
+      "}\n");
+  std::cout << json;
+  if (!output_file.empty()) {
+    TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(),
+                                              output_file, json));
+  }
+  return 0;
+}
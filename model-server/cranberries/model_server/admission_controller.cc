@@ -0,0 +1,220 @@
+#include "admission_controller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+struct AdmissionController::ModelState {
+  explicit ModelState(const string& name) : name(name) {}
+
+  const string name;
+  // Number of Ref()s, guarded by AdmissionController::mu_.
+  int refs = 0;
+
+  mutex mu;
+  condition_variable slot_freed;
+  int running GUARDED_BY(mu) = 0;
+  int queued GUARDED_BY(mu) = 0;
+  // Ring buffer of recent latencies and times they were recorded at.
+  std::vector<std::pair<int64, int64>> latencies GUARDED_BY(mu);
+  int next_latency GUARDED_BY(mu) = 0;
+  // Median of `latencies`, valid until the oldest of them expires.
+  int64 median_latency_micros GUARDED_BY(mu) = 0;
+  int64 median_expires_micros GUARDED_BY(mu) = kint64max;
+};
+
+AdmissionController::Ticket::Ticket(AdmissionController* controller,
+                                    ModelState* state)
+  : controller_(controller),
+    state_(state),
+    start_micros_(controller->env_->NowMicros()) {}
+
+AdmissionController::Ticket::~Ticket() {
+  controller_->Release(state_, succeeded_ ? controller_->env_->NowMicros() -
+                                                start_micros_
+                                          : -1);
+  controller_->Unref(state_);
+}
+
+AdmissionController::AdmissionController(const Options& options, Env* env)
+  : options_(options), env_(env) {
+  CHECK_GT(options_.latency_window, 0);
+}
+
+AdmissionController::~AdmissionController() {}
+
+Status AdmissionController::Admit(const string& model_name,
+                                  int64 deadline_micros,
+                                  const std::function<bool()>& is_cancelled,
+                                  std::unique_ptr<Ticket>* ticket) {
+  ModelState* state = Ref(model_name);
+  Status status;
+  {
+    mutex_lock l(state->mu);
+    bool queued = false;
+    while (true) {
+      const int64 remaining_micros = deadline_micros - env_->NowMicros();
+      const int64 median_latency_micros = GetMedianLatencyLocked(state);
+      if (remaining_micros < median_latency_micros) {
+        status = errors::ResourceExhausted(
+            "Deadline is too short, the model's median latency is ",
+            median_latency_micros, " us");
+        break;
+      }
+      if (options_.max_running_per_model <= 0 ||
+          state->running < options_.max_running_per_model) {
+        state->running++;
+        break;
+      }
+      if (!queued) {
+        if (state->queued >= options_.max_queued_per_model) {
+          status = errors::ResourceExhausted("Too many requests to model ",
+                                             model_name);
+          break;
+        }
+        state->queued++;
+        queued = true;
+      }
+      if (is_cancelled && is_cancelled()) {
+        status = errors::Cancelled("Client is gone");
+        break;
+      }
+      const int64 wait_micros =
+          std::min(options_.cancellation_check_interval_micros,
+                   remaining_micros - median_latency_micros);
+      state->slot_freed.wait_for(l, std::chrono::microseconds(wait_micros));
+    }
+    if (queued) {
+      state->queued--;
+    }
+  }
+  if (!status.ok()) {
+    Unref(state);
+    mutex_lock l(mu_);
+    num_rejected_++;
+    return status;
+  }
+  ticket->reset(new Ticket(this, state));
+  return Status::OK();
+}
+
+int64 AdmissionController::GetMedianLatencyMicros(const string& model_name) {
+  ModelState* state = Ref(model_name);
+  int64 median_latency_micros;
+  {
+    mutex_lock l(state->mu);
+    median_latency_micros = GetMedianLatencyLocked(state);
+  }
+  Unref(state);
+  return median_latency_micros;
+}
+
+void AdmissionController::RecordLatency(const string& model_name,
+                                        int64 latency_micros) {
+  ModelState* state = Ref(model_name);
+  {
+    mutex_lock l(state->mu);
+    RecordLatencyLocked(state, latency_micros);
+  }
+  Unref(state);
+}
+
+int64 AdmissionController::num_rejected() const {
+  mutex_lock l(mu_);
+  return num_rejected_;
+}
+
+size_t AdmissionController::num_model_states() const {
+  mutex_lock l(mu_);
+  return models_.size();
+}
+
+AdmissionController::ModelState* AdmissionController::Ref(
+    const string& model_name) {
+  mutex_lock l(mu_);
+  std::unique_ptr<ModelState>& state = models_[model_name];
+  if (!state) {
+    state.reset(new ModelState(model_name));
+  }
+  state->refs++;
+  return state.get();
+}
+
+void AdmissionController::Unref(ModelState* state) {
+  mutex_lock l(mu_);
+  if (--state->refs > 0) {
+    return;
+  }
+  {
+    // Nobody else can reach the state without `mu_`.
+    mutex_lock state_lock(state->mu);
+    GetMedianLatencyLocked(state);
+    if (state->median_expires_micros != kint64max) {
+      // Some latencies have not expired yet.
+      return;
+    }
+  }
+  models_.erase(state->name);
+}
+
+void AdmissionController::Release(ModelState* state, int64 latency_micros) {
+  mutex_lock l(state->mu);
+  state->running--;
+  if (latency_micros >= 0) {
+    RecordLatencyLocked(state, latency_micros);
+  }
+  // Waiters re-check their deadlines as well, so any of them may give up
+  // instead of taking the slot.
+  state->slot_freed.notify_all();
+}
+
+void AdmissionController::RecordLatencyLocked(ModelState* state,
+                                              int64 latency_micros) {
+  const std::pair<int64, int64> latency(latency_micros, env_->NowMicros());
+  if (state->latencies.size() < options_.latency_window) {
+    state->latencies.push_back(latency);
+  } else {
+    state->latencies[state->next_latency] = latency;
+    state->next_latency = (state->next_latency + 1) % options_.latency_window;
+  }
+  // Recomputed by the next GetMedianLatencyLocked().
+  state->median_expires_micros = 0;
+}
+
+int64 AdmissionController::GetMedianLatencyLocked(ModelState* state) {
+  const int64 now_micros = env_->NowMicros();
+  if (now_micros < state->median_expires_micros) {
+    return state->median_latency_micros;
+  }
+  const int64 min_recorded_micros =
+      now_micros - options_.latency_max_age_micros;
+  std::vector<int64> sorted;
+  sorted.reserve(state->latencies.size());
+  state->median_expires_micros = kint64max;
+  for (const auto& latency : state->latencies) {
+    if (latency.second >= min_recorded_micros) {
+      sorted.push_back(latency.first);
+      state->median_expires_micros =
+          std::min(state->median_expires_micros,
+                   latency.second + options_.latency_max_age_micros + 1);
+    }
+  }
+  if (sorted.empty()) {
+    state->median_latency_micros = 0;
+    return 0;
+  }
+  auto median = sorted.begin() + sorted.size() / 2;
+  std::nth_element(sorted.begin(), median, sorted.end());
+  state->median_latency_micros = *median;
+  return *median;
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,124 @@
+#ifndef CRANBERRIES_ADMISSION_CONTROLLER_H_
+#define CRANBERRIES_ADMISSION_CONTROLLER_H_
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Decides whether a request to a model should run, so an overloaded server
+// sheds load quickly instead of running requests nobody waits for:
+// 1. Requests whose remaining deadline is shorter than the model's median
+//    latency (over recent successful requests) are rejected. Latencies expire
+//    after `latency_max_age_micros`, so a model which has become slow and
+//    gets no requests through is not rejected forever.
+// 2. Number of concurrently running requests per model may be limited. Others
+//    wait in a bounded queue, which rejects requests when it's full.
+// 3. Queued requests are dropped when their deadline becomes too short or
+//    their client is gone.
+// Rejections are reported as RESOURCE_EXHAUSTED.
+class AdmissionController {
+ public:
+  struct Options {
+    // Maximal number of concurrently running requests per model, zero means
+    // no limit (and no queueing). With batching it should be at least the
+    // batch size.
+    int max_running_per_model = 32;
+    // Maximal number of requests waiting to run per model.
+    int max_queued_per_model = 64;
+    // Number of recent latencies used to estimate the median.
+    int latency_window = 100;
+    // Latencies older than that are forgotten.
+    int64 latency_max_age_micros = 10 * 1000 * 1000;
+    // How often queued requests check whether their client is gone.
+    int64 cancellation_check_interval_micros = 10000;
+  };
+
+  struct ModelState;
+
+  // Admitted request, which occupies a slot of the model until destroyed;
+  // its lifetime is recorded as the request's latency if it has succeeded.
+  class Ticket {
+   public:
+    ~Ticket();
+
+    // Should be called once the request has succeeded, failures (which may
+    // be much faster) do not affect the median latency.
+    void MarkSucceeded() { succeeded_ = true; }
+
+   private:
+    friend class AdmissionController;
+    Ticket(AdmissionController* controller, ModelState* state);
+
+    AdmissionController* controller_;
+    ModelState* state_;
+    const int64 start_micros_;
+    bool succeeded_ = false;
+
+    TF_DISALLOW_COPY_AND_ASSIGN(Ticket);
+  };
+
+  explicit AdmissionController(const Options& options,
+                               Env* env = Env::Default());
+  ~AdmissionController();
+
+  // Admits a request to `model_name` or returns an error. `deadline_micros`
+  // is absolute time by env's clock, kint64max if there is no deadline.
+  // `is_cancelled` tells whether the client is gone, may be empty.
+  Status Admit(const string& model_name, int64 deadline_micros,
+               const std::function<bool()>& is_cancelled,
+               std::unique_ptr<Ticket>* ticket);
+
+  // Median latency of recent requests to the model, zero if unknown.
+  int64 GetMedianLatencyMicros(const string& model_name);
+
+  void RecordLatency(const string& model_name, int64 latency_micros);
+
+  // Number of requests rejected or dropped from queues so far.
+  int64 num_rejected() const;
+
+  // Number of models whose state is kept, public for tests.
+  size_t num_model_states() const;
+
+ private:
+  // Returns state of the model, which stays valid until Unref().
+  ModelState* Ref(const string& model_name);
+  // Removes the state once it's unused and remembers no latencies.
+  void Unref(ModelState* state);
+  // Negative latency means the request has failed.
+  void Release(ModelState* state, int64 latency_micros);
+  void RecordLatencyLocked(ModelState* state, int64 latency_micros)
+      EXCLUSIVE_LOCKS_REQUIRED(state->mu);
+  // Returns the median of latencies which have not expired yet.
+  int64 GetMedianLatencyLocked(ModelState* state)
+      EXCLUSIVE_LOCKS_REQUIRED(state->mu);
+
+  const Options options_;
+  Env* const env_;
+
+  mutable mutex mu_;
+  // States of models which have running or queued requests, or recent
+  // latencies. Requests to models which do not exist create states as well,
+  // so they are removed once unused.
+  std::unordered_map<string, std::unique_ptr<ModelState>> models_
+      GUARDED_BY(mu_);
+  int64 num_rejected_ GUARDED_BY(mu_) = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AdmissionController);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_ADMISSION_CONTROLLER_H_
@@ -0,0 +1,165 @@
+#include "admission_controller.h"
+
+#include <memory>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/platform/env.h"
+
+using tensorflow::Env;
+using tensorflow::Status;
+using tensorflow::Thread;
+using tensorflow::ThreadOptions;
+using tensorflow::kint64max;
+using tensorflow::serving::cranberries::AdmissionController;
+
+namespace {
+
+using Ticket = AdmissionController::Ticket;
+
+Status Admit(AdmissionController* controller, tensorflow::int64 deadline,
+             std::unique_ptr<Ticket>* ticket) {
+  return controller->Admit("model", deadline, nullptr, ticket);
+}
+
+}  // namespace
+
+TEST(AdmissionControllerTest, AdmitsWithoutLimits) {
+  AdmissionController::Options options;
+  options.max_running_per_model = 0;
+  AdmissionController controller(options);
+  std::unique_ptr<Ticket> first, second;
+  EXPECT_TRUE(Admit(&controller, kint64max, &first).ok());
+  EXPECT_TRUE(Admit(&controller, kint64max, &second).ok());
+  EXPECT_EQ(0, controller.num_rejected());
+}
+
+TEST(AdmissionControllerTest, MedianLatency) {
+  AdmissionController controller({});
+  EXPECT_EQ(0, controller.GetMedianLatencyMicros("model"));
+  controller.RecordLatency("model", 30);
+  controller.RecordLatency("model", 10);
+  controller.RecordLatency("model", 20);
+  EXPECT_EQ(20, controller.GetMedianLatencyMicros("model"));
+  EXPECT_EQ(0, controller.GetMedianLatencyMicros("other"));
+}
+
+TEST(AdmissionControllerTest, MedianLatencyOverWindow) {
+  AdmissionController::Options options;
+  options.latency_window = 3;
+  AdmissionController controller(options);
+  for (int latency : {100, 100, 100, 1, 2, 3}) {
+    controller.RecordLatency("model", latency);
+  }
+  EXPECT_EQ(2, controller.GetMedianLatencyMicros("model"));
+}
+
+TEST(AdmissionControllerTest, ForgetsOldLatencies) {
+  AdmissionController::Options options;
+  options.latency_max_age_micros = 50 * 1000;
+  AdmissionController controller(options);
+  controller.RecordLatency("model", 10 * 1000 * 1000);
+  std::unique_ptr<Ticket> ticket;
+  EXPECT_FALSE(Admit(&controller, Env::Default()->NowMicros() + 1000,
+                     &ticket).ok());
+
+  // Otherwise the model would never get requests with short deadlines again.
+  Env::Default()->SleepForMicroseconds(100 * 1000);
+  EXPECT_EQ(0, controller.GetMedianLatencyMicros("model"));
+  EXPECT_TRUE(Admit(&controller, Env::Default()->NowMicros() + 1000,
+                    &ticket).ok());
+}
+
+TEST(AdmissionControllerTest, RecordsLatencyOfSucceededRequests) {
+  AdmissionController controller({});
+  std::unique_ptr<Ticket> ticket;
+  ASSERT_TRUE(Admit(&controller, kint64max, &ticket).ok());
+  Env::Default()->SleepForMicroseconds(10 * 1000);
+  ticket.reset();
+  EXPECT_EQ(0, controller.GetMedianLatencyMicros("model"));
+
+  ASSERT_TRUE(Admit(&controller, kint64max, &ticket).ok());
+  Env::Default()->SleepForMicroseconds(10 * 1000);
+  ticket->MarkSucceeded();
+  ticket.reset();
+  EXPECT_LE(10 * 1000, controller.GetMedianLatencyMicros("model"));
+}
+
+TEST(AdmissionControllerTest, RejectsShortDeadline) {
+  AdmissionController controller({});
+  controller.RecordLatency("model", 10 * 1000 * 1000);
+  const tensorflow::int64 now = Env::Default()->NowMicros();
+  std::unique_ptr<Ticket> ticket;
+  Status status = Admit(&controller, now + 1000, &ticket);
+  EXPECT_EQ(tensorflow::error::RESOURCE_EXHAUSTED, status.code());
+  EXPECT_EQ(nullptr, ticket);
+  EXPECT_TRUE(Admit(&controller, now + 60 * 1000 * 1000, &ticket).ok());
+  EXPECT_EQ(1, controller.num_rejected());
+}
+
+TEST(AdmissionControllerTest, RejectsWhenQueueIsFull) {
+  AdmissionController::Options options;
+  options.max_running_per_model = 1;
+  options.max_queued_per_model = 0;
+  AdmissionController controller(options);
+  std::unique_ptr<Ticket> first, second;
+  EXPECT_TRUE(Admit(&controller, kint64max, &first).ok());
+  EXPECT_EQ(tensorflow::error::RESOURCE_EXHAUSTED,
+            Admit(&controller, kint64max, &second).code());
+  first.reset();
+  EXPECT_TRUE(Admit(&controller, kint64max, &second).ok());
+}
+
+TEST(AdmissionControllerTest, QueuedRequestWaitsForSlot) {
+  AdmissionController::Options options;
+  options.max_running_per_model = 1;
+  AdmissionController controller(options);
+  std::unique_ptr<Ticket> first;
+  ASSERT_TRUE(Admit(&controller, kint64max, &first).ok());
+  Status queued_status;
+  {
+    std::unique_ptr<Thread> thread(Env::Default()->StartThread(
+        ThreadOptions(), "queued", [&controller, &queued_status]() {
+          std::unique_ptr<Ticket> ticket;
+          queued_status = Admit(&controller, kint64max, &ticket);
+        }));
+    Env::Default()->SleepForMicroseconds(50 * 1000);
+    first.reset();
+  }
+  EXPECT_TRUE(queued_status.ok());
+}
+
+TEST(AdmissionControllerTest, DropsQueuedRequestOfGoneClient) {
+  AdmissionController::Options options;
+  options.max_running_per_model = 1;
+  AdmissionController controller(options);
+  std::unique_ptr<Ticket> first, second;
+  ASSERT_TRUE(Admit(&controller, kint64max, &first).ok());
+  Status status = controller.Admit("model", kint64max,
+                                   []() { return true; }, &second);
+  EXPECT_EQ(tensorflow::error::CANCELLED, status.code());
+  EXPECT_EQ(1, controller.num_rejected());
+}
+
+TEST(AdmissionControllerTest, RemovesUnusedStates) {
+  AdmissionController::Options options;
+  options.latency_max_age_micros = 50 * 1000;
+  AdmissionController controller(options);
+  std::unique_ptr<Ticket> ticket;
+  // E.g. a model which does not exist, the request fails.
+  ASSERT_TRUE(
+      controller.Admit("missing", kint64max, nullptr, &ticket).ok());
+  EXPECT_EQ(1, controller.num_model_states());
+  ticket.reset();
+  EXPECT_EQ(0, controller.num_model_states());
+  EXPECT_EQ(0, controller.GetMedianLatencyMicros("missing"));
+  EXPECT_EQ(0, controller.num_model_states());
+
+  // Recent latencies are kept until they expire.
+  ASSERT_TRUE(Admit(&controller, kint64max, &ticket).ok());
+  ticket->MarkSucceeded();
+  ticket.reset();
+  EXPECT_EQ(1, controller.num_model_states());
+  Env::Default()->SleepForMicroseconds(100 * 1000);
+  EXPECT_EQ(0, controller.GetMedianLatencyMicros("model"));
+  EXPECT_EQ(0, controller.num_model_states());
+}
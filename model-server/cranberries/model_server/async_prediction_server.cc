@@ -0,0 +1,274 @@
+#include "async_prediction_server.h"
+
+#include "grpc++/server_context.h"
+#include "grpc++/impl/codegen/async_unary_call.h"
+#include "google/protobuf/arena.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "cranberries/core/cpu_affinity.h"
+
+using tensorflow::strings::StrCat;
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// A completion queue and a flag telling whether new calls can be requested
+// from it: gRPC forbids that after the queue is shut down. Calls running on
+// workers are counted, because they finish through the queue too.
+struct AsyncPredictQueue {
+  std::unique_ptr<grpc::ServerCompletionQueue> cq;
+  thread::ThreadPool* workers = nullptr;
+  mutex mu;
+  condition_variable idle;
+  bool shut_down GUARDED_BY(mu) = false;
+  int running GUARDED_BY(mu) = 0;
+};
+
+namespace {
+
+// Size of memory block embedded into each call. Requests and responses are
+// allocated from it, so typical calls do not touch the heap for protos.
+const size_t kArenaInitialBlockSize = 64 * 1024;
+
+google::protobuf::ArenaOptions MakeArenaOptions(char* initial_block) {
+  google::protobuf::ArenaOptions options;
+  options.initial_block = initial_block;
+  options.initial_block_size = kArenaInitialBlockSize;
+  return options;
+}
+
+// Tag of events in completion queues.
+class CallTag {
+ public:
+  virtual ~CallTag() {}
+
+  // Called by polling thread when the operation is completed. `ok` is false
+  // when the completion queue is shutting down.
+  virtual void Proceed(bool ok) = 0;
+};
+
+// State of a single Predict call. Each instance is used as a tag in the
+// completion queue. The request is run and the call is finished by a worker
+// thread. Once a call is finished, the instance is recycled for the next call
+// by the polling thread; it deletes itself when the queue is shut down.
+//
+// The call is finished when both Finish() has completed and gRPC has
+// notified that the call is done: the notification is requested (as gRPC
+// requires before the call starts) so that ServerContext::IsCancelled() works.
+//
+// Request and response are allocated from a protobuf Arena which is reset
+// after each call, freeing all memory at once and keeping the initial block.
+class PredictCall : public CallTag {
+ public:
+  PredictCall(AsyncPredictionService* service, AsyncPredictQueue* queue)
+    : service_(service),
+      queue_(queue),
+      arena_block_(new char[kArenaInitialBlockSize]),
+      arena_(MakeArenaOptions(arena_block_.get())),
+      done_tag_(this) {
+    RequestNext();
+  }
+
+  void Proceed(bool ok) override {
+    if (state_ == State::kFinishing) {
+      finished_ = true;
+      RequestNextIfDone();
+      return;
+    }
+    if (!ok) {
+      // The call has not started, so there is no done notification.
+      delete this;
+      return;
+    }
+    {
+      mutex_lock l(queue_->mu);
+      queue_->running++;
+    }
+    queue_->workers->Schedule([this]() { Run(); });
+  }
+
+ private:
+  enum class State { kWaitingForRequest, kFinishing };
+
+  // Tag of the notification that the call is done.
+  class DoneTag : public CallTag {
+   public:
+    explicit DoneTag(PredictCall* call) : call_(call) {}
+
+    void Proceed(bool ok) override {
+      call_->done_ = true;
+      call_->RequestNextIfDone();
+    }
+
+   private:
+    PredictCall* call_;
+  };
+
+  // Runs the request on a worker thread.
+  void Run() {
+    // The call may be recycled as soon as Finish() is called.
+    AsyncPredictQueue* queue = queue_;
+    grpc::Status status =
+        service_->impl()->Predict(context_.get(), request_, response_);
+    state_ = State::kFinishing;
+    responder_->Finish(*response_, status, static_cast<CallTag*>(this));
+
+    mutex_lock l(queue->mu);
+    if (--queue->running == 0) {
+      queue->idle.notify_all();
+    }
+  }
+
+  void RequestNextIfDone() {
+    if (finished_ && done_) {
+      RequestNext();
+    }
+  }
+
+  void RequestNext() {
+    responder_.reset();
+    context_.reset();
+    arena_.Reset();
+
+    bool shut_down;
+    {
+      mutex_lock l(queue_->mu);
+      shut_down = queue_->shut_down;
+      if (!shut_down) {
+        RequestNextLocked();
+      }
+    }
+    if (shut_down) {
+      delete this;
+    }
+  }
+
+  // Posts the request to the queue, which should not be shut down.
+  void RequestNextLocked() EXCLUSIVE_LOCKS_REQUIRED(queue_->mu) {
+    context_.reset(new grpc::ServerContext);
+    context_->AsyncNotifyWhenDone(static_cast<CallTag*>(&done_tag_));
+    finished_ = false;
+    done_ = false;
+    responder_.reset(
+        new grpc::ServerAsyncResponseWriter<PredictResponse>(context_.get()));
+    request_ =
+        google::protobuf::Arena::CreateMessage<PredictRequest>(&arena_);
+    response_ =
+        google::protobuf::Arena::CreateMessage<PredictResponse>(&arena_);
+    state_ = State::kWaitingForRequest;
+    service_->RequestPredict(context_.get(), request_, responder_.get(),
+                             queue_->cq.get(), queue_->cq.get(),
+                             static_cast<CallTag*>(this));
+  }
+
+  AsyncPredictionService* service_;
+  AsyncPredictQueue* queue_;
+  std::unique_ptr<char[]> arena_block_;
+  google::protobuf::Arena arena_;
+  std::unique_ptr<grpc::ServerContext> context_;
+  std::unique_ptr<grpc::ServerAsyncResponseWriter<PredictResponse>> responder_;
+  // Owned by `arena_`.
+  PredictRequest* request_ = nullptr;
+  PredictResponse* response_ = nullptr;
+  State state_ = State::kWaitingForRequest;
+  DoneTag done_tag_;
+  // Both are set by the polling thread.
+  bool finished_ = false;
+  bool done_ = false;
+};
+
+AsyncPredictionServer::Options WithDefaults(
+    AsyncPredictionServer::Options options) {
+  if (options.num_worker_threads == 0) {
+    options.num_worker_threads = options.num_completion_queues;
+  }
+  return options;
+}
+
+}  // namespace
+
+AsyncPredictionServer::AsyncPredictionServer(const Options& options,
+                                             AsyncPredictionService* service,
+                                             grpc::ServerBuilder* builder)
+  : options_(WithDefaults(options)), service_(service) {
+  CHECK_GT(options_.num_completion_queues, 0);
+  CHECK_GT(options_.calls_per_queue, 0);
+  CHECK_GT(options_.num_worker_threads, 0);
+  workers_.reset(new thread::ThreadPool(Env::Default(), "grpc_async_predict",
+                                        options_.num_worker_threads));
+  for (int i = 0; i < options_.num_completion_queues; i++) {
+    queues_.emplace_back(new AsyncPredictQueue);
+    queues_.back()->cq = builder->AddCompletionQueue();
+    queues_.back()->workers = workers_.get();
+  }
+}
+
+AsyncPredictionServer::~AsyncPredictionServer() {
+  Shutdown();
+}
+
+void AsyncPredictionServer::Start() {
+  CHECK(threads_.empty()) << "AsyncPredictionServer is already started";
+  for (int i = 0; i < queues_.size(); i++) {
+    for (int j = 0; j < options_.calls_per_queue; j++) {
+      new PredictCall(service_, queues_[i].get());
+    }
+    threads_.emplace_back(Env::Default()->StartThread(
+        ThreadOptions(), StrCat("grpc_cq_", i), [this, i]() { PollQueue(i); }));
+  }
+  LOG(INFO) << "Serving Predict from " << queues_.size()
+            << " completion queues with " << options_.num_worker_threads
+            << " worker threads";
+}
+
+void AsyncPredictionServer::Shutdown() {
+  if (shut_down_) {
+    return;
+  }
+  shut_down_ = true;
+  for (auto& queue : queues_) {
+    mutex_lock l(queue->mu);
+    queue->shut_down = true;
+  }
+  for (auto& queue : queues_) {
+    mutex_lock l(queue->mu);
+    // Running calls are yet to be finished through the queue.
+    while (queue->running > 0) {
+      queue->idle.wait(l);
+    }
+    queue->cq->Shutdown();
+  }
+  if (threads_.empty()) {
+    // Never started, drain queues here as gRPC requires.
+    for (int i = 0; i < queues_.size(); i++) {
+      PollQueue(i);
+    }
+  }
+  // Destructors of threads wait until all queues are drained.
+  threads_.clear();
+  workers_.reset();
+}
+
+void AsyncPredictionServer::PollQueue(int index) {
+  if (options_.pin_threads) {
+    Status status = PinCurrentThreadToCpu(index);
+    if (!status.ok()) {
+      LOG(WARNING) << "Unable to pin polling thread " << index
+                   << " to CPU: " << status;
+    }
+  }
+  grpc::ServerCompletionQueue* cq = queues_[index]->cq.get();
+  // Tags are always CallTag pointers.
+  void* tag;
+  bool ok;
+  while (cq->Next(&tag, &ok)) {
+    static_cast<CallTag*>(tag)->Proceed(ok);
+  }
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,114 @@
+#ifndef CRANBERRIES_ASYNC_PREDICTION_SERVER_H_
+#define CRANBERRIES_ASYNC_PREDICTION_SERVER_H_
+
+#include <memory>
+#include <vector>
+#include "grpc++/completion_queue.h"
+#include "grpc++/server_builder.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "cranberries/model_server/prediction_service_impl.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// PredictionService whose Predict method is served through completion queues
+// (see AsyncPredictionServer), all other methods are delegated to a
+// synchronous PredictionServiceImpl.
+class AsyncPredictionService final
+    : public PredictionService::WithAsyncMethod_Predict<
+          PredictionService::Service> {
+ public:
+  explicit AsyncPredictionService(PredictionServiceImpl* impl)
+    : impl_(impl) {}
+
+  grpc::Status GetModelMetadata(grpc::ServerContext* context,
+                                const GetModelMetadataRequest* request,
+                                GetModelMetadataResponse* response) override {
+    return impl_->GetModelMetadata(context, request, response);
+  }
+
+  PredictionServiceImpl* impl() { return impl_; }
+
+ private:
+  PredictionServiceImpl* impl_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AsyncPredictionService);
+};
+
+// Defined in async_prediction_server.cc.
+struct AsyncPredictQueue;
+
+// Drives Predict calls of AsyncPredictionService. There are several completion
+// queues, each of them is polled by its own thread which only accepts calls
+// and recycles finished ones; requests are run by a pool of worker threads,
+// which finish calls themselves. Optionally, polling threads are pinned to
+// CPU cores (Linux only).
+//
+// Every queue has `calls_per_queue` calls posted, so at most
+// `num_completion_queues * calls_per_queue` calls are accepted at a time and
+// at most `num_worker_threads` of them run concurrently, the rest wait for a
+// worker. With batching, there should be enough workers to fill a batch.
+//
+// Requests and responses are allocated from per-call protobuf arenas which
+// are recycled between calls, so serving a call usually does not allocate
+// protobuf messages on the heap. Tensors and other intermediate data of the
+// call are still allocated on the heap.
+//
+// Usage:
+//   AsyncPredictionServer async_server(options, &service, &builder);
+//   std::unique_ptr<Server> server(builder.BuildAndStart());
+//   async_server.Start();
+//   ...
+//   server->Shutdown();
+//   async_server.Shutdown();
+class AsyncPredictionServer {
+ public:
+  struct Options {
+    // Number of completion queues and polling threads.
+    int num_completion_queues = 1;
+    // Number of calls which wait for requests in each completion queue.
+    int calls_per_queue = 2;
+    // Number of threads which run requests, zero means one per completion
+    // queue (i.e. as many concurrent requests as when queues' threads ran
+    // them).
+    int num_worker_threads = 0;
+    // Pin i-th polling thread to i-th CPU available to the process.
+    bool pin_threads = false;
+  };
+
+  // Registers completion queues in `builder`, which has to be built afterwards.
+  // `service` should be registered in the same builder by the caller.
+  AsyncPredictionServer(const Options& options,
+                        AsyncPredictionService* service,
+                        grpc::ServerBuilder* builder);
+  ~AsyncPredictionServer();
+
+  // Starts polling threads, should be called after the server is started.
+  void Start();
+
+  // Waits for running requests, shuts down completion queues and waits for
+  // polling threads to finish, should be called after the server is shut down.
+  void Shutdown();
+
+ private:
+  void PollQueue(int index);
+
+  const Options options_;
+  AsyncPredictionService* service_;
+  std::vector<std::unique_ptr<AsyncPredictQueue>> queues_;
+  std::vector<std::unique_ptr<Thread>> threads_;
+  std::unique_ptr<thread::ThreadPool> workers_;
+  bool shut_down_ = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AsyncPredictionServer);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_ASYNC_PREDICTION_SERVER_H_
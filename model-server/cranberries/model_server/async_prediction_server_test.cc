@@ -0,0 +1,246 @@
+#include "async_prediction_server.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "grpc++/client_context.h"
+#include "grpc++/create_channel.h"
+#include "grpc++/security/credentials.h"
+#include "grpc++/security/server_credentials.h"
+#include "grpc++/server.h"
+#include "grpc++/server_builder.h"
+#include "grpc++/support/status_code_enum.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/platform/env.h"
+
+using tensorflow::Env;
+using tensorflow::Notification;
+using tensorflow::serving::PredictRequest;
+using tensorflow::serving::PredictResponse;
+using tensorflow::serving::PredictionService;
+using tensorflow::serving::TensorflowPredictor;
+using tensorflow::serving::cranberries::AsyncPredictionServer;
+using tensorflow::serving::cranberries::AsyncPredictionService;
+using tensorflow::serving::cranberries::PredictionServiceImpl;
+
+namespace {
+
+const char kFailingModel[] = "failing";
+const char kBlockingModel[] = "blocking";
+const char kCancellableModel[] = "cancellable";
+
+// Copies input "x" of the request to output "y" of the response. Requests to
+// kFailingModel fail, requests to kBlockingModel wait until unblocked,
+// requests to kCancellableModel wait until the call is cancelled.
+class FakePredictionService : public PredictionServiceImpl {
+ public:
+  FakePredictionService()
+      : PredictionServiceImpl(nullptr, TensorflowPredictor::Options()) {}
+
+  grpc::Status Predict(grpc::ServerContext* context,
+                       const PredictRequest* request,
+                       PredictResponse* response) override {
+    num_calls_++;
+    const std::string& model = request->model_spec().name();
+    if (model == kFailingModel) {
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Failed");
+    }
+    if (model == kBlockingModel) {
+      unblock_.WaitForNotification();
+    }
+    if (model == kCancellableModel) {
+      while (!context->IsCancelled()) {
+        Env::Default()->SleepForMicroseconds(1000);
+      }
+      num_cancelled_++;
+    }
+    (*response->mutable_outputs())["y"] = request->inputs().at("x");
+    return grpc::Status::OK;
+  }
+
+  void Unblock() { unblock_.Notify(); }
+
+  int num_calls() const { return num_calls_; }
+  int num_cancelled() const { return num_cancelled_; }
+
+ private:
+  Notification unblock_;
+  std::atomic<int> num_calls_{0};
+  std::atomic<int> num_cancelled_{0};
+};
+
+PredictRequest MakeRequest(int id, const std::string& model) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name(model);
+  (*request.mutable_inputs())["x"].add_float_val(id);
+  return request;
+}
+
+void WaitForCalls(const FakePredictionService& impl, int num_calls) {
+  while (impl.num_calls() < num_calls) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+}
+
+class AsyncPredictionServerTest : public ::testing::Test {
+ protected:
+  AsyncPredictionServerTest() : service_(&impl_) {}
+
+  ~AsyncPredictionServerTest() override { StopServer(); }
+
+  void StartServer(const AsyncPredictionServer::Options& options,
+                   bool start_async_server = true) {
+    grpc::ServerBuilder builder;
+    int port = 0;
+    builder.AddListeningPort("localhost:0", grpc::InsecureServerCredentials(),
+                             &port);
+    builder.RegisterService(&service_);
+    async_server_.reset(new AsyncPredictionServer(options, &service_,
+                                                  &builder));
+    server_ = builder.BuildAndStart();
+    ASSERT_TRUE(server_ != nullptr);
+    if (start_async_server) {
+      async_server_->Start();
+    }
+    stub_ = PredictionService::NewStub(grpc::CreateChannel(
+        "localhost:" + std::to_string(port),
+        grpc::InsecureChannelCredentials()));
+  }
+
+  // Waits for all calls to finish, in the order model_server uses.
+  void StopServer() {
+    if (server_) {
+      server_->Shutdown();
+      async_server_->Shutdown();
+      server_.reset();
+      async_server_.reset();
+    }
+  }
+
+  grpc::Status Predict(int id, const std::string& model,
+                       PredictResponse* response) {
+    grpc::ClientContext context;
+    return stub_->Predict(&context, MakeRequest(id, model), response);
+  }
+
+  void ExpectSucceeds(int id) {
+    PredictResponse response;
+    const grpc::Status status = Predict(id, "model", &response);
+    ASSERT_TRUE(status.ok()) << status.error_message();
+    ASSERT_EQ(1, response.outputs().count("y"));
+    ASSERT_EQ(1, response.outputs().at("y").float_val_size());
+    EXPECT_EQ(id, response.outputs().at("y").float_val(0));
+  }
+
+  FakePredictionService impl_;
+  AsyncPredictionService service_;
+  std::unique_ptr<AsyncPredictionServer> async_server_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<PredictionService::Stub> stub_;
+};
+
+}  // namespace
+
+TEST_F(AsyncPredictionServerTest, RecyclesSingleCall) {
+  AsyncPredictionServer::Options options;
+  options.calls_per_queue = 1;
+  StartServer(options);
+
+  // Each request is served by the same call, whose arena is reset between
+  // them.
+  for (int i = 0; i < 20; i++) {
+    ExpectSucceeds(i);
+  }
+  // A failed request recycles the call as well.
+  PredictResponse response;
+  const grpc::Status status = Predict(0, kFailingModel, &response);
+  EXPECT_EQ(grpc::StatusCode::INVALID_ARGUMENT, status.error_code());
+  EXPECT_EQ("Failed", status.error_message());
+  ExpectSucceeds(20);
+  EXPECT_EQ(22, impl_.num_calls());
+}
+
+TEST_F(AsyncPredictionServerTest, ServesConcurrentClients) {
+  AsyncPredictionServer::Options options;
+  options.num_completion_queues = 2;
+  options.calls_per_queue = 2;
+  options.num_worker_threads = 3;
+  StartServer(options);
+
+  const int kNumClients = 8;
+  const int kRequestsPerClient = 25;
+  std::vector<std::thread> clients;
+  for (int client = 0; client < kNumClients; client++) {
+    clients.emplace_back([this, client]() {
+      for (int i = 0; i < kRequestsPerClient; i++) {
+        ExpectSucceeds(client * kRequestsPerClient + i);
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  EXPECT_EQ(kNumClients * kRequestsPerClient, impl_.num_calls());
+}
+
+TEST_F(AsyncPredictionServerTest, RecyclesCancelledCall) {
+  AsyncPredictionServer::Options options;
+  options.calls_per_queue = 1;
+  StartServer(options);
+
+  // The running request notices that the call is cancelled, which needs the
+  // done notification of the call.
+  {
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() +
+                         std::chrono::milliseconds(100));
+    PredictResponse response;
+    const grpc::Status status =
+        stub_->Predict(&context, MakeRequest(0, kCancellableModel), &response);
+    EXPECT_EQ(grpc::StatusCode::DEADLINE_EXCEEDED, status.error_code());
+  }
+  // The only call is recycled once both the request and the notification are
+  // done.
+  ExpectSucceeds(1);
+  EXPECT_EQ(1, impl_.num_cancelled());
+}
+
+TEST_F(AsyncPredictionServerTest, ShutdownWaitsForRunningRequest) {
+  AsyncPredictionServer::Options options;
+  options.calls_per_queue = 2;
+  StartServer(options);
+
+  grpc::Status status;
+  PredictResponse response;
+  std::thread client([this, &status, &response]() {
+    status = Predict(7, kBlockingModel, &response);
+  });
+  WaitForCalls(impl_, 1);
+
+  std::atomic<bool> stopped(false);
+  std::thread stopper([this, &stopped]() {
+    StopServer();
+    stopped = true;
+  });
+  Env::Default()->SleepForMicroseconds(100 * 1000);
+  EXPECT_FALSE(stopped);
+  impl_.Unblock();
+  stopper.join();
+  client.join();
+
+  // The running request is answered, the idle call is deleted.
+  ASSERT_TRUE(status.ok()) << status.error_message();
+  ASSERT_EQ(1, response.outputs().at("y").float_val_size());
+  EXPECT_EQ(7, response.outputs().at("y").float_val(0));
+}
+
+TEST_F(AsyncPredictionServerTest, ShutsDownWithoutStart) {
+  AsyncPredictionServer::Options options;
+  StartServer(options, false /* start_async_server */);
+  StopServer();
+  EXPECT_EQ(0, impl_.num_calls());
+}
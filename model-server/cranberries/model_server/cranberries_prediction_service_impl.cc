@@ -0,0 +1,106 @@
+#include "cranberries_prediction_service_impl.h"
+
+#include <utility>
+#include "grpc++/support/status_code_enum.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+using ::cranberries::StreamPredictRequest;
+using ::cranberries::StreamPredictResponse;
+
+using Stream = grpc::ServerReaderWriter<StreamPredictResponse,
+                                        StreamPredictRequest>;
+
+// State of a single PredictStream call shared with its requests in flight.
+// Lives on the handler's stack, which waits for all requests to finish.
+struct StreamState {
+  explicit StreamState(Stream* stream) : stream(stream) {}
+
+  // Writes are serialized because gRPC forbids concurrent writes.
+  void Write(const StreamPredictResponse& response) {
+    mutex_lock l(mu);
+    if (!write_failed && !stream->Write(response)) {
+      // The client is gone, there is no point in running other requests.
+      write_failed = true;
+    }
+  }
+
+  bool WriteFailed() {
+    mutex_lock l(mu);
+    return write_failed;
+  }
+
+  Stream* const stream;
+  mutex mu;
+  condition_variable finished;
+  int in_flight GUARDED_BY(mu) = 0;
+  bool write_failed GUARDED_BY(mu) = false;
+};
+
+}  // namespace
+
+CranberriesPredictionServiceImpl::CranberriesPredictionServiceImpl(
+    const Options& options, PredictionServiceImpl* impl)
+  : options_(options),
+    impl_(impl),
+    thread_pool_(Env::Default(), "predict_stream", options.num_threads) {}
+
+grpc::Status CranberriesPredictionServiceImpl::PredictStream(
+    grpc::ServerContext* context, Stream* stream) {
+  StreamState state(stream);
+  while (true) {
+    std::shared_ptr<StreamPredictRequest> request(new StreamPredictRequest);
+    if (!stream->Read(request.get())) {
+      break;
+    }
+    {
+      mutex_lock l(state.mu);
+      while (state.in_flight >= options_.max_in_flight_per_stream) {
+        state.finished.wait(l);
+      }
+      if (state.write_failed) {
+        break;
+      }
+      state.in_flight++;
+    }
+    thread_pool_.Schedule([this, context, request, &state]() {
+      StreamPredictResponse response;
+      response.set_id(request->id());
+      if (!state.WriteFailed()) {
+        const grpc::Status status = impl_->Predict(
+            context, &request->request(), response.mutable_response());
+        if (!status.ok()) {
+          response.clear_response();
+          response.set_error_code(status.error_code());
+          response.set_error_message(status.error_message());
+        }
+        state.Write(response);
+      }
+      mutex_lock l(state.mu);
+      state.in_flight--;
+      state.finished.notify_all();
+    });
+  }
+
+  mutex_lock l(state.mu);
+  while (state.in_flight > 0) {
+    state.finished.wait(l);
+  }
+  if (state.write_failed) {
+    return grpc::Status(grpc::StatusCode::CANCELLED,
+                        "Unable to write response");
+  }
+  return grpc::Status::OK;
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,65 @@
+#ifndef CRANBERRIES_CRANBERRIES_PREDICTION_SERVICE_IMPL_H_
+#define CRANBERRIES_CRANBERRIES_PREDICTION_SERVICE_IMPL_H_
+
+#include <memory>
+#include "grpc++/server_context.h"
+#include "grpc++/support/status.h"
+#include "grpc++/support/sync_stream.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/macros.h"
+#include "cranberries/model_server/cranberries_prediction_service.grpc.pb.h"
+#include "cranberries/model_server/prediction_service_impl.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Implementation of cranberries_prediction_service.proto on top of
+// PredictionServiceImpl.
+//
+// BatchPredict is served by PredictionServiceImpl directly.
+//
+// Requests from PredictStream are read by gRPC's handler thread and run on a
+// thread pool shared by all streams, so a single stream may occupy several
+// threads. Number of requests in flight per stream is limited: the stream
+// is not read further until some of them are finished.
+class CranberriesPredictionServiceImpl final
+    : public ::cranberries::CranberriesPredictionService::Service {
+ public:
+  struct Options {
+    // Threads running requests from all streams.
+    int num_threads = 8;
+    // Limit of requests in flight per stream.
+    int max_in_flight_per_stream = 64;
+  };
+
+  // `impl` should outlive the service.
+  CranberriesPredictionServiceImpl(const Options& options,
+                                   PredictionServiceImpl* impl);
+
+  grpc::Status PredictStream(
+      grpc::ServerContext* context,
+      grpc::ServerReaderWriter<::cranberries::StreamPredictResponse,
+                               ::cranberries::StreamPredictRequest>* stream)
+      override;
+
+  grpc::Status BatchPredict(grpc::ServerContext* context,
+                            const ::cranberries::BatchPredictRequest* request,
+                            ::cranberries::BatchPredictResponse* response)
+      override {
+    return impl_->BatchPredict(context, request, response);
+  }
+
+ private:
+  const Options options_;
+  PredictionServiceImpl* impl_;
+  thread::ThreadPool thread_pool_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CranberriesPredictionServiceImpl);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_CRANBERRIES_PREDICTION_SERVICE_IMPL_H_
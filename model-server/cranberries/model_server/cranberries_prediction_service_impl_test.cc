@@ -0,0 +1,218 @@
+#include "cranberries_prediction_service_impl.h"
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <gtest/gtest.h>
+#include "grpc++/client_context.h"
+#include "grpc++/create_channel.h"
+#include "grpc++/security/credentials.h"
+#include "grpc++/security/server_credentials.h"
+#include "grpc++/server.h"
+#include "grpc++/server_builder.h"
+#include "grpc++/support/status_code_enum.h"
+#include "tensorflow/core/platform/env.h"
+
+using ::cranberries::CranberriesPredictionService;
+using ::cranberries::StreamPredictRequest;
+using ::cranberries::StreamPredictResponse;
+using tensorflow::Env;
+using tensorflow::serving::PredictRequest;
+using tensorflow::serving::PredictResponse;
+using tensorflow::serving::TensorflowPredictor;
+using tensorflow::serving::cranberries::CranberriesPredictionServiceImpl;
+using tensorflow::serving::cranberries::PredictionServiceImpl;
+
+namespace {
+
+const char kFailingModel[] = "failing";
+const char kBlockingModel[] = "blocking";
+
+// Copies input "x" of the request to output "y" of the response. Requests to
+// kFailingModel fail, requests to kBlockingModel wait until the call is
+// cancelled.
+class FakePredictionService : public PredictionServiceImpl {
+ public:
+  FakePredictionService()
+      : PredictionServiceImpl(nullptr, TensorflowPredictor::Options()) {}
+
+  grpc::Status Predict(grpc::ServerContext* context,
+                       const PredictRequest* request,
+                       PredictResponse* response) override {
+    num_calls_++;
+    const std::string& model = request->model_spec().name();
+    if (model == kFailingModel) {
+      return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Failed");
+    }
+    if (model == kBlockingModel) {
+      while (!context->IsCancelled()) {
+        Env::Default()->SleepForMicroseconds(1000);
+      }
+    }
+    (*response->mutable_outputs())["y"] = request->inputs().at("x");
+    return grpc::Status::OK;
+  }
+
+  int num_calls() const { return num_calls_; }
+
+ private:
+  std::atomic<int> num_calls_{0};
+};
+
+StreamPredictRequest MakeRequest(int id, const std::string& model) {
+  StreamPredictRequest request;
+  request.set_id(id);
+  request.mutable_request()->mutable_model_spec()->set_name(model);
+  (*request.mutable_request()->mutable_inputs())["x"].add_float_val(id);
+  return request;
+}
+
+class PredictStreamTest : public ::testing::Test {
+ protected:
+  ~PredictStreamTest() override { StopServer(); }
+
+  void StartServer(const CranberriesPredictionServiceImpl::Options& options) {
+    service_.reset(new CranberriesPredictionServiceImpl(options, &impl_));
+    grpc::ServerBuilder builder;
+    int port = 0;
+    builder.AddListeningPort("localhost:0", grpc::InsecureServerCredentials(),
+                             &port);
+    builder.RegisterService(service_.get());
+    server_ = builder.BuildAndStart();
+    ASSERT_TRUE(server_ != nullptr);
+    stub_ = CranberriesPredictionService::NewStub(grpc::CreateChannel(
+        "localhost:" + std::to_string(port),
+        grpc::InsecureChannelCredentials()));
+  }
+
+  // Waits for all calls to finish.
+  void StopServer() {
+    if (server_) {
+      server_->Shutdown();
+      server_.reset();
+    }
+  }
+
+  FakePredictionService impl_;
+  std::unique_ptr<CranberriesPredictionServiceImpl> service_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<CranberriesPredictionService::Stub> stub_;
+};
+
+void ExpectSucceeded(int id, const StreamPredictResponse& response) {
+  EXPECT_EQ(id, response.id());
+  EXPECT_EQ(0, response.error_code());
+  ASSERT_EQ(1, response.response().outputs().count("y"));
+  ASSERT_EQ(1, response.response().outputs().at("y").float_val_size());
+  EXPECT_EQ(id, response.response().outputs().at("y").float_val(0));
+}
+
+}  // namespace
+
+TEST_F(PredictStreamTest, RespondsInOrderWithSingleThread) {
+  CranberriesPredictionServiceImpl::Options options;
+  options.num_threads = 1;
+  // Less than the number of requests, so the stream waits for some of them.
+  options.max_in_flight_per_stream = 4;
+  StartServer(options);
+
+  const int kNumRequests = 50;
+  grpc::ClientContext context;
+  auto stream = stub_->PredictStream(&context);
+  for (int i = 0; i < kNumRequests; i++) {
+    ASSERT_TRUE(stream->Write(MakeRequest(i, "model")));
+  }
+  ASSERT_TRUE(stream->WritesDone());
+
+  StreamPredictResponse response;
+  for (int i = 0; i < kNumRequests; i++) {
+    ASSERT_TRUE(stream->Read(&response));
+    ExpectSucceeded(i, response);
+  }
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_TRUE(stream->Finish().ok());
+  EXPECT_EQ(kNumRequests, impl_.num_calls());
+}
+
+TEST_F(PredictStreamTest, RespondsToAllRequestsWithManyThreads) {
+  CranberriesPredictionServiceImpl::Options options;
+  options.num_threads = 4;
+  options.max_in_flight_per_stream = 8;
+  StartServer(options);
+
+  const int kNumRequests = 200;
+  grpc::ClientContext context;
+  auto stream = stub_->PredictStream(&context);
+  for (int i = 0; i < kNumRequests; i++) {
+    ASSERT_TRUE(stream->Write(MakeRequest(i, "model")));
+  }
+  ASSERT_TRUE(stream->WritesDone());
+
+  // Responses may be out of order, each one matches its request by id.
+  std::set<int> ids;
+  StreamPredictResponse response;
+  while (stream->Read(&response)) {
+    ExpectSucceeded(response.id(), response);
+    EXPECT_TRUE(ids.insert(response.id()).second);
+  }
+  EXPECT_TRUE(stream->Finish().ok());
+  EXPECT_EQ(kNumRequests, ids.size());
+}
+
+TEST_F(PredictStreamTest, ReportsErrorAndContinues) {
+  CranberriesPredictionServiceImpl::Options options;
+  options.num_threads = 1;
+  StartServer(options);
+
+  grpc::ClientContext context;
+  auto stream = stub_->PredictStream(&context);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_TRUE(
+        stream->Write(MakeRequest(i, i == 2 ? kFailingModel : "model")));
+  }
+  ASSERT_TRUE(stream->WritesDone());
+
+  StreamPredictResponse response;
+  for (int i = 0; i < 5; i++) {
+    ASSERT_TRUE(stream->Read(&response));
+    if (i == 2) {
+      EXPECT_EQ(2, response.id());
+      EXPECT_EQ(grpc::StatusCode::INVALID_ARGUMENT, response.error_code());
+      EXPECT_EQ("Failed", response.error_message());
+      EXPECT_FALSE(response.has_response());
+    } else {
+      ExpectSucceeded(i, response);
+    }
+  }
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_TRUE(stream->Finish().ok());
+}
+
+TEST_F(PredictStreamTest, StopsRunningRequestsWhenCancelled) {
+  CranberriesPredictionServiceImpl::Options options;
+  options.num_threads = 1;
+  StartServer(options);
+
+  grpc::ClientContext context;
+  auto stream = stub_->PredictStream(&context);
+  // The first request occupies the only thread until the call is cancelled,
+  // the others wait for it.
+  ASSERT_TRUE(stream->Write(MakeRequest(0, kBlockingModel)));
+  for (int i = 1; i < 5; i++) {
+    ASSERT_TRUE(stream->Write(MakeRequest(i, "model")));
+  }
+  while (impl_.num_calls() == 0) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  context.TryCancel();
+
+  StreamPredictResponse response;
+  EXPECT_FALSE(stream->Read(&response));
+  EXPECT_EQ(grpc::StatusCode::CANCELLED, stream->Finish().error_code());
+  // Returns once the handler has returned, i.e. all requests are finished.
+  StopServer();
+  // Response of the first request could not be written, so the others were
+  // not run.
+  EXPECT_EQ(1, impl_.num_calls());
+}
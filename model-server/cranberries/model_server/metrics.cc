@@ -0,0 +1,306 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+
+using tensorflow::strings::StrAppend;
+using tensorflow::strings::StrCat;
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+const char* const kStageNames[kNumPredictStages] = {"lookup", "decode", "run",
+                                                    "encode", "total"};
+
+int CurrentThreadShard() {
+  static std::atomic<int> next_shard{0};
+  static thread_local int shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed) % kNumMetricShards;
+  return shard;
+}
+
+string EscapeLabelValue(const string& value) {
+  string escaped;
+  for (char c : value) {
+    switch (c) {
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      default:
+        escaped += c;
+    }
+  }
+  return escaped;
+}
+
+string Labels(const PredictCallMetrics& call) {
+  return StrCat("model=\"", EscapeLabelValue(call.model), "\",version=\"",
+                EscapeLabelValue(call.version), "\",signature=\"",
+                EscapeLabelValue(call.signature), "\"");
+}
+
+}  // namespace
+
+void ShardedCounter::Add(int64 delta) {
+  shards_[CurrentThreadShard()].value.fetch_add(delta,
+                                                std::memory_order_relaxed);
+}
+
+int64 ShardedCounter::Get() const {
+  int64 sum = 0;
+  for (const Shard& shard : shards_) {
+    sum += shard.value.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+const std::vector<int64>& LatencyHistogram::BucketBounds() {
+  static const std::vector<int64>* const bounds = new std::vector<int64>{
+      10,     20,     50,      100,     200,     500,     1000,
+      2000,   5000,   10000,   20000,   50000,   100000,  200000,
+      500000, 1000000, 2000000, 5000000, 10000000};
+  return *bounds;
+}
+
+LatencyHistogram::Shard::Shard() {
+  for (auto& count : counts) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::Record(int64 micros) {
+  const std::vector<int64>& bounds = BucketBounds();
+  const int bucket =
+      std::lower_bound(bounds.begin(), bounds.end(), micros) - bounds.begin();
+  Shard& shard = shards_[CurrentThreadShard()];
+  shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.sum_micros.fetch_add(micros, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::GetSnapshot() const {
+  Snapshot snapshot;
+  snapshot.counts.assign(BucketBounds().size() + 1, 0);
+  for (const Shard& shard : shards_) {
+    for (int i = 0; i < snapshot.counts.size(); i++) {
+      snapshot.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+    }
+    snapshot.sum_micros += shard.sum_micros.load(std::memory_order_relaxed);
+  }
+  for (int64 count : snapshot.counts) {
+    snapshot.count += count;
+  }
+  return snapshot;
+}
+
+PredictCallMetrics* PredictMetrics::Get(const ServableId& id,
+                                        const string& signature) {
+  mutex_lock l(mu_);
+  std::unique_ptr<PredictCallMetrics>& call = calls_[{id, signature}];
+  if (!call) {
+    call.reset(new PredictCallMetrics);
+    call->model = id.name;
+    call->version = StrCat(id.version);
+    call->signature = signature;
+  }
+  return call.get();
+}
+
+void PredictMetrics::WritePrometheus(string* out) const {
+  // Entries are sorted by model, version and signature, calls to unknown
+  // models go first.
+  std::vector<const PredictCallMetrics*> calls = {&unknown_};
+  {
+    mutex_lock l(mu_);
+    for (const auto& entry : calls_) {
+      calls.push_back(entry.second.get());
+    }
+  }
+
+  StrAppend(out,
+            "# HELP cranberries_predict_requests_total Finished Predict "
+            "calls.\n"
+            "# TYPE cranberries_predict_requests_total counter\n");
+  for (const PredictCallMetrics* call : calls) {
+    StrAppend(out, "cranberries_predict_requests_total{", Labels(*call), "} ",
+              call->requests.Get(), "\n");
+  }
+  StrAppend(out,
+            "# HELP cranberries_predict_errors_total Failed Predict calls.\n"
+            "# TYPE cranberries_predict_errors_total counter\n");
+  for (const PredictCallMetrics* call : calls) {
+    StrAppend(out, "cranberries_predict_errors_total{", Labels(*call),
+              "} ", call->errors.Get(), "\n");
+  }
+  StrAppend(out,
+            "# HELP cranberries_predict_routed_total Finished Predict calls "
+            "routed to the version by traffic split.\n"
+            "# TYPE cranberries_predict_routed_total counter\n");
+  for (const PredictCallMetrics* call : calls) {
+    StrAppend(out, "cranberries_predict_routed_total{", Labels(*call),
+              "} ", call->routed.Get(), "\n");
+  }
+  StrAppend(out,
+            "# HELP cranberries_predict_in_flight Running Predict calls.\n"
+            "# TYPE cranberries_predict_in_flight gauge\n");
+  for (const PredictCallMetrics* call : calls) {
+    StrAppend(out, "cranberries_predict_in_flight{", Labels(*call),
+              "} ", call->in_flight.Get(), "\n");
+  }
+
+  const std::vector<int64>& bounds = LatencyHistogram::BucketBounds();
+  StrAppend(out,
+            "# HELP cranberries_predict_latency_microseconds Latency of "
+            "Predict calls by stage.\n"
+            "# TYPE cranberries_predict_latency_microseconds histogram\n");
+  for (const PredictCallMetrics* call : calls) {
+    const string labels = Labels(*call);
+    for (int stage = 0; stage < kNumPredictStages; stage++) {
+      const string stage_labels =
+          StrCat(labels, ",stage=\"", kStageNames[stage], "\"");
+      const LatencyHistogram::Snapshot snapshot =
+          call->latency[stage].GetSnapshot();
+      int64 cumulative = 0;
+      for (int i = 0; i < bounds.size(); i++) {
+        cumulative += snapshot.counts[i];
+        StrAppend(out, "cranberries_predict_latency_microseconds_bucket{",
+                  stage_labels, ",le=\"", bounds[i], "\"} ", cumulative,
+                  "\n");
+      }
+      StrAppend(out, "cranberries_predict_latency_microseconds_bucket{",
+                stage_labels, ",le=\"+Inf\"} ", snapshot.count, "\n");
+      StrAppend(out, "cranberries_predict_latency_microseconds_sum{",
+                stage_labels, "} ", snapshot.sum_micros, "\n");
+      StrAppend(out, "cranberries_predict_latency_microseconds_count{",
+                stage_labels, "} ", snapshot.count, "\n");
+    }
+  }
+}
+
+void WarmupMetrics::Record(const ServableId& id, int64 num_requests,
+                           int64 duration_micros) {
+  mutex_lock l(mu_);
+  Warmup& warmup = warmups_[id.name];
+  warmup.version = id.version;
+  warmup.num_requests = num_requests;
+  warmup.duration_micros = duration_micros;
+}
+
+void WarmupMetrics::WritePrometheus(string* out) const {
+  mutex_lock l(mu_);
+  StrAppend(out,
+            "# HELP cranberries_model_warmup_requests Warmup requests "
+            "replayed by the last loaded version.\n"
+            "# TYPE cranberries_model_warmup_requests gauge\n");
+  for (const auto& entry : warmups_) {
+    StrAppend(out, "cranberries_model_warmup_requests{model=\"",
+              EscapeLabelValue(entry.first), "\",version=\"",
+              entry.second.version, "\"} ", entry.second.num_requests, "\n");
+  }
+  StrAppend(out,
+            "# HELP cranberries_model_warmup_microseconds Warmup duration of "
+            "the last loaded version.\n"
+            "# TYPE cranberries_model_warmup_microseconds gauge\n");
+  for (const auto& entry : warmups_) {
+    StrAppend(out, "cranberries_model_warmup_microseconds{model=\"",
+              EscapeLabelValue(entry.first), "\",version=\"",
+              entry.second.version, "\"} ", entry.second.duration_micros,
+              "\n");
+  }
+}
+
+PredictTrace::PredictTrace(PredictMetrics* metrics, int num_requests)
+  : metrics_(metrics),
+    num_requests_(num_requests),
+    start_micros_(metrics ? Env::Default()->NowMicros() : 0),
+    last_lap_micros_(start_micros_) {}
+
+PredictTrace::~PredictTrace() {
+  if (call_ && !finished_) {
+    call_->in_flight.Add(-num_requests_);
+  }
+}
+
+void PredictTrace::SetCall(PredictCallMetrics* call) {
+  if (!metrics_ || call_ || !call) {
+    return;
+  }
+  call_ = call;
+  call_->in_flight.Add(num_requests_);
+}
+
+void PredictTrace::SetServable(const ServableId& id,
+                               const string& signature) {
+  if (!metrics_ || call_) {
+    return;
+  }
+  SetCall(metrics_->Get(id, signature));
+}
+
+void PredictTrace::Lap(PredictStage stage) {
+  if (!metrics_) {
+    return;
+  }
+  const int64 now_micros = Env::Default()->NowMicros();
+  stage_micros_[static_cast<int>(stage)] += now_micros - last_lap_micros_;
+  stage_seen_[static_cast<int>(stage)] = true;
+  last_lap_micros_ = now_micros;
+}
+
+void PredictTrace::Finish(const Status& status) {
+  Record(status.ok() ? 0 : num_requests_);
+}
+
+void PredictTrace::Finish(const std::vector<Status>& statuses) {
+  int num_errors = 0;
+  for (const Status& status : statuses) {
+    if (!status.ok()) {
+      num_errors++;
+    }
+  }
+  Record(num_errors);
+}
+
+void PredictTrace::Record(int num_errors) {
+  if (!metrics_ || finished_) {
+    return;
+  }
+  finished_ = true;
+  PredictCallMetrics* call = call_;
+  if (call) {
+    call->in_flight.Add(-num_requests_);
+  } else {
+    call = metrics_->unknown();
+  }
+  call->requests.Add(num_requests_);
+  if (routed_) {
+    call->routed.Add(num_requests_);
+  }
+  if (num_errors > 0) {
+    call->errors.Add(num_errors);
+  }
+  if (num_errors == num_requests_) {
+    return;
+  }
+  const int total = static_cast<int>(PredictStage::kTotal);
+  stage_micros_[total] = Env::Default()->NowMicros() - start_micros_;
+  stage_seen_[total] = true;
+  for (int stage = 0; stage < kNumPredictStages; stage++) {
+    if (stage_seen_[stage]) {
+      call->latency[stage].Record(stage_micros_[stage]);
+    }
+  }
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
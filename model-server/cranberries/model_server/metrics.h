@@ -0,0 +1,199 @@
+#ifndef CRANBERRIES_METRICS_H_
+#define CRANBERRIES_METRICS_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/core/servable_id.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Metrics below are updated without locks: each thread updates its own
+// shard (threads are assigned to shards round-robin) with relaxed atomic
+// increments, and readers sum all shards. Shards are cache line aligned, so
+// threads do not contend unless there are more threads than shards.
+const int kNumMetricShards = 16;
+
+class ShardedCounter {
+ public:
+  ShardedCounter() {}
+
+  void Add(int64 delta);
+  int64 Get() const;
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<int64> value{0};
+  };
+  Shard shards_[kNumMetricShards];
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ShardedCounter);
+};
+
+// Histogram of latencies with fixed buckets from 10us to 10s.
+class LatencyHistogram {
+ public:
+  // Upper bounds of buckets in microseconds, the last bucket is unbounded.
+  static const std::vector<int64>& BucketBounds();
+
+  struct Snapshot {
+    // Non-cumulative counts, one per bucket plus one for the unbounded one.
+    std::vector<int64> counts;
+    int64 sum_micros = 0;
+    int64 count = 0;
+  };
+
+  LatencyHistogram() {}
+
+  void Record(int64 micros);
+  Snapshot GetSnapshot() const;
+
+ private:
+  static const int kMaxBuckets = 32;
+  struct alignas(64) Shard {
+    std::atomic<int64> counts[kMaxBuckets];
+    std::atomic<int64> sum_micros{0};
+    Shard();
+  };
+  Shard shards_[kNumMetricShards];
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+// Stages of a Predict call. Decoding of the request message itself is done
+// by gRPC before the call starts, kDecode covers conversion of input tensors.
+enum class PredictStage { kLookup, kDecode, kRun, kEncode, kTotal };
+const int kNumPredictStages = 5;
+
+// Metrics of Predict calls to a single (model, version, signature). Labels
+// are empty for calls which failed before the servable was resolved, and
+// `signature` is empty for calls which failed before the signature was.
+struct PredictCallMetrics {
+  string model;
+  string version;
+  string signature;
+  ShardedCounter requests;
+  ShardedCounter errors;
+  ShardedCounter in_flight;
+  // Calls without version which were routed here by the model's
+  // traffic_split.
+  ShardedCounter routed;
+  LatencyHistogram latency[kNumPredictStages];
+};
+
+// Registry of PredictCallMetrics keyed by resolved servables, so clients
+// cannot add entries by sending arbitrary model names: calls to unknown
+// models share a single entry. Lookups take a lock, so Predict does not look
+// entries up per call: they are resolved once per servable and signature and
+// kept in PredictionPlan's. Entries are never removed, so pointers to them
+// stay valid.
+class PredictMetrics {
+ public:
+  PredictMetrics() {}
+
+  // `signature` should exist in the servable, or be empty.
+  PredictCallMetrics* Get(const ServableId& id, const string& signature);
+
+  // Metrics of calls which failed before the servable was resolved.
+  PredictCallMetrics* unknown() { return &unknown_; }
+
+  // Appends all metrics in Prometheus text exposition format.
+  void WritePrometheus(string* out) const;
+
+ private:
+  mutable mutex mu_;
+  std::map<std::pair<ServableId, string>, std::unique_ptr<PredictCallMetrics>>
+      calls_ GUARDED_BY(mu_);
+  PredictCallMetrics unknown_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PredictMetrics);
+};
+
+// Result of the last warmup of each model, see RunWarmup().
+class WarmupMetrics {
+ public:
+  WarmupMetrics() {}
+
+  void Record(const ServableId& id, int64 num_requests, int64 duration_micros);
+
+  // Appends all metrics in Prometheus text exposition format.
+  void WritePrometheus(string* out) const;
+
+ private:
+  struct Warmup {
+    int64 version = 0;
+    int64 num_requests = 0;
+    int64 duration_micros = 0;
+  };
+
+  mutable mutex mu_;
+  // Keyed by model name.
+  std::map<string, Warmup> warmups_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(WarmupMetrics);
+};
+
+// Measures stages of a Predict call and records them once it's finished.
+// A BatchPredict call is traced as `num_requests` calls which share
+// latencies. Does nothing if `metrics` is null.
+class PredictTrace {
+ public:
+  explicit PredictTrace(PredictMetrics* metrics, int num_requests = 1);
+  ~PredictTrace();
+
+  // Called once the servable and signature are resolved with their metrics
+  // (e.g. from PredictionPlan), starts counting the call as in flight. Does
+  // not take locks.
+  void SetCall(PredictCallMetrics* call);
+
+  // Same as above, but looks the metrics up. Used when the call failed
+  // before its signature was resolved (with empty `signature`).
+  void SetServable(const ServableId& id, const string& signature);
+
+  // Marks the call as routed to its version by traffic split.
+  void SetRouted() { routed_ = true; }
+
+  // Attributes time since the previous lap (or start) to `stage`.
+  void Lap(PredictStage stage);
+
+  // Records the call; latencies are recorded for successful calls only.
+  // Calls which failed before SetCall() or SetServable() are attributed to
+  // PredictMetrics::unknown().
+  void Finish(const Status& status);
+
+  // Same as above, with a status per request; latencies are recorded if any
+  // of them succeeded.
+  void Finish(const std::vector<Status>& statuses);
+
+ private:
+  void Record(int num_errors);
+
+  PredictMetrics* const metrics_;
+  const int num_requests_;
+  PredictCallMetrics* call_ = nullptr;
+  const int64 start_micros_;
+  int64 last_lap_micros_;
+  int64 stage_micros_[kNumPredictStages] = {};
+  // Stages skipped by the call (e.g. because of result cache) are not
+  // recorded.
+  bool stage_seen_[kNumPredictStages] = {};
+  bool routed_ = false;
+  bool finished_ = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PredictTrace);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_METRICS_H_
@@ -0,0 +1,138 @@
+#include "metrics_http_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+using tensorflow::strings::StrCat;
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+// How often the serving thread checks whether it should stop.
+const int kPollTimeoutMillis = 100;
+// Requests are not expected to have bodies, so headers are limited.
+const size_t kMaxRequestSize = 16 * 1024;
+
+void WriteAll(int fd, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t res = write(fd, data.data() + written, data.size() - written);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return;
+    }
+    written += res;
+  }
+}
+
+string MakeResponse(const string& status, const string& content_type,
+                    const string& body) {
+  return StrCat("HTTP/1.0 ", status, "\r\nContent-Type: ", content_type,
+                "\r\nContent-Length: ", body.size(),
+                "\r\nConnection: close\r\n\r\n", body);
+}
+
+}  // namespace
+
+MetricsHttpServer::MetricsHttpServer(int port, std::vector<Writer> writers)
+  : port_(port), writers_(std::move(writers)) {}
+
+MetricsHttpServer::~MetricsHttpServer() {
+  stopping_ = true;
+  thread_.reset();
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+}
+
+Status MetricsHttpServer::Start() {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    return errors::Internal("socket() failed: ", strerror(errno));
+  }
+  int reuse = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+  sockaddr_in address;
+  memset(&address, 0, sizeof address);
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port_);
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+           sizeof address) != 0 ||
+      listen(listen_fd_, 16) != 0) {
+    return errors::Unavailable("Unable to listen on port ", port_, ": ",
+                               strerror(errno));
+  }
+  thread_.reset(Env::Default()->StartThread(ThreadOptions(), "metrics_http",
+                                            [this]() { Serve(); }));
+  LOG(INFO) << "Serving metrics at http://localhost:" << port_ << "/metrics";
+  return Status::OK();
+}
+
+void MetricsHttpServer::Serve() {
+  while (!stopping_) {
+    pollfd listen_poll;
+    listen_poll.fd = listen_fd_;
+    listen_poll.events = POLLIN;
+    if (poll(&listen_poll, 1, kPollTimeoutMillis) <= 0) {
+      continue;
+    }
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    // Slow clients should not block the server forever.
+    timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+    HandleConnection(fd);
+    close(fd);
+  }
+}
+
+void MetricsHttpServer::HandleConnection(int fd) {
+  string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == string::npos &&
+         request.size() < kMaxRequestSize) {
+    ssize_t res = read(fd, buffer, sizeof buffer);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      break;
+    }
+    request.append(buffer, res);
+  }
+  const string request_line = request.substr(0, request.find("\r\n"));
+  if (request_line.compare(0, 13, "GET /metrics ") != 0 &&
+      request_line != "GET /metrics") {
+    WriteAll(fd, MakeResponse("404 Not Found", "text/plain", "Not found\n"));
+    return;
+  }
+  string body;
+  for (const Writer& writer : writers_) {
+    writer(&body);
+  }
+  WriteAll(fd, MakeResponse("200 OK", "text/plain; version=0.0.4", body));
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
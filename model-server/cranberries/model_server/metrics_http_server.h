@@ -0,0 +1,48 @@
+#ifndef CRANBERRIES_METRICS_HTTP_SERVER_H_
+#define CRANBERRIES_METRICS_HTTP_SERVER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Minimal HTTP/1.0 server which exposes metrics in Prometheus text format on
+// GET /metrics. It listens on localhost only and serves connections one by
+// one from a single thread, which is enough for a scraper.
+class MetricsHttpServer {
+ public:
+  // Appends metrics to the page.
+  using Writer = std::function<void(string*)>;
+
+  MetricsHttpServer(int port, std::vector<Writer> writers);
+  // Stops the server.
+  ~MetricsHttpServer();
+
+  // Binds the port and starts the serving thread.
+  Status Start();
+
+ private:
+  void Serve();
+  void HandleConnection(int fd);
+
+  const int port_;
+  const std::vector<Writer> writers_;
+  int listen_fd_ = -1;
+  std::atomic<bool> stopping_{false};
+  std::unique_ptr<Thread> thread_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(MetricsHttpServer);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_METRICS_HTTP_SERVER_H_
@@ -0,0 +1,217 @@
+#include "metrics.h"
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+
+using tensorflow::Status;
+using tensorflow::int64;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::cranberries::LatencyHistogram;
+using tensorflow::serving::cranberries::PredictCallMetrics;
+using tensorflow::serving::cranberries::PredictMetrics;
+using tensorflow::serving::cranberries::PredictStage;
+using tensorflow::serving::cranberries::PredictTrace;
+using tensorflow::serving::cranberries::ShardedCounter;
+using tensorflow::serving::cranberries::WarmupMetrics;
+
+namespace {
+
+const int kLookup = static_cast<int>(PredictStage::kLookup);
+const int kRun = static_cast<int>(PredictStage::kRun);
+const int kEncode = static_cast<int>(PredictStage::kEncode);
+const int kTotal = static_cast<int>(PredictStage::kTotal);
+
+TEST(ShardedCounterTest, SumsAllShards) {
+  ShardedCounter counter;
+  EXPECT_EQ(0, counter.Get());
+  counter.Add(5);
+  counter.Add(-2);
+  EXPECT_EQ(3, counter.Get());
+}
+
+TEST(LatencyHistogramTest, PutsValuesIntoBuckets) {
+  const auto& bounds = LatencyHistogram::BucketBounds();
+  LatencyHistogram histogram;
+  histogram.Record(0);
+  histogram.Record(bounds[0]);
+  histogram.Record(bounds[0] + 1);
+  histogram.Record(bounds.back() + 1);
+
+  const LatencyHistogram::Snapshot snapshot = histogram.GetSnapshot();
+  ASSERT_EQ(bounds.size() + 1, snapshot.counts.size());
+  EXPECT_EQ(2, snapshot.counts[0]);
+  EXPECT_EQ(1, snapshot.counts[1]);
+  EXPECT_EQ(1, snapshot.counts.back());
+  EXPECT_EQ(4, snapshot.count);
+  EXPECT_EQ(2 * bounds[0] + 1 + bounds.back() + 1, snapshot.sum_micros);
+}
+
+TEST(PredictMetricsTest, ReturnsSameEntryForSameKey) {
+  PredictMetrics metrics;
+  PredictCallMetrics* a = metrics.Get(ServableId{"model", 1}, "sig");
+  PredictCallMetrics* b = metrics.Get(ServableId{"model", 2}, "sig");
+  EXPECT_NE(a, b);
+  for (int i = 0; i < 100; i++) {
+    metrics.Get(ServableId{"model", i + 3}, "sig");
+  }
+  EXPECT_EQ(a, metrics.Get(ServableId{"model", 1}, "sig"));
+  EXPECT_EQ(b, metrics.Get(ServableId{"model", 2}, "sig"));
+  EXPECT_NE(a, metrics.Get(ServableId{"model", 1}, ""));
+  EXPECT_EQ("model", a->model);
+  EXPECT_EQ("1", a->version);
+  EXPECT_EQ("sig", a->signature);
+}
+
+TEST(PredictMetricsTest, WritesPrometheusFormat) {
+  PredictMetrics metrics;
+  PredictCallMetrics* call = metrics.Get(ServableId{"model", 1}, "sig\"");
+  call->requests.Add(3);
+  call->errors.Add(1);
+  call->latency[kTotal].Record(15);
+
+  std::string out;
+  metrics.WritePrometheus(&out);
+  const std::string labels =
+      "model=\"model\",version=\"1\",signature=\"sig\\\"\"";
+  EXPECT_NE(std::string::npos,
+            out.find("# TYPE cranberries_predict_requests_total counter\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_requests_total{" + labels + "} 3\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_errors_total{" + labels + "} 1\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_in_flight{" + labels + "} 0\n"));
+  const std::string total_labels = labels + ",stage=\"total\"";
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_latency_microseconds_bucket{" +
+                     total_labels + ",le=\"10\"} 0\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_latency_microseconds_bucket{" +
+                     total_labels + ",le=\"20\"} 1\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_latency_microseconds_bucket{" +
+                     total_labels + ",le=\"+Inf\"} 1\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_latency_microseconds_sum{" +
+                     total_labels + "} 15\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_requests_total{model=\"\","
+                     "version=\"\",signature=\"\"} 0\n"));
+}
+
+TEST(PredictTraceTest, RecordsSeenStagesOfSuccessfulCall) {
+  PredictMetrics metrics;
+  PredictCallMetrics* call = metrics.Get(ServableId{"model", 2}, "sig");
+  {
+    PredictTrace trace(&metrics);
+    trace.SetCall(call);
+    EXPECT_EQ(1, call->in_flight.Get());
+    trace.Lap(PredictStage::kLookup);
+    trace.Lap(PredictStage::kRun);
+    trace.Finish(Status::OK());
+  }
+  EXPECT_EQ(1, call->requests.Get());
+  EXPECT_EQ(0, call->errors.Get());
+  EXPECT_EQ(0, call->in_flight.Get());
+  EXPECT_EQ(1, call->latency[kLookup].GetSnapshot().count);
+  EXPECT_EQ(1, call->latency[kRun].GetSnapshot().count);
+  EXPECT_EQ(0, call->latency[kEncode].GetSnapshot().count);
+  EXPECT_EQ(1, call->latency[kTotal].GetSnapshot().count);
+}
+
+TEST(PredictTraceTest, CountsErrorsWithoutLatency) {
+  PredictMetrics metrics;
+  {
+    PredictTrace trace(&metrics);
+    trace.SetServable(ServableId{"model", 2}, "sig");
+    trace.Lap(PredictStage::kLookup);
+    trace.Finish(tensorflow::errors::Internal("failed"));
+  }
+  PredictCallMetrics* call = metrics.Get(ServableId{"model", 2}, "sig");
+  EXPECT_EQ(1, call->requests.Get());
+  EXPECT_EQ(1, call->errors.Get());
+  EXPECT_EQ(0, call->in_flight.Get());
+  EXPECT_EQ(0, call->latency[kTotal].GetSnapshot().count);
+}
+
+TEST(PredictTraceTest, CountsRoutedCalls) {
+  PredictMetrics metrics;
+  for (int i = 0; i < 3; i++) {
+    PredictTrace trace(&metrics);
+    trace.SetServable(ServableId{"model", 2}, "sig");
+    if (i > 0) {
+      trace.SetRouted();
+    }
+    trace.Finish(Status::OK());
+  }
+  PredictCallMetrics* call = metrics.Get(ServableId{"model", 2}, "sig");
+  EXPECT_EQ(3, call->requests.Get());
+  EXPECT_EQ(2, call->routed.Get());
+}
+
+TEST(PredictTraceTest, AttributesEarlyFailuresToUnknownModels) {
+  PredictMetrics metrics;
+  for (int i = 0; i < 3; i++) {
+    PredictTrace trace(&metrics);
+    trace.Finish(tensorflow::errors::NotFound("no such model"));
+  }
+  EXPECT_EQ(3, metrics.unknown()->requests.Get());
+  EXPECT_EQ(3, metrics.unknown()->errors.Get());
+
+  std::string out;
+  metrics.WritePrometheus(&out);
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_predict_errors_total{model=\"\","
+                     "version=\"\",signature=\"\"} 3\n"));
+}
+
+TEST(PredictTraceTest, CountsEachRequestOfBatch) {
+  PredictMetrics metrics;
+  PredictCallMetrics* call = metrics.Get(ServableId{"model", 2}, "sig");
+  {
+    PredictTrace trace(&metrics, 3);
+    trace.SetCall(call);
+    EXPECT_EQ(3, call->in_flight.Get());
+    trace.Lap(PredictStage::kRun);
+    trace.Finish(std::vector<Status>{
+        Status::OK(), tensorflow::errors::InvalidArgument("bad"),
+        Status::OK()});
+  }
+  {
+    PredictTrace trace(&metrics, 2);
+    trace.SetCall(call);
+    trace.Finish(tensorflow::errors::Internal("failed"));
+  }
+  EXPECT_EQ(5, call->requests.Get());
+  EXPECT_EQ(3, call->errors.Get());
+  EXPECT_EQ(0, call->in_flight.Get());
+  EXPECT_EQ(1, call->latency[kRun].GetSnapshot().count);
+  EXPECT_EQ(1, call->latency[kTotal].GetSnapshot().count);
+}
+
+TEST(PredictTraceTest, DoesNothingWithoutMetrics) {
+  PredictTrace trace(nullptr);
+  trace.SetServable(ServableId{"model", 1}, "sig");
+  trace.Lap(PredictStage::kRun);
+  trace.Finish(Status::OK());
+}
+
+TEST(WarmupMetricsTest, KeepsLastVersionOfModel) {
+  WarmupMetrics metrics;
+  metrics.Record(ServableId{"model", 1}, 10, 1000);
+  metrics.Record(ServableId{"model", 2}, 20, 3000);
+
+  std::string out;
+  metrics.WritePrometheus(&out);
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_model_warmup_requests{model=\"model\","
+                     "version=\"2\"} 20\n"));
+  EXPECT_NE(std::string::npos,
+            out.find("cranberries_model_warmup_microseconds{model=\"model\","
+                     "version=\"2\"} 3000\n"));
+  EXPECT_EQ(std::string::npos, out.find("version=\"1\""));
+}
+
+}  // namespace
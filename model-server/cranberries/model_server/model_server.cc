@@ -11,12 +11,19 @@
 // ModelServer has inter-request batching support built-in, by using the
 // BatchingSession at:
 //     tensorflow_serving/batching/batching_session.h
+// Batching parameters can be set per model in Zookeeper, see
+//     cranberries/core/model_config.proto
 //
 // For detailed description of example Zookeeper configuration, see
 //     zookeeper_source.cc
 //
 // To specify port (default 8500): --port=my_port
 // To enable batching (default disabled): --enable_batching
+// To serve Predict from N asynchronous completion queues instead of the
+// synchronous gRPC server: --grpc_async_completion_queues=N
+//
+// Besides PredictionService, the server implements
+//     cranberries/model_server/cranberries_prediction_service.proto
 
 #include <unistd.h>
 #include <iostream>
@@ -33,6 +40,8 @@
 #include "grpc++/support/status_code_enum.h"
 #include "grpc/grpc.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/init_main.h"
 #include "tensorflow/core/platform/protobuf.h"
@@ -46,11 +55,22 @@
 #include "tensorflow_serving/model_servers/model_platform_types.h"
 #include "tensorflow_serving/model_servers/platform_config_util.h"
 #include "tensorflow_serving/model_servers/server_core.h"
-#include "tensorflow_serving/servables/tensorflow/get_model_metadata_impl.h"
-#include "tensorflow_serving/servables/tensorflow/saved_model_bundle_source_adapter.h"
+#include "cranberries/model_server/admission_controller.h"
+#include "cranberries/model_server/async_prediction_server.h"
+#include "cranberries/model_server/cranberries_prediction_service_impl.h"
+#include "cranberries/model_server/metrics.h"
+#include "cranberries/model_server/metrics_http_server.h"
+#include "cranberries/model_server/model_warmup.h"
 #include "cranberries/model_server/predict_impl.h"
+#include "cranberries/model_server/prediction_service_impl.h"
+#include "cranberries/model_server/result_cache.h"
+#include "cranberries/model_server/tensor_codec.h"
 #include "cranberries/model_server/model_server_config.pb.h"
 #include "zookeeper_cc/zookeeper_cc.h"
+#include "cranberries/core/lazy_model_loader.h"
+#include "cranberries/core/memory_budget.h"
+#include "cranberries/core/model_bundle_source_adapter.h"
+#include "cranberries/core/model_config_registry.h"
 #include "cranberries/core/zookeeper_source.h"
 #include "cranberries/core/zookeeper_state_reporter.h"
 
@@ -59,12 +79,12 @@ using tensorflow::serving::AspiredVersionPolicy;
 using tensorflow::serving::AvailabilityPreservingPolicy;
 using tensorflow::serving::BatchingParameters;
 using tensorflow::serving::EventBus;
-using tensorflow::serving::GetModelMetadataImpl;
-using tensorflow::serving::SavedModelBundleSourceAdapter;
-using tensorflow::serving::SessionBundleSourceAdapterConfig;
+using tensorflow::serving::SavedModelBundle;
+using tensorflow::serving::ServableId;
 using tensorflow::serving::ServableState;
 using tensorflow::serving::ServerCore;
 using tensorflow::serving::SessionBundleConfig;
+using tensorflow::serving::StoragePath;
 using tensorflow::serving::TensorflowPredictor;
 using tensorflow::serving::UniquePtrWithDeps;
 using tensorflow::string;
@@ -72,25 +92,143 @@ using tensorflow::string;
 using grpc::InsecureServerCredentials;
 using grpc::Server;
 using grpc::ServerBuilder;
-using grpc::ServerContext;
-using tensorflow::serving::GetModelMetadataRequest;
-using tensorflow::serving::GetModelMetadataResponse;
-using tensorflow::serving::PredictRequest;
-using tensorflow::serving::PredictResponse;
-using tensorflow::serving::PredictionService;
 using tensorflow::Status;
 
 using cranberries::ModelServerConfig;
 using zookeeper_cc::Zookeeper;
+using tensorflow::serving::cranberries::AdmissionController;
+using tensorflow::serving::cranberries::AsyncPredictionServer;
+using tensorflow::serving::cranberries::AsyncPredictionService;
+using tensorflow::serving::cranberries::LazyModelLoader;
+using tensorflow::serving::cranberries::MemoryBudget;
+using tensorflow::serving::cranberries::CranberriesPredictionServiceImpl;
+using tensorflow::serving::cranberries::MetricsHttpServer;
+using tensorflow::serving::cranberries::PredictMetrics;
+using tensorflow::serving::cranberries::RunWarmup;
+using tensorflow::serving::cranberries::ModelBundleSourceAdapter;
+using tensorflow::serving::cranberries::ModelConfigRegistry;
+using tensorflow::serving::cranberries::PredictionPlanCache;
+using tensorflow::serving::cranberries::PredictionServiceImpl;
+using tensorflow::serving::cranberries::ResultCache;
+using tensorflow::serving::cranberries::TensorEncoding;
+using tensorflow::serving::cranberries::ParseTensorEncoding;
 using tensorflow::serving::cranberries::ZookeeperSource;
+using tensorflow::serving::cranberries::WarmupMetrics;
+using tensorflow::serving::cranberries::WarmupResult;
 using tensorflow::serving::cranberries::ZookeeperStateReporter;
 
 namespace {
 
+// Objects shared by the custom model config loader and PredictionService.
+struct ServerComponents {
+  SessionBundleConfig session_bundle_config;
+  // Zero means no limit.
+  tensorflow::int64 load_timeout_micros = 0;
+  // Null if memory of loaded models is not limited, otherwise it's
+  // subscribed to the manager's event bus and shows notes via the state
+  // reporter.
+  std::unique_ptr<MemoryBudget> memory_budget;
+  double graph_overhead_factor = 1;
+  LazyModelLoader::Options lazy_loader_options;
+  // Owned by the manager, set once models are loaded.
+  LazyModelLoader* lazy_loader = nullptr;
+  ZookeeperSource::Options source_options;
+  // Owned by the manager, set once models are loaded.
+  ZookeeperSource* source = nullptr;
+  // Filled by ZookeeperSource, read when models are loaded and served.
+  ModelConfigRegistry model_configs;
+  // Caches below are subscribed to the manager's event bus, which drops
+  // entries of unloaded servables. Plans keep pointers to `metrics`.
+  std::unique_ptr<PredictionPlanCache> plan_cache;
+  // Null if result caching is disabled.
+  std::unique_ptr<ResultCache> result_cache;
+  // Null if admission control is disabled.
+  std::unique_ptr<AdmissionController> admission_controller;
+  // Null if metrics are not exported.
+  std::unique_ptr<PredictMetrics> metrics;
+  WarmupMetrics warmup_metrics;
+};
+
+// Disconnects the memory budget, which outlives the manager, from the state
+// reporter owned by the manager.
+struct MemoryBudgetNotesReset {
+  ~MemoryBudgetNotesReset() { budget->SetNoteCallback(nullptr); }
+  MemoryBudget* budget;
+};
+
+// Replays warmup requests of a freshly loaded version.
+Status WarmupModel(const ServableId& id, const StoragePath& path,
+                   const SavedModelBundle& bundle,
+                   WarmupMetrics* warmup_metrics) {
+  WarmupResult result;
+  TF_RETURN_IF_ERROR(RunWarmup(path, bundle, &result));
+  if (result.num_requests > 0) {
+    LOG(INFO) << "Warmed up " << id.DebugString() << " with "
+              << result.num_requests << " requests in "
+              << result.duration_micros / 1000 << " ms";
+  }
+  warmup_metrics->Record(id, result.num_requests, result.duration_micros);
+  return Status::OK();
+}
+
+// Appends counters of server-wide components in Prometheus text format.
+void WriteComponentMetrics(const ServerComponents& components, string* out) {
+  if (components.source) {
+    const ZookeeperSource::Stats stats = components.source->GetStats();
+    tensorflow::strings::StrAppend(
+        out,
+        "# TYPE cranberries_zookeeper_watch_events_total counter\n"
+        "cranberries_zookeeper_watch_events_total ", stats.watch_events, "\n",
+        "# TYPE cranberries_zookeeper_requests_total counter\n"
+        "cranberries_zookeeper_requests_total ", stats.zookeeper_requests,
+        "\n",
+        "# TYPE cranberries_aspired_versions_updates_total counter\n"
+        "cranberries_aspired_versions_updates_total ", stats.updates, "\n",
+        "# TYPE cranberries_aspired_versions_update_latency_microseconds "
+        "summary\n"
+        "cranberries_aspired_versions_update_latency_microseconds_sum ",
+        stats.update_latency_micros_sum, "\n",
+        "cranberries_aspired_versions_update_latency_microseconds_count ",
+        stats.update_latency_count, "\n");
+  }
+  if (components.result_cache) {
+    const ResultCache::Stats stats = components.result_cache->GetStats();
+    tensorflow::strings::StrAppend(
+        out,
+        "# TYPE cranberries_result_cache_hits_total counter\n"
+        "cranberries_result_cache_hits_total ", stats.hits, "\n",
+        "# TYPE cranberries_result_cache_misses_total counter\n"
+        "cranberries_result_cache_misses_total ", stats.misses, "\n",
+        "# TYPE cranberries_result_cache_evictions_total counter\n"
+        "cranberries_result_cache_evictions_total ", stats.evictions, "\n",
+        "# TYPE cranberries_result_cache_bytes gauge\n"
+        "cranberries_result_cache_bytes ", stats.bytes, "\n");
+  }
+  components.warmup_metrics.WritePrometheus(out);
+  if (components.admission_controller) {
+    tensorflow::strings::StrAppend(
+        out,
+        "# TYPE cranberries_admission_rejected_total counter\n"
+        "cranberries_admission_rejected_total ",
+        components.admission_controller->num_rejected(), "\n");
+  }
+  if (components.memory_budget) {
+    tensorflow::strings::StrAppend(
+        out,
+        "# TYPE cranberries_model_memory_budget_bytes gauge\n"
+        "cranberries_model_memory_budget_bytes ",
+        components.memory_budget->budget_bytes(), "\n",
+        "# TYPE cranberries_model_memory_reserved_bytes gauge\n"
+        "cranberries_model_memory_reserved_bytes ",
+        components.memory_budget->reserved_bytes(), "\n");
+  }
+}
+
 tensorflow::Status LoadCustomModelConfig(
     const ::google::protobuf::Any& any,
     EventBus<ServableState>* servable_event_bus,
-    UniquePtrWithDeps<AspiredVersionsManager>* manager) {
+    UniquePtrWithDeps<AspiredVersionsManager>* manager,
+    ServerComponents* components) {
   ModelServerConfig config;
   CHECK(any.UnpackTo(&config));
 
@@ -102,90 +240,118 @@ tensorflow::Status LoadCustomModelConfig(
       new ZookeeperStateReporter(zookeeper.get()));
   std::unique_ptr<EventBus<ServableState>::Subscription> subscription =
       servable_event_bus->Subscribe(state_reporter->GetEventBusCallback());
+  ZookeeperStateReporter* reporter = state_reporter.get();
+  std::unique_ptr<EventBus<ServableState>::Subscription> plan_subscription =
+      servable_event_bus->Subscribe(
+          components->plan_cache->GetEventBusCallback());
+  std::unique_ptr<EventBus<ServableState>::Subscription> result_subscription;
+  if (components->result_cache) {
+    result_subscription = servable_event_bus->Subscribe(
+        components->result_cache->GetEventBusCallback());
+  }
+  std::unique_ptr<EventBus<ServableState>::Subscription> memory_subscription;
+  if (components->memory_budget) {
+    components->memory_budget->SetNoteCallback(
+        [reporter](const ServableId& id, const string& note) {
+          reporter->SetNote(id, note);
+        });
+    memory_subscription = servable_event_bus->Subscribe(
+        components->memory_budget->GetEventBusCallback());
+  }
 
-  std::unique_ptr<SavedModelBundleSourceAdapter> bundle_adapter;
-  SessionBundleSourceAdapterConfig bundle_adapter_config;
-  TF_CHECK_OK(SavedModelBundleSourceAdapter::Create(
-      bundle_adapter_config, &bundle_adapter));
+  ModelBundleSourceAdapter::Options adapter_options;
+  adapter_options.post_load = [components](const ServableId& id,
+                                           const StoragePath& path,
+                                           SavedModelBundle* bundle) {
+    components->plan_cache->AttachPlans(id, bundle);
+    return WarmupModel(id, path, *bundle, &components->warmup_metrics);
+  };
+  adapter_options.load_timeout_micros = components->load_timeout_micros;
+  adapter_options.memory_budget = components->memory_budget.get();
+  adapter_options.graph_overhead_factor = components->graph_overhead_factor;
+  std::unique_ptr<ModelBundleSourceAdapter> bundle_adapter(
+      new ModelBundleSourceAdapter(components->session_bundle_config,
+                                   &components->model_configs,
+                                   adapter_options));
   ConnectSourceToTarget(bundle_adapter.get(), manager->get());
 
-  std::unique_ptr<ZookeeperSource> source(
-      new ZookeeperSource(zookeeper.get()));
-  ConnectSourceToTarget(source.get(), bundle_adapter.get());
+  LazyModelLoader::Options lazy_loader_options =
+      components->lazy_loader_options;
+  lazy_loader_options.set_note = [reporter](const ServableId& id,
+                                            const string& note) {
+    reporter->SetNote(id, note);
+  };
+  std::unique_ptr<LazyModelLoader> lazy_loader(
+      new LazyModelLoader(&components->model_configs, lazy_loader_options));
+  std::unique_ptr<EventBus<ServableState>::Subscription> lazy_subscription =
+      servable_event_bus->Subscribe(lazy_loader->GetEventBusCallback());
+  if (components->memory_budget) {
+    // Withholds versions which did not fit until memory is released.
+    ConnectSourceToTarget(lazy_loader.get(), components->memory_budget.get());
+    ConnectSourceToTarget(components->memory_budget.get(),
+                          bundle_adapter.get());
+  } else {
+    ConnectSourceToTarget(lazy_loader.get(), bundle_adapter.get());
+  }
+  components->lazy_loader = lazy_loader.get();
+
+  ZookeeperSource::Options source_options = components->source_options;
+  source_options.snapshot_path = config.aspired_models_snapshot();
+  std::unique_ptr<ZookeeperSource> source(new ZookeeperSource(
+      zookeeper.get(), &components->model_configs, source_options));
+  ConnectSourceToTarget(source.get(), lazy_loader.get());
+  components->source = source.get();
 
   manager->AddDependency(std::move(zookeeper));
   manager->AddDependency(std::move(state_reporter));
+  if (components->memory_budget) {
+    manager->AddDependency(std::unique_ptr<MemoryBudgetNotesReset>(
+        new MemoryBudgetNotesReset{components->memory_budget.get()}));
+  }
   manager->AddDependency(std::move(subscription));
+  manager->AddDependency(std::move(plan_subscription));
+  if (result_subscription) {
+    manager->AddDependency(std::move(result_subscription));
+  }
+  if (memory_subscription) {
+    manager->AddDependency(std::move(memory_subscription));
+  }
   manager->AddDependency(std::move(bundle_adapter));
+  manager->AddDependency(std::move(lazy_subscription));
+  manager->AddDependency(std::move(lazy_loader));
   manager->AddDependency(std::move(source));
   return Status::OK();
 }
 
-grpc::Status ToGRPCStatus(const tensorflow::Status& status) {
-  const int kErrorMessageLimit = 1024;
-  string error_message;
-  if (status.error_message().length() > kErrorMessageLimit) {
-    error_message =
-        status.error_message().substr(0, kErrorMessageLimit) + "...TRUNCATED";
-  } else {
-    error_message = status.error_message();
-  }
-  return grpc::Status(static_cast<grpc::StatusCode>(status.code()),
-                      error_message);
-}
-
-class PredictionServiceImpl final : public PredictionService::Service {
- public:
-  explicit PredictionServiceImpl(std::unique_ptr<ServerCore> core,
-                                 bool use_saved_model)
-      : core_(std::move(core)),
-        predictor_(new TensorflowPredictor(use_saved_model)),
-        use_saved_model_(use_saved_model) {}
-
-  grpc::Status Predict(ServerContext* context, const PredictRequest* request,
-                       PredictResponse* response) override {
-    const grpc::Status status =
-        ToGRPCStatus(predictor_->Predict(core_.get(), *request, response));
-    if (!status.ok()) {
-      VLOG(1) << "Predict failed: " << status.error_message();
-    }
-    return status;
-  }
-
-  grpc::Status GetModelMetadata(ServerContext* context,
-                                const GetModelMetadataRequest* request,
-                                GetModelMetadataResponse* response) override {
-    if (!use_saved_model_) {
-      return ToGRPCStatus(tensorflow::errors::InvalidArgument(
-          "GetModelMetadata API is only available when use_saved_model is "
-          "set to true"));
-    }
-    const grpc::Status status =
-        ToGRPCStatus(GetModelMetadataImpl::GetModelMetadata(
-            core_.get(), *request, response));
-    if (!status.ok()) {
-      VLOG(1) << "GetModelMetadata failed: " << status.error_message();
-    }
-    return status;
-  }
-
- private:
-  std::unique_ptr<ServerCore> core_;
-  std::unique_ptr<TensorflowPredictor> predictor_;
-  bool use_saved_model_;
-};
-
 void RunServer(int port, std::unique_ptr<ServerCore> core,
-               bool use_saved_model) {
+               const TensorflowPredictor::Options& predictor_options,
+               const CranberriesPredictionServiceImpl::Options& stream_options,
+               AdmissionController* admission_controller,
+               const AsyncPredictionServer::Options* async_options) {
   // "0.0.0.0" is the way to listen on localhost in gRPC.
   const string server_address = "0.0.0.0:" + std::to_string(port);
-  PredictionServiceImpl service(std::move(core), use_saved_model);
+  PredictionServiceImpl service(std::move(core), predictor_options,
+                                admission_controller);
+  AsyncPredictionService async_service(&service);
+  CranberriesPredictionServiceImpl cranberries_service(stream_options,
+                                                       &service);
   ServerBuilder builder;
   std::shared_ptr<grpc::ServerCredentials> creds = InsecureServerCredentials();
   builder.AddListeningPort(server_address, creds);
-  builder.RegisterService(&service);
+  std::unique_ptr<AsyncPredictionServer> async_server;
+  if (async_options) {
+    builder.RegisterService(&async_service);
+    async_server.reset(
+        new AsyncPredictionServer(*async_options, &async_service, &builder));
+  } else {
+    builder.RegisterService(&service);
+  }
+  builder.RegisterService(&cranberries_service);
   builder.SetMaxMessageSize(tensorflow::kint32max);
   std::unique_ptr<Server> server(builder.BuildAndStart());
+  if (async_server) {
+    async_server->Start();
+  }
   LOG(INFO) << "Running ModelServer at " << server_address << " ...";
   server->Wait();
 }
@@ -197,9 +363,36 @@ int main(int argc, char** argv) {
   bool enable_batching = false;
   tensorflow::string zookeeper_hosts = "localhost:2181";
   tensorflow::string zookeeper_base;
+  tensorflow::string aspired_models_snapshot;
+  tensorflow::int64 zookeeper_coalescing_window_ms = 500;
+  tensorflow::int32 zookeeper_reload_threads = 4;
   // Tensorflow session parallelism of zero means that both inter and intra op
   // thread pools will be auto configured.
   tensorflow::int64 tensorflow_session_parallelism = 0;
+  // Zero completion queues means that synchronous gRPC server is used.
+  tensorflow::int32 grpc_async_completion_queues = 0;
+  bool grpc_async_pin_threads = false;
+  // Defaults keep the concurrency of the server before worker threads were
+  // added, larger values have not been benchmarked yet.
+  tensorflow::int32 grpc_async_calls_per_queue = 2;
+  tensorflow::int32 grpc_async_worker_threads = 0;
+  tensorflow::string output_tensor_encoding = "repeated_field";
+  tensorflow::int64 result_cache_bytes = 64 << 20;
+  tensorflow::int32 predict_stream_threads = 8;
+  tensorflow::int32 metrics_port = 0;
+  tensorflow::int32 num_load_threads = 4;
+  tensorflow::int32 num_unload_threads = 1;
+  tensorflow::int32 max_num_load_retries = 5;
+  tensorflow::int64 load_retry_interval_seconds = 60;
+  tensorflow::int64 load_timeout_seconds = 0;
+  tensorflow::int64 model_memory_budget_bytes = 0;
+  // TensorFlow's flags do not support floating point numbers.
+  tensorflow::string model_graph_overhead_factor = "4";
+  tensorflow::int64 on_demand_idle_unload_seconds = 600;
+  tensorflow::int64 on_demand_memory_cap_bytes = 0;
+  tensorflow::int64 on_demand_load_timeout_seconds = 30;
+  bool admission_control = false;
+  AdmissionController::Options admission_options;
   std::vector<tensorflow::Flag> flag_list = {
       tensorflow::Flag("port", &port, "port to listen on"),
       tensorflow::Flag("enable_batching", &enable_batching, "enable batching"),
@@ -210,13 +403,126 @@ int main(int argc, char** argv) {
                        "Specify path to the base node for this instance of "
                        "TensorFlow Serving, e.g. /cranberries/servers/server-42 "
                        "(required)."),
+      tensorflow::Flag("aspired_models_snapshot", &aspired_models_snapshot,
+                       "If not empty, aspired models last seen in Zookeeper "
+                       "are saved to this file and loaded from it on start, "
+                       "before Zookeeper is read."),
+      tensorflow::Flag("zookeeper_coalescing_window_ms",
+                       &zookeeper_coalescing_window_ms,
+                       "Changes of aspired models seen in Zookeeper within "
+                       "that many milliseconds since the first one are "
+                       "applied at once, with a single update per model. "
+                       "Zero applies every change right away."),
+      tensorflow::Flag("zookeeper_reload_threads", &zookeeper_reload_threads,
+                       "Number of threads which apply changes of aspired "
+                       "models, different models are updated in parallel."),
       tensorflow::Flag("tensorflow_session_parallelism",
                        &tensorflow_session_parallelism,
                        "Number of threads to use for running a "
-                       "Tensorflow session. Auto-configured by default.")};
+                       "Tensorflow session. Auto-configured by default."),
+      tensorflow::Flag("grpc_async_completion_queues",
+                       &grpc_async_completion_queues,
+                       "If positive, serve Predict asynchronously from that "
+                       "many gRPC completion queues, each one is polled by "
+                       "its own thread. Synchronous server is used by "
+                       "default."),
+      tensorflow::Flag("grpc_async_pin_threads", &grpc_async_pin_threads,
+                       "Pin threads polling completion queues to distinct "
+                       "CPU cores (only with --grpc_async_completion_queues)."),
+      tensorflow::Flag("grpc_async_calls_per_queue",
+                       &grpc_async_calls_per_queue,
+                       "Number of Predict calls accepted by each completion "
+                       "queue at a time (only with "
+                       "--grpc_async_completion_queues)."),
+      tensorflow::Flag("grpc_async_worker_threads", &grpc_async_worker_threads,
+                       "Number of threads which run asynchronous Predict "
+                       "calls, i.e. the maximal number of concurrently "
+                       "running ones; zero means one per completion queue "
+                       "(only with --grpc_async_completion_queues)."),
+      tensorflow::Flag("output_tensor_encoding", &output_tensor_encoding,
+                       "Default encoding of Predict's output tensors: "
+                       "'repeated_field' (e.g. float_val) or 'tensor_content' "
+                       "(raw bytes, faster). Clients can override it by "
+                       "sending 'cranberries-output-encoding' metadata."),
+      tensorflow::Flag("result_cache_bytes", &result_cache_bytes,
+                       "Memory limit of the cache of Predict responses, which "
+                       "is used for models with 'cache_results' set in their "
+                       "Zookeeper configuration. Zero disables the cache."),
+      tensorflow::Flag("predict_stream_threads", &predict_stream_threads,
+                       "Number of threads running requests received via "
+                       "PredictStream, shared by all streams."),
+      tensorflow::Flag("admission_control", &admission_control,
+                       "Reject Predict calls whose remaining deadline is "
+                       "shorter than the model's median latency, as well as "
+                       "calls which do not fit into the model's queue."),
+      tensorflow::Flag("admission_max_running_per_model",
+                       &admission_options.max_running_per_model,
+                       "Limit of concurrently running Predict calls per "
+                       "model with --admission_control, others are queued. "
+                       "Zero means no limit. With batching it should be at "
+                       "least the batch size."),
+      tensorflow::Flag("admission_max_queued_per_model",
+                       &admission_options.max_queued_per_model,
+                       "Limit of queued Predict calls per model with "
+                       "--admission_control."),
+      tensorflow::Flag("metrics_port", &metrics_port,
+                       "If positive, serve metrics in Prometheus text format "
+                       "at http://localhost:<metrics_port>/metrics."),
+      tensorflow::Flag("num_load_threads", &num_load_threads,
+                       "Number of models loaded concurrently. Zero means "
+                       "that models are loaded one by one by the manager's "
+                       "thread, which also blocks all other changes."),
+      tensorflow::Flag("num_unload_threads", &num_unload_threads,
+                       "Number of models unloaded concurrently, zero means "
+                       "that the manager's thread unloads them."),
+      tensorflow::Flag("max_num_load_retries", &max_num_load_retries,
+                       "Number of retries of a failed load before the "
+                       "version is given up."),
+      tensorflow::Flag("load_retry_interval_seconds",
+                       &load_retry_interval_seconds,
+                       "Delay between retries of a failed load."),
+      tensorflow::Flag("load_timeout_seconds", &load_timeout_seconds,
+                       "If positive, a load attempt (including warmup) which "
+                       "takes longer fails and may be retried."),
+      tensorflow::Flag("model_memory_budget_bytes",
+                       &model_memory_budget_bytes,
+                       "If positive, limit of estimated RAM taken by loaded "
+                       "models. Loads which do not fit fail and are retried "
+                       "later, and again whenever memory is released."),
+      tensorflow::Flag("model_graph_overhead_factor",
+                       &model_graph_overhead_factor,
+                       "Model's RAM is estimated as size of its variables "
+                       "plus size of its graph multiplied by this factor, "
+                       "which may be fractional."),
+      tensorflow::Flag("on_demand_idle_unload_seconds",
+                       &on_demand_idle_unload_seconds,
+                       "Versions of models with 'load_on_demand' in their "
+                       "configuration are unloaded after that many seconds "
+                       "without requests, zero means never."),
+      tensorflow::Flag("on_demand_memory_cap_bytes",
+                       &on_demand_memory_cap_bytes,
+                       "If positive, limit of estimated RAM of models loaded "
+                       "on demand, least recently used ones are unloaded to "
+                       "fit new ones."),
+      tensorflow::Flag("on_demand_load_timeout_seconds",
+                       &on_demand_load_timeout_seconds,
+                       "How long a request waits for a model loaded on "
+                       "demand before it fails with UNAVAILABLE.")};
   string usage = tensorflow::Flags::Usage(argv[0], flag_list);
   const bool parse_result = tensorflow::Flags::Parse(&argc, argv, flag_list);
-  if (!parse_result || zookeeper_base.empty()) {
+  TensorEncoding output_encoding;
+  double graph_overhead_factor = 0;
+  if (!parse_result || zookeeper_base.empty() ||
+      zookeeper_coalescing_window_ms < 0 || zookeeper_reload_threads <= 0 ||
+      predict_stream_threads <= 0 || num_load_threads < 0 ||
+      num_unload_threads < 0 || max_num_load_retries < 0 ||
+      load_retry_interval_seconds < 0 || load_timeout_seconds < 0 ||
+      model_memory_budget_bytes < 0 ||
+      !tensorflow::strings::safe_strtod(model_graph_overhead_factor.c_str(),
+                                        &graph_overhead_factor) ||
+      graph_overhead_factor < 0 || on_demand_idle_unload_seconds < 0 ||
+      on_demand_memory_cap_bytes < 0 || on_demand_load_timeout_seconds < 0 ||
+      !ParseTensorEncoding(output_tensor_encoding, &output_encoding)) {
     std::cout << usage;
     return -1;
   }
@@ -233,10 +539,14 @@ int main(int argc, char** argv) {
     ModelServerConfig config;
     config.set_zookeeper_hosts(zookeeper_hosts);
     config.set_zookeeper_base(zookeeper_base);
+    config.set_aspired_models_snapshot(aspired_models_snapshot);
     options.model_server_config.mutable_custom_model_config()->PackFrom(config);
   }
 
-  SessionBundleConfig session_bundle_config;
+  // Outlives `core`, whose manager references it.
+  ServerComponents components;
+  SessionBundleConfig& session_bundle_config =
+      components.session_bundle_config;
   // Batching config
   if (enable_batching) {
     BatchingParameters* batching_parameters =
@@ -246,7 +556,7 @@ int main(int argc, char** argv) {
   }
 
   // use_saved_model is fixed to `true` because `LoadCustomModelConfig`
-  // uses SavedModelBundleSourceAdapter only for now, and it's hard-coded.
+  // uses ModelBundleSourceAdapter only for now, and it's hard-coded.
 
   session_bundle_config.mutable_session_config()
       ->set_intra_op_parallelism_threads(tensorflow_session_parallelism);
@@ -255,14 +565,88 @@ int main(int argc, char** argv) {
   options.platform_config_map = CreateTensorFlowPlatformConfigMap(
       session_bundle_config, true /* use_saved_model */);
 
-  options.custom_model_config_loader = &LoadCustomModelConfig;
+  if (result_cache_bytes > 0) {
+    components.result_cache.reset(new ResultCache(result_cache_bytes));
+  }
+  if (admission_control) {
+    components.admission_controller.reset(
+        new AdmissionController(admission_options));
+  }
+  std::unique_ptr<MetricsHttpServer> metrics_server;
+  if (metrics_port > 0) {
+    components.metrics.reset(new PredictMetrics);
+    const PredictMetrics* metrics = components.metrics.get();
+    metrics_server.reset(new MetricsHttpServer(
+        metrics_port,
+        {[metrics](string* out) { metrics->WritePrometheus(out); },
+         [&components](string* out) {
+           WriteComponentMetrics(components, out);
+         }}));
+    TF_CHECK_OK(metrics_server->Start());
+  }
+  components.plan_cache.reset(
+      new PredictionPlanCache(components.metrics.get()));
+  options.custom_model_config_loader = [&components](
+      const ::google::protobuf::Any& any,
+      EventBus<ServableState>* servable_event_bus,
+      UniquePtrWithDeps<AspiredVersionsManager>* manager) {
+    return LoadCustomModelConfig(any, servable_event_bus, manager,
+                                 &components);
+  };
 
   options.aspired_version_policy =
       std::unique_ptr<AspiredVersionPolicy>(new AvailabilityPreservingPolicy);
+  // Retries of a failed load happen on its load thread, so with several
+  // threads they do not block loads of other models.
+  options.num_load_threads = num_load_threads;
+  options.num_unload_threads = num_unload_threads;
+  options.max_num_load_retries = max_num_load_retries;
+  options.load_retry_interval_micros =
+      load_retry_interval_seconds * tensorflow::int64{1000000};
+  components.load_timeout_micros =
+      load_timeout_seconds * tensorflow::int64{1000000};
+  if (model_memory_budget_bytes > 0) {
+    components.memory_budget.reset(
+        new MemoryBudget(model_memory_budget_bytes));
+  }
+  components.graph_overhead_factor = graph_overhead_factor;
+  LazyModelLoader::Options& lazy_loader_options =
+      components.lazy_loader_options;
+  lazy_loader_options.idle_unload_micros =
+      on_demand_idle_unload_seconds * tensorflow::int64{1000000};
+  lazy_loader_options.memory_cap_bytes = on_demand_memory_cap_bytes;
+  lazy_loader_options.graph_overhead_factor = graph_overhead_factor;
+  lazy_loader_options.load_wait_micros =
+      on_demand_load_timeout_seconds * tensorflow::int64{1000000};
+
+  components.source_options.coalescing_window_micros =
+      zookeeper_coalescing_window_ms * tensorflow::int64{1000};
+  components.source_options.num_reload_threads = zookeeper_reload_threads;
 
   std::unique_ptr<ServerCore> core;
   TF_CHECK_OK(ServerCore::Create(std::move(options), &core));
-  RunServer(port, std::move(core), true /* use_saved_model */);
+  TensorflowPredictor::Options predictor_options;
+  predictor_options.use_saved_model = true;
+  predictor_options.plan_cache = components.plan_cache.get();
+  predictor_options.result_cache = components.result_cache.get();
+  predictor_options.model_configs = &components.model_configs;
+  predictor_options.metrics = components.metrics.get();
+  predictor_options.lazy_loader = components.lazy_loader;
+  predictor_options.output_encoding = output_encoding;
+  CranberriesPredictionServiceImpl::Options stream_options;
+  stream_options.num_threads = predict_stream_threads;
+  if (grpc_async_completion_queues > 0) {
+    AsyncPredictionServer::Options async_options;
+    async_options.num_completion_queues = grpc_async_completion_queues;
+    async_options.pin_threads = grpc_async_pin_threads;
+    async_options.calls_per_queue = grpc_async_calls_per_queue;
+    async_options.num_worker_threads = grpc_async_worker_threads;
+    RunServer(port, std::move(core), predictor_options, stream_options,
+              components.admission_controller.get(), &async_options);
+  } else {
+    RunServer(port, std::move(core), predictor_options, stream_options,
+              components.admission_controller.get(), nullptr);
+  }
 
   return 0;
 }
@@ -0,0 +1,87 @@
+#include "model_warmup.h"
+
+#include <memory>
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "cranberries/model_server/metrics.h"
+#include "cranberries/model_server/predict_impl.h"
+#include "cranberries/model_server/prediction_plan.h"
+#include "cranberries/model_server/tensor_codec.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+const char kWarmupRequestsPath[] = "assets.extra/warmup_requests";
+
+namespace {
+
+Status RunWarmupRequest(const PredictRequest& request,
+                        const SavedModelBundle& bundle) {
+  const string signature_name =
+      request.model_spec().signature_name().empty()
+          ? kDefaultServingSignatureDefKey
+          : request.model_spec().signature_name();
+  PredictionPlan plan;
+  TF_RETURN_IF_ERROR(BuildPredictionPlan(bundle.meta_graph_def,
+                                         signature_name,
+                                         request.output_filter(), &plan));
+  PredictResponse response;
+  PredictTrace trace(nullptr);
+  return RunPredictionPlan(plan, request, TensorEncoding::kRepeatedField,
+                           bundle.session.get(), &response, &trace);
+}
+
+}  // namespace
+
+Status RunWarmup(const string& export_dir, const SavedModelBundle& bundle,
+                 WarmupResult* result) {
+  *result = WarmupResult();
+  Env* env = Env::Default();
+  const string path = io::JoinPath(export_dir, kWarmupRequestsPath);
+  std::unique_ptr<RandomAccessFile> file;
+  const Status open_status = env->NewRandomAccessFile(path, &file);
+  if (errors::IsNotFound(open_status)) {
+    return Status::OK();
+  }
+  TF_RETURN_IF_ERROR(open_status);
+
+  const int64 start_micros = env->NowMicros();
+  io::RecordReader reader(file.get());
+  uint64 offset = 0;
+  string record;
+  while (true) {
+    const Status read_status = reader.ReadRecord(&offset, &record);
+    if (errors::IsOutOfRange(read_status)) {
+      break;
+    }
+    TF_RETURN_IF_ERROR(read_status);
+    if (result->num_requests >= kMaxWarmupRequests) {
+      return errors::InvalidArgument(path, " has more than ",
+                                     kMaxWarmupRequests, " requests");
+    }
+    PredictRequest request;
+    if (!request.ParseFromString(record)) {
+      return errors::InvalidArgument("Unable to parse warmup request ",
+                                     result->num_requests, " from ", path);
+    }
+    const Status status = RunWarmupRequest(request, bundle);
+    if (!status.ok()) {
+      return Status(status.code(),
+                    strings::StrCat("Warmup request ", result->num_requests,
+                                    " failed: ", status.error_message()));
+    }
+    result->num_requests++;
+  }
+  result->duration_micros = env->NowMicros() - start_micros;
+  return Status::OK();
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,36 @@
+#ifndef CRANBERRIES_MODEL_WARMUP_H_
+#define CRANBERRIES_MODEL_WARMUP_H_
+
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Path of warmup requests relative to SavedModel's directory: a TFRecord
+// file of serialized PredictRequest's.
+extern const char kWarmupRequestsPath[];
+
+// At most that many warmup requests are replayed.
+const int kMaxWarmupRequests = 1000;
+
+struct WarmupResult {
+  int64 num_requests = 0;
+  int64 duration_micros = 0;
+};
+
+// Replays warmup requests of the SavedModel from `export_dir` through
+// `bundle`'s session the same way Predict does, so lazy initialization of
+// kernels, allocators and graph optimizations happens before the version
+// serves traffic. Does nothing if the model has no warmup requests. Fails on
+// the first request which fails.
+Status RunWarmup(const string& export_dir, const SavedModelBundle& bundle,
+                 WarmupResult* result);
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_MODEL_WARMUP_H_
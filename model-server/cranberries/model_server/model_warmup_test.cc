@@ -0,0 +1,134 @@
+#include "model_warmup.h"
+
+#include <stdlib.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/public/session.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+
+using tensorflow::DT_INT32;
+using tensorflow::Env;
+using tensorflow::GraphDef;
+using tensorflow::SavedModelBundle;
+using tensorflow::Session;
+using tensorflow::Status;
+using tensorflow::Tensor;
+using tensorflow::TensorInfo;
+using tensorflow::TensorShape;
+using tensorflow::WritableFile;
+using tensorflow::serving::PredictRequest;
+using tensorflow::serving::cranberries::RunWarmup;
+using tensorflow::serving::cranberries::WarmupResult;
+using tensorflow::serving::cranberries::kWarmupRequestsPath;
+
+namespace {
+
+// Returns input `inp` as output `out` and counts runs.
+class EchoSession : public Session {
+ public:
+  explicit EchoSession(int* num_runs) : num_runs_(num_runs) {}
+
+  Status Create(const GraphDef& graph) override { return Status::OK(); }
+
+  Status Extend(const GraphDef& graph) override { return Status::OK(); }
+
+  Status Run(const std::vector<std::pair<std::string, Tensor>>& inputs,
+             const std::vector<std::string>& output_tensor_names,
+             const std::vector<std::string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    (*num_runs_)++;
+    outputs->assign(output_tensor_names.size(), inputs.at(0).second);
+    return Status::OK();
+  }
+
+  Status Close() override { return Status::OK(); }
+
+ private:
+  int* num_runs_;
+};
+
+class ModelWarmupTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    export_dir_ = tensorflow::io::JoinPath(
+        getenv("TEST_TMPDIR"),
+        ::testing::UnitTest::GetInstance()->current_test_info()->name());
+    const std::string assets_dir =
+        tensorflow::io::JoinPath(export_dir_, "assets.extra");
+    ASSERT_TRUE(Env::Default()->RecursivelyCreateDir(assets_dir).ok());
+
+    bundle_.session.reset(new EchoSession(&num_runs_));
+    auto& signature =
+        (*bundle_.meta_graph_def.mutable_signature_def())
+            [tensorflow::kDefaultServingSignatureDefKey];
+    signature.set_method_name(tensorflow::kPredictMethodName);
+    TensorInfo& input = (*signature.mutable_inputs())["inp"];
+    input.set_name("inp:0");
+    input.set_dtype(DT_INT32);
+    TensorInfo& output = (*signature.mutable_outputs())["out"];
+    output.set_name("out:0");
+    output.set_dtype(DT_INT32);
+  }
+
+  void WriteRequests(const std::vector<PredictRequest>& requests) {
+    std::unique_ptr<WritableFile> file;
+    const std::string path =
+        tensorflow::io::JoinPath(export_dir_, kWarmupRequestsPath);
+    ASSERT_TRUE(Env::Default()->NewWritableFile(path, &file).ok());
+    tensorflow::io::RecordWriter writer(file.get());
+    for (const PredictRequest& request : requests) {
+      ASSERT_TRUE(writer.WriteRecord(request.SerializeAsString()).ok());
+    }
+    ASSERT_TRUE(file->Close().ok());
+  }
+
+  static PredictRequest MakeRequest(const std::string& input_alias) {
+    PredictRequest request;
+    request.mutable_model_spec()->set_name("model");
+    Tensor tensor(DT_INT32, TensorShape({1}));
+    tensor.flat<int>()(0) = 5;
+    tensor.AsProtoField(&(*request.mutable_inputs())[input_alias]);
+    return request;
+  }
+
+  std::string export_dir_;
+  SavedModelBundle bundle_;
+  int num_runs_ = 0;
+};
+
+TEST_F(ModelWarmupTest, SucceedsWithoutWarmupRequests) {
+  WarmupResult result;
+  EXPECT_TRUE(RunWarmup(export_dir_, bundle_, &result).ok());
+  EXPECT_EQ(0, result.num_requests);
+  EXPECT_EQ(0, num_runs_);
+}
+
+TEST_F(ModelWarmupTest, ReplaysRequests) {
+  WriteRequests({MakeRequest("inp"), MakeRequest("inp")});
+  WarmupResult result;
+  EXPECT_TRUE(RunWarmup(export_dir_, bundle_, &result).ok());
+  EXPECT_EQ(2, result.num_requests);
+  EXPECT_EQ(2, num_runs_);
+  EXPECT_GE(result.duration_micros, 0);
+}
+
+TEST_F(ModelWarmupTest, FailsOnInvalidRequest) {
+  WriteRequests({MakeRequest("inp"), MakeRequest("unknown")});
+  WarmupResult result;
+  const Status status = RunWarmup(export_dir_, bundle_, &result);
+  EXPECT_EQ(tensorflow::error::INVALID_ARGUMENT, status.code());
+  EXPECT_NE(std::string::npos,
+            status.error_message().find("Warmup request 1 failed"))
+      << status;
+  EXPECT_EQ(1, num_runs_);
+}
+
+}  // namespace
@@ -0,0 +1,262 @@
+// Compares heap and arena allocation of PredictRequest/PredictResponse:
+//
+// - BM_HeapMessages and BM_ArenaMessages only parse a serialized request,
+//   fill a response and destroy both, in the way the synchronous and the
+//   asynchronous server handle messages.
+// - BM_SyncServer and BM_AsyncServer send Predict calls of model
+//   half_plus_two through gRPC to the server in the same process. Arenas
+//   cover messages only: input and output tensors, vectors of Session::Run(),
+//   plans and gRPC's own buffers are allocated on the heap either way.
+//
+// Run with:
+//   bazel run -c opt //cranberries/model_server:predict_arena_benchmark -- \
+//       --benchmarks=all
+//
+// Label shows number of operator new calls per call, including the client's
+// ones for server benchmarks. Allocations of gRPC core, which uses malloc(),
+// are not counted.
+
+#include <stdlib.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include "google/protobuf/arena.h"
+#include "grpc++/create_channel.h"
+#include "grpc++/security/credentials.h"
+#include "grpc++/security/server_credentials.h"
+#include "grpc++/server.h"
+#include "grpc++/server_builder.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "tensorflow_serving/config/model_server_config.pb.h"
+#include "tensorflow_serving/core/availability_preserving_policy.h"
+#include "tensorflow_serving/model_servers/model_platform_types.h"
+#include "tensorflow_serving/model_servers/platform_config_util.h"
+#include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/test_util/test_util.h"
+#include "cranberries/model_server/async_prediction_server.h"
+#include "cranberries/model_server/predict_impl.h"
+#include "cranberries/model_server/prediction_plan.h"
+#include "cranberries/model_server/prediction_service_impl.h"
+#include "cranberries/model_server/tensor_codec.h"
+
+namespace {
+
+std::atomic<long long> heap_allocations(0);
+
+}  // namespace
+
+void* operator new(size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+namespace {
+
+const int kNumInputs = 4;
+const int kNumOutputs = 2;
+const size_t kArenaInitialBlockSize = 64 * 1024;
+
+Tensor MakeFloatTensor(int num_floats) {
+  Tensor tensor(DT_FLOAT, TensorShape({num_floats}));
+  tensor.flat<float>().setConstant(1.5f);
+  return tensor;
+}
+
+string MakeSerializedRequest(int num_floats) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name("model");
+  Tensor tensor = MakeFloatTensor(num_floats);
+  for (int i = 0; i < kNumInputs; i++) {
+    EncodeTensor(tensor, TensorEncoding::kTensorContent,
+                 &(*request.mutable_inputs())[strings::StrCat("input", i)]);
+  }
+  return request.SerializeAsString();
+}
+
+void ProcessCall(const string& serialized_request, const Tensor& output,
+                 PredictRequest* request, PredictResponse* response) {
+  CHECK(request->ParseFromString(serialized_request));
+  auto& outputs = *response->mutable_outputs();
+  for (int i = 0; i < kNumOutputs; i++) {
+    EncodeTensor(output, TensorEncoding::kTensorContent,
+                 &outputs[strings::StrCat("output", i)]);
+  }
+}
+
+void ReportAllocations(int iters, long long allocations) {
+  testing::SetLabel(strings::Printf("%.1f allocations/call",
+                                    static_cast<double>(allocations) / iters));
+}
+
+void BM_HeapMessages(int iters, int num_floats) {
+  testing::StopTiming();
+  const string serialized_request = MakeSerializedRequest(num_floats);
+  const Tensor output = MakeFloatTensor(num_floats);
+  const long long allocations_before = heap_allocations.load();
+  testing::StartTiming();
+  for (int i = 0; i < iters; i++) {
+    std::unique_ptr<PredictRequest> request(new PredictRequest);
+    std::unique_ptr<PredictResponse> response(new PredictResponse);
+    ProcessCall(serialized_request, output, request.get(), response.get());
+  }
+  testing::StopTiming();
+  ReportAllocations(iters, heap_allocations.load() - allocations_before);
+}
+
+void BM_ArenaMessages(int iters, int num_floats) {
+  testing::StopTiming();
+  const string serialized_request = MakeSerializedRequest(num_floats);
+  const Tensor output = MakeFloatTensor(num_floats);
+  std::unique_ptr<char[]> initial_block(new char[kArenaInitialBlockSize]);
+  google::protobuf::ArenaOptions options;
+  options.initial_block = initial_block.get();
+  options.initial_block_size = kArenaInitialBlockSize;
+  google::protobuf::Arena arena(options);
+  const long long allocations_before = heap_allocations.load();
+  testing::StartTiming();
+  for (int i = 0; i < iters; i++) {
+    auto request =
+        google::protobuf::Arena::CreateMessage<PredictRequest>(&arena);
+    auto response =
+        google::protobuf::Arena::CreateMessage<PredictResponse>(&arena);
+    ProcessCall(serialized_request, output, request, response);
+    arena.Reset();
+  }
+  testing::StopTiming();
+  ReportAllocations(iters, heap_allocations.load() - allocations_before);
+}
+
+BENCHMARK(BM_HeapMessages)->Arg(1)->Arg(1 << 10)->Arg(1 << 16);
+BENCHMARK(BM_ArenaMessages)->Arg(1)->Arg(1 << 10)->Arg(1 << 16);
+
+const char kModelName[] = "half_plus_two";
+
+// Serves model half_plus_two on a local port, the way model_server does
+// with or without --grpc_async_completion_queues.
+class TestServer {
+ public:
+  // Starts the synchronous server unless `async_options` is given.
+  explicit TestServer(const AsyncPredictionServer::Options* async_options) {
+    ModelServerConfig config;
+    ModelConfig* model_config =
+        config.mutable_model_config_list()->add_config();
+    model_config->set_name(kModelName);
+    model_config->set_base_path(test_util::TestSrcDirPath(
+        "servables/tensorflow/testdata/saved_model_half_plus_two"));
+    model_config->set_model_platform(kTensorFlowModelPlatform);
+    ServerCore::Options options;
+    options.model_server_config = config;
+    options.platform_config_map = CreateTensorFlowPlatformConfigMap(
+        SessionBundleConfig(), true /* use_saved_model */);
+    options.aspired_version_policy = std::unique_ptr<AspiredVersionPolicy>(
+        new AvailabilityPreservingPolicy);
+    // Waits until the model is loaded.
+    std::unique_ptr<ServerCore> core;
+    TF_CHECK_OK(ServerCore::Create(std::move(options), &core));
+
+    TensorflowPredictor::Options predictor_options;
+    predictor_options.plan_cache = &plan_cache_;
+    service_.reset(
+        new PredictionServiceImpl(std::move(core), predictor_options));
+    async_service_.reset(new AsyncPredictionService(service_.get()));
+    grpc::ServerBuilder builder;
+    int port = 0;
+    builder.AddListeningPort("localhost:0", grpc::InsecureServerCredentials(),
+                             &port);
+    if (async_options) {
+      builder.RegisterService(async_service_.get());
+      async_server_.reset(new AsyncPredictionServer(
+          *async_options, async_service_.get(), &builder));
+    } else {
+      builder.RegisterService(service_.get());
+    }
+    server_ = builder.BuildAndStart();
+    CHECK(server_) << "Unable to start the server";
+    if (async_server_) {
+      async_server_->Start();
+    }
+    stub_ = PredictionService::NewStub(
+        grpc::CreateChannel(strings::StrCat("localhost:", port),
+                            grpc::InsecureChannelCredentials()));
+  }
+
+  ~TestServer() {
+    server_->Shutdown();
+    if (async_server_) {
+      async_server_->Shutdown();
+    }
+  }
+
+  void Predict(const PredictRequest& request) {
+    grpc::ClientContext context;
+    PredictResponse response;
+    const grpc::Status status = stub_->Predict(&context, request, &response);
+    CHECK(status.ok()) << status.error_message();
+  }
+
+ private:
+  PredictionPlanCache plan_cache_;
+  std::unique_ptr<PredictionServiceImpl> service_;
+  std::unique_ptr<AsyncPredictionService> async_service_;
+  std::unique_ptr<AsyncPredictionServer> async_server_;
+  std::unique_ptr<grpc::Server> server_;
+  std::unique_ptr<PredictionService::Stub> stub_;
+};
+
+void RunServer(int iters, int num_floats, TestServer* server) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name(kModelName);
+  Tensor x(DT_FLOAT, TensorShape({num_floats, 1}));
+  x.flat<float>().setConstant(1.5f);
+  EncodeTensor(x, TensorEncoding::kTensorContent,
+               &(*request.mutable_inputs())["x"]);
+  // The first call of a session initializes it.
+  server->Predict(request);
+  const long long allocations_before = heap_allocations.load();
+  testing::StartTiming();
+  for (int i = 0; i < iters; i++) {
+    server->Predict(request);
+  }
+  testing::StopTiming();
+  ReportAllocations(iters, heap_allocations.load() - allocations_before);
+}
+
+// Servers are started once, the benchmarks are run several times.
+void BM_SyncServer(int iters, int num_floats) {
+  testing::StopTiming();
+  static TestServer* server = new TestServer(nullptr);
+  RunServer(iters, num_floats, server);
+}
+
+void BM_AsyncServer(int iters, int num_floats) {
+  testing::StopTiming();
+  static TestServer* server = [] {
+    AsyncPredictionServer::Options options;
+    return new TestServer(&options);
+  }();
+  RunServer(iters, num_floats, server);
+}
+
+BENCHMARK(BM_SyncServer)->Arg(1)->Arg(1 << 10)->Arg(1 << 16);
+BENCHMARK(BM_AsyncServer)->Arg(1)->Arg(1 << 10)->Arg(1 << 16);
+
+}  // namespace
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
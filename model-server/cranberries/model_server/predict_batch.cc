@@ -0,0 +1,130 @@
+#include "predict_batch.h"
+
+#include <algorithm>
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+bool HaveSameBatchSpec(const PredictRequest& a, const PredictRequest& b) {
+  const ModelSpec& a_spec = a.model_spec();
+  const ModelSpec& b_spec = b.model_spec();
+  if (a_spec.name() != b_spec.name() ||
+      a_spec.signature_name() != b_spec.signature_name() ||
+      a_spec.has_version() != b_spec.has_version() ||
+      a_spec.version().value() != b_spec.version().value() ||
+      a.output_filter_size() != b.output_filter_size()) {
+    return false;
+  }
+  for (int i = 0; i < a.output_filter_size(); i++) {
+    if (a.output_filter(i) != b.output_filter(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Status PrepareBatchItem(const BatchItem* reference, BatchItem* item) {
+  if (item->inputs.empty()) {
+    return errors::InvalidArgument("BatchPredict requires at least one input");
+  }
+  std::sort(item->inputs.begin(), item->inputs.end(),
+            [](const std::pair<string, Tensor>& a,
+               const std::pair<string, Tensor>& b) {
+              return a.first < b.first;
+            });
+  for (const auto& input : item->inputs) {
+    if (input.second.dims() < 1) {
+      return errors::InvalidArgument("Input tensor ", input.first,
+                                     " has no batch dimension");
+    }
+  }
+  item->size = item->inputs[0].second.dim_size(0);
+  for (int i = 0; i < item->inputs.size(); i++) {
+    const string& name = item->inputs[i].first;
+    const Tensor& tensor = item->inputs[i].second;
+    if (tensor.dim_size(0) != item->size) {
+      return errors::InvalidArgument(
+          "Input tensors have different sizes of the first dimension");
+    }
+    if (!reference) {
+      continue;
+    }
+    const Tensor& expected = reference->inputs[i].second;
+    if (reference->inputs[i].first != name ||
+        expected.dtype() != tensor.dtype() ||
+        expected.dims() != tensor.dims()) {
+      return errors::InvalidArgument("Input tensor ", name,
+                                     " is incompatible with the batch");
+    }
+    for (int d = 1; d < tensor.dims(); d++) {
+      if (expected.dim_size(d) != tensor.dim_size(d)) {
+        return errors::InvalidArgument("Input tensor ", name,
+                                       " is incompatible with the batch");
+      }
+    }
+  }
+  return Status::OK();
+}
+
+Status ConcatBatchInputs(const std::vector<BatchItem>& items,
+                         std::vector<std::pair<string, Tensor>>* inputs) {
+  const BatchItem& reference = items.front();
+  for (int i = 0; i < reference.inputs.size(); i++) {
+    if (items.size() == 1) {
+      inputs->push_back(reference.inputs[i]);
+      continue;
+    }
+    std::vector<Tensor> parts;
+    parts.reserve(items.size());
+    for (const BatchItem& item : items) {
+      parts.push_back(item.inputs[i].second);
+    }
+    Tensor batched;
+    TF_RETURN_IF_ERROR(tensor::Concat(parts, &batched));
+    inputs->emplace_back(reference.inputs[i].first, std::move(batched));
+  }
+  return Status::OK();
+}
+
+Status SplitBatchOutputs(const std::vector<string>& output_tensor_aliases,
+                         const std::vector<Tensor>& outputs,
+                         const std::vector<BatchItem>& items,
+                         TensorEncoding output_encoding,
+                         const std::vector<PredictResponse*>& responses) {
+  if (outputs.size() != output_tensor_aliases.size()) {
+    return tensorflow::Status(tensorflow::error::UNKNOWN,
+                              "Predict internal error");
+  }
+  std::vector<int64> sizes;
+  int64 total_size = 0;
+  for (const BatchItem& item : items) {
+    sizes.push_back(item.size);
+    total_size += item.size;
+  }
+  for (int i = 0; i < outputs.size(); i++) {
+    const string& alias = output_tensor_aliases[i];
+    if (outputs[i].dims() < 1 || outputs[i].dim_size(0) != total_size) {
+      return errors::InvalidArgument("Output tensor ", alias,
+                                     " is not batched along the first "
+                                     "dimension");
+    }
+    std::vector<Tensor> parts;
+    if (items.size() == 1) {
+      parts.push_back(outputs[i]);
+    } else {
+      TF_RETURN_IF_ERROR(tensor::Split(outputs[i], sizes, &parts));
+    }
+    for (int j = 0; j < items.size(); j++) {
+      EncodeTensor(parts[j], output_encoding,
+                   &((*responses[items[j].index]->mutable_outputs())[alias]));
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
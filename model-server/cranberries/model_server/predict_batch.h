@@ -0,0 +1,55 @@
+#ifndef CRANBERRIES_PREDICT_BATCH_H_
+#define CRANBERRIES_PREDICT_BATCH_H_
+
+#include <utility>
+#include <vector>
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "cranberries/model_server/tensor_codec.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Building blocks of BatchPredict, which runs several requests with a single
+// Session::Run: their inputs are concatenated along the first dimension and
+// outputs are split back along it.
+
+// Whether `a` and `b` can be run in the same batch: they have the same model
+// spec and output filter.
+bool HaveSameBatchSpec(const PredictRequest& a, const PredictRequest& b);
+
+// Input tensors of a single request in a batch, sorted by name.
+struct BatchItem {
+  // Index of the request in the batch.
+  int index = 0;
+  // Size of the first dimension, equal for all inputs.
+  int64 size = 0;
+  std::vector<std::pair<string, Tensor>> inputs;
+};
+
+// Sorts inputs of `item`, sets its size and checks that they can be
+// concatenated with inputs of `reference`, which is null for the first item.
+Status PrepareBatchItem(const BatchItem* reference, BatchItem* item);
+
+// Concatenates inputs of non-empty `items`, which are prepared by
+// PrepareBatchItem().
+Status ConcatBatchInputs(const std::vector<BatchItem>& items,
+                         std::vector<std::pair<string, Tensor>>* inputs);
+
+// Splits `outputs` of a batch and encodes them into responses of `items`,
+// `responses` are indexed by BatchItem::index. Fails if an output is not
+// batched, in which case some responses may be filled partially.
+Status SplitBatchOutputs(const std::vector<string>& output_tensor_aliases,
+                         const std::vector<Tensor>& outputs,
+                         const std::vector<BatchItem>& items,
+                         TensorEncoding output_encoding,
+                         const std::vector<PredictResponse*>& responses);
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_PREDICT_BATCH_H_
@@ -0,0 +1,249 @@
+#include "predict_batch.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "cranberries/model_server/tensor_codec.h"
+
+using tensorflow::Tensor;
+using tensorflow::TensorShape;
+using tensorflow::errors::IsInvalidArgument;
+using tensorflow::serving::PredictRequest;
+using tensorflow::serving::PredictResponse;
+using tensorflow::serving::cranberries::BatchItem;
+using tensorflow::serving::cranberries::ConcatBatchInputs;
+using tensorflow::serving::cranberries::HaveSameBatchSpec;
+using tensorflow::serving::cranberries::ParseTensorProto;
+using tensorflow::serving::cranberries::PrepareBatchItem;
+using tensorflow::serving::cranberries::SplitBatchOutputs;
+using tensorflow::serving::cranberries::TensorEncoding;
+using tensorflow::test::AsTensor;
+using tensorflow::test::ExpectTensorEqual;
+using ::testing::ElementsAre;
+
+namespace {
+
+PredictRequest MakeRequest() {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name("model");
+  request.mutable_model_spec()->set_signature_name("signature");
+  request.mutable_model_spec()->mutable_version()->set_value(3);
+  request.add_output_filter("a");
+  request.add_output_filter("b");
+  return request;
+}
+
+// Item of `rows` rows, whose inputs "x" and "y" have 2 and 1 columns.
+BatchItem MakeItem(int index, int rows, float first_value) {
+  BatchItem item;
+  item.index = index;
+  std::vector<float> x;
+  std::vector<float> y;
+  for (int i = 0; i < rows; i++) {
+    x.push_back(first_value + 2 * i);
+    x.push_back(first_value + 2 * i + 1);
+    y.push_back(-first_value - i);
+  }
+  // Unsorted on purpose.
+  item.inputs.emplace_back("y", AsTensor<float>(y, TensorShape({rows, 1})));
+  item.inputs.emplace_back("x", AsTensor<float>(x, TensorShape({rows, 2})));
+  return item;
+}
+
+std::vector<std::string> InputNames(const BatchItem& item) {
+  std::vector<std::string> names;
+  for (const auto& input : item.inputs) {
+    names.push_back(input.first);
+  }
+  return names;
+}
+
+Tensor ResponseOutput(const PredictResponse& response,
+                      const std::string& alias) {
+  Tensor tensor;
+  EXPECT_TRUE(ParseTensorProto(response.outputs().at(alias), &tensor));
+  return tensor;
+}
+
+}  // namespace
+
+TEST(HaveSameBatchSpecTest, SameSpec) {
+  EXPECT_TRUE(HaveSameBatchSpec(MakeRequest(), MakeRequest()));
+}
+
+TEST(HaveSameBatchSpecTest, IgnoresInputs) {
+  PredictRequest a = MakeRequest();
+  PredictRequest b = MakeRequest();
+  AsTensor<float>({1, 2}).AsProtoTensorContent(&(*b.mutable_inputs())["x"]);
+  EXPECT_TRUE(HaveSameBatchSpec(a, b));
+}
+
+TEST(HaveSameBatchSpecTest, DifferentModelSpec) {
+  const PredictRequest a = MakeRequest();
+  PredictRequest b = MakeRequest();
+  b.mutable_model_spec()->set_name("other");
+  EXPECT_FALSE(HaveSameBatchSpec(a, b));
+
+  b = MakeRequest();
+  b.mutable_model_spec()->clear_signature_name();
+  EXPECT_FALSE(HaveSameBatchSpec(a, b));
+
+  b = MakeRequest();
+  b.mutable_model_spec()->mutable_version()->set_value(4);
+  EXPECT_FALSE(HaveSameBatchSpec(a, b));
+
+  // The latest version may differ from version 0.
+  PredictRequest latest = MakeRequest();
+  latest.mutable_model_spec()->clear_version();
+  b.mutable_model_spec()->mutable_version()->set_value(0);
+  EXPECT_FALSE(HaveSameBatchSpec(latest, b));
+}
+
+TEST(HaveSameBatchSpecTest, DifferentOutputFilter) {
+  const PredictRequest a = MakeRequest();
+  PredictRequest b = MakeRequest();
+  b.add_output_filter("c");
+  EXPECT_FALSE(HaveSameBatchSpec(a, b));
+
+  // Order of outputs matters, it's the order of Session::Run fetches.
+  b = MakeRequest();
+  b.set_output_filter(0, "b");
+  b.set_output_filter(1, "a");
+  EXPECT_FALSE(HaveSameBatchSpec(a, b));
+}
+
+TEST(PrepareBatchItemTest, SortsInputsAndSetsSize) {
+  BatchItem item = MakeItem(0, 3, 0);
+  ASSERT_TRUE(PrepareBatchItem(nullptr, &item).ok());
+  EXPECT_THAT(InputNames(item), ElementsAre("x", "y"));
+  EXPECT_EQ(3, item.size);
+
+  BatchItem other = MakeItem(1, 5, 0);
+  ASSERT_TRUE(PrepareBatchItem(&item, &other).ok());
+  EXPECT_EQ(5, other.size);
+}
+
+TEST(PrepareBatchItemTest, RejectsInvalidItem) {
+  BatchItem empty;
+  EXPECT_TRUE(IsInvalidArgument(PrepareBatchItem(nullptr, &empty)));
+
+  BatchItem scalar;
+  scalar.inputs.emplace_back("x", AsTensor<float>({1}, TensorShape())));
+  EXPECT_TRUE(IsInvalidArgument(PrepareBatchItem(nullptr, &scalar)));
+
+  BatchItem different_sizes = MakeItem(0, 2, 0);
+  different_sizes.inputs[0].second = AsTensor<float>({1}, TensorShape({1, 1}));
+  EXPECT_TRUE(IsInvalidArgument(PrepareBatchItem(nullptr, &different_sizes)));
+}
+
+TEST(PrepareBatchItemTest, RejectsMismatchedSpec) {
+  BatchItem reference = MakeItem(0, 2, 0);
+  ASSERT_TRUE(PrepareBatchItem(nullptr, &reference).ok());
+
+  BatchItem renamed = MakeItem(1, 2, 0);
+  renamed.inputs[0].first = "z";
+  EXPECT_TRUE(IsInvalidArgument(PrepareBatchItem(&reference, &renamed)));
+
+  BatchItem other_dtype = MakeItem(1, 2, 0);
+  other_dtype.inputs[0].second =
+      AsTensor<tensorflow::int32>({1, 2}, TensorShape({2, 1}));
+  EXPECT_TRUE(IsInvalidArgument(PrepareBatchItem(&reference, &other_dtype)));
+
+  BatchItem other_rank = MakeItem(1, 2, 0);
+  other_rank.inputs[0].second = AsTensor<float>({1, 2}, TensorShape({2}));
+  EXPECT_TRUE(IsInvalidArgument(PrepareBatchItem(&reference, &other_rank)));
+
+  BatchItem other_dims = MakeItem(1, 2, 0);
+  other_dims.inputs[0].second =
+      AsTensor<float>({1, 2, 3, 4}, TensorShape({2, 2}));
+  EXPECT_TRUE(IsInvalidArgument(PrepareBatchItem(&reference, &other_dims)));
+}
+
+TEST(ConcatBatchInputsTest, ConcatenatesAlongFirstDimension) {
+  std::vector<BatchItem> items;
+  items.push_back(MakeItem(0, 1, 0));
+  items.push_back(MakeItem(1, 2, 10));
+  ASSERT_TRUE(PrepareBatchItem(nullptr, &items[0]).ok());
+  ASSERT_TRUE(PrepareBatchItem(&items[0], &items[1]).ok());
+
+  std::vector<std::pair<std::string, Tensor>> inputs;
+  ASSERT_TRUE(ConcatBatchInputs(items, &inputs).ok());
+  ASSERT_EQ(2, inputs.size());
+  EXPECT_EQ("x", inputs[0].first);
+  ExpectTensorEqual<float>(
+      AsTensor<float>({0, 1, 10, 11, 12, 13}, TensorShape({3, 2})),
+      inputs[0].second);
+  EXPECT_EQ("y", inputs[1].first);
+  ExpectTensorEqual<float>(AsTensor<float>({0, -10, -11}, TensorShape({3, 1})),
+                           inputs[1].second);
+}
+
+TEST(ConcatBatchInputsTest, SingleItemIsNotCopied) {
+  std::vector<BatchItem> items;
+  items.push_back(MakeItem(0, 2, 0));
+  ASSERT_TRUE(PrepareBatchItem(nullptr, &items[0]).ok());
+
+  std::vector<std::pair<std::string, Tensor>> inputs;
+  ASSERT_TRUE(ConcatBatchInputs(items, &inputs).ok());
+  ASSERT_EQ(2, inputs.size());
+  EXPECT_TRUE(inputs[0].second.SharesBufferWith(items[0].inputs[0].second));
+}
+
+TEST(SplitBatchOutputsTest, SplitsBySizesOfItems) {
+  // Items are in order of the batch, responses are indexed by requests.
+  std::vector<BatchItem> items(2);
+  items[0].index = 2;
+  items[0].size = 1;
+  items[1].index = 0;
+  items[1].size = 2;
+  std::vector<PredictResponse> responses(3);
+  std::vector<PredictResponse*> response_ptrs;
+  for (auto& response : responses) {
+    response_ptrs.push_back(&response);
+  }
+  const std::vector<Tensor> outputs = {
+      AsTensor<float>({1, 2, 3, 4, 5, 6}, TensorShape({3, 2})),
+      AsTensor<float>({7, 8, 9}, TensorShape({3}))};
+
+  ASSERT_TRUE(SplitBatchOutputs({"a", "b"}, outputs, items,
+                                TensorEncoding::kTensorContent, response_ptrs)
+                  .ok());
+  ExpectTensorEqual<float>(AsTensor<float>({1, 2}, TensorShape({1, 2})),
+                           ResponseOutput(responses[2], "a"));
+  ExpectTensorEqual<float>(AsTensor<float>({7}, TensorShape({1})),
+                           ResponseOutput(responses[2], "b"));
+  ExpectTensorEqual<float>(AsTensor<float>({3, 4, 5, 6}, TensorShape({2, 2})),
+                           ResponseOutput(responses[0], "a"));
+  ExpectTensorEqual<float>(AsTensor<float>({8, 9}, TensorShape({2})),
+                           ResponseOutput(responses[0], "b"));
+  EXPECT_EQ(0, responses[1].outputs_size());
+}
+
+TEST(SplitBatchOutputsTest, FailsOnUnbatchedOutputs) {
+  std::vector<BatchItem> items(2);
+  items[0].size = 1;
+  items[1].index = 1;
+  items[1].size = 2;
+  std::vector<PredictResponse> responses(2);
+  const std::vector<PredictResponse*> response_ptrs = {&responses[0],
+                                                       &responses[1]};
+
+  // The first dimension is not the size of the batch.
+  EXPECT_TRUE(IsInvalidArgument(SplitBatchOutputs(
+      {"a"}, {AsTensor<float>({1, 2}, TensorShape({2}))}, items,
+      TensorEncoding::kTensorContent, response_ptrs)));
+  // A scalar.
+  EXPECT_TRUE(IsInvalidArgument(SplitBatchOutputs(
+      {"a"}, {AsTensor<float>({1}, TensorShape()))}, items,
+      TensorEncoding::kTensorContent, response_ptrs)));
+  // Session::Run has returned fewer outputs than requested.
+  EXPECT_FALSE(SplitBatchOutputs({"a", "b"},
+                                 {AsTensor<float>({1, 2, 3})}, items,
+                                 TensorEncoding::kTensorContent,
+                                 response_ptrs)
+                   .ok());
+}
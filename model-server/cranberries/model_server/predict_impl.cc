@@ -28,6 +28,8 @@ limitations under the License.
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/protobuf/named_tensor.pb.h"
 #include "tensorflow_serving/core/servable_handle.h"
+#include "cranberries/model_server/predict_batch.h"
+#include "cranberries/model_server/tensor_codec.h"
 
 namespace tensorflow {
 namespace serving {
@@ -35,6 +37,7 @@ namespace {
 
 // Implementation of Predict using the legacy SessionBundle GenericSignature.
 Status SessionBundlePredict(ServerCore* core, const PredictRequest& request,
+                            cranberries::TensorEncoding output_encoding,
                             PredictResponse* response) {
   // Validate signatures.
   ServableHandle<SessionBundle> bundle;
@@ -72,7 +75,7 @@ Status SessionBundlePredict(ServerCore* core, const PredictRequest& request,
           "input tensor alias not found in signature: " + alias);
     }
     Tensor tensor;
-    if (!tensor.FromProto(input.second)) {
+    if (!cranberries::ParseTensorProto(input.second, &tensor)) {
       return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                                 "tensor parsing error: " + alias);
     }
@@ -120,161 +123,391 @@ Status SessionBundlePredict(ServerCore* core, const PredictRequest& request,
                               "Predict internal error");
   }
   for (int i = 0; i < outputs.size(); i++) {
-    outputs[i].AsProtoField(
+    cranberries::EncodeTensor(
+        outputs[i], output_encoding,
         &((*response->mutable_outputs())[output_aliases[i]]));
   }
 
   return Status::OK();
 }
 
-// Validate a SignatureDef to make sure it's compatible with prediction, and
-// if so, populate the input and output tensor names.
-Status PreProcessPrediction(const SignatureDef& signature,
-                            const PredictRequest& request,
-                            std::vector<std::pair<string, Tensor>>* inputs,
-                            std::vector<string>* output_tensor_names,
-                            std::vector<string>* output_tensor_aliases) {
-  if (signature.method_name() != kPredictMethodName &&
-      signature.method_name() != kClassifyMethodName &&
-      signature.method_name() != kRegressMethodName) {
-    return errors::Internal(strings::StrCat(
-        "Expected prediction signature method_name to be one of {",
-        kPredictMethodName, ", ", kClassifyMethodName, ", ", kRegressMethodName,
-        "}. Was: ", signature.method_name()));
-  }
-  if (signature.inputs().empty()) {
-    return errors::Internal(strings::StrCat(
-        "Expected at least one input Tensor in prediction signature."));
-  }
-  if (signature.outputs().empty()) {
-    return errors::Internal(strings::StrCat(
-        "Expected at least one output Tensor in prediction signature."));
-  }
+const string& DefaultSignatureName() {
+  static const string* const name = new string(kDefaultServingSignatureDefKey);
+  return *name;
+}
 
+// Validate the request against a PredictionPlan and populate the input
+// tensors.
+Status PreProcessPrediction(const cranberries::PredictionPlan& plan,
+                            const PredictRequest& request,
+                            std::vector<std::pair<string, Tensor>>* inputs) {
   // Verify and prepare input.
-  if (request.inputs().size() != signature.inputs().size()) {
+  if (request.inputs().size() != plan.num_inputs) {
     return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                               "input size does not match signature");
   }
+  inputs->reserve(request.inputs().size());
   for (auto& input : request.inputs()) {
     const string& alias = input.first;
     // When using a Prediction signature, tensors are aliased and the name is
-    // retrieved from the Tensor value, otherwise the alias (key) is the name.
-    string tensor_name = alias;
-    if (signature.method_name() == kPredictMethodName) {
-      auto iter = signature.inputs().find(alias);
-      if (iter == signature.inputs().end()) {
+    // retrieved from the plan, otherwise the alias (key) is the name.
+    const string* tensor_name = &alias;
+    if (plan.inputs_aliased) {
+      auto iter = plan.input_tensor_names.find(alias);
+      if (iter == plan.input_tensor_names.end()) {
         return tensorflow::Status(
             tensorflow::error::INVALID_ARGUMENT,
             "input tensor alias not found in signature: " + alias);
       }
-      tensor_name = iter->second.name();
+      tensor_name = &iter->second;
     }
     Tensor tensor;
-    if (!tensor.FromProto(input.second)) {
+    if (!cranberries::ParseTensorProto(input.second, &tensor)) {
       return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                                 "tensor parsing error: " + alias);
     }
-    inputs->emplace_back(std::make_pair(tensor_name, tensor));
-  }
-
-  // Prepare run target.
-  std::set<string> seen_outputs;
-  std::vector<string> output_filter(request.output_filter().begin(),
-                                    request.output_filter().end());
-  for (auto& alias : output_filter) {
-    auto iter = signature.outputs().find(alias);
-    if (iter == signature.outputs().end()) {
-      return tensorflow::Status(
-          tensorflow::error::INVALID_ARGUMENT,
-          "output tensor alias not found in signature: " + alias);
-    }
-    if (seen_outputs.find(alias) != seen_outputs.end()) {
-      return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
-                                "duplicate output tensor alias: " + alias);
-    }
-    seen_outputs.insert(alias);
-    output_tensor_names->emplace_back(iter->second.name());
-    output_tensor_aliases->emplace_back(alias);
-  }
-  // When no output is specified, fetch all output tensors specified in
-  // the signature.
-  if (output_tensor_names->empty()) {
-    for (auto& iter : signature.outputs()) {
-      output_tensor_names->emplace_back(iter.second.name());
-      // When using a Prediction signature, the tensor output alias is the key
-      // in the map, otherwise we don't use aliases and just go by actual tensor
-      // names.
-      const string alias = signature.method_name() == kPredictMethodName
-                               ? iter.first
-                               : iter.second.name();
-      output_tensor_aliases->emplace_back(alias);
-    }
+    inputs->emplace_back(*tensor_name, std::move(tensor));
   }
   return Status::OK();
 }
 
 // Validate results and populate a PredictResponse.
 Status PostProcessPredictionResult(
-    const SignatureDef& signature,
     const std::vector<string>& output_tensor_aliases,
-    const std::vector<Tensor>& output_tensors, PredictResponse* response) {
+    const std::vector<Tensor>& output_tensors,
+    cranberries::TensorEncoding output_encoding, PredictResponse* response) {
   // Validate and return output.
   if (output_tensors.size() != output_tensor_aliases.size()) {
     return tensorflow::Status(tensorflow::error::UNKNOWN,
                               "Predict internal error");
   }
   for (int i = 0; i < output_tensors.size(); i++) {
-    output_tensors[i].AsProtoField(
+    cranberries::EncodeTensor(
+        output_tensors[i], output_encoding,
         &((*response->mutable_outputs())[output_tensor_aliases[i]]));
   }
   return Status::OK();
 }
 
-// Implementation of Predict using the SavedModel SignatureDef format.
-Status SavedModelPredict(ServerCore* core, const PredictRequest& request,
-                         PredictResponse* response) {
-  // Validate signatures.
-  ServableHandle<SavedModelBundle> bundle;
-  TF_RETURN_IF_ERROR(core->GetServableHandle(request.model_spec(), &bundle));
+}  // namespace
 
-  const string signature_name = request.model_spec().signature_name().empty()
-                                    ? kDefaultServingSignatureDefKey
-                                    : request.model_spec().signature_name();
-  auto iter = bundle->meta_graph_def.signature_def().find(signature_name);
-  if (iter == bundle->meta_graph_def.signature_def().end()) {
-    return errors::FailedPrecondition(
-        "Default serving signature key not found.");
-  }
-  SignatureDef signature = iter->second;
+namespace cranberries {
 
+Status RunPredictionPlan(const PredictionPlan& plan,
+                         const PredictRequest& request,
+                         TensorEncoding output_encoding, Session* session,
+                         PredictResponse* response, PredictTrace* trace) {
   std::vector<std::pair<string, Tensor>> input_tensors;
-  std::vector<string> output_tensor_names;
-  std::vector<string> output_tensor_aliases;
-  TF_RETURN_IF_ERROR(PreProcessPrediction(signature, request, &input_tensors,
-                                          &output_tensor_names,
-                                          &output_tensor_aliases));
+  TF_RETURN_IF_ERROR(PreProcessPrediction(plan, request, &input_tensors));
+  trace->Lap(PredictStage::kDecode);
   std::vector<Tensor> outputs;
   TF_RETURN_IF_ERROR(
-      bundle->session->Run(input_tensors, output_tensor_names, {}, &outputs));
+      session->Run(input_tensors, plan.output_tensor_names, {}, &outputs));
+  trace->Lap(PredictStage::kRun);
 
-  return PostProcessPredictionResult(signature, output_tensor_aliases, outputs,
-                                     response);
+  TF_RETURN_IF_ERROR(PostProcessPredictionResult(
+      plan.output_tensor_aliases, outputs, output_encoding, response));
+  trace->Lap(PredictStage::kEncode);
+  return Status::OK();
 }
 
-}  // namespace
+}  // namespace cranberries
+
+Status TensorflowPredictor::GetPredictionPlan(
+    const ServableHandle<SavedModelBundle>& bundle,
+    const PredictRequest& request,
+    std::shared_ptr<const cranberries::PredictionPlan>* holder,
+    const cranberries::PredictionPlan** plan) {
+  const string& signature_name =
+      request.model_spec().signature_name().empty()
+          ? DefaultSignatureName()
+          : request.model_spec().signature_name();
+  if (request.output_filter().empty()) {
+    const cranberries::PlannedSession* session =
+        cranberries::PlannedSession::FromSession(bundle->session.get());
+    if (session) {
+      *plan = session->GetPlan(signature_name);
+      if (*plan) {
+        return Status::OK();
+      }
+    }
+  }
+  if (plan_cache_) {
+    TF_RETURN_IF_ERROR(plan_cache_->GetOrBuild(
+        bundle.id(), bundle->meta_graph_def, signature_name,
+        request.output_filter(), holder));
+    *plan = holder->get();
+    return Status::OK();
+  }
+  std::shared_ptr<cranberries::PredictionPlan> new_plan(
+      new cranberries::PredictionPlan);
+  TF_RETURN_IF_ERROR(cranberries::BuildPredictionPlan(
+      bundle->meta_graph_def, signature_name, request.output_filter(),
+      new_plan.get()));
+  if (metrics_) {
+    new_plan->metrics = metrics_->Get(bundle.id(), signature_name);
+  }
+  *plan = new_plan.get();
+  *holder = std::move(new_plan);
+  return Status::OK();
+}
+
+Status TensorflowPredictor::GetServableHandle(
+    ServerCore* core, const ModelSpec& model_spec,
+    ServableHandle<SavedModelBundle>* bundle) {
+  if (lazy_loader_ != nullptr) {
+    TF_RETURN_IF_ERROR(lazy_loader_->Acquire(
+        model_spec.name(),
+        model_spec.has_version()
+            ? model_spec.version().value()
+            : cranberries::LazyModelLoader::kLatestVersion));
+  }
+  return core->GetServableHandle(model_spec, bundle);
+}
+
+Status TensorflowPredictor::GetServableHandle(
+    ServerCore* core, const ModelSpec& model_spec,
+    ServableHandle<SavedModelBundle>* bundle, bool* routed) {
+  *routed = false;
+  std::shared_ptr<const cranberries::TrafficSplit> traffic_split;
+  if (!model_spec.has_version() && model_configs_ != nullptr) {
+    traffic_split = model_configs_->GetTrafficSplit(model_spec.name());
+  }
+  if (!traffic_split) {
+    return GetServableHandle(core, model_spec, bundle);
+  }
+  ModelSpec routed_spec = model_spec;
+  routed_spec.mutable_version()->set_value(
+      traffic_split->Pick(cranberries::TrafficSplit::NextCallHash()));
+  const Status status = GetServableHandle(core, routed_spec, bundle);
+  if (errors::IsNotFound(status)) {
+    // The version is not loaded (yet or anymore), the latest one serves its
+    // share instead.
+    return GetServableHandle(core, model_spec, bundle);
+  }
+  *routed = status.ok();
+  return status;
+}
+
+// Implementation of Predict using the SavedModel SignatureDef format.
+Status TensorflowPredictor::SavedModelPredict(
+    ServerCore* core, const PredictRequest& request,
+    cranberries::TensorEncoding output_encoding, PredictResponse* response,
+    cranberries::PredictTrace* trace) {
+  // Validate signatures.
+  ServableHandle<SavedModelBundle> bundle;
+  bool routed;
+  TF_RETURN_IF_ERROR(
+      GetServableHandle(core, request.model_spec(), &bundle, &routed));
+
+  const string& signature_name =
+      request.model_spec().signature_name().empty()
+          ? DefaultSignatureName()
+          : request.model_spec().signature_name();
+  if (routed) {
+    trace->SetRouted();
+  }
+
+  // The plan is resolved first, so that metrics are attributed to existing
+  // signatures only.
+  std::shared_ptr<const cranberries::PredictionPlan> plan_holder;
+  const cranberries::PredictionPlan* plan;
+  const Status plan_status =
+      GetPredictionPlan(bundle, request, &plan_holder, &plan);
+  if (!plan_status.ok()) {
+    trace->SetServable(bundle.id(), "");
+    return plan_status;
+  }
+  trace->SetCall(plan->metrics);
+
+  const bool use_result_cache =
+      result_cache_ != nullptr && model_configs_ != nullptr &&
+      model_configs_->Get(bundle.id().name)->cache_results();
+  cranberries::ResultCacheKey cache_key;
+  if (use_result_cache) {
+    cache_key = cranberries::MakeResultCacheKey(bundle.id(), signature_name,
+                                                output_encoding, request);
+    std::shared_ptr<const PredictResponse> cached =
+        result_cache_->Lookup(cache_key);
+    if (cached) {
+      response->CopyFrom(*cached);
+      trace->Lap(cranberries::PredictStage::kLookup);
+      return Status::OK();
+    }
+  }
+  trace->Lap(cranberries::PredictStage::kLookup);
+
+  TF_RETURN_IF_ERROR(cranberries::RunPredictionPlan(
+      *plan, request, output_encoding, bundle->session.get(), response,
+      trace));
+  if (use_result_cache) {
+    result_cache_->Insert(cache_key, std::shared_ptr<const PredictResponse>(
+                                         new PredictResponse(*response)));
+  }
+  return Status::OK();
+}
 
 Status TensorflowPredictor::Predict(ServerCore* core,
                                     const PredictRequest& request,
+                                    cranberries::TensorEncoding output_encoding,
                                     PredictResponse* response) {
+  cranberries::PredictTrace trace(metrics_);
+  Status status;
   if (!request.has_model_spec()) {
+    status = tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
+                                "Missing ModelSpec");
+  } else if (use_saved_model_) {
+    status =
+        SavedModelPredict(core, request, output_encoding, response, &trace);
+  } else {
+    status = SessionBundlePredict(core, request, output_encoding, response);
+  }
+  trace.Finish(status);
+  return status;
+}
+
+Status TensorflowPredictor::BatchPredict(
+    ServerCore* core,
+    const protobuf::RepeatedPtrField<PredictRequest>& requests,
+    cranberries::TensorEncoding output_encoding,
+    const std::vector<PredictResponse*>& responses,
+    std::vector<Status>* statuses) {
+  if (!use_saved_model_) {
+    return errors::Unimplemented(
+        "BatchPredict is only available when use_saved_model is set to true");
+  }
+  CHECK_EQ(requests.size(), responses.size());
+  statuses->assign(requests.size(), Status::OK());
+  if (requests.empty()) {
+    return Status::OK();
+  }
+  cranberries::PredictTrace trace(metrics_, requests.size());
+  const Status status = SavedModelBatchPredict(
+      core, requests, output_encoding, responses, statuses, &trace);
+  if (status.ok()) {
+    trace.Finish(*statuses);
+  } else {
+    trace.Finish(status);
+  }
+  return status;
+}
+
+Status TensorflowPredictor::SavedModelBatchPredict(
+    ServerCore* core,
+    const protobuf::RepeatedPtrField<PredictRequest>& requests,
+    cranberries::TensorEncoding output_encoding,
+    const std::vector<PredictResponse*>& responses,
+    std::vector<Status>* statuses, cranberries::PredictTrace* trace) {
+  const PredictRequest& first = requests.Get(0);
+  if (!first.has_model_spec()) {
     return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                               "Missing ModelSpec");
   }
-  if (use_saved_model_) {
-    return SavedModelPredict(core, request, response);
+  ServableHandle<SavedModelBundle> bundle;
+  bool routed;
+  TF_RETURN_IF_ERROR(
+      GetServableHandle(core, first.model_spec(), &bundle, &routed));
+  if (routed) {
+    trace->SetRouted();
+  }
+  std::shared_ptr<const cranberries::PredictionPlan> plan_holder;
+  const cranberries::PredictionPlan* plan;
+  const Status plan_status =
+      GetPredictionPlan(bundle, first, &plan_holder, &plan);
+  if (!plan_status.ok()) {
+    trace->SetServable(bundle.id(), "");
+    return plan_status;
+  }
+  trace->SetCall(plan->metrics);
+
+  const string& signature_name =
+      first.model_spec().signature_name().empty()
+          ? DefaultSignatureName()
+          : first.model_spec().signature_name();
+  const bool use_result_cache =
+      result_cache_ != nullptr && model_configs_ != nullptr &&
+      model_configs_->Get(bundle.id().name)->cache_results();
+
+  // Requests are validated one by one, only valid ones which are not cached
+  // are run.
+  std::vector<int> misses;
+  std::vector<cranberries::ResultCacheKey> miss_keys;
+  for (int i = 0; i < requests.size(); i++) {
+    const PredictRequest& request = requests.Get(i);
+    if (!cranberries::HaveSameBatchSpec(first, request)) {
+      (*statuses)[i] = errors::InvalidArgument(
+          "All requests in a batch should have the same ModelSpec and output "
+          "filter");
+      continue;
+    }
+    if (use_result_cache) {
+      const cranberries::ResultCacheKey cache_key =
+          cranberries::MakeResultCacheKey(bundle.id(), signature_name,
+                                          output_encoding, request);
+      std::shared_ptr<const PredictResponse> cached =
+          result_cache_->Lookup(cache_key);
+      if (cached) {
+        responses[i]->CopyFrom(*cached);
+        continue;
+      }
+      miss_keys.push_back(cache_key);
+    }
+    misses.push_back(i);
+  }
+  trace->Lap(cranberries::PredictStage::kLookup);
+
+  std::vector<cranberries::BatchItem> items;
+  std::vector<cranberries::ResultCacheKey> cache_keys;
+  items.reserve(misses.size());
+  for (int j = 0; j < misses.size(); j++) {
+    cranberries::BatchItem item;
+    item.index = misses[j];
+    Status& status = (*statuses)[item.index];
+    status = PreProcessPrediction(*plan, requests.Get(item.index),
+                                  &item.inputs);
+    if (status.ok()) {
+      status = cranberries::PrepareBatchItem(
+          items.empty() ? nullptr : &items.front(), &item);
+    }
+    if (status.ok()) {
+      items.push_back(std::move(item));
+      if (use_result_cache) {
+        cache_keys.push_back(miss_keys[j]);
+      }
+    }
+  }
+  if (items.empty()) {
+    return Status::OK();
+  }
+
+  std::vector<std::pair<string, Tensor>> inputs;
+  std::vector<Tensor> outputs;
+  Status batch_status = cranberries::ConcatBatchInputs(items, &inputs);
+  trace->Lap(cranberries::PredictStage::kDecode);
+  if (batch_status.ok()) {
+    batch_status = bundle->session->Run(inputs, plan->output_tensor_names, {},
+                                        &outputs);
+    trace->Lap(cranberries::PredictStage::kRun);
+  }
+  if (batch_status.ok()) {
+    batch_status = cranberries::SplitBatchOutputs(
+        plan->output_tensor_aliases, outputs, items, output_encoding,
+        responses);
+    trace->Lap(cranberries::PredictStage::kEncode);
+  }
+  if (!batch_status.ok()) {
+    for (const auto& item : items) {
+      (*statuses)[item.index] = batch_status;
+      responses[item.index]->Clear();
+    }
+    return Status::OK();
+  }
+  for (int i = 0; i < cache_keys.size(); i++) {
+    result_cache_->Insert(cache_keys[i],
+                          std::shared_ptr<const PredictResponse>(
+                              new PredictResponse(*responses[items[i].index])));
   }
-  return SessionBundlePredict(core, request, response);
+  return Status::OK();
 }
 
 }  // namespace serving
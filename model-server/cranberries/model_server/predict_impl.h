@@ -16,27 +16,150 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_IMPL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_IMPL_H_
 
+#include <memory>
+#include <vector>
+#include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/protobuf.h"
+#include "tensorflow/core/public/session.h"
 #include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/core/servable_handle.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "cranberries/core/lazy_model_loader.h"
+#include "cranberries/core/model_config_registry.h"
+#include "cranberries/model_server/metrics.h"
+#include "cranberries/model_server/prediction_plan.h"
+#include "cranberries/model_server/result_cache.h"
+#include "cranberries/model_server/tensor_codec.h"
 
 namespace tensorflow {
 namespace serving {
 
+namespace cranberries {
+
+// Request plumbing of Predict once the servable and signature are resolved:
+// converts inputs of `request`, runs `session` and encodes outputs into
+// `response`, reporting decode, run and encode stages to `trace`. Separate
+// from TensorflowPredictor so it can be benchmarked without a ServerCore.
+Status RunPredictionPlan(const PredictionPlan& plan,
+                         const PredictRequest& request,
+                         TensorEncoding output_encoding, Session* session,
+                         PredictResponse* response, PredictTrace* trace);
+
+}  // namespace cranberries
+
 // Utility methods for implementation of PredictionService::Predict.
 class TensorflowPredictor {
  public:
+  struct Options {
+    // If use_saved_model is true, a SavedModelBundle handle will be retrieved
+    // from the ServerCore and the new SavedModel SignatureDef format will be
+    // used.
+    bool use_saved_model = true;
+    // Cache of resolved signatures, used with SavedModel only. Not owned,
+    // may be null.
+    cranberries::PredictionPlanCache* plan_cache = nullptr;
+    // Encoding of output tensors unless specified otherwise for the call.
+    cranberries::TensorEncoding output_encoding =
+        cranberries::TensorEncoding::kRepeatedField;
+    // Cache of responses, used with SavedModel only for models which have
+    // `cache_results` set in `model_configs`. Not owned, may be null.
+    cranberries::ResultCache* result_cache = nullptr;
+    cranberries::ModelConfigRegistry* model_configs = nullptr;
+    // Per-stage latencies and counters of Predict calls. Not owned, may be
+    // null. `plan_cache` should be created with the same metrics.
+    cranberries::PredictMetrics* metrics = nullptr;
+    // Loads requested versions of models which are loaded on demand. Not
+    // owned, may be null.
+    cranberries::LazyModelLoader* lazy_loader = nullptr;
+  };
+
   explicit TensorflowPredictor(bool use_saved_model)
-      : use_saved_model_(use_saved_model) {}
+      : use_saved_model_(use_saved_model),
+        plan_cache_(nullptr),
+        output_encoding_(cranberries::TensorEncoding::kRepeatedField),
+        result_cache_(nullptr),
+        model_configs_(nullptr),
+        metrics_(nullptr),
+        lazy_loader_(nullptr) {}
+  explicit TensorflowPredictor(const Options& options)
+      : use_saved_model_(options.use_saved_model),
+        plan_cache_(options.plan_cache),
+        output_encoding_(options.output_encoding),
+        result_cache_(options.result_cache),
+        model_configs_(options.model_configs),
+        metrics_(options.metrics),
+        lazy_loader_(options.lazy_loader) {}
 
   Status Predict(ServerCore* core, const PredictRequest& request,
+                 PredictResponse* response) {
+    return Predict(core, request, output_encoding_, response);
+  }
+
+  // Same as above, but overrides encoding of output tensors.
+  Status Predict(ServerCore* core, const PredictRequest& request,
+                 cranberries::TensorEncoding output_encoding,
                  PredictResponse* response);
 
+  // Runs `requests` with a single Session::Run, concatenating their inputs
+  // along the first dimension and splitting outputs back to `responses` (one
+  // per request). Requests which cannot be batched with the first one fail
+  // individually, their errors are stored in `statuses`. Returned status is
+  // the one of the whole batch, e.g. when the model is not found. With the
+  // result cache, cached requests are not run and results of the others are
+  // cached, the same way as with Predict.
+  Status BatchPredict(
+      ServerCore* core,
+      const protobuf::RepeatedPtrField<PredictRequest>& requests,
+      cranberries::TensorEncoding output_encoding,
+      const std::vector<PredictResponse*>& responses,
+      std::vector<Status>* statuses);
+
+  cranberries::TensorEncoding output_encoding() const {
+    return output_encoding_;
+  }
+
  private:
-  // If use_saved_model_ is true, a SavedModelBundle handle will be retrieved
-  // from the ServerCore and the new SavedModel SignatureDef format will be
-  // used.
+  Status SavedModelPredict(ServerCore* core, const PredictRequest& request,
+                           cranberries::TensorEncoding output_encoding,
+                           PredictResponse* response,
+                           cranberries::PredictTrace* trace);
+
+  // BatchPredict of non-empty `requests`.
+  Status SavedModelBatchPredict(
+      ServerCore* core,
+      const protobuf::RepeatedPtrField<PredictRequest>& requests,
+      cranberries::TensorEncoding output_encoding,
+      const std::vector<PredictResponse*>& responses,
+      std::vector<Status>* statuses, cranberries::PredictTrace* trace);
+
+  // Gets the servable, loading it first if it's loaded on demand. Calls
+  // without version are routed by the model's traffic split, if any, in
+  // which case `routed` is set.
+  Status GetServableHandle(ServerCore* core, const ModelSpec& model_spec,
+                           ServableHandle<SavedModelBundle>* bundle,
+                           bool* routed);
+
+  // Same as above, without routing.
+  Status GetServableHandle(ServerCore* core, const ModelSpec& model_spec,
+                           ServableHandle<SavedModelBundle>* bundle);
+
+  // Gets the plan attached to the servable (see
+  // PredictionPlanCache::AttachPlans()) or, failing that, a cached or a new
+  // one, which is kept alive by `holder`.
+  Status GetPredictionPlan(
+      const ServableHandle<SavedModelBundle>& bundle,
+      const PredictRequest& request,
+      std::shared_ptr<const cranberries::PredictionPlan>* holder,
+      const cranberries::PredictionPlan** plan);
+
   bool use_saved_model_;
+  cranberries::PredictionPlanCache* plan_cache_;
+  cranberries::TensorEncoding output_encoding_;
+  cranberries::ResultCache* result_cache_;
+  cranberries::ModelConfigRegistry* model_configs_;
+  cranberries::PredictMetrics* metrics_;
+  cranberries::LazyModelLoader* lazy_loader_;
 };
 
 }  // namespace serving
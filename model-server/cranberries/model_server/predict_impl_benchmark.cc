@@ -0,0 +1,276 @@
+// Benchmarks of the Predict request plumbing: resolving the signature and
+// output filter, converting input tensors, encoding output tensors and
+// recording metrics. The model is a fake session which returns its inputs as
+// outputs, so nothing else is measured. Parsing and serialization of messages
+// is done by gRPC and is not included either, see tensor_codec_benchmark.
+//
+// Run with:
+//   bazel run -c opt //cranberries/model_server:predict_impl_benchmark -- \
+//       --benchmarks=all
+//
+// Reported items are elements of input and output tensors.
+
+#include "predict_impl.h"
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/protobuf/meta_graph.pb.h"
+#include "tensorflow/core/public/session.h"
+#include "cranberries/model_server/metrics.h"
+#include "cranberries/model_server/prediction_plan.h"
+#include "cranberries/model_server/tensor_codec.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+namespace {
+
+string InputAlias(int index) { return strings::StrCat("in_", index); }
+
+string OutputAlias(int index) { return strings::StrCat("out_", index); }
+
+string TensorName(const string& alias) { return strings::StrCat(alias, ":0"); }
+
+// Returns input `in_<i % num_inputs>` as output `out_<i>`.
+class EchoSession : public Session {
+ public:
+  EchoSession(int num_inputs, int num_outputs) {
+    for (int i = 0; i < num_outputs; i++) {
+      output_to_input_.emplace(TensorName(OutputAlias(i)),
+                               TensorName(InputAlias(i % num_inputs)));
+    }
+  }
+
+  Status Create(const GraphDef& graph) override { return Status::OK(); }
+
+  Status Extend(const GraphDef& graph) override { return Status::OK(); }
+
+  Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    outputs->clear();
+    for (const string& output_name : output_tensor_names) {
+      const string& input_name = output_to_input_.at(output_name);
+      for (const auto& input : inputs) {
+        if (input.first == input_name) {
+          outputs->push_back(input.second);
+          break;
+        }
+      }
+    }
+    return Status::OK();
+  }
+
+  Status Close() override { return Status::OK(); }
+
+ private:
+  std::unordered_map<string, string> output_to_input_;
+};
+
+MetaGraphDef MakeMetaGraphDef(DataType dtype, int num_inputs,
+                              int num_outputs) {
+  MetaGraphDef meta_graph_def;
+  SignatureDef& signature =
+      (*meta_graph_def.mutable_signature_def())[kDefaultServingSignatureDefKey];
+  signature.set_method_name(kPredictMethodName);
+  for (int i = 0; i < num_inputs; i++) {
+    TensorInfo& info = (*signature.mutable_inputs())[InputAlias(i)];
+    info.set_name(TensorName(InputAlias(i)));
+    info.set_dtype(dtype);
+  }
+  for (int i = 0; i < num_outputs; i++) {
+    TensorInfo& info = (*signature.mutable_outputs())[OutputAlias(i)];
+    info.set_name(TensorName(OutputAlias(i)));
+    info.set_dtype(dtype);
+  }
+  return meta_graph_def;
+}
+
+Tensor MakeTensor(DataType dtype, int num_elements) {
+  Tensor tensor(dtype, TensorShape({num_elements}));
+  switch (dtype) {
+    case DT_FLOAT:
+      tensor.flat<float>().setConstant(1.5f);
+      break;
+    case DT_INT64:
+      tensor.flat<int64>().setConstant(42);
+      break;
+    case DT_STRING:
+      tensor.flat<string>().setConstant("example");
+      break;
+    default:
+      LOG(FATAL) << "Unsupported dtype: " << DataTypeString(dtype);
+  }
+  return tensor;
+}
+
+// Filter of `filter_size` outputs in reverse order, empty filter means all
+// outputs.
+PredictRequest MakeRequest(DataType dtype, int num_elements, int num_inputs,
+                           int filter_size) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name("model");
+  const Tensor tensor = MakeTensor(dtype, num_elements);
+  for (int i = 0; i < num_inputs; i++) {
+    // Numeric tensors are sent as `tensor_content`, like Python's
+    // make_tensor_proto() does.
+    EncodeTensor(tensor, TensorEncoding::kTensorContent,
+                 &(*request.mutable_inputs())[InputAlias(i)]);
+  }
+  for (int i = filter_size - 1; i >= 0; i--) {
+    request.add_output_filter(OutputAlias(i));
+  }
+  return request;
+}
+
+struct PredictParams {
+  DataType dtype = DT_FLOAT;
+  int num_elements = 1;
+  int num_inputs = 1;
+  int num_outputs = 1;
+  int filter_size = 0;
+  TensorEncoding output_encoding = TensorEncoding::kRepeatedField;
+  bool with_metrics = false;
+};
+
+// Same steps as TensorflowPredictor::SavedModelPredict() except for getting
+// the servable from ServerCore.
+void BM_Predict(int iters, const PredictParams& params) {
+  testing::StopTiming();
+  const MetaGraphDef meta_graph_def =
+      MakeMetaGraphDef(params.dtype, params.num_inputs, params.num_outputs);
+  const PredictRequest request =
+      MakeRequest(params.dtype, params.num_elements, params.num_inputs,
+                  params.filter_size);
+  const string signature_name = kDefaultServingSignatureDefKey;
+  const ServableId id{"model", 1};
+  PredictMetrics metrics;
+  PredictionPlanCache plan_cache(params.with_metrics ? &metrics : nullptr);
+  SavedModelBundle bundle;
+  bundle.meta_graph_def = meta_graph_def;
+  bundle.session.reset(new EchoSession(params.num_inputs, params.num_outputs));
+  plan_cache.AttachPlans(id, &bundle);
+  const int num_returned_outputs =
+      params.filter_size > 0 ? params.filter_size : params.num_outputs;
+  testing::StartTiming();
+  for (int i = 0; i < iters; i++) {
+    PredictTrace trace(params.with_metrics ? &metrics : nullptr);
+    std::shared_ptr<const PredictionPlan> plan_holder;
+    const PredictionPlan* plan = nullptr;
+    if (request.output_filter().empty()) {
+      plan = PlannedSession::FromSession(bundle.session.get())
+                 ->GetPlan(signature_name);
+    } else {
+      TF_CHECK_OK(plan_cache.GetOrBuild(id, bundle.meta_graph_def,
+                                        signature_name,
+                                        request.output_filter(),
+                                        &plan_holder));
+      plan = plan_holder.get();
+    }
+    trace.SetCall(plan->metrics);
+    trace.Lap(PredictStage::kLookup);
+    PredictResponse response;
+    TF_CHECK_OK(RunPredictionPlan(*plan, request, params.output_encoding,
+                                  bundle.session.get(), &response,
+                                  &trace));
+    trace.Finish(Status::OK());
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters) * params.num_elements *
+                          (params.num_inputs + num_returned_outputs));
+}
+
+void BM_PredictFloat(int iters, int num_elements) {
+  PredictParams params;
+  params.num_elements = num_elements;
+  BM_Predict(iters, params);
+}
+
+void BM_PredictFloatTensorContent(int iters, int num_elements) {
+  PredictParams params;
+  params.num_elements = num_elements;
+  params.output_encoding = TensorEncoding::kTensorContent;
+  BM_Predict(iters, params);
+}
+
+void BM_PredictInt64(int iters, int num_elements) {
+  PredictParams params;
+  params.dtype = DT_INT64;
+  params.num_elements = num_elements;
+  BM_Predict(iters, params);
+}
+
+void BM_PredictString(int iters, int num_elements) {
+  PredictParams params;
+  params.dtype = DT_STRING;
+  params.num_elements = num_elements;
+  BM_Predict(iters, params);
+}
+
+void BM_PredictTensors(int iters, int num_inputs, int num_outputs) {
+  PredictParams params;
+  params.num_elements = 16;
+  params.num_inputs = num_inputs;
+  params.num_outputs = num_outputs;
+  BM_Predict(iters, params);
+}
+
+void BM_PredictOutputFilter(int iters, int filter_size) {
+  PredictParams params;
+  params.num_elements = 16;
+  params.num_outputs = 16;
+  params.filter_size = filter_size;
+  BM_Predict(iters, params);
+}
+
+void BM_PredictWithMetrics(int iters, int num_elements) {
+  PredictParams params;
+  params.num_elements = num_elements;
+  params.with_metrics = true;
+  BM_Predict(iters, params);
+}
+
+// Cost of a PredictionPlanCache miss.
+void BM_BuildPredictionPlan(int iters, int filter_size) {
+  testing::StopTiming();
+  const MetaGraphDef meta_graph_def = MakeMetaGraphDef(DT_FLOAT, 1, 16);
+  const PredictRequest request = MakeRequest(DT_FLOAT, 1, 1, filter_size);
+  testing::StartTiming();
+  for (int i = 0; i < iters; i++) {
+    PredictionPlan plan;
+    TF_CHECK_OK(BuildPredictionPlan(meta_graph_def,
+                                    kDefaultServingSignatureDefKey,
+                                    request.output_filter(), &plan));
+  }
+}
+
+BENCHMARK(BM_PredictFloat)->Arg(1)->Arg(1 << 8)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK(BM_PredictFloatTensorContent)
+    ->Arg(1)
+    ->Arg(1 << 8)
+    ->Arg(1 << 14)
+    ->Arg(1 << 20);
+BENCHMARK(BM_PredictInt64)->Arg(1)->Arg(1 << 8)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK(BM_PredictString)->Arg(1)->Arg(1 << 8)->Arg(1 << 14);
+BENCHMARK(BM_PredictTensors)
+    ->ArgPair(1, 1)
+    ->ArgPair(1, 16)
+    ->ArgPair(16, 1)
+    ->ArgPair(4, 4)
+    ->ArgPair(16, 16);
+BENCHMARK(BM_PredictOutputFilter)->Arg(0)->Arg(1)->Arg(4)->Arg(16);
+BENCHMARK(BM_PredictWithMetrics)->Arg(1)->Arg(1 << 8);
+BENCHMARK(BM_BuildPredictionPlan)->Arg(0)->Arg(1)->Arg(16);
+
+}  // namespace
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,168 @@
+#include "prediction_plan.h"
+
+#include <functional>
+#include <unordered_set>
+#include <utility>
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+const size_t PredictionPlanCache::kMaxPlansPerServable;
+
+Status BuildPredictionPlan(
+    const MetaGraphDef& meta_graph_def, const string& signature_name,
+    const protobuf::RepeatedPtrField<string>& output_filter,
+    PredictionPlan* plan) {
+  auto iter = meta_graph_def.signature_def().find(signature_name);
+  if (iter == meta_graph_def.signature_def().end()) {
+    return errors::FailedPrecondition(
+        "Default serving signature key not found.");
+  }
+  const SignatureDef& signature = iter->second;
+
+  if (signature.method_name() != kPredictMethodName &&
+      signature.method_name() != kClassifyMethodName &&
+      signature.method_name() != kRegressMethodName) {
+    return errors::Internal(strings::StrCat(
+        "Expected prediction signature method_name to be one of {",
+        kPredictMethodName, ", ", kClassifyMethodName, ", ", kRegressMethodName,
+        "}. Was: ", signature.method_name()));
+  }
+  if (signature.inputs().empty()) {
+    return errors::Internal(strings::StrCat(
+        "Expected at least one input Tensor in prediction signature."));
+  }
+  if (signature.outputs().empty()) {
+    return errors::Internal(strings::StrCat(
+        "Expected at least one output Tensor in prediction signature."));
+  }
+
+  // When using a Prediction signature, tensors are aliased and the name is
+  // retrieved from the Tensor value, otherwise the alias (key) is the name.
+  const bool aliased = signature.method_name() == kPredictMethodName;
+  plan->num_inputs = signature.inputs().size();
+  plan->inputs_aliased = aliased;
+  if (aliased) {
+    for (auto& input : signature.inputs()) {
+      plan->input_tensor_names.emplace(input.first, input.second.name());
+    }
+  }
+
+  std::unordered_set<string> seen_outputs;
+  for (auto& alias : output_filter) {
+    auto iter = signature.outputs().find(alias);
+    if (iter == signature.outputs().end()) {
+      return tensorflow::Status(
+          tensorflow::error::INVALID_ARGUMENT,
+          "output tensor alias not found in signature: " + alias);
+    }
+    if (!seen_outputs.insert(alias).second) {
+      return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
+                                "duplicate output tensor alias: " + alias);
+    }
+    plan->output_tensor_names.emplace_back(iter->second.name());
+    plan->output_tensor_aliases.emplace_back(alias);
+  }
+  // When no output is specified, fetch all output tensors specified in
+  // the signature.
+  if (plan->output_tensor_names.empty()) {
+    for (auto& iter : signature.outputs()) {
+      plan->output_tensor_names.emplace_back(iter.second.name());
+      // When using a Prediction signature, the tensor output alias is the key
+      // in the map, otherwise we don't use aliases and just go by actual tensor
+      // names.
+      plan->output_tensor_aliases.emplace_back(aliased ? iter.first
+                                                       : iter.second.name());
+    }
+  }
+  return Status::OK();
+}
+
+Status PredictionPlanCache::GetOrBuild(
+    const ServableId& id, const MetaGraphDef& meta_graph_def,
+    const string& signature_name,
+    const protobuf::RepeatedPtrField<string>& output_filter,
+    std::shared_ptr<const PredictionPlan>* plan) {
+  // Aliases and signature names cannot contain null characters in practice,
+  // so it's a safe separator.
+  string key = signature_name;
+  for (const string& alias : output_filter) {
+    key += '\0';
+    key += alias;
+  }
+  {
+    mutex_lock l(mu_);
+    auto servable = servables_.find(id);
+    if (servable != servables_.end()) {
+      auto iter = servable->second.find(key);
+      if (iter != servable->second.end()) {
+        *plan = iter->second;
+        return Status::OK();
+      }
+    }
+  }
+
+  // Build outside of the lock, concurrent requests may build the same plan
+  // twice, which is harmless.
+  std::shared_ptr<PredictionPlan> new_plan(new PredictionPlan);
+  TF_RETURN_IF_ERROR(BuildPredictionPlan(meta_graph_def, signature_name,
+                                         output_filter, new_plan.get()));
+  if (metrics_) {
+    new_plan->metrics = metrics_->Get(id, signature_name);
+  }
+  *plan = new_plan;
+
+  mutex_lock l(mu_);
+  ServablePlans& servable = servables_[id];
+  if (servable.size() < kMaxPlansPerServable) {
+    servable.emplace(std::move(key), std::move(new_plan));
+  }
+  return Status::OK();
+}
+
+void PredictionPlanCache::AttachPlans(const ServableId& id,
+                                      SavedModelBundle* bundle) {
+  PlannedSession::Plans plans;
+  const protobuf::RepeatedPtrField<string> no_output_filter;
+  for (const auto& signature : bundle->meta_graph_def.signature_def()) {
+    std::unique_ptr<PredictionPlan> plan(new PredictionPlan);
+    // Signatures which are not fit for prediction are left out, requests
+    // to them fail when the plan is built.
+    if (!BuildPredictionPlan(bundle->meta_graph_def, signature.first,
+                             no_output_filter, plan.get())
+             .ok()) {
+      continue;
+    }
+    if (metrics_) {
+      plan->metrics = metrics_->Get(id, signature.first);
+    }
+    plans.emplace(signature.first, std::move(plan));
+  }
+  bundle->session.reset(
+      new PlannedSession(std::move(bundle->session), std::move(plans)));
+}
+
+void PredictionPlanCache::Evict(const ServableId& id) {
+  mutex_lock l(mu_);
+  servables_.erase(id);
+}
+
+EventBus<ServableState>::Callback PredictionPlanCache::GetEventBusCallback() {
+  return std::bind(&PredictionPlanCache::ProcessEvent, this,
+                   std::placeholders::_1);
+}
+
+void PredictionPlanCache::ProcessEvent(
+    const EventBus<ServableState>::EventAndTime& ev) {
+  if (ev.event.manager_state == ServableState::ManagerState::kEnd) {
+    Evict(ev.event.id);
+  }
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
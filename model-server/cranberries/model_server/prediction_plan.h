@@ -0,0 +1,134 @@
+#ifndef CRANBERRIES_PREDICTION_PLAN_H_
+#define CRANBERRIES_PREDICTION_PLAN_H_
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/protobuf.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/protobuf/meta_graph.pb.h"
+#include "tensorflow_serving/core/servable_id.h"
+#include "tensorflow_serving/core/servable_state.h"
+#include "tensorflow_serving/servables/tensorflow/serving_session.h"
+#include "tensorflow_serving/util/event_bus.h"
+#include "cranberries/model_server/metrics.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Everything Predict needs to know about a SignatureDef and an output filter,
+// resolved in advance: it does not depend on request's tensors, so it can be
+// shared by all requests to the same signature with the same output filter.
+struct PredictionPlan {
+  // Number of inputs the signature expects.
+  int num_inputs = 0;
+  // When using a Prediction signature, input tensors are aliased and this map
+  // contains their names. Otherwise, the alias is the name and the map is
+  // empty.
+  bool inputs_aliased = false;
+  std::unordered_map<string, string> input_tensor_names;
+  // Tensors to fetch and aliases to return them under, in the same order.
+  std::vector<string> output_tensor_names;
+  std::vector<string> output_tensor_aliases;
+  // Metrics of calls to the servable and signature, set by
+  // PredictionPlanCache if it has metrics. Not owned.
+  PredictCallMetrics* metrics = nullptr;
+};
+
+// Validates that signature `signature_name` from `meta_graph_def` is
+// compatible with prediction and resolves `output_filter` against it.
+Status BuildPredictionPlan(
+    const MetaGraphDef& meta_graph_def, const string& signature_name,
+    const protobuf::RepeatedPtrField<string>& output_filter,
+    PredictionPlan* plan);
+
+// Session of a loaded servable which carries plans of its signatures without
+// output filter, see PredictionPlanCache::AttachPlans(). They are immutable
+// and live as long as the servable, so Predict gets them without locks.
+class PlannedSession : public ServingSessionWrapper {
+ public:
+  using Plans =
+      std::unordered_map<string, std::unique_ptr<const PredictionPlan>>;
+
+  PlannedSession(std::unique_ptr<Session> wrapped, Plans plans)
+    : ServingSessionWrapper(std::move(wrapped)), plans_(std::move(plans)) {}
+
+  // Returns null if `signature_name` is not a prediction signature.
+  const PredictionPlan* GetPlan(const string& signature_name) const {
+    auto iter = plans_.find(signature_name);
+    return iter == plans_.end() ? nullptr : iter->second.get();
+  }
+
+  // Returns null if `session` is not a PlannedSession.
+  static const PlannedSession* FromSession(const Session* session) {
+    return dynamic_cast<const PlannedSession*>(session);
+  }
+
+ private:
+  const Plans plans_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PlannedSession);
+};
+
+// Thread-safe cache of PredictionPlan's keyed by servable, signature name and
+// output filter. Plans of a servable are dropped when it's unloaded, so the
+// cache should be subscribed to the manager's EventBus<ServableState>.
+//
+// Plans which requests need most, the ones of signatures without output
+// filter, are attached to servables once they are loaded, and the cache is
+// only used for requests with output filter.
+class PredictionPlanCache {
+ public:
+  // Plans for that many distinct output filters are cached per servable, the
+  // rest are built on each request. Protects from unbounded growth when
+  // clients send arbitrary filters.
+  static const size_t kMaxPlansPerServable = 64;
+
+  // Plans get their metrics from `metrics`, which may be null.
+  explicit PredictionPlanCache(PredictMetrics* metrics = nullptr)
+    : metrics_(metrics) {}
+
+  // Returns a cached plan or builds and caches a new one. Errors are not
+  // cached. `meta_graph_def` should belong to servable `id`, which should be
+  // held by the caller: plans are only dropped once the servable reaches kEnd,
+  // so this is what tells two loads of the same version apart.
+  Status GetOrBuild(const ServableId& id, const MetaGraphDef& meta_graph_def,
+                    const string& signature_name,
+                    const protobuf::RepeatedPtrField<string>& output_filter,
+                    std::shared_ptr<const PredictionPlan>* plan);
+
+  // Drops all plans of servable `id`.
+  void Evict(const ServableId& id);
+
+  // Builds plans of all prediction signatures of freshly loaded servable `id`
+  // without output filter and wraps its session into a PlannedSession which
+  // carries them. Should be called before the servable serves requests.
+  void AttachPlans(const ServableId& id, SavedModelBundle* bundle);
+
+  EventBus<ServableState>::Callback GetEventBusCallback();
+
+ private:
+  // Plans of a servable keyed by signature name and output filter.
+  using ServablePlans =
+      std::unordered_map<string, std::shared_ptr<const PredictionPlan>>;
+
+  void ProcessEvent(const EventBus<ServableState>::EventAndTime& ev);
+
+  PredictMetrics* const metrics_;
+  mutable mutex mu_;
+  std::unordered_map<ServableId, ServablePlans, HashServableId> servables_
+      GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PredictionPlanCache);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_PREDICTION_PLAN_H_
@@ -0,0 +1,219 @@
+#include "prediction_plan.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+#include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/public/session.h"
+
+using tensorflow::GraphDef;
+using tensorflow::MetaGraphDef;
+using tensorflow::SavedModelBundle;
+using tensorflow::Session;
+using tensorflow::SignatureDef;
+using tensorflow::Status;
+using tensorflow::Tensor;
+using tensorflow::protobuf::RepeatedPtrField;
+using tensorflow::serving::EventBus;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::ServableState;
+using tensorflow::serving::cranberries::PlannedSession;
+using tensorflow::serving::cranberries::PredictMetrics;
+using tensorflow::serving::cranberries::PredictionPlan;
+using tensorflow::serving::cranberries::PredictionPlanCache;
+
+namespace {
+
+const char kSignature[] = "sig";
+
+using ManagerState = ServableState::ManagerState;
+
+class NoopSession : public Session {
+ public:
+  Status Create(const GraphDef& graph) override { return Status::OK(); }
+
+  Status Extend(const GraphDef& graph) override { return Status::OK(); }
+
+  Status Run(const std::vector<std::pair<std::string, Tensor>>& inputs,
+             const std::vector<std::string>& output_tensor_names,
+             const std::vector<std::string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    return Status::OK();
+  }
+
+  Status Close() override { return Status::OK(); }
+};
+
+// Adds a signature with input "x" and outputs "<output_prefix><i>" named
+// "<output_prefix><i>:0".
+void AddSignature(const std::string& name, const std::string& method_name,
+                  int num_outputs, const std::string& output_prefix,
+                  MetaGraphDef* meta_graph_def) {
+  SignatureDef& signature = (*meta_graph_def->mutable_signature_def())[name];
+  signature.set_method_name(method_name);
+  (*signature.mutable_inputs())["x"].set_name("x:0");
+  for (int i = 0; i < num_outputs; i++) {
+    const std::string alias = output_prefix + std::to_string(i);
+    (*signature.mutable_outputs())[alias].set_name(alias + ":0");
+  }
+}
+
+RepeatedPtrField<std::string> OutputFilter(
+    const std::vector<std::string>& aliases) {
+  RepeatedPtrField<std::string> filter;
+  for (const std::string& alias : aliases) {
+    *filter.Add() = alias;
+  }
+  return filter;
+}
+
+class PredictionPlanCacheTest : public ::testing::Test {
+ protected:
+  PredictionPlanCacheTest() : cache_(&metrics_) {
+    AddSignature(kSignature, tensorflow::kPredictMethodName, 2, "y",
+                 &meta_graph_def_);
+  }
+
+  std::shared_ptr<const PredictionPlan> GetOrBuild(
+      const ServableId& id, const std::vector<std::string>& output_filter) {
+    std::shared_ptr<const PredictionPlan> plan;
+    EXPECT_TRUE(cache_
+                    .GetOrBuild(id, meta_graph_def_, kSignature,
+                                OutputFilter(output_filter), &plan)
+                    .ok());
+    return plan;
+  }
+
+  void Report(const ServableId& id, ManagerState state) {
+    ServableState event;
+    event.id = id;
+    event.manager_state = state;
+    cache_.GetEventBusCallback()({event, 0});
+  }
+
+  PredictMetrics metrics_;
+  PredictionPlanCache cache_;
+  MetaGraphDef meta_graph_def_;
+};
+
+}  // namespace
+
+TEST_F(PredictionPlanCacheTest, AttachesPlansOfPredictionSignatures) {
+  const ServableId id{"model", 1};
+  SavedModelBundle bundle;
+  bundle.session.reset(new NoopSession);
+  bundle.meta_graph_def = meta_graph_def_;
+  AddSignature("classify", tensorflow::kClassifyMethodName, 1, "scores",
+               &bundle.meta_graph_def);
+  AddSignature("train", "tensorflow/serving/train", 1, "loss",
+               &bundle.meta_graph_def);
+  // Done by the model's post_load, before it serves requests.
+  cache_.AttachPlans(id, &bundle);
+
+  const PlannedSession* session =
+      PlannedSession::FromSession(bundle.session.get());
+  ASSERT_TRUE(session != nullptr);
+  const PredictionPlan* plan = session->GetPlan(kSignature);
+  ASSERT_TRUE(plan != nullptr);
+  EXPECT_EQ(1, plan->num_inputs);
+  EXPECT_TRUE(plan->inputs_aliased);
+  EXPECT_EQ("x:0", plan->input_tensor_names.at("x"));
+  // Without output filter, all outputs are fetched.
+  EXPECT_EQ(2, plan->output_tensor_names.size());
+  EXPECT_EQ(metrics_.Get(id, kSignature), plan->metrics);
+
+  const PredictionPlan* classify = session->GetPlan("classify");
+  ASSERT_TRUE(classify != nullptr);
+  EXPECT_FALSE(classify->inputs_aliased);
+  EXPECT_EQ(std::vector<std::string>{"scores0:0"},
+            classify->output_tensor_aliases);
+  // Not fit for prediction, requests to it fail when the plan is built.
+  EXPECT_TRUE(session->GetPlan("train") == nullptr);
+  EXPECT_TRUE(session->GetPlan("missing") == nullptr);
+}
+
+TEST_F(PredictionPlanCacheTest, CachesPlansWithOutputFilter) {
+  const ServableId id{"model", 1};
+  std::shared_ptr<const PredictionPlan> y1 = GetOrBuild(id, {"y1"});
+  ASSERT_TRUE(y1 != nullptr);
+  EXPECT_EQ(std::vector<std::string>{"y1:0"}, y1->output_tensor_names);
+  EXPECT_EQ(std::vector<std::string>{"y1"}, y1->output_tensor_aliases);
+  EXPECT_EQ(metrics_.Get(id, kSignature), y1->metrics);
+  EXPECT_EQ(y1, GetOrBuild(id, {"y1"}));
+
+  // The order of aliases matters, the order of outputs follows it.
+  std::shared_ptr<const PredictionPlan> y1y0 = GetOrBuild(id, {"y1", "y0"});
+  EXPECT_NE(y1, y1y0);
+  EXPECT_EQ(y1y0, GetOrBuild(id, {"y1", "y0"}));
+  EXPECT_NE(y1y0, GetOrBuild(id, {"y0", "y1"}));
+  // Plans are per servable.
+  EXPECT_NE(y1, GetOrBuild({"model", 2}, {"y1"}));
+
+  // Errors are not cached.
+  std::shared_ptr<const PredictionPlan> plan;
+  EXPECT_EQ(tensorflow::error::INVALID_ARGUMENT,
+            cache_
+                .GetOrBuild(id, meta_graph_def_, kSignature,
+                            OutputFilter({"z"}), &plan)
+                .code());
+  EXPECT_EQ(tensorflow::error::INVALID_ARGUMENT,
+            cache_
+                .GetOrBuild(id, meta_graph_def_, kSignature,
+                            OutputFilter({"y0", "y0"}), &plan)
+                .code());
+  EXPECT_EQ(tensorflow::error::FAILED_PRECONDITION,
+            cache_
+                .GetOrBuild(id, meta_graph_def_, "missing",
+                            OutputFilter({"y0"}), &plan)
+                .code());
+}
+
+TEST_F(PredictionPlanCacheTest, EvictsPlansOfUnloadedServable) {
+  const ServableId id{"model", 1};
+  const ServableId other{"model", 2};
+  std::shared_ptr<const PredictionPlan> plan = GetOrBuild(id, {"y1"});
+  std::shared_ptr<const PredictionPlan> other_plan = GetOrBuild(other, {"y1"});
+  Report(id, ManagerState::kUnloading);
+  EXPECT_EQ(plan, GetOrBuild(id, {"y1"}));
+
+  Report(id, ManagerState::kEnd);
+  // The same version is loaded again, its new MetaGraphDef may well have the
+  // address of the old one. Plans are built from the new one.
+  meta_graph_def_.clear_signature_def();
+  AddSignature(kSignature, tensorflow::kPredictMethodName, 2, "new_y",
+               &meta_graph_def_);
+  std::shared_ptr<const PredictionPlan> reloaded = GetOrBuild(id, {"new_y1"});
+  ASSERT_TRUE(reloaded != nullptr);
+  EXPECT_EQ(std::vector<std::string>{"new_y1:0"},
+            reloaded->output_tensor_names);
+  // Plans of other servables are kept.
+  EXPECT_EQ(other_plan, GetOrBuild(other, {"y1"}));
+}
+
+TEST_F(PredictionPlanCacheTest, CapsPlansPerServable) {
+  const int kNumOutputs = PredictionPlanCache::kMaxPlansPerServable + 1;
+  meta_graph_def_.clear_signature_def();
+  AddSignature(kSignature, tensorflow::kPredictMethodName, kNumOutputs, "y",
+               &meta_graph_def_);
+  const ServableId id{"model", 1};
+  std::vector<std::shared_ptr<const PredictionPlan>> plans;
+  for (int i = 0; i < kNumOutputs; i++) {
+    plans.push_back(GetOrBuild(id, {"y" + std::to_string(i)}));
+  }
+
+  for (int i = 0; i < kNumOutputs - 1; i++) {
+    EXPECT_EQ(plans[i], GetOrBuild(id, {"y" + std::to_string(i)}));
+  }
+  // Over the cap, built on each request.
+  const std::string last = "y" + std::to_string(kNumOutputs - 1);
+  std::shared_ptr<const PredictionPlan> plan = GetOrBuild(id, {last});
+  ASSERT_TRUE(plan != nullptr);
+  EXPECT_NE(plans.back(), plan);
+  EXPECT_EQ(std::vector<std::string>{last}, plan->output_tensor_aliases);
+  // Other servables have caps of their own.
+  std::shared_ptr<const PredictionPlan> other =
+      GetOrBuild({"model", 2}, {last});
+  EXPECT_EQ(other, GetOrBuild({"model", 2}, {last}));
+}
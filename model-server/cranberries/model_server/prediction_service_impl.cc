@@ -0,0 +1,173 @@
+#include "prediction_service_impl.h"
+
+#include <chrono>
+#include <utility>
+#include <vector>
+#include "grpc++/support/status_code_enum.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow_serving/servables/tensorflow/get_model_metadata_impl.h"
+#include "cranberries/model_server/tensor_codec.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+// Clients may override encoding of output tensors for a call by sending this
+// metadata; values are parsed by ParseTensorEncoding().
+const char kOutputEncodingMetadataKey[] = "cranberries-output-encoding";
+
+Status GetOutputEncoding(const grpc::ServerContext* context,
+                         TensorEncoding* encoding) {
+  if (!context) {
+    return Status::OK();
+  }
+  const auto& metadata = context->client_metadata();
+  auto iter = metadata.find(kOutputEncodingMetadataKey);
+  if (iter == metadata.end()) {
+    return Status::OK();
+  }
+  const string value(iter->second.data(), iter->second.size());
+  if (!ParseTensorEncoding(value, encoding)) {
+    return errors::InvalidArgument("Unknown output encoding: ", value);
+  }
+  return Status::OK();
+}
+
+// Returns the call's deadline in microseconds since the Epoch, which is the
+// clock of Env::NowMicros().
+int64 GetDeadlineMicros(const grpc::ServerContext* context) {
+  const auto deadline = context->deadline();
+  if (deadline == std::chrono::system_clock::time_point::max()) {
+    return kint64max;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             deadline.time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+grpc::Status ToGRPCStatus(const tensorflow::Status& status) {
+  const int kErrorMessageLimit = 1024;
+  string error_message;
+  if (status.error_message().length() > kErrorMessageLimit) {
+    error_message =
+        status.error_message().substr(0, kErrorMessageLimit) + "...TRUNCATED";
+  } else {
+    error_message = status.error_message();
+  }
+  return grpc::Status(static_cast<grpc::StatusCode>(status.code()),
+                      error_message);
+}
+
+PredictionServiceImpl::PredictionServiceImpl(
+    std::unique_ptr<ServerCore> core,
+    const TensorflowPredictor::Options& predictor_options,
+    AdmissionController* admission_controller)
+    : core_(std::move(core)),
+      predictor_(new TensorflowPredictor(predictor_options)),
+      use_saved_model_(predictor_options.use_saved_model),
+      admission_controller_(admission_controller) {}
+
+Status PredictionServiceImpl::Admit(
+    grpc::ServerContext* context, const PredictRequest& request,
+    std::unique_ptr<AdmissionController::Ticket>* ticket) {
+  if (!admission_controller_ || !context) {
+    return Status::OK();
+  }
+  return admission_controller_->Admit(
+      request.model_spec().name(), GetDeadlineMicros(context),
+      [context]() { return context->IsCancelled(); }, ticket);
+}
+
+grpc::Status PredictionServiceImpl::Predict(grpc::ServerContext* context,
+                                            const PredictRequest* request,
+                                            PredictResponse* response) {
+  TensorEncoding output_encoding = predictor_->output_encoding();
+  tensorflow::Status predict_status =
+      GetOutputEncoding(context, &output_encoding);
+  std::unique_ptr<AdmissionController::Ticket> ticket;
+  if (predict_status.ok()) {
+    predict_status = Admit(context, *request, &ticket);
+  }
+  if (predict_status.ok()) {
+    predict_status = predictor_->Predict(core_.get(), *request,
+                                         output_encoding, response);
+  }
+  if (predict_status.ok() && ticket) {
+    ticket->MarkSucceeded();
+  }
+  const grpc::Status status = ToGRPCStatus(predict_status);
+  if (!status.ok()) {
+    VLOG(1) << "Predict failed: " << status.error_message();
+  }
+  return status;
+}
+
+grpc::Status PredictionServiceImpl::BatchPredict(
+    grpc::ServerContext* context,
+    const ::cranberries::BatchPredictRequest* request,
+    ::cranberries::BatchPredictResponse* response) {
+  TensorEncoding output_encoding = predictor_->output_encoding();
+  tensorflow::Status batch_status =
+      GetOutputEncoding(context, &output_encoding);
+  std::vector<PredictResponse*> responses;
+  std::vector<tensorflow::Status> statuses;
+  std::unique_ptr<AdmissionController::Ticket> ticket;
+  if (batch_status.ok() && request->requests_size() > 0) {
+    batch_status = Admit(context, request->requests(0), &ticket);
+  }
+  if (batch_status.ok()) {
+    responses.reserve(request->requests_size());
+    for (int i = 0; i < request->requests_size(); i++) {
+      responses.push_back(response->add_results()->mutable_response());
+    }
+    batch_status =
+        predictor_->BatchPredict(core_.get(), request->requests(),
+                                 output_encoding, responses, &statuses);
+  }
+  if (batch_status.ok() && ticket) {
+    ticket->MarkSucceeded();
+  }
+  if (!batch_status.ok()) {
+    response->Clear();
+    const grpc::Status status = ToGRPCStatus(batch_status);
+    VLOG(1) << "BatchPredict failed: " << status.error_message();
+    return status;
+  }
+  for (int i = 0; i < statuses.size(); i++) {
+    if (statuses[i].ok()) {
+      continue;
+    }
+    const grpc::Status status = ToGRPCStatus(statuses[i]);
+    auto* result = response->mutable_results(i);
+    result->clear_response();
+    result->set_error_code(status.error_code());
+    result->set_error_message(status.error_message());
+  }
+  return grpc::Status::OK;
+}
+
+grpc::Status PredictionServiceImpl::GetModelMetadata(
+    grpc::ServerContext* context, const GetModelMetadataRequest* request,
+    GetModelMetadataResponse* response) {
+  if (!use_saved_model_) {
+    return ToGRPCStatus(tensorflow::errors::InvalidArgument(
+        "GetModelMetadata API is only available when use_saved_model is "
+        "set to true"));
+  }
+  const grpc::Status status =
+      ToGRPCStatus(GetModelMetadataImpl::GetModelMetadata(
+          core_.get(), *request, response));
+  if (!status.ok()) {
+    VLOG(1) << "GetModelMetadata failed: " << status.error_message();
+  }
+  return status;
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
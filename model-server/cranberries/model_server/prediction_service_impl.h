@@ -0,0 +1,65 @@
+#ifndef CRANBERRIES_PREDICTION_SERVICE_IMPL_H_
+#define CRANBERRIES_PREDICTION_SERVICE_IMPL_H_
+
+#include <memory>
+#include "grpc++/server_context.h"
+#include "grpc++/support/status.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "tensorflow_serving/model_servers/server_core.h"
+#include "cranberries/model_server/admission_controller.h"
+#include "cranberries/model_server/cranberries_prediction_service.pb.h"
+#include "cranberries/model_server/predict_impl.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Converts TensorFlow's status to gRPC's one, truncating overly long error
+// messages.
+grpc::Status ToGRPCStatus(const tensorflow::Status& status);
+
+// Synchronous implementation of
+// tensorflow_serving/apis/prediction_service.proto: every call is served on
+// one of gRPC's threads from start to end.
+//
+// Its methods are also safe to call directly, which is how
+// AsyncPredictionService reuses them.
+//
+// If AdmissionController is given, Predict and BatchPredict calls have to be
+// admitted by it before they run, taking into account the call's deadline.
+class PredictionServiceImpl : public PredictionService::Service {
+ public:
+  // `admission_controller` may be null, it should outlive the service.
+  PredictionServiceImpl(std::unique_ptr<ServerCore> core,
+                        const TensorflowPredictor::Options& predictor_options,
+                        AdmissionController* admission_controller = nullptr);
+
+  grpc::Status Predict(grpc::ServerContext* context,
+                       const PredictRequest* request,
+                       PredictResponse* response) override;
+
+  grpc::Status GetModelMetadata(grpc::ServerContext* context,
+                                const GetModelMetadataRequest* request,
+                                GetModelMetadataResponse* response) override;
+
+  // Implementation of CranberriesPredictionService::BatchPredict.
+  grpc::Status BatchPredict(grpc::ServerContext* context,
+                            const ::cranberries::BatchPredictRequest* request,
+                            ::cranberries::BatchPredictResponse* response);
+
+ private:
+  Status Admit(grpc::ServerContext* context, const PredictRequest& request,
+               std::unique_ptr<AdmissionController::Ticket>* ticket);
+
+  std::unique_ptr<ServerCore> core_;
+  std::unique_ptr<TensorflowPredictor> predictor_;
+  bool use_saved_model_;
+  AdmissionController* admission_controller_;
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_PREDICTION_SERVICE_IMPL_H_
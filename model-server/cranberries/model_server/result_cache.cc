@@ -0,0 +1,168 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <utility>
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+// Approximate memory taken by an entry besides the response itself: list
+// node, hash table node and the model name.
+const int64 kEntryOverheadBytes = 128;
+
+Fprint128 Combine(const Fprint128& a, const Fprint128& b) {
+  return {FingerprintCat64(a.low64, b.low64),
+          FingerprintCat64(a.high64, b.high64)};
+}
+
+}  // namespace
+
+ResultCacheKey MakeResultCacheKey(const ServableId& id,
+                                  const string& signature_name,
+                                  TensorEncoding output_encoding,
+                                  const PredictRequest& request) {
+  Fprint128 fingerprint = Fingerprint128(signature_name);
+  // Aliases and signature names cannot contain null characters in practice,
+  // so it's a safe separator.
+  string outputs;
+  for (const string& alias : request.output_filter()) {
+    outputs += '\0';
+    outputs += alias;
+  }
+  outputs += '\0';
+  outputs += static_cast<char>(output_encoding);
+  fingerprint = Combine(fingerprint, Fingerprint128(outputs));
+
+  // Order of protobuf map's entries is unspecified, so sort them by alias.
+  std::vector<const string*> aliases;
+  aliases.reserve(request.inputs().size());
+  for (const auto& input : request.inputs()) {
+    aliases.push_back(&input.first);
+  }
+  std::sort(aliases.begin(), aliases.end(),
+            [](const string* a, const string* b) { return *a < *b; });
+  string serialized;
+  for (const string* alias : aliases) {
+    request.inputs().at(*alias).SerializeToString(&serialized);
+    fingerprint = Combine(fingerprint, Fingerprint128(*alias));
+    fingerprint = Combine(fingerprint, Fingerprint128(serialized));
+  }
+  return {id, fingerprint};
+}
+
+size_t ResultCache::KeyHash::operator()(const ResultCacheKey& key) const {
+  return key.fingerprint.low64;
+}
+
+bool ResultCache::KeyEqual::operator()(const ResultCacheKey& a,
+                                       const ResultCacheKey& b) const {
+  return a.fingerprint.low64 == b.fingerprint.low64 &&
+         a.fingerprint.high64 == b.fingerprint.high64 && a.id == b.id;
+}
+
+ResultCache::ResultCache(int64 capacity_bytes, int num_shards)
+  : shard_capacity_bytes_(capacity_bytes / num_shards) {
+  CHECK_GT(num_shards, 0);
+  for (int i = 0; i < num_shards; i++) {
+    shards_.emplace_back(new Shard);
+  }
+}
+
+ResultCache::Shard* ResultCache::GetShard(const ResultCacheKey& key) {
+  // The low half is used by hash tables inside shards.
+  return shards_[key.fingerprint.high64 % shards_.size()].get();
+}
+
+std::shared_ptr<const PredictResponse> ResultCache::Lookup(
+    const ResultCacheKey& key) {
+  Shard* shard = GetShard(key);
+  {
+    mutex_lock l(shard->mu);
+    auto iter = shard->index.find(key);
+    if (iter != shard->index.end()) {
+      shard->lru.splice(shard->lru.begin(), shard->lru, iter->second);
+      hits_++;
+      return iter->second->response;
+    }
+  }
+  misses_++;
+  return nullptr;
+}
+
+void ResultCache::Insert(const ResultCacheKey& key,
+                         std::shared_ptr<const PredictResponse> response) {
+  const int64 bytes = response->SpaceUsed() + kEntryOverheadBytes;
+  if (bytes > shard_capacity_bytes_) {
+    return;
+  }
+  Shard* shard = GetShard(key);
+  mutex_lock l(shard->mu);
+  auto iter = shard->index.find(key);
+  if (iter != shard->index.end()) {
+    // Computed concurrently by another call.
+    return;
+  }
+  while (shard->bytes + bytes > shard_capacity_bytes_) {
+    const Entry& victim = shard->lru.back();
+    shard->bytes -= victim.bytes;
+    shard->index.erase(victim.key);
+    shard->lru.pop_back();
+    evictions_++;
+  }
+  shard->lru.push_front({key, std::move(response), bytes});
+  shard->index.emplace(key, shard->lru.begin());
+  shard->bytes += bytes;
+}
+
+void ResultCache::Evict(const ServableId& id) {
+  for (auto& shard : shards_) {
+    mutex_lock l(shard->mu);
+    for (auto iter = shard->lru.begin(); iter != shard->lru.end();) {
+      if (iter->key.id == id) {
+        shard->bytes -= iter->bytes;
+        shard->index.erase(iter->key);
+        iter = shard->lru.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+  }
+}
+
+ResultCache::Stats ResultCache::GetStats() const {
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.evictions = evictions_;
+  for (const auto& shard : shards_) {
+    mutex_lock l(shard->mu);
+    stats.entries += shard->index.size();
+    stats.bytes += shard->bytes;
+  }
+  return stats;
+}
+
+EventBus<ServableState>::Callback ResultCache::GetEventBusCallback() {
+  return std::bind(&ResultCache::ProcessEvent, this, std::placeholders::_1);
+}
+
+void ResultCache::ProcessEvent(
+    const EventBus<ServableState>::EventAndTime& ev) {
+  if (ev.event.manager_state != ServableState::ManagerState::kEnd) {
+    return;
+  }
+  Evict(ev.event.id);
+  const Stats stats = GetStats();
+  LOG(INFO) << "Result cache: " << stats.hits << " hits, " << stats.misses
+            << " misses, " << stats.evictions << " evictions, "
+            << stats.entries << " entries taking " << stats.bytes
+            << " bytes";
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
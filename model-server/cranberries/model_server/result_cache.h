@@ -0,0 +1,111 @@
+#ifndef CRANBERRIES_RESULT_CACHE_H_
+#define CRANBERRIES_RESULT_CACHE_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "tensorflow/core/platform/fingerprint.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/core/servable_id.h"
+#include "tensorflow_serving/core/servable_state.h"
+#include "tensorflow_serving/util/event_bus.h"
+#include "cranberries/model_server/tensor_codec.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Identifies a Predict call whose result can be reused: servable (with
+// resolved version), signature, output filter, encoding of outputs and the
+// input tensors, the latter are identified by 128-bit fingerprint.
+struct ResultCacheKey {
+  ServableId id;
+  Fprint128 fingerprint;
+};
+
+// Builds a key for `request` served by servable `id`. Inputs are fingerprinted
+// in order of their aliases, so the key does not depend on order of map
+// entries on the wire.
+ResultCacheKey MakeResultCacheKey(const ServableId& id,
+                                  const string& signature_name,
+                                  TensorEncoding output_encoding,
+                                  const PredictRequest& request);
+
+// Thread-safe memory-bounded cache of Predict responses, meant for
+// deterministic models only. It's split into shards with separate locks and
+// LRU lists, each shard gets an equal part of the capacity.
+//
+// Entries of a servable are dropped when it's unloaded, so the cache should
+// be subscribed to the manager's EventBus<ServableState>.
+class ResultCache {
+ public:
+  struct Stats {
+    int64 hits = 0;
+    int64 misses = 0;
+    // Number of entries dropped to free space for new ones.
+    int64 evictions = 0;
+    int64 entries = 0;
+    int64 bytes = 0;
+  };
+
+  explicit ResultCache(int64 capacity_bytes, int num_shards = 16);
+
+  // Returns the cached response or nullptr, updating hit/miss counters.
+  std::shared_ptr<const PredictResponse> Lookup(const ResultCacheKey& key);
+
+  // Caches `response`, unless it alone exceeds capacity of a shard.
+  void Insert(const ResultCacheKey& key,
+              std::shared_ptr<const PredictResponse> response);
+
+  // Drops all entries of servable `id`.
+  void Evict(const ServableId& id);
+
+  Stats GetStats() const;
+
+  EventBus<ServableState>::Callback GetEventBusCallback();
+
+ private:
+  struct KeyHash {
+    size_t operator()(const ResultCacheKey& key) const;
+  };
+  struct KeyEqual {
+    bool operator()(const ResultCacheKey& a, const ResultCacheKey& b) const;
+  };
+  struct Entry {
+    ResultCacheKey key;
+    std::shared_ptr<const PredictResponse> response;
+    int64 bytes;
+  };
+  struct Shard {
+    mutex mu;
+    // Most recently used entries go first.
+    std::list<Entry> lru GUARDED_BY(mu);
+    std::unordered_map<ResultCacheKey, std::list<Entry>::iterator, KeyHash,
+                       KeyEqual>
+        index GUARDED_BY(mu);
+    int64 bytes GUARDED_BY(mu) = 0;
+  };
+
+  Shard* GetShard(const ResultCacheKey& key);
+  void ProcessEvent(const EventBus<ServableState>::EventAndTime& ev);
+
+  const int64 shard_capacity_bytes_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<int64> hits_{0};
+  std::atomic<int64> misses_{0};
+  std::atomic<int64> evictions_{0};
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ResultCache);
+};
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_RESULT_CACHE_H_
@@ -0,0 +1,140 @@
+#include "result_cache.h"
+
+#include <memory>
+#include <string>
+#include <gtest/gtest.h>
+#include "tensorflow/core/framework/tensor.h"
+
+using tensorflow::DT_FLOAT;
+using tensorflow::Tensor;
+using tensorflow::TensorShape;
+using tensorflow::serving::PredictRequest;
+using tensorflow::serving::PredictResponse;
+using tensorflow::serving::ServableId;
+using tensorflow::serving::cranberries::MakeResultCacheKey;
+using tensorflow::serving::cranberries::ResultCache;
+using tensorflow::serving::cranberries::ResultCacheKey;
+using tensorflow::serving::cranberries::TensorEncoding;
+
+namespace {
+
+void AddInput(const std::string& alias, float value, PredictRequest* request) {
+  Tensor tensor(DT_FLOAT, TensorShape({1}));
+  tensor.flat<float>()(0) = value;
+  tensor.AsProtoTensorContent(&(*request->mutable_inputs())[alias]);
+}
+
+ResultCacheKey MakeKey(const ServableId& id, float value) {
+  PredictRequest request;
+  AddInput("x", value, &request);
+  return MakeResultCacheKey(id, "serving_default",
+                            TensorEncoding::kRepeatedField, request);
+}
+
+std::shared_ptr<const PredictResponse> MakeResponse(float value) {
+  std::shared_ptr<PredictResponse> response(new PredictResponse);
+  Tensor tensor(DT_FLOAT, TensorShape({1}));
+  tensor.flat<float>()(0) = value;
+  tensor.AsProtoField(&(*response->mutable_outputs())["y"]);
+  return response;
+}
+
+bool SameKey(const ResultCacheKey& a, const ResultCacheKey& b) {
+  return a.id == b.id && a.fingerprint.low64 == b.fingerprint.low64 &&
+         a.fingerprint.high64 == b.fingerprint.high64;
+}
+
+}  // namespace
+
+TEST(MakeResultCacheKeyTest, DependsOnInputsOnly) {
+  const ServableId id = {"model", 1};
+  PredictRequest first;
+  AddInput("a", 1, &first);
+  AddInput("b", 2, &first);
+  PredictRequest second;
+  AddInput("b", 2, &second);
+  AddInput("a", 1, &second);
+  EXPECT_TRUE(SameKey(
+      MakeResultCacheKey(id, "sig", TensorEncoding::kRepeatedField, first),
+      MakeResultCacheKey(id, "sig", TensorEncoding::kRepeatedField, second)));
+
+  (*second.mutable_inputs())["a"].set_tensor_content(std::string(4, '\0'));
+  EXPECT_FALSE(SameKey(
+      MakeResultCacheKey(id, "sig", TensorEncoding::kRepeatedField, first),
+      MakeResultCacheKey(id, "sig", TensorEncoding::kRepeatedField, second)));
+}
+
+TEST(MakeResultCacheKeyTest, DependsOnSignatureFilterAndEncoding) {
+  const ServableId id = {"model", 1};
+  PredictRequest request;
+  AddInput("a", 1, &request);
+  const ResultCacheKey key =
+      MakeResultCacheKey(id, "sig", TensorEncoding::kRepeatedField, request);
+  EXPECT_FALSE(SameKey(key, MakeResultCacheKey(id, "other",
+                                               TensorEncoding::kRepeatedField,
+                                               request)));
+  EXPECT_FALSE(SameKey(key, MakeResultCacheKey(id, "sig",
+                                               TensorEncoding::kTensorContent,
+                                               request)));
+  request.add_output_filter("y");
+  EXPECT_FALSE(SameKey(key, MakeResultCacheKey(id, "sig",
+                                               TensorEncoding::kRepeatedField,
+                                               request)));
+}
+
+TEST(ResultCacheTest, LookupAfterInsert) {
+  ResultCache cache(1 << 20);
+  const ResultCacheKey key = MakeKey({"model", 1}, 1);
+  EXPECT_EQ(nullptr, cache.Lookup(key));
+  auto response = MakeResponse(2);
+  cache.Insert(key, response);
+  EXPECT_EQ(response, cache.Lookup(key));
+  EXPECT_EQ(nullptr, cache.Lookup(MakeKey({"model", 2}, 1)));
+
+  const ResultCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(1, stats.entries);
+  EXPECT_GT(stats.bytes, 0);
+}
+
+TEST(ResultCacheTest, EvictsLeastRecentlyUsed) {
+  auto response = MakeResponse(0);
+  const ResultCacheKey first = MakeKey({"model", 1}, 1);
+  ResultCache probe(1 << 20, 1);
+  probe.Insert(first, response);
+  ASSERT_EQ(1, probe.GetStats().entries);
+  // Fits exactly two entries of the same size.
+  ResultCache cache(2 * probe.GetStats().bytes, 1);
+
+  const ResultCacheKey second = MakeKey({"model", 1}, 2);
+  const ResultCacheKey third = MakeKey({"model", 1}, 3);
+  cache.Insert(first, response);
+  cache.Insert(second, response);
+  EXPECT_NE(nullptr, cache.Lookup(first));
+  cache.Insert(third, response);
+  EXPECT_NE(nullptr, cache.Lookup(first));
+  EXPECT_EQ(nullptr, cache.Lookup(second));
+  EXPECT_NE(nullptr, cache.Lookup(third));
+  EXPECT_EQ(1, cache.GetStats().evictions);
+}
+
+TEST(ResultCacheTest, EvictServable) {
+  ResultCache cache(1 << 20);
+  const ResultCacheKey first = MakeKey({"model", 1}, 1);
+  const ResultCacheKey second = MakeKey({"model", 2}, 1);
+  cache.Insert(first, MakeResponse(1));
+  cache.Insert(second, MakeResponse(2));
+  cache.Evict({"model", 1});
+  EXPECT_EQ(nullptr, cache.Lookup(first));
+  EXPECT_NE(nullptr, cache.Lookup(second));
+  EXPECT_EQ(1, cache.GetStats().entries);
+}
+
+TEST(ResultCacheTest, SkipsOversizedResponses) {
+  ResultCache cache(16);
+  const ResultCacheKey key = MakeKey({"model", 1}, 1);
+  cache.Insert(key, MakeResponse(1));
+  EXPECT_EQ(nullptr, cache.Lookup(key));
+  EXPECT_EQ(0, cache.GetStats().bytes);
+}
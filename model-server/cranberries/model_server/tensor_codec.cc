@@ -0,0 +1,107 @@
+#include "tensor_codec.h"
+
+#include <stdint.h>
+#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+namespace {
+
+// Allocator which hands out a single buffer owned by someone else instead of
+// allocating memory. That's the only public way to make Tensor reference
+// existing memory: Tensor asks its allocator for exactly one buffer and
+// returns it once the last reference to the buffer is dropped.
+//
+// Instances are created with `new` and delete themselves when the buffer is
+// returned, because Tensor keeps raw pointer to its allocator.
+class BorrowedBufferAllocator : public Allocator {
+ public:
+  BorrowedBufferAllocator(const void* data, size_t size)
+    : data_(const_cast<void*>(data)), size_(size) {}
+
+  string Name() override { return "borrowed_buffer"; }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override {
+    CHECK(!allocated_) << "Borrowed buffer can be allocated only once";
+    CHECK_EQ(num_bytes, size_);
+    allocated_ = true;
+    return data_;
+  }
+
+  void DeallocateRaw(void* ptr) override {
+    CHECK_EQ(ptr, data_);
+    delete this;
+  }
+
+ private:
+  ~BorrowedBufferAllocator() override {}
+
+  void* const data_;
+  const size_t size_;
+  bool allocated_ = false;
+};
+
+bool IsAlignedForEigen(const void* ptr) {
+#if EIGEN_MAX_ALIGN_BYTES > 0
+  return reinterpret_cast<uintptr_t>(ptr) % EIGEN_MAX_ALIGN_BYTES == 0;
+#else
+  return true;
+#endif
+}
+
+}  // namespace
+
+bool ParseTensorProto(const TensorProto& proto, Tensor* tensor) {
+  const DataType dtype = proto.dtype();
+  const string& content = proto.tensor_content();
+  if (content.empty() || !DataTypeCanUseMemcpy(dtype) ||
+      !TensorShape::IsValid(proto.tensor_shape()) ||
+      !IsAlignedForEigen(content.data())) {
+    return tensor->FromProto(proto);
+  }
+  TensorShape shape(proto.tensor_shape());
+  const int64 num_elements = shape.num_elements();
+  // Empty tensors do not allocate anything, so the allocator would leak.
+  const size_t expected_size =
+      static_cast<size_t>(num_elements) * DataTypeSize(dtype);
+  if (num_elements == 0 || content.size() != expected_size) {
+    return tensor->FromProto(proto);
+  }
+
+  // Plain old data types do not run any constructors on allocation, so the
+  // content is kept intact.
+  *tensor = Tensor(new BorrowedBufferAllocator(content.data(), content.size()),
+                   dtype, shape);
+  return true;
+}
+
+bool ParseTensorEncoding(const string& name, TensorEncoding* encoding) {
+  if (name == "repeated_field") {
+    *encoding = TensorEncoding::kRepeatedField;
+    return true;
+  }
+  if (name == "tensor_content") {
+    *encoding = TensorEncoding::kTensorContent;
+    return true;
+  }
+  return false;
+}
+
+void EncodeTensor(const Tensor& tensor, TensorEncoding encoding,
+                  TensorProto* proto) {
+  if (encoding == TensorEncoding::kTensorContent &&
+      DataTypeCanUseMemcpy(tensor.dtype())) {
+    tensor.AsProtoTensorContent(proto);
+  } else {
+    tensor.AsProtoField(proto);
+  }
+}
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
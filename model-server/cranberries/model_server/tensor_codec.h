@@ -0,0 +1,43 @@
+#ifndef CRANBERRIES_TENSOR_CODEC_H_
+#define CRANBERRIES_TENSOR_CODEC_H_
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+
+// Same as Tensor::FromProto(), but avoids copying the data when possible:
+// if `proto` has dense `tensor_content` of a memcpy-able type which is aligned
+// well enough for Eigen, the resulting tensor references `tensor_content`
+// directly.
+//
+// Hence `proto` must outlive `tensor` and all tensors sharing its buffer
+// (e.g. outputs of Session::Run which may forward inputs) and must not be
+// modified in the meantime. Returns false if `proto` is invalid.
+bool ParseTensorProto(const TensorProto& proto, Tensor* tensor);
+
+// How tensors are encoded into TensorProto.
+enum class TensorEncoding {
+  // Typed repeated fields, e.g. `float_val` (see Tensor::AsProtoField()).
+  // Understood by all clients, but each element is encoded separately.
+  kRepeatedField,
+  // Raw bytes in `tensor_content` (see Tensor::AsProtoTensorContent()),
+  // which takes a single memcpy and is more compact. Used for memcpy-able
+  // types only, others are encoded as kRepeatedField.
+  kTensorContent,
+};
+
+// Parses names like "repeated_field" and "tensor_content".
+bool ParseTensorEncoding(const string& name, TensorEncoding* encoding);
+
+// Encodes `tensor` into `proto`, overwriting it.
+void EncodeTensor(const Tensor& tensor, TensorEncoding encoding,
+                  TensorProto* proto);
+
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // CRANBERRIES_TENSOR_CODEC_H_
@@ -0,0 +1,79 @@
+// Benchmarks of encoding output tensors into TensorProto, including
+// serialization of the proto, as it's done by gRPC.
+//
+// Run with:
+//   bazel run -c opt //cranberries/model_server:tensor_codec_benchmark -- \
+//       --benchmarks=all
+//
+// Reported MB/s is the amount of tensor data processed per second, so
+// serialization time per MB of output is 1/(MB/s). Label shows size of
+// serialized proto relative to the raw tensor data.
+
+#include "tensor_codec.h"
+
+#include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace serving {
+namespace cranberries {
+namespace {
+
+Tensor MakeFloatTensor(int num_floats) {
+  Tensor tensor(DT_FLOAT, TensorShape({num_floats}));
+  auto flat = tensor.flat<float>();
+  for (int i = 0; i < num_floats; i++) {
+    flat(i) = i * 0.25f;
+  }
+  return tensor;
+}
+
+void BM_Encode(int iters, int num_floats, TensorEncoding encoding,
+               bool serialize) {
+  testing::StopTiming();
+  Tensor tensor = MakeFloatTensor(num_floats);
+  const int64 tensor_bytes = tensor.TotalBytes();
+  string serialized;
+  testing::StartTiming();
+  for (int i = 0; i < iters; i++) {
+    TensorProto proto;
+    EncodeTensor(tensor, encoding, &proto);
+    if (serialize) {
+      proto.SerializeToString(&serialized);
+    }
+  }
+  testing::StopTiming();
+  testing::BytesProcessed(static_cast<int64>(iters) * tensor_bytes);
+  if (serialize) {
+    testing::SetLabel(strings::Printf(
+        "%.2fx of raw size", static_cast<double>(serialized.size()) /
+                                 tensor_bytes));
+  }
+}
+
+void BM_EncodeRepeatedField(int iters, int num_floats) {
+  BM_Encode(iters, num_floats, TensorEncoding::kRepeatedField, false);
+}
+
+void BM_EncodeTensorContent(int iters, int num_floats) {
+  BM_Encode(iters, num_floats, TensorEncoding::kTensorContent, false);
+}
+
+void BM_SerializeRepeatedField(int iters, int num_floats) {
+  BM_Encode(iters, num_floats, TensorEncoding::kRepeatedField, true);
+}
+
+void BM_SerializeTensorContent(int iters, int num_floats) {
+  BM_Encode(iters, num_floats, TensorEncoding::kTensorContent, true);
+}
+
+BENCHMARK(BM_EncodeRepeatedField)->Arg(1 << 8)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK(BM_EncodeTensorContent)->Arg(1 << 8)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK(BM_SerializeRepeatedField)->Arg(1 << 8)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK(BM_SerializeTensorContent)->Arg(1 << 8)->Arg(1 << 14)->Arg(1 << 20);
+
+}  // namespace
+}  // namespace cranberries
+}  // namespace serving
+}  // namespace tensorflow
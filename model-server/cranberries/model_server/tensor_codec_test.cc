@@ -0,0 +1,205 @@
+#include "tensor_codec.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "tensorflow/core/framework/tensor_testutil.h"
+
+using tensorflow::DT_FLOAT;
+using tensorflow::DT_STRING;
+using tensorflow::Tensor;
+using tensorflow::TensorProto;
+using tensorflow::TensorShape;
+using tensorflow::serving::cranberries::EncodeTensor;
+using tensorflow::serving::cranberries::ParseTensorProto;
+using tensorflow::serving::cranberries::TensorEncoding;
+using tensorflow::test::AsTensor;
+using tensorflow::test::ExpectTensorEqual;
+
+namespace {
+
+Tensor MakeFloatTensor(int size) {
+  Tensor tensor(DT_FLOAT, TensorShape({size}));
+  auto flat = tensor.flat<float>();
+  for (int i = 0; i < size; i++) {
+    flat(i) = i * 0.5f;
+  }
+  return tensor;
+}
+
+bool SharesBuffer(const Tensor& tensor, const TensorProto& proto) {
+  return tensor.tensor_data().data() == proto.tensor_content().data();
+}
+
+// Encodes `expected` with both encodings and checks that ParseTensorProto()
+// and Tensor::FromProto() decode it back. Memcpy-able types are expected in
+// `tensor_content` with kTensorContent only.
+template <typename T>
+void ExpectRoundTrip(const Tensor& expected, bool memcpyable) {
+  for (TensorEncoding encoding :
+       {TensorEncoding::kRepeatedField, TensorEncoding::kTensorContent}) {
+    SCOPED_TRACE(encoding == TensorEncoding::kRepeatedField
+                     ? "repeated_field" : "tensor_content");
+    TensorProto proto;
+    EncodeTensor(expected, encoding, &proto);
+    EXPECT_EQ(expected.dtype(), proto.dtype());
+    EXPECT_EQ(expected.shape(), TensorShape(proto.tensor_shape()));
+    const bool in_content =
+        memcpyable && encoding == TensorEncoding::kTensorContent;
+    if (!in_content) {
+      EXPECT_TRUE(proto.tensor_content().empty());
+    } else if (expected.NumElements() > 0) {
+      EXPECT_FALSE(proto.tensor_content().empty());
+    }
+
+    Tensor parsed;
+    ASSERT_TRUE(ParseTensorProto(proto, &parsed));
+    ExpectTensorEqual<T>(expected, parsed);
+    Tensor from_proto;
+    ASSERT_TRUE(from_proto.FromProto(proto));
+    ExpectTensorEqual<T>(expected, from_proto);
+  }
+}
+
+}  // namespace
+
+TEST(ParseTensorProtoTest, TensorContent) {
+  Tensor expected = MakeFloatTensor(1024);
+  TensorProto proto;
+  expected.AsProtoTensorContent(&proto);
+
+  Tensor tensor;
+  ASSERT_TRUE(ParseTensorProto(proto, &tensor));
+  ExpectTensorEqual<float>(expected, tensor);
+  // Whether the buffer is shared depends on alignment of the string which
+  // is not under our control; when it's shared, the tensor has to be aligned.
+  if (SharesBuffer(tensor, proto)) {
+    EXPECT_TRUE(tensor.IsAligned());
+  }
+}
+
+TEST(ParseTensorProtoTest, SharesAlignedTensorContent) {
+  Tensor expected = MakeFloatTensor(1024);
+  // Alignment of string's buffer is not under our control, so we allocate
+  // several of them until we get one which is aligned.
+  std::vector<TensorProto> protos(64);
+  const TensorProto* proto = nullptr;
+  for (auto& candidate : protos) {
+    expected.AsProtoTensorContent(&candidate);
+    if (reinterpret_cast<uintptr_t>(candidate.tensor_content().data()) %
+            EIGEN_MAX_ALIGN_BYTES == 0) {
+      proto = &candidate;
+      break;
+    }
+  }
+  ASSERT_NE(nullptr, proto) << "Unable to allocate aligned buffer";
+
+  Tensor tensor;
+  ASSERT_TRUE(ParseTensorProto(*proto, &tensor));
+  EXPECT_TRUE(SharesBuffer(tensor, *proto));
+  ExpectTensorEqual<float>(expected, tensor);
+
+  // The buffer is valid while there are tensors referencing it.
+  Tensor copy = tensor;
+  tensor = Tensor();
+  ExpectTensorEqual<float>(expected, copy);
+}
+
+TEST(ParseTensorProtoTest, RepeatedField) {
+  Tensor expected = MakeFloatTensor(16);
+  TensorProto proto;
+  expected.AsProtoField(&proto);
+
+  Tensor tensor;
+  ASSERT_TRUE(ParseTensorProto(proto, &tensor));
+  ExpectTensorEqual<float>(expected, tensor);
+}
+
+TEST(ParseTensorProtoTest, Strings) {
+  Tensor expected = AsTensor<std::string>({"a", "bb", "ccc"});
+  TensorProto proto;
+  expected.AsProtoTensorContent(&proto);
+
+  Tensor tensor;
+  ASSERT_TRUE(ParseTensorProto(proto, &tensor));
+  ExpectTensorEqual<std::string>(expected, tensor);
+}
+
+TEST(ParseTensorProtoTest, EmptyTensor) {
+  Tensor expected(DT_FLOAT, TensorShape({0, 3}));
+  TensorProto proto;
+  expected.AsProtoTensorContent(&proto);
+
+  Tensor tensor;
+  ASSERT_TRUE(ParseTensorProto(proto, &tensor));
+  EXPECT_EQ(expected.shape(), tensor.shape());
+}
+
+TEST(ParseTensorProtoTest, ContentSizeMismatch) {
+  TensorProto proto;
+  MakeFloatTensor(16).AsProtoTensorContent(&proto);
+  proto.mutable_tensor_shape()->mutable_dim(0)->set_size(17);
+
+  Tensor tensor;
+  EXPECT_FALSE(ParseTensorProto(proto, &tensor));
+}
+
+TEST(EncodeTensorTest, RoundTripsDtypes) {
+  const TensorShape shape({2, 3});
+  ExpectRoundTrip<float>(AsTensor<float>({0, -1.5f, 2, 3, 4, 5}, shape),
+                         true);
+  ExpectRoundTrip<double>(AsTensor<double>({0, -1.5, 2, 3, 4, 1e300}, shape),
+                          true);
+  ExpectRoundTrip<tensorflow::int32>(
+      AsTensor<tensorflow::int32>({0, -1, 2, 3, 4, 1 << 30}, shape), true);
+  ExpectRoundTrip<tensorflow::int64>(
+      AsTensor<tensorflow::int64>({0, -1, 2, 3, 4, 1ll << 40}, shape), true);
+  ExpectRoundTrip<tensorflow::uint8>(
+      AsTensor<tensorflow::uint8>({0, 1, 2, 3, 4, 255}, shape), true);
+  ExpectRoundTrip<bool>(
+      AsTensor<bool>({true, false, false, true, true, false}, shape), true);
+}
+
+TEST(EncodeTensorTest, RoundTripsShapes) {
+  ExpectRoundTrip<float>(AsTensor<float>({1.5f}, TensorShape()), true);
+  ExpectRoundTrip<float>(MakeFloatTensor(1), true);
+  ExpectRoundTrip<float>(MakeFloatTensor(1000), true);
+  ExpectRoundTrip<float>(
+      AsTensor<float>({1, 2, 3, 4, 5, 6, 7, 8}, TensorShape({2, 1, 2, 2})),
+      true);
+}
+
+TEST(EncodeTensorTest, RoundTripsStrings) {
+  // Strings are not memcpy-able, so kTensorContent falls back to
+  // `string_val`.
+  ExpectRoundTrip<std::string>(
+      AsTensor<std::string>({"a", "", "ccc", std::string("\0\xff", 2)},
+                            TensorShape({2, 2})),
+      false);
+  ExpectRoundTrip<std::string>(AsTensor<std::string>({"x"}, TensorShape()),
+                               false);
+}
+
+TEST(EncodeTensorTest, RoundTripsEmptyTensors) {
+  ExpectRoundTrip<float>(Tensor(DT_FLOAT, TensorShape({0})), true);
+  ExpectRoundTrip<float>(Tensor(DT_FLOAT, TensorShape({2, 0, 3})), true);
+  ExpectRoundTrip<tensorflow::int64>(
+      Tensor(tensorflow::DT_INT64, TensorShape({0, 4})), true);
+  ExpectRoundTrip<std::string>(Tensor(DT_STRING, TensorShape({0, 2})), false);
+}
+
+TEST(EncodeTensorTest, OverwritesProto) {
+  TensorProto proto;
+  MakeFloatTensor(4).AsProtoField(&proto);
+  EncodeTensor(AsTensor<float>({7}), TensorEncoding::kTensorContent, &proto);
+  EXPECT_EQ(0, proto.float_val_size());
+
+  EncodeTensor(AsTensor<std::string>({"a", "b"}),
+               TensorEncoding::kRepeatedField, &proto);
+  EXPECT_TRUE(proto.tensor_content().empty());
+  Tensor tensor;
+  ASSERT_TRUE(ParseTensorProto(proto, &tensor));
+  ExpectTensorEqual<std::string>(AsTensor<std::string>({"a", "b"}), tensor);
+}
@@ -15,5 +15,21 @@ def test_model_loading(zk, models_base):
     assert wait_until(model_available, "Model did not become available")
 
 
+
+def test_model_loading_with_batching_config(zk, models_base):
+    zk.ensure_path("/aspired-models")
+    zk.create(
+        "/aspired-models/b",
+        "batching { max_batch_size: 4 batch_timeout_micros: 1000 }"
+    )
+    zk.create(
+        "/aspired-models/b/1",
+        os.path.join(models_base, "models", "a", "1")
+    )
+    def model_available():
+        return try_get_node_data(zk, "/current-models/b/1") == "kAvailable"
+    assert wait_until(model_available, "Model did not become available")
+
+
 if __name__ == "__main__":
     run_tests()
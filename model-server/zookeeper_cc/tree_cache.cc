@@ -0,0 +1,608 @@
+#include "tree_cache.h"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include "path_utils.h"
+#include "zookeeper_log.h"
+
+namespace zookeeper_cc {
+
+namespace {
+
+// Lets the reading thread wait for completions of asynchronous requests.
+class Countdown {
+ public:
+  explicit Countdown(size_t count) : count_(count) {}
+
+  void Done() {
+    std::lock_guard<std::mutex> l(mu_);
+    if (--count_ == 0) {
+      done_.notify_all();
+    }
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> l(mu_);
+    done_.wait(l, [this]() { return count_ == 0; });
+  }
+
+ private:
+  std::mutex mu_;
+  std::condition_variable done_;
+  size_t count_;
+};
+
+struct DataResult {
+  int rc;
+  std::string data;
+  struct Stat stat;
+};
+
+struct ChildrenResult {
+  int rc;
+  std::vector<std::string> children;
+  struct Stat stat;
+};
+
+std::string JoinPath(const std::string &parent, const std::string &name) {
+  return parent.empty() ? name : parent + "/" + name;
+}
+
+std::string ParentPath(const std::string &path) {
+  size_t pos = path.rfind('/');
+  return pos == std::string::npos ? "" : path.substr(0, pos);
+}
+
+bool SameStat(const struct Stat &a, const struct Stat &b) {
+  return a.czxid == b.czxid && a.mzxid == b.mzxid && a.pzxid == b.pzxid &&
+         a.version == b.version && a.cversion == b.cversion &&
+         a.aversion == b.aversion;
+}
+
+std::string AbsoluteRoot(Zookeeper *zookeeper, const std::string &root) {
+  std::string base = zookeeper->GetBasePath();
+  if (root.empty()) {
+    // Base path always has a trailing slash.
+    base.erase(base.size() - 1);
+    return base;
+  }
+  return base + root;
+}
+
+// Whether a request has failed because of the connection or the session
+// rather than the znode.
+bool IsConnectionError(int rc) {
+  return rc == ZCONNECTIONLOSS || rc == ZOPERATIONTIMEOUT ||
+         rc == ZSESSIONEXPIRED || rc == ZSESSIONMOVED || rc == ZCLOSING ||
+         rc == ZINVALIDSTATE;
+}
+
+uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+const int TreeCache::kRetryIntervalMs;
+
+TreeCache::TreeCache(Zookeeper *zookeeper, std::string root, int max_depth)
+  : zookeeper_(zookeeper)
+  , root_(std::move(root))
+  , absolute_root_(AbsoluteRoot(zookeeper_, root_))
+  , max_depth_(max_depth)
+  , watcher_([this](int type, int state, const char *path) {
+      Watch(type, state, path);
+    })
+{
+}
+
+TreeCache::~TreeCache() {
+  {
+    std::lock_guard<std::mutex> l(mu_);
+    stop_ = true;
+  }
+  events_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void TreeCache::Start(Listener listener) {
+  assert(!thread_.joinable());
+  listener_ = std::move(listener);
+  zookeeper_->SetWatcher(&watcher_);
+  {
+    std::lock_guard<std::mutex> l(mu_);
+    pending_.data.insert("");
+    if (max_depth_ > 0) {
+      pending_.children.insert("");
+    }
+  }
+  thread_ = std::thread(&TreeCache::Run, this);
+}
+
+std::shared_ptr<const TreeCache::Node> TreeCache::GetRoot() const {
+  std::lock_guard<std::mutex> l(mu_);
+  return snapshot_;
+}
+
+void TreeCache::Watch(int type, int state, const char *path) {
+  std::lock_guard<std::mutex> l(mu_);
+  if (type == ZOO_SESSION_EVENT) {
+    // Events which happened while disconnected are delivered after
+    // reconnection, but changes may be missed (e.g. a znode which is
+    // created and deleted), and znodes whose reads have failed are not
+    // watched.
+    if (state == ZOO_CONNECTING_STATE) {
+      disconnected_ = true;
+    } else if (state == ZOO_CONNECTED_STATE && disconnected_) {
+      disconnected_ = false;
+      resync_ = true;
+      events_.notify_all();
+    } else if (state == ZOO_EXPIRED_SESSION_STATE) {
+      // Nothing is delivered anymore, the handle is unusable.
+      session_expired_ = true;
+      events_.notify_all();
+    }
+    return;
+  }
+  watch_events_++;
+  std::string relative;
+  if (!RelativePath(path, &relative)) {
+    return;
+  }
+  if (pending_since_micros_ == 0) {
+    pending_since_micros_ = NowMicros();
+  }
+  if (type == ZOO_CHILD_EVENT) {
+    pending_.children.insert(relative);
+  } else {
+    // Created, changed or deleted, reading data tells which one.
+    pending_.data.insert(relative);
+    if (type == ZOO_CREATED_EVENT && Depth(relative) < max_depth_) {
+      pending_.children.insert(relative);
+    }
+  }
+  events_.notify_all();
+}
+
+void TreeCache::Run() {
+  std::unique_lock<std::mutex> l(mu_);
+  while (true) {
+    auto ready = [this]() {
+      return stop_ || resync_ || session_expired_ || !pending_.empty();
+    };
+    if (failed_.empty() && !expired_) {
+      events_.wait(l, ready);
+    } else {
+      events_.wait_for(l, std::chrono::milliseconds(kRetryIntervalMs), ready);
+    }
+    if (stop_) {
+      return;
+    }
+    if (session_expired_) {
+      session_expired_ = false;
+      disconnected_ = false;
+      resync_ = false;
+      expired_ = true;
+    }
+    bool new_session = false;
+    if (expired_) {
+      // Watch events of the new session may arrive meanwhile.
+      l.unlock();
+      new_session = zookeeper_->Reconnect();
+      l.lock();
+      if (!new_session) {
+        LOG_WARN(("Unable to start a new Zookeeper session, retrying"));
+        continue;
+      }
+      expired_ = false;
+    }
+    Reads reads = std::move(pending_);
+    pending_ = Reads();
+    const uint64_t event_micros = pending_since_micros_;
+    pending_since_micros_ = 0;
+    const bool resync = resync_;
+    resync_ = false;
+    l.unlock();
+
+    for (const auto &failure : failed_) {
+      reads.data.insert(failure.first);
+      if (Depth(failure.first) < max_depth_) {
+        reads.children.insert(failure.first);
+      }
+    }
+    failed_.clear();
+    if (new_session) {
+      ReadAll(&reads);
+    } else if (resync) {
+      Resync(&reads);
+    }
+    const size_t first_change = unpublished_.size();
+    Read(std::move(reads), &unpublished_);
+    for (size_t i = first_change; i < unpublished_.size(); i++) {
+      unpublished_[i].event_micros = event_micros;
+    }
+
+    std::shared_ptr<const Node> root;
+    const bool publish =
+        LogUnreadable() && (!published_ || !unpublished_.empty());
+    if (publish && tree_) {
+      root = Freeze(tree_.get());
+    }
+    l.lock();
+    if (publish) {
+      snapshot_ = root;
+      published_ = true;
+      std::vector<Change> changes = std::move(unpublished_);
+      unpublished_.clear();
+      // Events which arrive meanwhile are processed after the listener
+      // returns.
+      l.unlock();
+      listener_(root, changes);
+      l.lock();
+    }
+  }
+}
+
+void TreeCache::Read(Reads reads, std::vector<Change> *changes) {
+  while (!reads.empty()) {
+    const std::vector<std::string> data_paths(reads.data.begin(),
+                                              reads.data.end());
+    const std::vector<std::string> children_paths(reads.children.begin(),
+                                                  reads.children.end());
+    std::vector<DataResult> data_results(data_paths.size());
+    std::vector<ChildrenResult> children_results(children_paths.size());
+    Countdown countdown(data_paths.size() + children_paths.size());
+    // Zookeeper answers requests in order, so new znodes are cached by the
+    // time their children are applied.
+    for (size_t i = 0; i < data_paths.size(); i++) {
+      DataResult *result = &data_results[i];
+      requests_++;
+      const int rc = zookeeper_->AsyncGet(
+          ZookeeperPath(data_paths[i]).c_str(), &watcher_,
+          [result, &countdown](int rc, const std::string &data,
+                               const struct Stat *stat) {
+            result->rc = rc;
+            result->data = data;
+            if (stat) {
+              result->stat = *stat;
+            }
+            countdown.Done();
+          });
+      if (rc != ZOK) {
+        result->rc = rc;
+        countdown.Done();
+      }
+    }
+    for (size_t i = 0; i < children_paths.size(); i++) {
+      ChildrenResult *result = &children_results[i];
+      requests_++;
+      const int rc = zookeeper_->AsyncGetChildren(
+          ZookeeperPath(children_paths[i]).c_str(), &watcher_,
+          [result, &countdown](int rc,
+                               const std::vector<std::string> &children,
+                               const struct Stat *stat) {
+            result->rc = rc;
+            result->children = children;
+            if (stat) {
+              result->stat = *stat;
+            }
+            countdown.Done();
+          });
+      if (rc != ZOK) {
+        result->rc = rc;
+        countdown.Done();
+      }
+    }
+    countdown.Wait();
+
+    reads = Reads();
+    for (size_t i = 0; i < data_paths.size(); i++) {
+      const DataResult &result = data_results[i];
+      ApplyData(data_paths[i], result.rc, result.data, &result.stat, &reads,
+                changes);
+    }
+    for (size_t i = 0; i < children_paths.size(); i++) {
+      const ChildrenResult &result = children_results[i];
+      ApplyChildren(children_paths[i], result.rc, result.children,
+                    &result.stat, &reads, changes);
+    }
+  }
+}
+
+void TreeCache::Resync(Reads *reads) {
+  if (!tree_) {
+    ReadAll(reads);
+    return;
+  }
+  const auto nodes = CachedNodes();
+
+  std::vector<DataResult> results(nodes.size());
+  Countdown countdown(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    DataResult *result = &results[i];
+    requests_++;
+    // Watches are restored by the client library.
+    const int rc = zookeeper_->AsyncExists(
+        ZookeeperPath(nodes[i].first).c_str(), nullptr,
+        [result, &countdown](int rc, const struct Stat *stat) {
+          result->rc = rc;
+          if (stat) {
+            result->stat = *stat;
+          }
+          countdown.Done();
+        });
+    if (rc != ZOK) {
+      result->rc = rc;
+      countdown.Done();
+    }
+  }
+  countdown.Wait();
+
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const std::string &path = nodes[i].first;
+    const struct Stat &cached = nodes[i].second->stat;
+    const DataResult &result = results[i];
+    const bool has_children = Depth(path) < max_depth_;
+    if (result.rc == ZNONODE) {
+      reads->data.insert(path);
+    } else if (result.rc != ZOK) {
+      failed_[path] = result.rc;
+    } else if (result.stat.czxid != cached.czxid) {
+      // Re-created.
+      reads->data.insert(path);
+      if (has_children) {
+        reads->children.insert(path);
+      }
+    } else {
+      if (result.stat.version != cached.version) {
+        reads->data.insert(path);
+      }
+      if (has_children && result.stat.cversion != cached.cversion) {
+        reads->children.insert(path);
+      }
+    }
+  }
+}
+
+void TreeCache::ReadAll(Reads *reads) {
+  if (!tree_) {
+    reads->data.insert("");
+    if (max_depth_ > 0) {
+      reads->children.insert("");
+    }
+    return;
+  }
+  for (const auto &node : CachedNodes()) {
+    reads->data.insert(node.first);
+    if (Depth(node.first) < max_depth_) {
+      reads->children.insert(node.first);
+    }
+  }
+}
+
+std::vector<std::pair<std::string, const TreeCache::MutableNode*>>
+TreeCache::CachedNodes() const {
+  std::vector<std::pair<std::string, const MutableNode*>> nodes;
+  if (!tree_) {
+    return nodes;
+  }
+  std::vector<std::pair<std::string, const MutableNode*>> stack{
+      {"", tree_.get()}};
+  while (!stack.empty()) {
+    nodes.push_back(stack.back());
+    stack.pop_back();
+    for (const auto &child : nodes.back().second->children) {
+      stack.emplace_back(JoinPath(nodes.back().first, child.first),
+                         child.second.get());
+    }
+  }
+  return nodes;
+}
+
+bool TreeCache::LogUnreadable() {
+  std::map<std::string, int> unreadable;
+  for (const auto &failure : failed_) {
+    if (IsConnectionError(failure.second)) {
+      continue;
+    }
+    auto logged = unreadable_.find(failure.first);
+    if (logged == unreadable_.end() || logged->second != failure.second) {
+      const std::string path = failure.first.empty()
+          ? absolute_root_ : absolute_root_ + "/" + failure.first;
+      LOG_WARN(("Unable to read %s, error %d, publishing without its changes",
+                path.c_str(), failure.second));
+    }
+    unreadable.insert(failure);
+  }
+  unreadable_.swap(unreadable);
+  return unreadable_.size() == failed_.size();
+}
+
+void TreeCache::ApplyData(const std::string &path, int rc,
+                          const std::string &data, const struct Stat *stat,
+                          Reads *next, std::vector<Change> *changes) {
+  if (rc == ZNONODE) {
+    MutableNode *node = Find(path, false);
+    if (node) {
+      AddDeleted(path, *node, changes);
+      if (path.empty()) {
+        tree_.reset();
+      } else {
+        Find(ParentPath(path), true)->children.erase(GetLastPathSegment(
+            path.c_str()));
+      }
+    }
+    if (path.empty()) {
+      WatchRootCreation(next);
+    }
+    return;
+  }
+  if (rc != ZOK) {
+    failed_[path] = rc;
+    return;
+  }
+  MutableNode *node = Find(path, false);
+  if (!node) {
+    if (path.empty()) {
+      tree_.reset(new MutableNode());
+      node = tree_.get();
+    } else {
+      MutableNode *parent = Find(ParentPath(path), true);
+      if (!parent) {
+        // The parent is gone meanwhile.
+        return;
+      }
+      std::unique_ptr<MutableNode> &child =
+          parent->children[GetLastPathSegment(path.c_str())];
+      child.reset(new MutableNode());
+      node = child.get();
+    }
+    node->data = data;
+    node->stat = *stat;
+    changes->push_back({Change::kCreated, path, 0});
+    return;
+  }
+  const bool data_changed = node->data != data;
+  if (!data_changed && SameStat(node->stat, *stat)) {
+    return;
+  }
+  Find(path, true);
+  node->data = data;
+  node->stat = *stat;
+  if (data_changed) {
+    changes->push_back({Change::kChanged, path, 0});
+  }
+}
+
+void TreeCache::ApplyChildren(const std::string &path, int rc,
+                              const std::vector<std::string> &children,
+                              const struct Stat *stat, Reads *next,
+                              std::vector<Change> *changes) {
+  if (rc == ZNONODE) {
+    // Deletion is handled by the data watch.
+    return;
+  }
+  if (rc != ZOK) {
+    failed_[path] = rc;
+    return;
+  }
+  MutableNode *node = Find(path, false);
+  if (!node) {
+    return;
+  }
+  const std::set<std::string> names(children.begin(), children.end());
+  bool changed = node->stat.cversion != stat->cversion;
+  for (auto child = node->children.begin(); child != node->children.end();) {
+    if (names.count(child->first) == 0) {
+      AddDeleted(JoinPath(path, child->first), *child->second, changes);
+      child = node->children.erase(child);
+      changed = true;
+    } else {
+      ++child;
+    }
+  }
+  for (const std::string &name : names) {
+    if (node->children.count(name) == 0) {
+      const std::string child_path = JoinPath(path, name);
+      next->data.insert(child_path);
+      if (Depth(child_path) < max_depth_) {
+        next->children.insert(child_path);
+      }
+    }
+  }
+  if (changed) {
+    Find(path, true);
+    node->stat.cversion = stat->cversion;
+    node->stat.numChildren = stat->numChildren;
+    node->stat.pzxid = stat->pzxid;
+  }
+}
+
+void TreeCache::WatchRootCreation(Reads *next) {
+  requests_++;
+  int rc = zookeeper_->Exists(ZookeeperPath("").c_str(), &watcher_, nullptr);
+  if (rc == ZOK) {
+    // Created meanwhile.
+    next->data.insert("");
+    if (max_depth_ > 0) {
+      next->children.insert("");
+    }
+  } else if (rc != ZNONODE) {
+    failed_[""] = rc;
+  }
+}
+
+TreeCache::MutableNode *TreeCache::Find(const std::string &path, bool touch) {
+  MutableNode *node = tree_.get();
+  size_t begin = 0;
+  while (node) {
+    if (touch) {
+      node->frozen.reset();
+    }
+    if (begin >= path.size()) {
+      return node;
+    }
+    size_t end = std::min(path.find('/', begin), path.size());
+    auto child = node->children.find(path.substr(begin, end - begin));
+    node = child == node->children.end() ? nullptr : child->second.get();
+    begin = end + 1;
+  }
+  return nullptr;
+}
+
+void TreeCache::AddDeleted(const std::string &path, const MutableNode &node,
+                           std::vector<Change> *changes) {
+  for (const auto &child : node.children) {
+    AddDeleted(JoinPath(path, child.first), *child.second, changes);
+  }
+  changes->push_back({Change::kDeleted, path, 0});
+}
+
+std::shared_ptr<const TreeCache::Node> TreeCache::Freeze(MutableNode *node) {
+  if (!node->frozen) {
+    std::shared_ptr<Node> frozen = std::make_shared<Node>();
+    frozen->data = node->data;
+    frozen->stat = node->stat;
+    for (const auto &child : node->children) {
+      frozen->children.emplace(child.first, Freeze(child.second.get()));
+    }
+    node->frozen = frozen;
+  }
+  return node->frozen;
+}
+
+std::string TreeCache::ZookeeperPath(const std::string &path) const {
+  if (path.empty() || root_.empty()) {
+    return root_ + path;
+  }
+  return root_ + "/" + path;
+}
+
+bool TreeCache::RelativePath(const char *path, std::string *relative) const {
+  const size_t length = absolute_root_.size();
+  if (strncmp(path, absolute_root_.c_str(), length) != 0) {
+    return false;
+  }
+  if (path[length] == 0) {
+    relative->clear();
+    return true;
+  }
+  if (path[length] != '/') {
+    return false;
+  }
+  relative->assign(path + length + 1);
+  return true;
+}
+
+int TreeCache::Depth(const std::string &path) {
+  return path.empty() ? 0 : 1 + std::count(path.begin(), path.end(), '/');
+}
+
+}  // namespace zookeeper_cc
@@ -0,0 +1,190 @@
+#ifndef ZOOKEEPER_CC_TREE_CACHE_H_
+#define ZOOKEEPER_CC_TREE_CACHE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "zookeeper_cc.h"
+
+namespace zookeeper_cc {
+
+// Mirrors a subtree of Zookeeper in memory: data and Stat of the root znode
+// and its descendants up to `max_depth` levels below it, which are kept up
+// to date with watches.
+//
+// Watch events are applied incrementally: a data event re-reads data of its
+// znode only, a child event re-reads the list of children of its znode and
+// reads new children only. Pending events are processed in batches on the
+// cache's own thread, reads of a batch are pipelined with asynchronous
+// calls. After reconnection, Stat of each cached znode is compared with the
+// one in Zookeeper and only znodes whose `version` or `cversion` changed are
+// read again. Reads which failed (e.g. because of connection loss) are
+// retried on reconnection and every `kRetryIntervalMs` otherwise.
+//
+// Consumers get an immutable snapshot of the tree, which shares unchanged
+// subtrees with the previous one, and the list of changes after each batch.
+// A snapshot is published only once no read of the batch has failed because
+// of the connection, so it's always consistent with some recent state of
+// Zookeeper (modulo changes which happened while the batch was read). Znodes
+// which can't be read otherwise (e.g. ZNOAUTH) don't hold it back: new ones
+// are left out of the snapshot and the others keep their last known state.
+// They are logged and retried like other failed reads.
+//
+// When the session expires, the cache starts a new one with
+// Zookeeper::Reconnect() and reads all cached znodes again, since their
+// watches are lost with the old session.
+class TreeCache {
+ public:
+  struct Node {
+    std::string data;
+    struct Stat stat;
+    // Keyed by name, empty for znodes at `max_depth`.
+    std::map<std::string, std::shared_ptr<const Node>> children;
+  };
+
+  struct Change {
+    enum Type { kCreated, kChanged, kDeleted };
+
+    Type type;
+    // Relative to the root, empty for the root itself. Creation and
+    // deletion are reported for each descendant as well; kChanged means
+    // that data has changed.
+    std::string path;
+    // Wall time in microseconds since the epoch when the earliest watch
+    // event of the batch which found the change was received, zero if the
+    // change was found otherwise (the first read, resync or a retry).
+    uint64_t event_micros;
+  };
+
+  // Called with the new snapshot (null if the root does not exist) and
+  // changes since the previous call, never concurrently.
+  using Listener = std::function<void(const std::shared_ptr<const Node>&,
+                                      const std::vector<Change>&)>;
+
+  static const int kRetryIntervalMs = 1000;
+
+  // `root` is relative to the base path of `zookeeper`, which should outlive
+  // the cache.
+  TreeCache(Zookeeper *zookeeper, std::string root, int max_depth);
+  ~TreeCache();
+
+  // Takes over the global watcher of `zookeeper` (to be notified on
+  // reconnection and session expiration) and starts following the tree. The first call of
+  // `listener` reports everything which exists as created.
+  void Start(Listener listener);
+
+  // Returns the latest published snapshot, null if the root does not exist
+  // or is not read yet.
+  std::shared_ptr<const Node> GetRoot() const;
+
+  // Number of requests sent to Zookeeper so far.
+  uint64_t requests() const { return requests_; }
+  // Number of watch events received so far, not counting session events.
+  uint64_t watch_events() const { return watch_events_; }
+
+ private:
+  struct MutableNode {
+    std::string data;
+    struct Stat stat;
+    std::map<std::string, std::unique_ptr<MutableNode>> children;
+    // Snapshot of the node, null if it has changed since.
+    std::shared_ptr<const Node> frozen;
+  };
+
+  // Paths (relative to the root) whose data or children should be read.
+  struct Reads {
+    std::set<std::string> data;
+    std::set<std::string> children;
+
+    bool empty() const { return data.empty() && children.empty(); }
+  };
+
+  void Watch(int type, int state, const char *path);
+  void Run();
+
+  // Reads everything in `reads` and whatever turns out to be new, applying
+  // results to the tree. Returns after all reads are done.
+  void Read(Reads reads, std::vector<Change> *changes);
+  // Compares Stat of cached znodes with Zookeeper, adds the ones which
+  // changed to `reads`.
+  void Resync(Reads *reads);
+  // Adds all cached znodes to `reads`, or the root if it's not cached.
+  void ReadAll(Reads *reads);
+  // Returns paths of all cached znodes with the nodes.
+  std::vector<std::pair<std::string, const MutableNode*>> CachedNodes() const;
+  // Logs paths in `failed_` which can't be read for reasons other than the
+  // connection unless they were logged with the same error already, returns
+  // false if there are other failures.
+  bool LogUnreadable();
+
+  void ApplyData(const std::string &path, int rc, const std::string &data,
+                 const struct Stat *stat, Reads *next,
+                 std::vector<Change> *changes);
+  void ApplyChildren(const std::string &path, int rc,
+                     const std::vector<std::string> &children,
+                     const struct Stat *stat, Reads *next,
+                     std::vector<Change> *changes);
+  // Sets watch on creation of the root.
+  void WatchRootCreation(Reads *next);
+
+  // Returns the node at `path`, null if it's not cached. Marks it and its
+  // ancestors changed if `touch` is set.
+  MutableNode *Find(const std::string &path, bool touch);
+  void AddDeleted(const std::string &path, const MutableNode &node,
+                  std::vector<Change> *changes);
+  static std::shared_ptr<const Node> Freeze(MutableNode *node);
+
+  // Path for calls of `zookeeper_`.
+  std::string ZookeeperPath(const std::string &path) const;
+  // Converts path reported by a watch, returns false if it's not in the tree.
+  bool RelativePath(const char *path, std::string *relative) const;
+  static int Depth(const std::string &path);
+
+  Zookeeper *zookeeper_;
+  const std::string root_;
+  // Absolute path of the root, as reported by watches.
+  const std::string absolute_root_;
+  const int max_depth_;
+  const Zookeeper::WatcherCallback watcher_;
+  Listener listener_;
+  std::atomic<uint64_t> requests_{0};
+  std::atomic<uint64_t> watch_events_{0};
+
+  // Owned by the thread.
+  std::unique_ptr<MutableNode> tree_;
+  // Paths whose reads failed with their errors, they are read again.
+  std::map<std::string, int> failed_;
+  // Paths which can't be read for reasons other than the connection, as
+  // logged last time.
+  std::map<std::string, int> unreadable_;
+  // Whether the session has expired and a new one is not started yet.
+  bool expired_ = false;
+  // Changes which are not published yet because of failed reads.
+  std::vector<Change> unpublished_;
+  bool published_ = false;
+
+  mutable std::mutex mu_;
+  std::condition_variable events_;
+  Reads pending_;
+  // When the first of `pending_` was added by a watch event, zero if none.
+  uint64_t pending_since_micros_ = 0;
+  bool disconnected_ = false;
+  bool resync_ = false;
+  bool session_expired_ = false;
+  bool stop_ = false;
+  std::shared_ptr<const Node> snapshot_;
+
+  std::thread thread_;
+};
+
+}  // namespace zookeeper_cc
+
+#endif  // ZOOKEEPER_CC_TREE_CACHE_H_
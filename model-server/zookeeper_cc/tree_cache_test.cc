@@ -0,0 +1,295 @@
+#include "zookeeper_cc/tree_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using zookeeper_cc::TreeCache;
+using zookeeper_cc::Zookeeper;
+using ::testing::ElementsAre;
+using ::testing::UnorderedElementsAre;
+
+namespace {
+
+const int kRecvTimeoutMs = 1000;
+const auto kListenerTimeout = std::chrono::seconds(5);
+
+using NodePtr = std::shared_ptr<const TreeCache::Node>;
+
+// Records calls of the cache's listener.
+class Listener {
+ public:
+  TreeCache::Listener callback() {
+    return [this](const NodePtr &root,
+                  const std::vector<TreeCache::Change> &changes) {
+      std::lock_guard<std::mutex> l(mu_);
+      roots_.push_back(root);
+      std::vector<std::string> descriptions;
+      std::vector<uint64_t> event_micros;
+      for (const auto &change : changes) {
+        static const char *kTypes[] = {"created", "changed", "deleted"};
+        descriptions.push_back(std::string(kTypes[change.type]) + " " +
+                               change.path);
+        event_micros.push_back(change.event_micros);
+      }
+      changes_.push_back(descriptions);
+      event_micros_.push_back(event_micros);
+      called_.notify_all();
+    };
+  }
+
+  // Waits for the next call, returns false on timeout. Event times of the
+  // changes are returned in `event_micros` if it's not null.
+  bool Wait(NodePtr *root, std::vector<std::string> *changes,
+            std::vector<uint64_t> *event_micros = nullptr) {
+    std::unique_lock<std::mutex> l(mu_);
+    if (!called_.wait_for(l, kListenerTimeout,
+                          [this]() { return next_ < roots_.size(); })) {
+      return false;
+    }
+    *root = roots_[next_];
+    *changes = changes_[next_];
+    if (event_micros) {
+      *event_micros = event_micros_[next_];
+    }
+    next_++;
+    return true;
+  }
+
+ private:
+  std::mutex mu_;
+  std::condition_variable called_;
+  std::vector<NodePtr> roots_;
+  std::vector<std::vector<std::string>> changes_;
+  std::vector<std::vector<uint64_t>> event_micros_;
+  size_t next_ = 0;
+};
+
+uint64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::vector<std::string> ChildNames(const NodePtr &node) {
+  std::vector<std::string> names;
+  for (const auto &child : node->children) {
+    names.push_back(child.first);
+  }
+  return names;
+}
+
+}
+
+class TreeCacheTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() override {
+    char *hosts = getenv("ZOOKEEPER_TEST_HOSTS");
+    ASSERT_TRUE(hosts && strlen(hosts) > 0) << "ZOOKEEPER_TEST_HOSTS is unspecified";
+
+    // Construct random path inside Zookeeper to provide some tests isolation.
+    auto unit_test = ::testing::UnitTest::GetInstance();
+    const ::testing::TestInfo* const test_info =
+        unit_test->current_test_info();
+    std::stringstream bases;
+    bases << "/zookeeper-cc-tree-cache-test"
+          << "/" << unit_test->random_seed()
+          << "/" << test_info->test_case_name()
+          << "/" << test_info->name();
+
+    // Disable most logging.
+    zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
+
+    zk_.reset(new Zookeeper(hosts, kRecvTimeoutMs, bases.str()));
+    ASSERT_TRUE(zk_->Init());
+  }
+
+  virtual void TearDown() override {
+    cache_.reset();
+    zk_.reset();
+  }
+
+  void StartCache(int max_depth) {
+    cache_.reset(new TreeCache(zk_.get(), "tree", max_depth));
+    cache_->Start(listener_.callback());
+  }
+
+  std::unique_ptr<Zookeeper> zk_;
+  std::unique_ptr<TreeCache> cache_;
+  Listener listener_;
+};
+
+TEST_F(TreeCacheTest, ReadsTree) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a/1", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/b", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->Set("tree/a", "config"));
+  ASSERT_EQ(ZOK, zk_->Set("tree/a/1", "path"));
+  StartCache(2);
+
+  NodePtr root;
+  std::vector<std::string> changes;
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_THAT(changes, UnorderedElementsAre("created ", "created a",
+                                            "created a/1", "created b"));
+  ASSERT_TRUE(root);
+  EXPECT_EQ(root, cache_->GetRoot());
+  ASSERT_THAT(ChildNames(root), ElementsAre("a", "b"));
+  const NodePtr &a = root->children.at("a");
+  EXPECT_EQ("config", a->data);
+  EXPECT_EQ(1, a->stat.version);
+  ASSERT_THAT(ChildNames(a), ElementsAre("1"));
+  EXPECT_EQ("path", a->children.at("1")->data);
+}
+
+TEST_F(TreeCacheTest, ReportsMissingRoot) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("", &ZOO_OPEN_ACL_UNSAFE));
+  StartCache(2);
+
+  NodePtr root;
+  std::vector<std::string> changes;
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_FALSE(root);
+  EXPECT_THAT(changes, ElementsAre());
+
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a", &ZOO_OPEN_ACL_UNSAFE));
+  // The root and its child may be seen separately.
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  ASSERT_TRUE(root);
+  if (root->children.empty()) {
+    ASSERT_TRUE(listener_.Wait(&root, &changes));
+  }
+  EXPECT_THAT(ChildNames(root), ElementsAre("a"));
+}
+
+TEST_F(TreeCacheTest, ReadsChangedDataOnly) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a/1", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/b/1", &ZOO_OPEN_ACL_UNSAFE));
+  StartCache(2);
+  NodePtr before;
+  std::vector<std::string> changes;
+  ASSERT_TRUE(listener_.Wait(&before, &changes));
+  const uint64_t requests = cache_->requests();
+  const uint64_t watch_events = cache_->watch_events();
+
+  ASSERT_EQ(ZOK, zk_->Set("tree/a/1", "path"));
+  NodePtr after;
+  ASSERT_TRUE(listener_.Wait(&after, &changes));
+  EXPECT_THAT(changes, ElementsAre("changed a/1"));
+  EXPECT_EQ("path", after->children.at("a")->children.at("1")->data);
+  EXPECT_EQ(watch_events + 1, cache_->watch_events());
+  EXPECT_EQ(requests + 1, cache_->requests());
+
+  // Unchanged subtrees are shared between snapshots, the previous snapshot
+  // is not modified.
+  EXPECT_EQ(before->children.at("b"), after->children.at("b"));
+  EXPECT_EQ("", before->children.at("a")->children.at("1")->data);
+}
+
+TEST_F(TreeCacheTest, ReportsTimeOfWatchEvents) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a", &ZOO_OPEN_ACL_UNSAFE));
+  StartCache(2);
+  NodePtr root;
+  std::vector<std::string> changes;
+  std::vector<uint64_t> event_micros;
+  ASSERT_TRUE(listener_.Wait(&root, &changes, &event_micros));
+  // Found by the first read.
+  EXPECT_THAT(event_micros, ElementsAre(0, 0));
+
+  const uint64_t before_micros = NowMicros();
+  ASSERT_EQ(ZOK, zk_->Set("tree/a", "config"));
+  ASSERT_TRUE(listener_.Wait(&root, &changes, &event_micros));
+  const uint64_t after_micros = NowMicros();
+  EXPECT_THAT(changes, ElementsAre("changed a"));
+  ASSERT_EQ(1, event_micros.size());
+  EXPECT_LE(before_micros, event_micros[0]);
+  EXPECT_GE(after_micros, event_micros[0]);
+}
+
+TEST_F(TreeCacheTest, ReadsNewChildrenOnly) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a/1", &ZOO_OPEN_ACL_UNSAFE));
+  StartCache(2);
+  NodePtr root;
+  std::vector<std::string> changes;
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  const uint64_t requests = cache_->requests();
+
+  ASSERT_EQ(ZOK, zk_->Create("tree/a/2", "path", false,
+                             &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_THAT(changes, ElementsAre("created a/2"));
+  EXPECT_THAT(ChildNames(root->children.at("a")), ElementsAre("1", "2"));
+  EXPECT_EQ("path", root->children.at("a")->children.at("2")->data);
+  // Children of "a" and data of "a/2".
+  EXPECT_EQ(requests + 2, cache_->requests());
+
+  ASSERT_EQ(ZOK, zk_->Delete("tree/a/1"));
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_THAT(changes, ElementsAre("deleted a/1"));
+  EXPECT_THAT(ChildNames(root->children.at("a")), ElementsAre("2"));
+}
+
+TEST_F(TreeCacheTest, FollowsDeletionOfRoot) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a", &ZOO_OPEN_ACL_UNSAFE));
+  StartCache(2);
+  NodePtr root;
+  std::vector<std::string> changes;
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+
+  ASSERT_EQ(ZOK, zk_->Delete("tree/a"));
+  ASSERT_EQ(ZOK, zk_->Delete("tree"));
+  // Deletions may be seen separately.
+  std::vector<std::string> deleted;
+  do {
+    ASSERT_TRUE(listener_.Wait(&root, &changes));
+    deleted.insert(deleted.end(), changes.begin(), changes.end());
+  } while (root);
+  EXPECT_THAT(deleted, UnorderedElementsAre("deleted a", "deleted "));
+  EXPECT_FALSE(cache_->GetRoot());
+
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_THAT(changes, ElementsAre("created "));
+  EXPECT_TRUE(root);
+}
+
+TEST_F(TreeCacheTest, DoesNotCacheBelowMaxDepth) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a/1", &ZOO_OPEN_ACL_UNSAFE));
+  StartCache(1);
+
+  NodePtr root;
+  std::vector<std::string> changes;
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_THAT(changes, UnorderedElementsAre("created ", "created a"));
+  EXPECT_THAT(ChildNames(root->children.at("a")), ElementsAre());
+  EXPECT_EQ(1, root->children.at("a")->stat.numChildren);
+}
+
+TEST_F(TreeCacheTest, PublishesWithoutUnreadableZnodes) {
+  ASSERT_EQ(ZOK, zk_->EnforcePath("tree/a", &ZOO_OPEN_ACL_UNSAFE));
+  // Reading it requires authentication, so it fails with ZNOAUTH.
+  struct ACL acl = {ZOO_PERM_ALL, {const_cast<char*>("digest"),
+                                   const_cast<char*>("someone:secret")}};
+  struct ACL_vector acls = {1, &acl};
+  ASSERT_EQ(ZOK, zk_->Create("tree/secret", "", false, &acls));
+  StartCache(2);
+
+  NodePtr root;
+  std::vector<std::string> changes;
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_THAT(changes, UnorderedElementsAre("created ", "created a"));
+  EXPECT_THAT(ChildNames(root), ElementsAre("a"));
+
+  // Retries of the unreadable znode don't hold back other changes.
+  ASSERT_EQ(ZOK, zk_->Set("tree/a", "config"));
+  ASSERT_TRUE(listener_.Wait(&root, &changes));
+  EXPECT_THAT(changes, ElementsAre("changed a"));
+  EXPECT_EQ("config", root->children.at("a")->data);
+}
@@ -13,6 +13,22 @@ Zookeeper::Zookeeper(std::string hosts, int recv_timeout, std::string base)
 {
 }
 
+zhandle_t *Zookeeper::NewHandle() {
+  return zookeeper_init(
+    hosts_.c_str(),
+    &Zookeeper::WatcherHandler,
+    recv_timeout_,
+    NULL, // clientid
+    const_cast<void*>(static_cast<const void*>(watcher_)), // watcher context
+    0 // flags
+  );
+}
+
+std::shared_ptr<zhandle_t> Zookeeper::Handle() {
+  std::lock_guard<std::mutex> l(mu_);
+  return zh_;
+}
+
 std::string Zookeeper::GetAbsolutePath(const char *path) {
   if (path[0] == '/') {
     return base_ + (path + 1);
@@ -24,28 +40,45 @@ std::string Zookeeper::GetAbsolutePath(const char *path) {
 }
 
 bool Zookeeper::Init() {
+  std::lock_guard<std::mutex> l(mu_);
   assert(!zh_);
-  zh_.reset(zookeeper_init(
-    hosts_.c_str(),
-    &Zookeeper::WatcherHandler,
-    recv_timeout_,
-    NULL, // clientid
-    NULL, // watcher context
-    0 // flags
-  ));
+  zhandle_t *zh = NewHandle();
+  if (zh) {
+    zh_.reset(zh, ZhandleDeleter());
+    session_number_++;
+  }
   return static_cast<bool>(zh_);
 }
 
+bool Zookeeper::Reconnect() {
+  // Closed after the lock is released: closing waits for the handle's
+  // threads, whose callbacks may call the wrapper.
+  std::shared_ptr<zhandle_t> old;
+  std::lock_guard<std::mutex> l(mu_);
+  assert(zh_);
+  zhandle_t *zh = NewHandle();
+  if (!zh) {
+    return false;
+  }
+  old = std::move(zh_);
+  zh_.reset(zh, ZhandleDeleter());
+  session_number_++;
+  return true;
+}
+
 void Zookeeper::SetWatcher(const WatcherCallback *watcher) {
+  std::lock_guard<std::mutex> l(mu_);
   assert(zh_);
+  watcher_ = watcher;
   zoo_set_context(zh_.get(), const_cast<void*>(static_cast<const void*>(watcher)));
 }
 
 int Zookeeper::Create(const char *path, const std::string &value,
                       bool ephemeral, struct ACL_vector *acl) {
-  assert(zh_);
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
   return zoo_create(
-    zh_.get(),
+    zh.get(),
     GetAbsolutePath(path).c_str(),
     value.data(),
     value.size(),
@@ -58,9 +91,10 @@ int Zookeeper::Create(const char *path, const std::string &value,
 
 int Zookeeper::Exists(const char *path, const WatcherCallback *watcher,
                       struct Stat *stat) {
-  assert(zh_);
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
   return zoo_wexists(
-    zh_.get(),
+    zh.get(),
     GetAbsolutePath(path).c_str(),
     watcher ? &Zookeeper::WatcherHandler : NULL,
     const_cast<void*>(static_cast<const void*>(watcher)),
@@ -70,13 +104,14 @@ int Zookeeper::Exists(const char *path, const WatcherCallback *watcher,
 
 int Zookeeper::Get(const char *path, std::string *output,
                    const WatcherCallback *watcher, struct Stat *stat) {
-  assert(zh_);
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
   // Zookeeper's limit on data size is 1 MiB, plus 1 for null terminator.
   static const int BUF_SIZE = 1024 * 1024 + 1;
   thread_local char buf[BUF_SIZE];
   int len = sizeof buf;
   int res = zoo_wget(
-    zh_.get(),
+    zh.get(),
     GetAbsolutePath(path).c_str(),
     watcher ? &Zookeeper::WatcherHandler : NULL,
     const_cast<void*>(static_cast<const void*>(watcher)),
@@ -91,23 +126,26 @@ int Zookeeper::Get(const char *path, std::string *output,
 }
 
 int Zookeeper::Set(const char *path, const std::string &data, int version) {
-  assert(zh_);
-  return zoo_set(zh_.get(), GetAbsolutePath(path).c_str(),
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  return zoo_set(zh.get(), GetAbsolutePath(path).c_str(),
                  data.data(), data.size(), version);
 }
 
 int Zookeeper::Delete(const char *path, int version) {
-  assert(zh_);
-  return zoo_delete(zh_.get(), GetAbsolutePath(path).c_str(), version);
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  return zoo_delete(zh.get(), GetAbsolutePath(path).c_str(), version);
 }
 
 int Zookeeper::GetChildren(const char *path,
                            std::vector<std::string> *children_name,
                            const WatcherCallback *watcher) {
-  assert(zh_);
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
   String_vector children {};
   int res = zoo_wget_children(
-    zh_.get(),
+    zh.get(),
     GetAbsolutePath(path).c_str(),
     watcher ? &Zookeeper::WatcherHandler : NULL,
     const_cast<void*>(static_cast<const void*>(watcher)),
@@ -121,7 +159,8 @@ int Zookeeper::GetChildren(const char *path,
 }
 
 int Zookeeper::EnforcePath(const char *rel_path, struct ACL_vector *acl) {
-  assert(zh_);
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
   std::string full_path = EnsureTrailingSlash(GetAbsolutePath(rel_path));
   int res = ZOK;
   // Iterate over all parent znodes of `full_path` by replacing slashes
@@ -131,7 +170,7 @@ int Zookeeper::EnforcePath(const char *rel_path, struct ACL_vector *acl) {
     if (full_path[i] == '/') {
       full_path[i] = 0;
       res = zoo_create(
-        zh_.get(),
+        zh.get(),
         full_path.c_str(),
         "", // value
         0, // valuelen
@@ -150,7 +189,185 @@ int Zookeeper::EnforcePath(const char *rel_path, struct ACL_vector *acl) {
 }
 
 int Zookeeper::State() {
-  return zoo_state(zh_.get());
+  return zoo_state(Handle().get());
+}
+
+int Zookeeper::AsyncCreate(const char *path, const std::string &value,
+                           bool ephemeral, struct ACL_vector *acl,
+                           VoidCompletion done) {
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  std::unique_ptr<VoidCompletion> completion(
+      new VoidCompletion(std::move(done)));
+  int res = zoo_acreate(
+    zh.get(),
+    GetAbsolutePath(path).c_str(),
+    value.data(),
+    value.size(),
+    acl,
+    (ephemeral ? ZOO_EPHEMERAL : 0), // flags
+    &Zookeeper::StringCompletionHandler,
+    completion.get()
+  );
+  if (res == ZOK) {
+    completion.release();
+  }
+  return res;
+}
+
+int Zookeeper::AsyncExists(const char *path, const WatcherCallback *watcher,
+                           StatCompletion done) {
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  std::unique_ptr<StatCompletion> completion(
+      new StatCompletion(std::move(done)));
+  int res = zoo_awexists(
+    zh.get(),
+    GetAbsolutePath(path).c_str(),
+    watcher ? &Zookeeper::WatcherHandler : NULL,
+    const_cast<void*>(static_cast<const void*>(watcher)),
+    &Zookeeper::StatCompletionHandler,
+    completion.get()
+  );
+  if (res == ZOK) {
+    completion.release();
+  }
+  return res;
+}
+
+int Zookeeper::AsyncGet(const char *path, const WatcherCallback *watcher,
+                        DataCompletion done) {
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  std::unique_ptr<DataCompletion> completion(
+      new DataCompletion(std::move(done)));
+  int res = zoo_awget(
+    zh.get(),
+    GetAbsolutePath(path).c_str(),
+    watcher ? &Zookeeper::WatcherHandler : NULL,
+    const_cast<void*>(static_cast<const void*>(watcher)),
+    &Zookeeper::DataCompletionHandler,
+    completion.get()
+  );
+  if (res == ZOK) {
+    completion.release();
+  }
+  return res;
+}
+
+int Zookeeper::AsyncSet(const char *path, const std::string &data,
+                        int version, StatCompletion done) {
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  std::unique_ptr<StatCompletion> completion(
+      new StatCompletion(std::move(done)));
+  int res = zoo_aset(
+    zh.get(),
+    GetAbsolutePath(path).c_str(),
+    data.data(),
+    data.size(),
+    version,
+    &Zookeeper::StatCompletionHandler,
+    completion.get()
+  );
+  if (res == ZOK) {
+    completion.release();
+  }
+  return res;
+}
+
+int Zookeeper::AsyncDelete(const char *path, int version,
+                           VoidCompletion done) {
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  std::unique_ptr<VoidCompletion> completion(
+      new VoidCompletion(std::move(done)));
+  int res = zoo_adelete(
+    zh.get(),
+    GetAbsolutePath(path).c_str(),
+    version,
+    &Zookeeper::VoidCompletionHandler,
+    completion.get()
+  );
+  if (res == ZOK) {
+    completion.release();
+  }
+  return res;
+}
+
+int Zookeeper::AsyncGetChildren(const char *path,
+                                const WatcherCallback *watcher,
+                                ChildrenCompletion done) {
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  std::unique_ptr<ChildrenCompletion> completion(
+      new ChildrenCompletion(std::move(done)));
+  int res = zoo_awget_children2(
+    zh.get(),
+    GetAbsolutePath(path).c_str(),
+    watcher ? &Zookeeper::WatcherHandler : NULL,
+    const_cast<void*>(static_cast<const void*>(watcher)),
+    &Zookeeper::ChildrenCompletionHandler,
+    completion.get()
+  );
+  if (res == ZOK) {
+    completion.release();
+  }
+  return res;
+}
+
+Zookeeper::Op Zookeeper::Op::Create(const char *path,
+                                    const std::string &value,
+                                    bool ephemeral, struct ACL_vector *acl) {
+  return Op{kCreate, path, value, ephemeral, acl, -1};
+}
+
+Zookeeper::Op Zookeeper::Op::Set(const char *path, const std::string &data,
+                                 int version) {
+  return Op{kSet, path, data, false, NULL, version};
+}
+
+Zookeeper::Op Zookeeper::Op::Delete(const char *path, int version) {
+  return Op{kDelete, path, "", false, NULL, version};
+}
+
+int Zookeeper::Multi(const std::vector<Op> &ops, std::vector<int> *results) {
+  const std::shared_ptr<zhandle_t> zh = Handle();
+  assert(zh);
+  // zoo_op_t only points to paths, so they are kept until the call returns.
+  std::vector<std::string> paths;
+  paths.reserve(ops.size());
+  std::vector<zoo_op_t> zoo_ops(ops.size());
+  std::vector<zoo_op_result_t> zoo_results(ops.size());
+  for (size_t i = 0; i < ops.size(); i++) {
+    const Op &op = ops[i];
+    paths.push_back(GetAbsolutePath(op.path.c_str()));
+    switch (op.type) {
+    case Op::kCreate:
+      zoo_create_op_init(&zoo_ops[i], paths[i].c_str(), op.value.data(),
+                         op.value.size(), op.acl,
+                         (op.ephemeral ? ZOO_EPHEMERAL : 0),
+                         NULL, 0);
+      break;
+    case Op::kSet:
+      zoo_set_op_init(&zoo_ops[i], paths[i].c_str(), op.value.data(),
+                      op.value.size(), op.version, NULL);
+      break;
+    case Op::kDelete:
+      zoo_delete_op_init(&zoo_ops[i], paths[i].c_str(), op.version);
+      break;
+    }
+    zoo_results[i].err = ZRUNTIMEINCONSISTENCY;
+  }
+  int res = ops.empty() ? ZOK : zoo_multi(zh.get(), ops.size(),
+                                          zoo_ops.data(), zoo_results.data());
+  if (results) {
+    results->clear();
+    for (const zoo_op_result_t &result : zoo_results) {
+      results->push_back(result.err);
+    }
+  }
+  return res;
 }
 
 void Zookeeper::WatcherHandler(zhandle_t *zzh, int type, int state,
@@ -161,4 +378,52 @@ void Zookeeper::WatcherHandler(zhandle_t *zzh, int type, int state,
   (*static_cast<WatcherCallback*>(watcherCtx))(type, state, path);
 }
 
+void Zookeeper::StringCompletionHandler(int rc, const char *value,
+                                        const void *data) {
+  // Path of the created znode is not reported, it's known to the caller
+  // unless the znode is sequential, which is not supported.
+  std::unique_ptr<const VoidCompletion> completion(
+      static_cast<const VoidCompletion*>(data));
+  (*completion)(rc);
+}
+
+void Zookeeper::VoidCompletionHandler(int rc, const void *data) {
+  std::unique_ptr<const VoidCompletion> completion(
+      static_cast<const VoidCompletion*>(data));
+  (*completion)(rc);
+}
+
+void Zookeeper::StatCompletionHandler(int rc, const struct Stat *stat,
+                                      const void *data) {
+  std::unique_ptr<const StatCompletion> completion(
+      static_cast<const StatCompletion*>(data));
+  (*completion)(rc, rc == ZOK ? stat : NULL);
+}
+
+void Zookeeper::DataCompletionHandler(int rc, const char *value,
+                                      int value_len, const struct Stat *stat,
+                                      const void *data) {
+  std::unique_ptr<const DataCompletion> completion(
+      static_cast<const DataCompletion*>(data));
+  // Znodes created by other clients may have null data (`value_len` is -1).
+  std::string output;
+  if (rc == ZOK && value && value_len > 0) {
+    output.assign(value, value + value_len);
+  }
+  (*completion)(rc, output, rc == ZOK ? stat : NULL);
+}
+
+void Zookeeper::ChildrenCompletionHandler(int rc,
+                                          const struct String_vector *strings,
+                                          const struct Stat *stat,
+                                          const void *data) {
+  std::unique_ptr<const ChildrenCompletion> completion(
+      static_cast<const ChildrenCompletion*>(data));
+  std::vector<std::string> children;
+  if (rc == ZOK && strings) {
+    children.assign(strings->data, strings->data + strings->count);
+  }
+  (*completion)(rc, children, rc == ZOK ? stat : NULL);
+}
+
 }  // namespace zookeeper_cc
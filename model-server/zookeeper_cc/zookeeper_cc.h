@@ -1,8 +1,11 @@
 #ifndef ZOOKEEPER_CC_ZOOKEEPER_CC_H_
 #define ZOOKEEPER_CC_ZOOKEEPER_CC_H_
 
+#include <stdint.h>
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "zookeeper.h"
@@ -26,6 +29,19 @@ class Zookeeper {
   // connection can still be in progress).
   bool Init();
 
+  // Replaces the handle with a new one, i.e. starts a new session, e.g.
+  // after the previous one has expired: it's unusable then. Watches and
+  // ephemeral znodes of the previous session are gone, its pending requests
+  // complete with ZCLOSING. The global watcher is kept. Must not be called
+  // from callbacks, it waits for threads of the previous handle. Returns
+  // false if the new handle can't be created, the previous one is kept then.
+  bool Reconnect();
+
+  // Number of the current session, incremented by Init() and Reconnect().
+  // Lets users of ephemeral znodes notice that the session which owned them
+  // is gone.
+  uint64_t SessionNumber() const { return session_number_; }
+
   const char *GetBasePath() { return base_.c_str(); }
 
   using WatcherCallback = std::function<void(int, int, const char*)>;
@@ -45,6 +61,62 @@ class Zookeeper {
                   const WatcherCallback *watcher);
   int State();
 
+  // Asynchronous counterparts of the routines above, built on zoo_a*
+  // completions: they send the request and return right away, so many
+  // requests can be in flight over the connection at once (Zookeeper
+  // answers them in order). `done` is called exactly once with the status
+  // of the request from Zookeeper's completion thread, so it must not block
+  // (e.g. on a synchronous call of the same Zookeeper). It's also called
+  // with ZCLOSING for requests which are pending when the wrapper is
+  // destroyed. Return the status of sending the request; `done` is not
+  // called unless it's ZOK.
+  using VoidCompletion = std::function<void(int)>;
+  using StatCompletion = std::function<void(int, const struct Stat*)>;
+  using DataCompletion =
+      std::function<void(int, const std::string&, const struct Stat*)>;
+  using ChildrenCompletion = std::function<
+      void(int, const std::vector<std::string>&, const struct Stat*)>;
+
+  int AsyncCreate(const char *path, const std::string &value,
+                  bool ephemeral, struct ACL_vector *acl,
+                  VoidCompletion done);
+  int AsyncExists(const char *path, const WatcherCallback *watcher,
+                  StatCompletion done);
+  int AsyncGet(const char *path, const WatcherCallback *watcher,
+               DataCompletion done);
+  int AsyncSet(const char *path, const std::string &data, int version,
+               StatCompletion done);
+  int AsyncDelete(const char *path, int version, VoidCompletion done);
+  int AsyncGetChildren(const char *path, const WatcherCallback *watcher,
+                       ChildrenCompletion done);
+
+  // Operation of Multi(), built with one of the functions below.
+  struct Op {
+    enum Type { kCreate, kSet, kDelete };
+
+    Type type;
+    std::string path;
+    // Value of a created znode or new data of kSet.
+    std::string value;
+    // kCreate only.
+    bool ephemeral;
+    struct ACL_vector *acl;
+    // kSet and kDelete only, -1 matches any version.
+    int version;
+
+    static Op Create(const char *path, const std::string &value,
+                     bool ephemeral, struct ACL_vector *acl);
+    static Op Set(const char *path, const std::string &data,
+                  int version = -1);
+    static Op Delete(const char *path, int version = -1);
+  };
+
+  // Executes `ops` in a single request with blocking zoo_multi: either all of
+  // them succeed or none is applied. Returns ZOK or the error of the first
+  // failed operation. If `results` is not null, it receives statuses of the
+  // operations, ones which were not executed get ZRUNTIMEINCONSISTENCY.
+  int Multi(const std::vector<Op> &ops, std::vector<int> *results);
+
   // Tries to create all znodes in path from top to bottom. If some node
   // already exists, it's not touched. Nodes are created with empty content.
   int EnforcePath(const char *path, struct ACL_vector *acl);
@@ -57,12 +129,37 @@ class Zookeeper {
   static void WatcherHandler(zhandle_t *zzh, int type, int state,
                              const char *path, void *watcherCtx);
 
+  // Trampolines of zoo_a* completions, `data` is a heap-allocated
+  // completion which they call and delete.
+  static void StringCompletionHandler(int rc, const char *value,
+                                      const void *data);
+  static void VoidCompletionHandler(int rc, const void *data);
+  static void StatCompletionHandler(int rc, const struct Stat *stat,
+                                    const void *data);
+  static void DataCompletionHandler(int rc, const char *value, int value_len,
+                                    const struct Stat *stat,
+                                    const void *data);
+  static void ChildrenCompletionHandler(int rc,
+                                        const struct String_vector *strings,
+                                        const struct Stat *stat,
+                                        const void *data);
+
   std::string GetAbsolutePath(const char *path);
 
-  std::unique_ptr<zhandle_t, ZhandleDeleter> zh_;
+  // Returns a handle with the global watcher, null on failure.
+  zhandle_t *NewHandle();
+  // Callers keep the handle while using it, so Reconnect() doesn't close it
+  // under them.
+  std::shared_ptr<zhandle_t> Handle();
+
   const std::string hosts_;
   const int recv_timeout_;
   const std::string base_;
+
+  std::mutex mu_;
+  std::shared_ptr<zhandle_t> zh_;
+  const WatcherCallback *watcher_ = nullptr;
+  std::atomic<uint64_t> session_number_{0};
 };
 
 }  // namespace zookeeper_cc
@@ -0,0 +1,247 @@
+// Measures how long it takes to read a tree of aspired models, laid out the
+// way ZookeeperSource reads it (configuration in the model's znode, paths in
+// versions' znodes), with blocking and with pipelined asynchronous calls.
+//
+// Usage: zookeeper_cc_benchmark [models [versions_per_model [runs]]]
+// Zookeeper is taken from ZOOKEEPER_TEST_HOSTS, see zookeeper_cc_benchmark.sh.
+
+#include "zookeeper_cc/zookeeper_cc.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using zookeeper_cc::Zookeeper;
+
+namespace {
+
+const int kRecvTimeoutMs = 10000;
+
+// Counts requests in flight and lets the caller wait until all of them are
+// completed. Remembers the first error.
+class Pending {
+ public:
+  void Add() {
+    std::lock_guard<std::mutex> l(mu_);
+    pending_++;
+  }
+
+  void Done(int rc) {
+    std::lock_guard<std::mutex> l(mu_);
+    if (rc != ZOK && error_ == ZOK) {
+      error_ = rc;
+    }
+    if (--pending_ == 0) {
+      done_.notify_all();
+    }
+  }
+
+  // Returns the first error, ZOK if there were none.
+  int Wait() {
+    std::unique_lock<std::mutex> l(mu_);
+    done_.wait(l, [this]() { return pending_ == 0; });
+    return error_;
+  }
+
+ private:
+  std::mutex mu_;
+  std::condition_variable done_;
+  int pending_ = 0;
+  int error_ = ZOK;
+};
+
+std::string ModelPath(int model) {
+  return "models/model" + std::to_string(model);
+}
+
+std::string VersionPath(int model, int version) {
+  return ModelPath(model) + "/" + std::to_string(version);
+}
+
+int Populate(Zookeeper *zk, int models, int versions) {
+  int res = zk->EnforcePath("models", &ZOO_OPEN_ACL_UNSAFE);
+  if (res != ZOK && res != ZNODEEXISTS) {
+    return res;
+  }
+  res = ZOK;
+  // Requests of a session are executed in order, so versions can be sent
+  // right after their models.
+  Pending pending;
+  auto done = [&pending](int rc) { pending.Done(rc); };
+  for (int model = 0; model < models && res == ZOK; model++) {
+    pending.Add();
+    res = zk->AsyncCreate(ModelPath(model).c_str(), "", false,
+                          &ZOO_OPEN_ACL_UNSAFE, done);
+    for (int version = 0; version < versions && res == ZOK; version++) {
+      pending.Add();
+      res = zk->AsyncCreate(
+          VersionPath(model, version).c_str(),
+          "/models/model" + std::to_string(model) + "/" +
+              std::to_string(version),
+          false, &ZOO_OPEN_ACL_UNSAFE, done);
+    }
+  }
+  if (res != ZOK) {
+    // The request which failed to be sent is never completed.
+    pending.Done(res);
+  }
+  return pending.Wait();
+}
+
+// Reads the tree the way ZookeeperSource does: one blocking call after
+// another. Returns the number of read version paths in `*paths`.
+int ReadSync(Zookeeper *zk, int *paths) {
+  *paths = 0;
+  std::vector<std::string> models;
+  int res = zk->GetChildren("models", &models, nullptr);
+  if (res != ZOK) {
+    return res;
+  }
+  for (const std::string &model : models) {
+    const std::string model_path = "models/" + model;
+    std::string config;
+    res = zk->Get(model_path.c_str(), &config, nullptr, nullptr);
+    if (res != ZOK) {
+      return res;
+    }
+    std::vector<std::string> versions;
+    res = zk->GetChildren(model_path.c_str(), &versions, nullptr);
+    if (res != ZOK) {
+      return res;
+    }
+    for (const std::string &version : versions) {
+      std::string path;
+      res = zk->Get((model_path + "/" + version).c_str(), &path, nullptr,
+                    nullptr);
+      if (res != ZOK) {
+        return res;
+      }
+      (*paths)++;
+    }
+  }
+  return ZOK;
+}
+
+// Reads the same tree with all reads of a level in flight at once: versions
+// of a model are requested as soon as its children are known.
+int ReadAsync(Zookeeper *zk, int *paths) {
+  *paths = 0;
+  std::vector<std::string> models;
+  int res = zk->GetChildren("models", &models, nullptr);
+  if (res != ZOK) {
+    return res;
+  }
+  Pending pending;
+  std::mutex paths_mu;
+  for (const std::string &model : models) {
+    const std::string model_path = "models/" + model;
+    pending.Add();
+    res = zk->AsyncGet(model_path.c_str(), nullptr,
+                       [&pending](int rc, const std::string &config,
+                                  const struct Stat *stat) {
+                         pending.Done(rc);
+                       });
+    if (res != ZOK) {
+      pending.Done(res);
+      break;
+    }
+    pending.Add();
+    res = zk->AsyncGetChildren(
+        model_path.c_str(), nullptr,
+        [zk, model_path, &pending, &paths_mu, paths](
+            int rc, const std::vector<std::string> &versions,
+            const struct Stat *stat) {
+          for (size_t i = 0; rc == ZOK && i < versions.size(); i++) {
+            pending.Add();
+            int res = zk->AsyncGet(
+                (model_path + "/" + versions[i]).c_str(), nullptr,
+                [&pending, &paths_mu, paths](int rc, const std::string &path,
+                                             const struct Stat *stat) {
+                  if (rc == ZOK) {
+                    std::lock_guard<std::mutex> l(paths_mu);
+                    (*paths)++;
+                  }
+                  pending.Done(rc);
+                });
+            if (res != ZOK) {
+              pending.Done(res);
+            }
+          }
+          pending.Done(rc);
+        });
+    if (res != ZOK) {
+      pending.Done(res);
+      break;
+    }
+  }
+  int wait_res = pending.Wait();
+  return res != ZOK ? res : wait_res;
+}
+
+bool Run(const char *name, int (*read)(Zookeeper*, int*), Zookeeper *zk,
+         int runs, int expected_paths) {
+  double total_ms = 0;
+  double best_ms = 0;
+  for (int run = 0; run < runs; run++) {
+    auto start = std::chrono::steady_clock::now();
+    int paths;
+    int res = read(zk, &paths);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (res != ZOK) {
+      std::cerr << name << ": Zookeeper error " << res << std::endl;
+      return false;
+    }
+    if (paths != expected_paths) {
+      std::cerr << name << ": read " << paths << " paths instead of "
+                << expected_paths << std::endl;
+      return false;
+    }
+    total_ms += elapsed.count();
+    if (run == 0 || elapsed.count() < best_ms) {
+      best_ms = elapsed.count();
+    }
+  }
+  std::cout << name << ": " << total_ms / runs << " ms on average, "
+            << best_ms << " ms best of " << runs << " runs" << std::endl;
+  return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+  const int models = argc > 1 ? atoi(argv[1]) : 1000;
+  const int versions = argc > 2 ? atoi(argv[2]) : 2;
+  const int runs = argc > 3 ? atoi(argv[3]) : 5;
+  const char *hosts = getenv("ZOOKEEPER_TEST_HOSTS");
+  if (!hosts || !hosts[0]) {
+    std::cerr << "ZOOKEEPER_TEST_HOSTS is unspecified" << std::endl;
+    return 1;
+  }
+
+  zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
+  Zookeeper zk(hosts, kRecvTimeoutMs,
+               "/zookeeper-cc-benchmark/" + std::to_string(getpid()));
+  if (!zk.Init()) {
+    std::cerr << "Unable to create Zookeeper handle" << std::endl;
+    return 1;
+  }
+  int res = Populate(&zk, models, versions);
+  if (res != ZOK) {
+    std::cerr << "Unable to create the tree, Zookeeper error " << res
+              << std::endl;
+    return 1;
+  }
+  std::cout << "Reading " << models << " models with " << versions
+            << " versions each" << std::endl;
+  if (!Run("Sync", &ReadSync, &zk, runs, models * versions) ||
+      !Run("Async", &ReadAsync, &zk, runs, models * versions)) {
+    return 1;
+  }
+  return 0;
+}
@@ -7,6 +7,7 @@
 #include <iostream>
 #include <sstream>
 #include <future>
+#include <vector>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
@@ -300,3 +301,193 @@ TEST_F(ZookeeperCcTest, GlobalWatcherSessionEvents) {
   ASSERT_TRUE(StartZookeeper());
   EXPECT_TRUE(wait_ready(connected_future));
 }
+
+TEST_F(ZookeeperCcTest, Multi) {
+  ASSERT_TRUE(zk_->Init());
+  ASSERT_EQ(ZOK, zk_->EnforcePath("", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->Create("old_node", "", false, &ZOO_OPEN_ACL_UNSAFE));
+
+  std::vector<int> results;
+  ASSERT_EQ(ZOK, zk_->Multi(
+      {Zookeeper::Op::Create("new_node", "new_value", false,
+                             &ZOO_OPEN_ACL_UNSAFE),
+       Zookeeper::Op::Set("new_node", "other_value"),
+       Zookeeper::Op::Delete("old_node")},
+      &results));
+  EXPECT_EQ((std::vector<int>{ZOK, ZOK, ZOK}), results);
+  std::string data;
+  EXPECT_EQ(ZOK, zk_->Get("new_node", &data, nullptr, nullptr));
+  EXPECT_EQ("other_value", data);
+  EXPECT_EQ(ZNONODE, zk_->Exists("old_node", nullptr, nullptr));
+
+  // Nothing is applied if an operation fails.
+  EXPECT_EQ(ZNONODE, zk_->Multi(
+      {Zookeeper::Op::Set("new_node", "third_value"),
+       Zookeeper::Op::Delete("old_node"),
+       Zookeeper::Op::Delete("new_node")},
+      &results));
+  EXPECT_EQ((std::vector<int>{ZOK, ZNONODE, ZRUNTIMEINCONSISTENCY}), results);
+  EXPECT_EQ(ZOK, zk_->Get("new_node", &data, nullptr, nullptr));
+  EXPECT_EQ("other_value", data);
+}
+
+TEST_F(ZookeeperCcTest, AsyncCreateGetSetDelete) {
+  ASSERT_TRUE(zk_->Init());
+  ASSERT_EQ(ZOK, zk_->EnforcePath("", &ZOO_OPEN_ACL_UNSAFE));
+
+  std::promise<int> created;
+  ASSERT_EQ(ZOK, zk_->AsyncCreate("some_node", "some_value", false,
+                                  &ZOO_OPEN_ACL_UNSAFE,
+                                  [&created](int rc) {
+                                    created.set_value(rc);
+                                  }));
+  EXPECT_EQ(ZOK, created.get_future().get());
+
+  std::promise<std::string> got;
+  ASSERT_EQ(ZOK, zk_->AsyncGet("some_node", nullptr,
+                               [&got](int rc, const std::string &value,
+                                      const struct Stat *stat) {
+                                 got.set_value(rc == ZOK ? value : "error");
+                               }));
+  EXPECT_EQ("some_value", got.get_future().get());
+
+  std::promise<int> set;
+  ASSERT_EQ(ZOK, zk_->AsyncSet("some_node", "other_value", -1,
+                               [&set](int rc, const struct Stat *stat) {
+                                 set.set_value(rc);
+                               }));
+  EXPECT_EQ(ZOK, set.get_future().get());
+  std::string data;
+  EXPECT_EQ(ZOK, zk_->Get("some_node", &data, nullptr, nullptr));
+  EXPECT_EQ("other_value", data);
+
+  std::promise<int> deleted;
+  ASSERT_EQ(ZOK, zk_->AsyncDelete("some_node", -1,
+                                  [&deleted](int rc) {
+                                    deleted.set_value(rc);
+                                  }));
+  EXPECT_EQ(ZOK, deleted.get_future().get());
+
+  std::promise<int> exists;
+  ASSERT_EQ(ZOK, zk_->AsyncExists("some_node", nullptr,
+                                  [&exists](int rc, const struct Stat *stat) {
+                                    exists.set_value(rc);
+                                  }));
+  EXPECT_EQ(ZNONODE, exists.get_future().get());
+}
+
+TEST_F(ZookeeperCcTest, AsyncGetChildren) {
+  ASSERT_TRUE(zk_->Init());
+  ASSERT_EQ(ZOK, zk_->EnforcePath("node1/1", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->EnforcePath("node1/2", &ZOO_OPEN_ACL_UNSAFE));
+
+  std::promise<std::vector<std::string>> children;
+  ASSERT_EQ(ZOK, zk_->AsyncGetChildren(
+      "node1", nullptr,
+      [&children](int rc, const std::vector<std::string> &names,
+                  const struct Stat *stat) {
+        children.set_value(names);
+      }));
+  EXPECT_THAT(children.get_future().get(), UnorderedElementsAre("1", "2"));
+
+  std::promise<int> missing;
+  ASSERT_EQ(ZOK, zk_->AsyncGetChildren(
+      "node2", nullptr,
+      [&missing](int rc, const std::vector<std::string> &names,
+                 const struct Stat *stat) {
+        missing.set_value(rc);
+      }));
+  EXPECT_EQ(ZNONODE, missing.get_future().get());
+}
+
+// Ensure that many requests can be in flight at once and each of them
+// completes with its own result.
+TEST_F(ZookeeperCcTest, AsyncGetPipelined) {
+  const int kNodes = 100;
+  ASSERT_TRUE(zk_->Init());
+  ASSERT_EQ(ZOK, zk_->EnforcePath("", &ZOO_OPEN_ACL_UNSAFE));
+  for (int i = 0; i < kNodes; i++) {
+    ASSERT_EQ(ZOK, zk_->Create(("node" + std::to_string(i)).c_str(),
+                               std::to_string(i), false,
+                               &ZOO_OPEN_ACL_UNSAFE));
+  }
+
+  std::vector<std::promise<std::string>> values(kNodes);
+  for (int i = 0; i < kNodes; i++) {
+    std::promise<std::string> *value = &values[i];
+    ASSERT_EQ(ZOK, zk_->AsyncGet(("node" + std::to_string(i)).c_str(),
+                                 nullptr,
+                                 [value](int rc, const std::string &data,
+                                         const struct Stat *stat) {
+                                   value->set_value(data);
+                                 }));
+  }
+  for (int i = 0; i < kNodes; i++) {
+    EXPECT_EQ(std::to_string(i), values[i].get_future().get());
+  }
+}
+
+TEST_F(ZookeeperCcTest, AsyncGetWatcher) {
+  ASSERT_TRUE(zk_->Init());
+  ASSERT_EQ(ZOK, zk_->EnforcePath("some_node", &ZOO_OPEN_ACL_UNSAFE));
+
+  std::promise<void> changed_promise;
+  Zookeeper::WatcherCallback watcher =
+      [&changed_promise](int type, int state, const char *path) {
+        if (type == ZOO_CHANGED_EVENT) {
+          changed_promise.set_value();
+        }
+      };
+  std::future<void> changed_future = changed_promise.get_future();
+  std::promise<int> got;
+  ASSERT_EQ(ZOK, zk_->AsyncGet("some_node", &watcher,
+                               [&got](int rc, const std::string &value,
+                                      const struct Stat *stat) {
+                                 got.set_value(rc);
+                               }));
+  ASSERT_EQ(ZOK, got.get_future().get());
+  EXPECT_FALSE(is_ready(changed_future));
+
+  ASSERT_EQ(ZOK, zk_->Set("some_node", "some_value"));
+  EXPECT_TRUE(wait_ready(changed_future));
+}
+
+// Ensure that requests which are still pending when the wrapper is destroyed
+// are completed as well.
+TEST_F(ZookeeperCcTest, AsyncCompletedOnClose) {
+  const int kRequests = 100;
+  ASSERT_TRUE(zk_->Init());
+  ASSERT_TRUE(WaitForConnection());
+
+  std::vector<std::promise<int>> promises(kRequests);
+  for (int i = 0; i < kRequests; i++) {
+    std::promise<int> *promise = &promises[i];
+    ASSERT_EQ(ZOK, zk_->AsyncExists("some_node", nullptr,
+                                    [promise](int rc,
+                                              const struct Stat *stat) {
+                                      promise->set_value(rc);
+                                    }));
+  }
+  zk_.reset();
+  for (int i = 0; i < kRequests; i++) {
+    std::future<int> future = promises[i].get_future();
+    ASSERT_TRUE(is_ready(future));
+    // ZNONODE if the request was answered, ZCLOSING otherwise.
+    EXPECT_NE(ZOK, future.get());
+  }
+}
+
+TEST_F(ZookeeperCcTest, ReconnectStartsNewSession) {
+  EXPECT_EQ(0, zk_->SessionNumber());
+  ASSERT_TRUE(zk_->Init());
+  EXPECT_EQ(1, zk_->SessionNumber());
+  ASSERT_EQ(ZOK, zk_->EnforcePath("", &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->Create("ephemeral", "", true, &ZOO_OPEN_ACL_UNSAFE));
+  ASSERT_EQ(ZOK, zk_->Create("persistent", "", false, &ZOO_OPEN_ACL_UNSAFE));
+
+  ASSERT_TRUE(zk_->Reconnect());
+  EXPECT_EQ(2, zk_->SessionNumber());
+  ASSERT_TRUE(WaitForConnection());
+  EXPECT_EQ(ZNONODE, zk_->Exists("ephemeral", nullptr, nullptr));
+  EXPECT_EQ(ZOK, zk_->Exists("persistent", nullptr, nullptr));
+}